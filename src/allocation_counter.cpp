@@ -0,0 +1,78 @@
+#include "allocation_counter.h"
+
+#include <malloc.h>
+
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+namespace
+{
+
+// Threads other than the io_service one allocate too (resolver, logging).
+std::atomic<uint64_t> allocations(0);
+std::atomic<uint64_t> bytes(0);
+
+void* allocate(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* res = std::malloc(size == 0 ? 1 : size);
+    if (!res)
+        throw std::bad_alloc();
+    bytes.fetch_add(malloc_usable_size(res), std::memory_order_relaxed);
+    return res;
+}
+
+void* allocate(std::size_t size, std::align_val_t alignment)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t align = static_cast<std::size_t>(alignment);
+    void* res = std::aligned_alloc(align, (size + align - 1) / align * align);
+    if (!res)
+        throw std::bad_alloc();
+    bytes.fetch_add(malloc_usable_size(res), std::memory_order_relaxed);
+    return res;
+}
+
+void deallocate(void* pointer) noexcept
+{
+    if (pointer)
+        bytes.fetch_sub(malloc_usable_size(pointer), std::memory_order_relaxed);
+    std::free(pointer);
+}
+
+}
+
+uint64_t Caster::allocationCount() noexcept
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+uint64_t Caster::allocatedBytes() noexcept
+{
+    return bytes.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return allocate(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return allocate(size, alignment); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return allocate(size); } catch (const std::bad_alloc&) { return nullptr; }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return allocate(size); } catch (const std::bad_alloc&) { return nullptr; }
+}
+
+void operator delete(void* pointer) noexcept { deallocate(pointer); }
+void operator delete[](void* pointer) noexcept { deallocate(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { deallocate(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { deallocate(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { deallocate(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { deallocate(pointer); }
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept { deallocate(pointer); }
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept { deallocate(pointer); }
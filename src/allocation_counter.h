@@ -0,0 +1,18 @@
+#ifndef __CASTER_ALLOCATION_COUNTER_H__
+#define __CASTER_ALLOCATION_COUNTER_H__
+
+#include <cstdint>
+
+namespace Caster {
+
+// Heap allocations of the process so far, counted by the replaced global
+// operator new when built with ALLOCATION_COUNT. The steady-state data path
+// is expected to leave it unchanged.
+uint64_t allocationCount() noexcept;
+// Bytes currently allocated with operator new, as sized by malloc, so that
+// the footprint of idle connections can be measured.
+uint64_t allocatedBytes() noexcept;
+
+}
+
+#endif
@@ -0,0 +1,44 @@
+#include "arrival_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+
+using Caster::ArrivalEstimator;
+
+namespace
+{
+
+const auto burstGap = std::chrono::milliseconds(50);
+const auto minLimit = std::chrono::seconds(2);
+const double alpha = 1.0 / 16; // about the last 16 gaps weigh in
+
+}
+
+void ArrivalEstimator::arrived(Clock::time_point now) noexcept
+{
+    const Clock::time_point last = m_last;
+    m_last = now;
+    if (last == Clock::time_point() || now - last < burstGap)
+        return;
+
+    const double gap = std::chrono::duration<double, std::milli>(now - last).count();
+    if (m_samples++ == 0) {
+        m_mean = gap;
+        m_variance = 0;
+        return;
+    }
+    const double diff = gap - m_mean;
+    m_mean += alpha * diff;
+    m_variance = (1 - alpha) * (m_variance + alpha * diff * diff);
+}
+
+double ArrivalEstimator::deviation() const noexcept
+{
+    return std::sqrt(m_variance);
+}
+
+ArrivalEstimator::Clock::duration ArrivalEstimator::limit(double sigmas) const noexcept
+{
+    const std::chrono::duration<double, std::milli> learned(m_mean + sigmas * deviation());
+    return std::max<Clock::duration>(std::chrono::duration_cast<Clock::duration>(learned), minLimit);
+}
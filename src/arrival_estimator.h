@@ -0,0 +1,42 @@
+#ifndef __CASTER_ARRIVAL_ESTIMATOR_H__
+#define __CASTER_ARRIVAL_ESTIMATOR_H__
+
+#include <chrono>
+#include <cstddef>
+
+namespace Caster {
+
+// Learns how often a stream delivers data, with exponentially weighted mean
+// and variance of the gaps between bursts, and tells how long a silence is
+// still normal for it. Reads that follow each other within a burst (one
+// epoch split over several packets) are not counted as gaps.
+class ArrivalEstimator {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        void arrived(Clock::time_point now) noexcept;
+        // The next data comes over a new connection, the time until it
+        // arrives is not a gap of the stream.
+        void restart() noexcept { m_last = Clock::time_point(); }
+
+        // Enough gaps have been seen to trust limit().
+        bool ready() const noexcept { return m_samples >= minSamples; }
+        // Learned interval plus the given number of standard deviations,
+        // never less than a floor that absorbs network jitter.
+        Clock::duration limit(double sigmas) const noexcept;
+
+        double mean() const noexcept { return m_mean; } // ms
+        double deviation() const noexcept; // ms
+
+    private:
+        static constexpr size_t minSamples = 16;
+
+        Clock::time_point m_last;
+        size_t m_samples = 0;
+        double m_mean = 0;
+        double m_variance = 0;
+};
+
+}
+
+#endif
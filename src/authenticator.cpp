@@ -2,15 +2,155 @@
 #include "base64.h"
 #include "error.h"
 
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <cstdio>
+
 using Caster::Authenticator;
+using Caster::DigestChallenge;
+using Caster::NonceCache;
+
+namespace ba = boost::algorithm;
+
+namespace
+{
 
-Authenticator::Authenticator() noexcept
+std::string toHex(const unsigned char* data, size_t size)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string res;
+    res.reserve(size * 2);
+    for (size_t i = 0; i < size; ++i) {
+        res += digits[data[i] >> 4];
+        res += digits[data[i] & 0x0F];
+    }
+    return res;
+}
+
+std::string hash(const EVP_MD* md, const std::string& data)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned size = 0;
+    if (EVP_Digest(data.data(), data.size(), digest, &size, md, nullptr) != 1)
+        throw Caster::CasterError("Failed to calculate digest");
+    return toHex(digest, size);
+}
+
+std::string cnonce()
+{
+    unsigned char data[8];
+    if (RAND_bytes(data, sizeof(data)) != 1)
+        throw Caster::CasterError("Failed to generate cnonce");
+    return toHex(data, sizeof(data));
+}
+
+// Next "key=value" or "key="value"" of a challenge, false at the end.
+bool nextParam(const std::string& src, size_t& pos, std::string& key, std::string& value)
+{
+    pos = src.find_first_not_of(" \t,", pos);
+    if (pos == std::string::npos)
+        return false;
+    const size_t eq = src.find('=', pos);
+    if (eq == std::string::npos)
+        return false;
+    key = src.substr(pos, eq - pos);
+    while (!key.empty() && (key.back() == ' ' || key.back() == '\t'))
+        key.pop_back();
+    pos = src.find_first_not_of(" \t", eq + 1);
+    value.clear();
+    if (pos == std::string::npos)
+        return true;
+    if (src[pos] == '"') {
+        for (++pos; pos < src.size() && src[pos] != '"'; ++pos) {
+            if (src[pos] == '\\' && pos + 1 < src.size())
+                ++pos;
+            value += src[pos];
+        }
+        ++pos;
+    } else {
+        const size_t end = src.find_first_of(" \t,", pos);
+        value = src.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        pos = end;
+    }
+    return true;
+}
+
+}
+
+bool Caster::parseDigestChallenge(const std::string& header, DigestChallenge& challenge)
+{
+    const size_t start = header.find_first_not_of(" \t");
+    if (start == std::string::npos || !ba::istarts_with(header.substr(start), "Digest "))
+        return false;
+
+    DigestChallenge res{"", "", "", "MD5", false, 0};
+    bool qopOffered = false;
+    size_t pos = start + 7;
+    std::string key;
+    std::string value;
+    while (pos != std::string::npos && pos < header.size() && nextParam(header, pos, key, value)) {
+        if (ba::iequals(key, "realm")) {
+            res.realm = value;
+        } else if (ba::iequals(key, "nonce")) {
+            res.nonce = value;
+        } else if (ba::iequals(key, "opaque")) {
+            res.opaque = value;
+        } else if (ba::iequals(key, "algorithm")) {
+            res.algorithm = value;
+        } else if (ba::iequals(key, "qop")) {
+            qopOffered = true;
+            size_t from = 0;
+            while (from <= value.size()) {
+                size_t to = value.find(',', from);
+                if (to == std::string::npos)
+                    to = value.size();
+                std::string option = value.substr(from, to - from);
+                option.erase(0, option.find_first_not_of(" \t"));
+                option.erase(option.find_last_not_of(" \t") + 1);
+                if (option == "auth")
+                    res.qop = true;
+                from = to + 1;
+            }
+        }
+    }
+
+    // Only qop=auth is supported when the caster asks for a qop.
+    if (res.nonce.empty() || (qopOffered && !res.qop))
+        return false;
+    if (!ba::iequals(res.algorithm, "MD5") && !ba::iequals(res.algorithm, "MD5-sess") &&
+        !ba::iequals(res.algorithm, "SHA-256") && !ba::iequals(res.algorithm, "SHA-256-sess"))
+        return false;
+    challenge = res;
+    return true;
+}
+
+NonceCache& NonceCache::instance()
+{
+    static NonceCache cache;
+    return cache;
+}
+
+DigestChallenge* NonceCache::find(const std::string& host)
+{
+    const auto it = m_challenges.find(host);
+    return it == m_challenges.end() ? nullptr : &it->second;
+}
+
+void NonceCache::set(const std::string& host, const DigestChallenge& challenge)
+{
+    m_challenges[host] = challenge;
+}
+
+Authenticator::Authenticator()
     : m_authenticated(false)
 {
 }
 
 Authenticator::Authenticator(const std::string& login,
-                             const std::string& password) noexcept
+                             const std::string& password)
     : m_login(login),
       m_password(password),
       m_authenticated(true)
@@ -23,11 +163,34 @@ std::string Authenticator::basic() const
     return base64_encode(reinterpret_cast<const unsigned char*>(credentials.c_str()), credentials.length());
 }
 
-std::string Authenticator::digest(const std::string& /*method*/,
-                                  const std::string& /*uri*/,
-                                  const std::string& /*realm*/,
-                                  uint8_t /*qop*/,
-                                  const std::string& /*nonce*/) const
+std::string Authenticator::digest(const std::string& method,
+                                  const std::string& uri,
+                                  DigestChallenge& challenge) const
 {
-    throw CasterError("Digest authentication method is not implemented");
+    const bool sha256 = ba::istarts_with(challenge.algorithm, "SHA-256");
+    const EVP_MD* md = sha256 ? EVP_sha256() : EVP_md5();
+    const std::string client = cnonce();
+
+    char nc[9];
+    snprintf(nc, sizeof(nc), "%08x", ++challenge.nc);
+
+    std::string ha1 = hash(md, m_login + ":" + challenge.realm + ":" + m_password);
+    if (ba::iends_with(challenge.algorithm, "-sess"))
+        ha1 = hash(md, ha1 + ":" + challenge.nonce + ":" + client);
+    const std::string ha2 = hash(md, method + ":" + uri);
+    const std::string response = challenge.qop ?
+        hash(md, ha1 + ":" + challenge.nonce + ":" + nc + ":" + client + ":auth:" + ha2) :
+        hash(md, ha1 + ":" + challenge.nonce + ":" + ha2);
+
+    std::string res = "Digest username=\"" + m_login + "\"" +
+                      ", realm=\"" + challenge.realm + "\"" +
+                      ", nonce=\"" + challenge.nonce + "\"" +
+                      ", uri=\"" + uri + "\"" +
+                      ", algorithm=" + challenge.algorithm +
+                      ", response=\"" + response + "\"";
+    if (!challenge.opaque.empty())
+        res += ", opaque=\"" + challenge.opaque + "\"";
+    if (challenge.qop)
+        res += ", qop=auth, nc=" + std::string(nc) + ", cnonce=\"" + client + "\"";
+    return res;
 }
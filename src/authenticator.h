@@ -2,15 +2,44 @@
 #define __CASTER_AUTHENTICATOR_H__
 
 #include <string>
+#include <map>
 #include <cstdint>
 
 namespace Caster {
 
+// Digest challenge of a caster, reused for the requests that follow it.
+struct DigestChallenge {
+    std::string realm;
+    std::string nonce;
+    std::string opaque;
+    std::string algorithm; // MD5, MD5-sess, SHA-256 or SHA-256-sess
+    bool qop; // qop=auth offered
+    uint32_t nc; // nonce uses so far
+};
+
+// Parses a WWW-Authenticate header value, false if it is not a Digest
+// challenge this client can answer.
+bool parseDigestChallenge(const std::string& header, DigestChallenge& challenge);
+
+// Latest Digest challenge per caster, so reconnects are authorized right
+// away instead of taking a 401 round-trip first.
+class NonceCache {
+    public:
+        static NonceCache& instance();
+
+        DigestChallenge* find(const std::string& host);
+        void set(const std::string& host, const DigestChallenge& challenge);
+        void erase(const std::string& host) { m_challenges.erase(host); }
+
+    private:
+        std::map<std::string, DigestChallenge> m_challenges;
+};
+
 class Authenticator {
     public:
-        Authenticator() noexcept;
+        Authenticator();
         Authenticator(const std::string& login,
-                      const std::string& password) noexcept;
+                      const std::string& password);
 
         Authenticator(const Authenticator&) = default;
         Authenticator& operator=(const Authenticator&) = default;
@@ -18,15 +47,17 @@ class Authenticator {
         Authenticator& operator=(Authenticator&&) = default;
 
         std::string basic() const;
+        // Authorization header value answering the challenge, counts the
+        // nonce use.
         std::string digest(const std::string& method,
                            const std::string& uri,
-                           const std::string& realm,
-                           uint8_t qop,
-                           const std::string& nonce) const;
+                           DigestChallenge& challenge) const;
 
         bool authenticated() const noexcept { return m_authenticated; }
 
     private:
+        // Owned rather than interned: interned strings live as long as the
+        // process, and a changed password must not.
         std::string m_login;
         std::string m_password;
         bool m_authenticated;
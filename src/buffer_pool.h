@@ -0,0 +1,57 @@
+#ifndef __CASTER_BUFFER_POOL_H__
+#define __CASTER_BUFFER_POOL_H__
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+
+namespace Caster {
+
+// Buffers lent to connections only while data is in flight, so that an idle
+// connection holds none. A returned buffer keeps its capacity for the next
+// borrower; beyond a few spares they are freed.
+template <typename Buffer>
+class BufferPool {
+    public:
+        using Ptr = std::unique_ptr<Buffer>;
+
+        // Connections run on the io_service thread only.
+        static BufferPool& instance()
+        {
+            static BufferPool pool;
+            return pool;
+        }
+
+        Ptr take()
+        {
+            ++m_lent;
+            if (m_free.empty())
+                return Ptr(new Buffer());
+            Ptr res = std::move(m_free.back());
+            m_free.pop_back();
+            return res;
+        }
+
+        // Accepts an empty pointer, so a connection can give back whatever
+        // it holds.
+        void give(Ptr buffer)
+        {
+            if (!buffer)
+                return;
+            --m_lent;
+            if (m_free.size() < maxSpare)
+                m_free.push_back(std::move(buffer));
+        }
+
+        size_t lent() const noexcept { return m_lent; }
+
+    private:
+        static constexpr size_t maxSpare = 64;
+
+        std::vector<Ptr> m_free;
+        size_t m_lent = 0;
+};
+
+}
+
+#endif
@@ -4,14 +4,120 @@
 #include <boost/system/error_code.hpp>
 #include <boost/asio/buffer.hpp>
 
-#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
 
 namespace Caster {
 
-using ErrorCallback = std::function<void (const boost::system::error_code&)>;
-using DataCallback = std::function<void (const boost::asio::const_buffers_1&)>;
-using EOFCallback = std::function<void ()>;
-using HeadersCallback = std::function<void ()>;
+template <typename Signature, size_t Size>
+class InplaceFunction;
+
+// Like std::function, but the target is stored in place: binding a member
+// function with the shared_ptr of its object costs no allocation, and a
+// target that does not fit is a compile error rather than a hidden one.
+template <typename R, typename... Args, size_t Size>
+class InplaceFunction<R (Args...), Size>
+{
+    public:
+        InplaceFunction() noexcept : m_ops(nullptr) {}
+        InplaceFunction(std::nullptr_t) noexcept : m_ops(nullptr) {}
+
+        template <typename F,
+                  typename = std::enable_if_t<!std::is_same<std::decay_t<F>, InplaceFunction>::value>>
+        InplaceFunction(F&& f)
+            : m_ops(&ops<std::decay_t<F>>)
+        {
+            using Target = std::decay_t<F>;
+            static_assert(sizeof(Target) <= Size, "Callback target is too large to be stored in place");
+            static_assert(alignof(Target) <= alignof(Storage), "Callback target is overaligned");
+            new (&m_storage) Target(std::forward<F>(f));
+        }
+
+        InplaceFunction(const InplaceFunction& rhs)
+            : m_ops(rhs.m_ops)
+        {
+            if (m_ops)
+                m_ops->copy(&m_storage, &rhs.m_storage);
+        }
+
+        InplaceFunction(InplaceFunction&& rhs) noexcept
+            : m_ops(rhs.m_ops)
+        {
+            if (m_ops)
+                m_ops->move(&m_storage, &rhs.m_storage);
+        }
+
+        ~InplaceFunction() { reset(); }
+
+        InplaceFunction& operator=(const InplaceFunction& rhs)
+        {
+            if (this != &rhs) {
+                reset();
+                if (rhs.m_ops)
+                    rhs.m_ops->copy(&m_storage, &rhs.m_storage);
+                m_ops = rhs.m_ops;
+            }
+            return *this;
+        }
+
+        InplaceFunction& operator=(InplaceFunction&& rhs) noexcept
+        {
+            if (this != &rhs) {
+                reset();
+                if (rhs.m_ops)
+                    rhs.m_ops->move(&m_storage, &rhs.m_storage);
+                m_ops = rhs.m_ops;
+            }
+            return *this;
+        }
+
+        explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+        R operator()(Args... args) const
+        {
+            return m_ops->invoke(&m_storage, std::forward<Args>(args)...);
+        }
+
+    private:
+        using Storage = std::aligned_storage_t<Size, alignof(std::max_align_t)>;
+
+        struct Ops {
+            R (*invoke)(void* target, Args&&... args);
+            void (*copy)(void* to, const void* from);
+            void (*move)(void* to, void* from);
+            void (*destroy)(void* target);
+        };
+
+        template <typename Target>
+        static constexpr Ops ops = {
+            [](void* target, Args&&... args) -> R
+            { return (*static_cast<Target*>(target))(std::forward<Args>(args)...); },
+            [](void* to, const void* from) { new (to) Target(*static_cast<const Target*>(from)); },
+            [](void* to, void* from) { new (to) Target(std::move(*static_cast<Target*>(from))); },
+            [](void* target) { static_cast<Target*>(target)->~Target(); }
+        };
+
+        const Ops* m_ops;
+        mutable Storage m_storage;
+
+        void reset() noexcept
+        {
+            if (m_ops)
+                m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+};
+
+// Enough for a member function bound with a shared_ptr and one more
+// argument.
+constexpr size_t callbackSize = 5 * sizeof(void*);
+
+using ErrorCallback = InplaceFunction<void (const boost::system::error_code&), callbackSize>;
+using DataCallback = InplaceFunction<void (const boost::asio::const_buffers_1&), callbackSize>;
+using EOFCallback = InplaceFunction<void (), callbackSize>;
+using HeadersCallback = InplaceFunction<void (), callbackSize>;
 
 }
 
@@ -0,0 +1,271 @@
+#include "capture.h"
+#include "error.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glob.h>
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+
+using namespace Caster::Capture;
+using Caster::CasterError;
+
+namespace
+{
+
+uint64_t load64(const uint8_t* src)
+{
+    uint64_t res = 0;
+    for (int i = 7; i >= 0; --i)
+        res = (res << 8) | src[i];
+    return res;
+}
+
+uint32_t load32(const uint8_t* src)
+{
+    return static_cast<uint32_t>(src[0]) | static_cast<uint32_t>(src[1]) << 8 |
+           static_cast<uint32_t>(src[2]) << 16 | static_cast<uint32_t>(src[3]) << 24;
+}
+
+void store64(uint8_t* dst, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i, value >>= 8)
+        dst[i] = static_cast<uint8_t>(value & 0xFF);
+}
+
+void store32(uint8_t* dst, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i, value >>= 8)
+        dst[i] = static_cast<uint8_t>(value & 0xFF);
+}
+
+}
+
+void Caster::Capture::storeRecordHeader(uint8_t* dst, uint64_t monotonic, uint64_t wall, uint32_t size)
+{
+    store64(dst, monotonic);
+    store64(dst + 8, wall);
+    store32(dst + 16, size);
+}
+
+void Caster::Capture::loadRecordHeader(const uint8_t* src, uint64_t& monotonic, uint64_t& wall, uint32_t& size)
+{
+    monotonic = load64(src);
+    wall = load64(src + 8);
+    size = load32(src + 16);
+}
+
+void Caster::Capture::storeIndexEntry(uint8_t* dst, const IndexEntry& entry)
+{
+    store64(dst, entry.wall);
+    store64(dst + 8, entry.monotonic);
+    store64(dst + 16, entry.offset);
+}
+
+std::vector<std::string> Caster::Capture::segments(const std::string& prefix)
+{
+    std::vector<std::string> res;
+    glob_t matches;
+    if (glob((prefix + "-*.rec").c_str(), 0, nullptr, &matches) == 0) {
+        for (size_t i = 0; i < matches.gl_pathc; ++i)
+            res.emplace_back(matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+    // Names carry the start time, so the sorted order is the time order.
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+std::string Caster::Capture::segmentPath(const std::string& prefix, uint64_t wall)
+{
+    const time_t seconds = static_cast<time_t>(wall / 1000000000);
+    struct tm brokenTime;
+    gmtime_r(&seconds, &brokenTime);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y%m%d-%H%M%S", &brokenTime);
+    char millis[8];
+    snprintf(millis, sizeof(millis), ".%03u", static_cast<unsigned>(wall / 1000000 % 1000));
+    return prefix + "-" + buf + millis + ".rec";
+}
+
+std::string Caster::Capture::indexPath(const std::string& segmentPath)
+{
+    return segmentPath.substr(0, segmentPath.size() - 4) + ".idx";
+}
+
+MappedFile::MappedFile() noexcept
+    : m_data(nullptr),
+      m_size(0)
+{
+}
+
+MappedFile::MappedFile(const std::string& path)
+    : m_data(nullptr),
+      m_size(0)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw CasterError("Failed to open " + path + ": " + strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        const int error = errno;
+        ::close(fd);
+        throw CasterError("Failed to stat " + path + ": " + strerror(error));
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    if (m_size > 0) {
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            const int error = errno;
+            ::close(fd);
+            throw CasterError("Failed to map " + path + ": " + strerror(error));
+        }
+        m_data = static_cast<const uint8_t*>(data);
+    }
+    ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+}
+
+MappedFile::MappedFile(MappedFile&& rhs) noexcept
+    : m_data(rhs.m_data),
+      m_size(rhs.m_size)
+{
+    rhs.m_data = nullptr;
+    rhs.m_size = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& rhs) noexcept
+{
+    std::swap(m_data, rhs.m_data);
+    std::swap(m_size, rhs.m_size);
+    return *this;
+}
+
+SegmentReader::SegmentReader(const std::string& path)
+    : m_file(path)
+{
+    if (m_file.size() < magicSize || memcmp(m_file.data(), segmentMagic, magicSize) != 0)
+        throw CasterError(path + " is not a capture segment");
+    loadIndex(indexPath(path));
+    if (m_index.empty())
+        buildIndex();
+}
+
+void SegmentReader::loadIndex(const std::string& path)
+{
+    MappedFile index;
+    try
+    {
+        index = MappedFile(path);
+    }
+    catch (const CasterError&)
+    {
+        return;
+    }
+    if (index.size() < magicSize || memcmp(index.data(), indexMagic, magicSize) != 0)
+        return;
+    const size_t count = (index.size() - magicSize) / indexEntrySize;
+    m_index.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t* src = index.data() + magicSize + i * indexEntrySize;
+        const IndexEntry entry{load64(src), load64(src + 8), load64(src + 16)};
+        if (entry.offset >= m_file.size())
+            break;
+        m_index.push_back(entry);
+    }
+}
+
+void SegmentReader::buildIndex()
+{
+    size_t offset = begin();
+    size_t indexed = 0;
+    Record record;
+    for (size_t pos = offset; next(offset, record); pos = offset) {
+        if (m_index.empty() || pos - indexed >= indexInterval) {
+            m_index.push_back(IndexEntry{record.wall, record.monotonic, pos});
+            indexed = pos;
+        }
+    }
+}
+
+size_t SegmentReader::seek(uint64_t wall) const
+{
+    if (m_index.empty())
+        return m_file.size();
+    // Last entry not later than the time, the record is after it.
+    auto it = std::upper_bound(m_index.begin(), m_index.end(), wall,
+                               [](uint64_t value, const IndexEntry& entry) { return value < entry.wall; });
+    if (it != m_index.begin())
+        --it;
+    size_t offset = it->offset;
+    Record record;
+    for (size_t pos = offset; next(offset, record); pos = offset)
+        if (record.wall >= wall)
+            return pos;
+    return m_file.size();
+}
+
+bool SegmentReader::next(size_t& offset, Record& record) const
+{
+    if (offset + recordHeaderSize > m_file.size())
+        return false;
+    const uint8_t* src = m_file.data() + offset;
+    loadRecordHeader(src, record.monotonic, record.wall, record.size);
+    if (offset + recordHeaderSize + record.size > m_file.size())
+        return false;
+    record.data = src + recordHeaderSize;
+    offset += recordHeaderSize + record.size;
+    return true;
+}
+
+CaptureReader::CaptureReader(const std::vector<std::string>& paths)
+    : m_segment(0),
+      m_offset(0)
+{
+    for (const auto& path : paths) {
+        SegmentReader segment(path);
+        if (!segment.empty())
+            m_segments.push_back(std::move(segment));
+    }
+    if (m_segments.empty())
+        throw CasterError("No capture records");
+    std::stable_sort(m_segments.begin(), m_segments.end(),
+                     [](const SegmentReader& lhs, const SegmentReader& rhs) { return lhs.firstWall() < rhs.firstWall(); });
+    rewind();
+}
+
+void CaptureReader::rewind()
+{
+    m_segment = 0;
+    m_offset = m_segments.front().begin();
+}
+
+void CaptureReader::seek(uint64_t wall)
+{
+    auto it = std::upper_bound(m_segments.begin(), m_segments.end(), wall,
+                               [](uint64_t value, const SegmentReader& segment) { return value < segment.firstWall(); });
+    if (it != m_segments.begin())
+        --it;
+    m_segment = static_cast<size_t>(it - m_segments.begin());
+    m_offset = it->seek(wall);
+}
+
+bool CaptureReader::next(Record& record)
+{
+    while (m_segment < m_segments.size()) {
+        if (m_segments[m_segment].next(m_offset, record))
+            return true;
+        if (++m_segment < m_segments.size())
+            m_offset = m_segments[m_segment].begin();
+    }
+    return false;
+}
@@ -0,0 +1,124 @@
+#ifndef __CASTER_CAPTURE_H__
+#define __CASTER_CAPTURE_H__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace Caster {
+namespace Capture {
+
+// Capture segments hold received buffers as they came:
+//
+//   segment: "NTRREC1\0", then records of
+//            u64 monotonic ns, u64 wall-clock ns, u32 size, size bytes
+//   index:   "NTRIDX1\0", then entries of
+//            u64 wall-clock ns, u64 monotonic ns, u64 record offset
+//
+// All numbers are little-endian. The index is sparse, one entry per
+// indexInterval bytes of records, and never points past the data written.
+
+const size_t magicSize = 8;
+const char segmentMagic[magicSize + 1] = "NTRREC1";
+const char indexMagic[magicSize + 1] = "NTRIDX1";
+const size_t recordHeaderSize = 20;
+const size_t indexEntrySize = 24;
+const size_t indexInterval = 64 * 1024;
+
+struct Record {
+    uint64_t monotonic; // ns, steady clock
+    uint64_t wall; // ns since the Unix epoch
+    const uint8_t* data;
+    uint32_t size;
+};
+
+struct IndexEntry {
+    uint64_t wall;
+    uint64_t monotonic;
+    uint64_t offset;
+};
+
+void storeRecordHeader(uint8_t* dst, uint64_t monotonic, uint64_t wall, uint32_t size);
+void loadRecordHeader(const uint8_t* src, uint64_t& monotonic, uint64_t& wall, uint32_t& size);
+void storeIndexEntry(uint8_t* dst, const IndexEntry& entry);
+
+// Segment paths of a capture, oldest first.
+std::vector<std::string> segments(const std::string& prefix);
+std::string segmentPath(const std::string& prefix, uint64_t wall);
+std::string indexPath(const std::string& segmentPath);
+
+// Read-only memory map of a whole file.
+class MappedFile
+{
+    public:
+        MappedFile() noexcept;
+        // Throws CasterError.
+        explicit MappedFile(const std::string& path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& rhs) noexcept;
+        MappedFile& operator=(MappedFile&& rhs) noexcept;
+
+        const uint8_t* data() const noexcept { return m_data; }
+        size_t size() const noexcept { return m_size; }
+
+    private:
+        const uint8_t* m_data;
+        size_t m_size;
+};
+
+// Records of one segment. The index file is used when present, otherwise
+// it is rebuilt in memory with one pass over the segment.
+class SegmentReader
+{
+    public:
+        // Throws CasterError if the file is not a capture segment.
+        explicit SegmentReader(const std::string& path);
+
+        bool empty() const noexcept { return m_index.empty(); }
+        uint64_t firstWall() const noexcept { return m_index.empty() ? 0 : m_index.front().wall; }
+
+        // Offset of the first record at or after the wall-clock time, found
+        // with a binary search over the index and a short scan.
+        size_t seek(uint64_t wall) const;
+        size_t begin() const noexcept { return magicSize; }
+        // Reads the record at offset and moves past it, false at the end or
+        // on a truncated record.
+        bool next(size_t& offset, Record& record) const;
+
+        const MappedFile& file() const noexcept { return m_file; }
+
+    private:
+        MappedFile m_file;
+        std::vector<IndexEntry> m_index;
+
+        void loadIndex(const std::string& path);
+        void buildIndex();
+};
+
+// Records of all segments of a capture in time order.
+class CaptureReader
+{
+    public:
+        // Throws CasterError if there are no readable segments.
+        explicit CaptureReader(const std::vector<std::string>& paths);
+
+        // Positions at the first record at or after the wall-clock time,
+        // O(log n) in segments and index entries.
+        void seek(uint64_t wall);
+        void rewind();
+        bool next(Record& record);
+
+    private:
+        std::vector<SegmentReader> m_segments;
+        size_t m_segment;
+        size_t m_offset;
+};
+
+}
+}
+
+#endif
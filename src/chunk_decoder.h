@@ -0,0 +1,120 @@
+#ifndef __CASTER_CHUNK_DECODER_H__
+#define __CASTER_CHUNK_DECODER_H__
+
+#include <algorithm>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+
+namespace Caster {
+
+// Decodes HTTP chunked transfer coding as it arrives. Chunk data is passed
+// on in place, between the chunk framing, so nothing is buffered across
+// reads and the whole state is a size and a byte. Trailers after the last
+// chunk are not read.
+class ChunkDecoder {
+    public:
+        enum class State : uint8_t {
+            Size,
+            Extension,
+            Data,
+            End, // CRLF after the data
+            Finished, // the last chunk has been read
+            Invalid
+        };
+
+        // Calls onData(data, size) for each piece of chunk data; onData
+        // returns false to stop. Returns false once the stream has finished,
+        // turned out to be invalid or was stopped.
+        template <typename F>
+        bool feed(const uint8_t* data, size_t size, F&& onData);
+
+        State state() const noexcept { return m_state; }
+        // Chunk size read so far, or data bytes of the chunk still to come.
+        size_t left() const noexcept { return m_left; }
+
+        // Goes on from a state saved elsewhere.
+        void restore(State state, size_t left) noexcept { m_state = state; m_left = left; }
+        void reset() noexcept { restore(State::Size, 0); }
+
+    private:
+        size_t m_left = 0;
+        State m_state = State::Size;
+
+        static int hexDigit(uint8_t c) noexcept;
+};
+
+template <typename F>
+inline
+bool ChunkDecoder::feed(const uint8_t* data, size_t size, F&& onData)
+{
+    const uint8_t* const end = data + size;
+    while (data < end) {
+        switch (m_state) {
+            case State::Size:
+            case State::Extension: {
+                const uint8_t c = *data++;
+                const int digit = hexDigit(c);
+                if (c == '\n') {
+                    m_state = m_left == 0 ? State::Finished : State::Data;
+                    if (m_state == State::Finished)
+                        return false;
+                } else if (m_state == State::Size && digit >= 0) {
+                    if (m_left > std::numeric_limits<size_t>::max() / 16) {
+                        m_state = State::Invalid;
+                        return false;
+                    }
+                    m_left = m_left * 16 + static_cast<size_t>(digit);
+                } else if (c != '\r') {
+                    m_state = State::Extension;
+                }
+                break;
+            }
+            case State::Data: {
+                const size_t part = std::min(m_left, static_cast<size_t>(end - data));
+                const uint8_t* const piece = data;
+                data += part;
+                m_left -= part;
+                if (m_left == 0)
+                    m_state = State::End;
+                if (!onData(piece, part))
+                    return false;
+                break;
+            }
+            case State::End:
+                if (*data++ == '\n')
+                    m_state = State::Size;
+                break;
+            default:
+                return false;
+        }
+    }
+    return m_state != State::Finished && m_state != State::Invalid;
+}
+
+// A stream without transfer coding, with the interface of ChunkDecoder so
+// that the data path is compiled for either coding.
+class IdentityDecoder {
+    public:
+        template <typename F>
+        bool feed(const uint8_t* data, size_t size, F&& onData)
+        {
+            return onData(data, size);
+        }
+};
+
+inline
+int ChunkDecoder::hexDigit(uint8_t c) noexcept
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+}
+
+#endif
@@ -1,35 +1,55 @@
 #include "client.h"
 
 #include "version.h"
+#include "metrics.h"
 
 #include <iostream>
 
 using Caster::Client;
+using Caster::Metrics;
 using namespace boost::asio;
 
 Client::Client(io_service& ioService,
                const std::string& server, uint16_t port)
-    : Connection(ioService, server, port)
+    : Connection(ioService, server, port),
+      m_ggaWriting(false)
 {
+    ++Metrics::instance().objects("source", sizeof(Client)).live;
 }
 
 Client::Client(io_service& ioService,
                const std::string& server, uint16_t port,
                const std::string& mountpoint)
-    : Connection(ioService, server, port, mountpoint)
+    : Connection(ioService, server, port, mountpoint),
+      m_ggaWriting(false)
 {
+    ++Metrics::instance().objects("source", sizeof(Client)).live;
+}
+
+Client::~Client()
+{
+    --Metrics::instance().objects("source", sizeof(Client)).live;
+}
+
+void Client::sendGGA()
+{
+    if (!isActive() || m_ggaWriting || m_gga.empty())
+        return;
+    m_ggaLine = m_gga + "\r\n";
+    m_ggaWriting = true;
+    send(buffer(m_ggaLine));
 }
 
 void Client::prepareRequest()
 {
-    std::ostream requestStream(&m_request);
+    m_ggaWriting = false;
+    std::ostream requestStream(m_request.get());
     requestStream << "GET " << m_uri << " HTTP/1.1\r\n"
                   << "Host: " << m_server << "\r\n"
                   << "Ntrip-Version: Ntrip/2.0\r\n"
                   << "User-Agent: Boost.Asio NTRIP Client " << version
                   << "\r\n";
-    if (m_auth.authenticated())
-        requestStream << "Authorization: Basic " << m_auth.basic() << "\r\n";
+    requestStream << authorization("GET");
     if (!m_gga.empty())
         requestStream << "Ntrip-GGA: " << m_gga << "\r\n";
     requestStream << "Connection: close\r\n"
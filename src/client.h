@@ -2,6 +2,7 @@
 #define __CASTER_CLIENT_H__
 
 #include "connection.h"
+#include "source.h"
 
 #include <boost/asio/io_service.hpp>
 
@@ -10,7 +11,7 @@
 
 namespace Caster {
 
-class Client : public Connection {
+class Client : public Connection, public Source {
     public:
         Client(boost::asio::io_service& ioService,
                const std::string& server, uint16_t port);
@@ -18,13 +19,43 @@ class Client : public Connection {
         Client(boost::asio::io_service& ioService,
                const std::string& server, uint16_t port,
                const std::string& mountpoint);
-
-        void setGGA(const std::string& gga) { m_gga = gga; }
+        ~Client() override;
+
+        void start(unsigned timeout) override { Connection::start(timeout); }
+        void stop() override { Connection::stop(); }
+        bool isIdle() const override { return Connection::isIdle(); }
+
+        void setGGA(const std::string& gga) override { m_gga = gga; }
+        void setCredentials(const std::string& login,
+                            const std::string& password) override
+        { Connection::setCredentials(login, password); }
+        void setPriority(unsigned priority) override { Connection::setPriority(priority); }
+        const std::map<std::string, std::string>& headers() const override
+        { return Connection::headers(); }
+
+        void setErrorCallback(const ErrorCallback& cb) override { Connection::setErrorCallback(cb); }
+        void setDataCallback(const DataCallback& cb) override { Connection::setDataCallback(cb); }
+        void setEOFCallback(const EOFCallback& cb) override { Connection::setEOFCallback(cb); }
+        void setHeadersCallback(const HeadersCallback& cb) override { Connection::setHeadersCallback(cb); }
+
+        bool canHandOver() const override { return true; }
+        void suspend() override { Connection::suspend(); }
+        bool detach(Handover::ConnectionState& state, int& fd) override
+        { return Connection::detach(state, fd); }
+        bool adopt(int fd, const Handover::ConnectionState& state, unsigned timeout) override
+        { Connection::adopt(fd, state, timeout); return true; }
+
+        // Sends the current GGA over the established connection, as VRS
+        // casters expect position updates while streaming.
+        void sendGGA();
 
     private:
         std::string m_gga;
+        std::string m_ggaLine;
+        bool m_ggaWriting;
 
         void prepareRequest() override;
+        void writeComplete() override { m_ggaWriting = false; }
 };
 
 }
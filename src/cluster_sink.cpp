@@ -0,0 +1,314 @@
+#include "cluster_sink.h"
+
+#include "error.h"
+#include "logger.h"
+#include "metrics.h"
+#include "utils.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <functional> // std::bind
+#include <map>
+#include <sstream>
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::ClusterSink;
+
+namespace pls = std::placeholders;
+namespace bs = boost::system;
+namespace ba = boost::asio;
+
+namespace
+{
+
+// A standby that failed connects again after this long, to the next member.
+const std::chrono::seconds standbyRetry(5);
+
+// The member each relay of a cluster starts on when load is spread, by the
+// list of members.
+std::map<std::string, size_t>& turns()
+{
+    static std::map<std::string, size_t> res;
+    return res;
+}
+
+}
+
+ClusterSink::ClusterSink(ba::io_service& ioService,
+                         const std::string& server, uint16_t port,
+                         const std::string& cluster,
+                         const std::string& mountpoint)
+    : m_ioService(ioService),
+      m_mountpoint(mountpoint),
+      m_priority(0),
+      m_batchDeadline(0),
+      m_replayWindow(0),
+      m_spread(false),
+      m_timeout(0),
+      m_finishing(false),
+      m_activeIndex(0),
+      m_standbyIndex(0),
+      m_retryTimer(ioService),
+      m_outstanding(0)
+{
+    if (server.empty())
+        throw CasterError("Destination cluster needs a destination server");
+    m_members.push_back(Member{server, port});
+    std::istringstream stream(cluster);
+    std::string address;
+    while (std::getline(stream, address, ',')) {
+        const size_t pos = address.rfind(':');
+        Member member{address.substr(0, pos), port};
+        if (pos != std::string::npos) {
+            try {
+                member.port = boost::lexical_cast<uint16_t>(address.substr(pos + 1));
+            } catch (const boost::bad_lexical_cast&) {
+                throw CasterError("Invalid destination cluster port: " + address);
+            }
+        }
+        if (member.server.empty())
+            throw CasterError("Invalid destination cluster member: " + address);
+        m_members.push_back(member);
+    }
+    if (m_members.size() < 2)
+        throw CasterError("Destination cluster has no other members: " + cluster);
+}
+
+void ClusterSink::start(unsigned timeout)
+{
+    m_timeout = timeout;
+    m_finishing = false;
+    retire(std::move(m_active));
+    retire(std::move(m_standby));
+    m_activeIndex = 0;
+    if (m_spread) {
+        std::string key;
+        for (const Member& member : m_members)
+            key += member.server + ":" + std::to_string(member.port) + ",";
+        m_activeIndex = turns()[key]++ % m_members.size();
+    }
+    m_active = makeServer(m_activeIndex);
+    m_active->start(timeout);
+    m_standbyIndex = next(m_activeIndex);
+    startStandby();
+}
+
+void ClusterSink::stop()
+{
+    bs::error_code ec;
+    m_retryTimer.cancel(ec);
+    retire(std::move(m_active));
+    retire(std::move(m_standby));
+    m_history.clear();
+}
+
+bool ClusterSink::isIdle() const
+{
+    for (const auto& server : m_retired)
+        if (!server->isIdle())
+            return false;
+    return m_outstanding == 0 &&
+           (!m_active || m_active->isIdle()) &&
+           (!m_standby || m_standby->isIdle());
+}
+
+void ClusterSink::setCredentials(const std::string& login,
+                                 const std::string& password)
+{
+    m_login = login;
+    m_password = password;
+    if (m_active)
+        m_active->setCredentials(login, password);
+    if (m_standby)
+        m_standby->setCredentials(login, password);
+}
+
+void ClusterSink::setPriority(unsigned priority)
+{
+    m_priority = priority;
+    if (m_active)
+        m_active->setPriority(priority);
+    if (m_standby)
+        m_standby->setPriority(priority);
+}
+
+void ClusterSink::setBatchDeadline(std::chrono::microseconds deadline)
+{
+    m_batchDeadline = deadline;
+    if (m_active)
+        m_active->setBatchDeadline(deadline);
+    if (m_standby)
+        m_standby->setBatchDeadline(deadline);
+}
+
+void ClusterSink::send(const FrameBatch& frames)
+{
+    if (m_replayWindow.count() > 0) {
+        const auto now = Clock::now();
+        m_history.dropBefore(now - m_replayWindow);
+        for (const OutgoingFrame& outgoing : frames)
+            m_history.push(outgoing.frame, now, outgoing.expires);
+    }
+    if (m_active)
+        m_active->send(frames);
+}
+
+void ClusterSink::finish(const EOFCallback& done)
+{
+    // The stream ends, no member is to take over any more.
+    m_finishing = true;
+    bs::error_code ec;
+    m_retryTimer.cancel(ec);
+    retire(std::move(m_standby));
+    if (m_active)
+        m_active->finish(done);
+    else if (done)
+        done();
+}
+
+std::string ClusterSink::name(size_t index) const
+{
+    const Member& member = m_members[index];
+    return member.server + ":" + std::to_string(member.port) +
+           (m_mountpoint.compare(0, 1, "/") == 0 ? m_mountpoint : "/" + m_mountpoint);
+}
+
+std::unique_ptr<Caster::Server> ClusterSink::makeServer(size_t index)
+{
+    const Member& member = m_members[index];
+    std::unique_ptr<Server> server(new Server(m_ioService, member.server, member.port, m_mountpoint));
+    if (!m_login.empty() || !m_password.empty())
+        server->setCredentials(m_login, m_password);
+    server->setPriority(m_priority);
+    server->setBatchDeadline(m_batchDeadline);
+    // Completion handlers of a retired member may still report, they are
+    // told apart by the pointer.
+    server->setErrorCallback(std::bind(&ClusterSink::handleError, this, server.get(), pls::_1));
+    server->setHeadersCallback(std::bind(&ClusterSink::handleReady, this, server.get()));
+    return server;
+}
+
+void ClusterSink::startStandby()
+{
+    if (m_standbyIndex == m_activeIndex)
+        m_standbyIndex = next(m_standbyIndex);
+    m_standby = makeServer(m_standbyIndex);
+    // Nothing is written to a standby, a timeout would close it.
+    m_standby->start(0);
+}
+
+void ClusterSink::retire(std::unique_ptr<Server> server)
+{
+    // A member fails from within its own completion handler, it is
+    // destroyed later, once no completion handler refers to it.
+    if (!server)
+        return;
+    server->stop();
+    m_retired.push_back(std::move(server));
+    m_ioService.post(track([this]() { purgeIdle(m_retired); }));
+}
+
+void ClusterSink::replay()
+{
+    if (m_replayWindow.count() == 0)
+        return;
+    const auto now = Clock::now();
+    m_history.dropBefore(now - m_replayWindow);
+    FrameBatch frames;
+    m_history.forEach([now, &frames](const RTCM::Frame& frame, Clock::time_point expires)
+                      {
+                          if (expires > now)
+                              frames.push_back(OutgoingFrame{frame, expires});
+                      });
+    m_active->send(frames);
+    const uint64_t count = frames.size();
+    Metrics::instance().destination(name(m_activeIndex)).replayed += count;
+    ERRLOG(logInfo) << "Replayed " << count << " frames to " << name(m_activeIndex);
+}
+
+void ClusterSink::handleReady(const Server* server)
+{
+    if (server == m_active.get()) {
+        if (m_headersCallback)
+            m_headersCallback();
+        return;
+    }
+    if (server == m_standby.get()) {
+        ERRLOG(logDebug) << "Standby destination " << name(m_standbyIndex) << " is ready";
+    }
+}
+
+void ClusterSink::handleError(const Server* server, const bs::error_code& ec)
+{
+    if (server == m_standby.get()) {
+        ERRLOG(logWarning) << "Standby destination " << name(m_standbyIndex) << " failed: " << ec.message();
+        retire(std::move(m_standby));
+        m_standbyIndex = next(m_standbyIndex);
+        m_retryTimer.expires_from_now(standbyRetry);
+        m_retryTimer.async_wait(track(std::bind(&ClusterSink::handleRetry, this, pls::_1)));
+        return;
+    }
+    if (server != m_active.get())
+        return;
+
+    if (m_finishing || !m_standby || !m_standby->isActive()) {
+        if (m_errorCallback)
+            m_errorCallback(ec);
+        return;
+    }
+    ERRLOG(logWarning) << "Destination " << name(m_activeIndex) << " failed: " << ec.message()
+                       << ", " << name(m_standbyIndex) << " takes over";
+    retire(std::move(m_active));
+    m_active = std::move(m_standby);
+    m_activeIndex = m_standbyIndex;
+    m_active->setTimeout(m_timeout);
+    ++Metrics::instance().destination(name(m_activeIndex)).takeovers;
+    replay();
+    // The relay primes the new member with the station messages it has.
+    if (m_headersCallback)
+        m_headersCallback();
+    m_standbyIndex = next(m_activeIndex);
+    startStandby();
+}
+
+void ClusterSink::handleRetry(const bs::error_code& ec)
+{
+    if (ec || m_finishing || !m_active || m_standby)
+        return;
+    startStandby();
+}
+
+void ClusterSink::History::push(const RTCM::Frame& frame, Clock::time_point sent, Clock::time_point expires)
+{
+    m_entries.push_back(Entry{m_data.size(), frame.size, frame.info, sent, expires});
+    m_data.insert(m_data.end(), frame.data, frame.data + frame.size);
+}
+
+void ClusterSink::History::dropBefore(Clock::time_point time)
+{
+    while (m_head < m_entries.size() && m_entries[m_head].sent < time)
+        ++m_head;
+    if (m_head == m_entries.size()) {
+        clear();
+        return;
+    }
+    // Dropped frames are compacted away once they make up half of the
+    // history.
+    if (m_head >= 32 && m_head * 2 >= m_entries.size()) {
+        const size_t offset = m_entries[m_head].offset;
+        m_entries.erase(m_entries.begin(), m_entries.begin() + static_cast<std::ptrdiff_t>(m_head));
+        m_data.erase(m_data.begin(), m_data.begin() + static_cast<std::ptrdiff_t>(offset));
+        for (auto& entry : m_entries)
+            entry.offset -= offset;
+        m_head = 0;
+    }
+}
+
+void ClusterSink::History::clear() noexcept
+{
+    m_entries.clear();
+    m_data.clear();
+    m_head = 0;
+}
@@ -0,0 +1,149 @@
+#ifndef __CASTER_CLUSTER_SINK_H__
+#define __CASTER_CLUSTER_SINK_H__
+
+#include "sink.h"
+#include "server.h"
+#include "rtcm.h"
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+namespace Caster {
+
+// Destination caster that is a cluster of casters. Frames go to one member
+// while a standby connection to another one is kept ready: requested and
+// accepted, but with no data sent. When the active member fails the standby
+// takes over with the next write instead of resolving, connecting and
+// requesting from scratch, frames sent shortly before the failure are sent
+// again and a new standby connects to the next member.
+class ClusterSink final : public Sink {
+    public:
+        // Cluster lists the other members as "host[:port],...", the port
+        // defaults to the one of the first member. Throws CasterError if it
+        // does not parse.
+        ClusterSink(boost::asio::io_service& ioService,
+                    const std::string& server, uint16_t port,
+                    const std::string& cluster,
+                    const std::string& mountpoint);
+
+        // Frames sent this long before a failure go again to the member that
+        // takes over, unless they have expired. Zero disables the replay.
+        void setReplayWindow(std::chrono::milliseconds window) { m_replayWindow = window; }
+        // Relays of the same cluster start on its members in turn instead of
+        // all on the first one.
+        void setSpread(bool spread) { m_spread = spread; }
+
+        void start(unsigned timeout) override;
+        void stop() override;
+        bool isIdle() const override;
+        bool isActive() const override { return m_active && m_active->isActive(); }
+
+        void setCredentials(const std::string& login,
+                            const std::string& password) override;
+        void setPriority(unsigned priority) override;
+        void setBatchDeadline(std::chrono::microseconds deadline) override;
+
+        void send(const FrameBatch& frames) override;
+        void finish(const EOFCallback& done) override;
+
+        void setErrorCallback(const ErrorCallback& cb) override { m_errorCallback = cb; }
+        void setHeadersCallback(const HeadersCallback& cb) override { m_headersCallback = cb; }
+
+    private:
+        struct Member {
+            std::string server;
+            uint16_t port;
+        };
+
+        // Frames sent within the replay window, back to back in one buffer
+        // like the queues of FrameScheduler, so a steady stream allocates
+        // nothing.
+        class History {
+            public:
+                void push(const RTCM::Frame& frame, Clock::time_point sent, Clock::time_point expires);
+                // Forgets the frames sent before the given time.
+                void dropBefore(Clock::time_point time);
+                void clear() noexcept;
+
+                template <typename Function>
+                void forEach(Function function) const
+                {
+                    for (size_t i = m_head; i < m_entries.size(); ++i) {
+                        const Entry& entry = m_entries[i];
+                        function(RTCM::Frame{m_data.data() + entry.offset, entry.size, entry.info}, entry.expires);
+                    }
+                }
+
+            private:
+                struct Entry {
+                    size_t offset;
+                    size_t size;
+                    RTCM::FrameInfo info;
+                    Clock::time_point sent;
+                    Clock::time_point expires;
+                };
+
+                std::vector<Entry> m_entries;
+                std::vector<uint8_t> m_data;
+                size_t m_head = 0;
+        };
+
+        boost::asio::io_service& m_ioService;
+        std::vector<Member> m_members;
+        std::string m_mountpoint;
+        std::string m_login;
+        std::string m_password;
+        unsigned m_priority;
+        std::chrono::microseconds m_batchDeadline;
+        std::chrono::milliseconds m_replayWindow;
+        bool m_spread;
+        unsigned m_timeout;
+        bool m_finishing;
+        size_t m_activeIndex;
+        size_t m_standbyIndex;
+        std::unique_ptr<Server> m_active;
+        std::unique_ptr<Server> m_standby;
+        std::vector<std::unique_ptr<Server>> m_retired;
+        History m_history;
+        boost::asio::steady_timer m_retryTimer;
+        size_t m_outstanding;
+        ErrorCallback m_errorCallback;
+        HeadersCallback m_headersCallback;
+
+        template <typename Handler>
+        auto track(Handler handler);
+
+        std::string name(size_t index) const;
+        size_t next(size_t index) const { return (index + 1) % m_members.size(); }
+        std::unique_ptr<Server> makeServer(size_t index);
+        void startStandby();
+        void retire(std::unique_ptr<Server> server);
+        void replay();
+
+        void handleReady(const Server* server);
+        void handleError(const Server* server, const boost::system::error_code& ec);
+        void handleRetry(const boost::system::error_code& ec);
+};
+
+template <typename Handler>
+inline
+auto ClusterSink::track(Handler handler)
+{
+    ++m_outstanding;
+    return [this, handler](auto&&... args) mutable
+           {
+               --m_outstanding;
+               handler(std::forward<decltype(args)>(args)...);
+           };
+}
+
+}
+
+#endif
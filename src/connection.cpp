@@ -3,8 +3,17 @@
 #include "error.h"
 #include "logger.h"
 #include "utils.h"
+#include "buffer_pool.h"
 
 #include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <array>
+#include <random>
+#include <cerrno>
 
 #define ERRLOG(level) LOG(CerrWriter, level)
 
@@ -18,6 +27,10 @@ namespace ba = boost::asio;
 namespace
 {
 
+// How often deadlines are checked, the precision of timeouts.
+const auto sweepInterval = std::chrono::milliseconds(250);
+const size_t notWatched = static_cast<size_t>(-1);
+
 using StringPair = std::pair<std::string, std::string>;
 
 StringPair splitString(const std::string& src, char delimiter)
@@ -38,44 +51,299 @@ StringPair trimStringPair(const StringPair& pair)
 
 }
 
+// What the connections of an io_service share instead of having one each:
+// the resolver, the buffer data is read into, and one timer that sweeps
+// over their deadlines. The timer runs only while some deadline is set, so
+// it does not keep the io_service busy. Connection attempts also wait here
+// for admission, see AdmissionLimits.
+class Connection::Shared : public ba::io_service::service
+{
+    public:
+        static ba::io_service::id id;
+
+        explicit Shared(ba::io_service& ioService)
+            : ba::io_service::service(ioService),
+              resolver(ioService),
+              buffer(),
+              m_timer(ioService),
+              m_sweeping(false),
+              m_armed(false),
+              m_admissionTimer(ioService),
+              m_random(std::random_device()()),
+              m_nextSlot(),
+              m_pumping(false)
+        {
+        }
+
+        tcp::resolver resolver;
+        std::array<uint8_t, 16384> buffer;
+
+        // The deadline of the connection is checked until it is unwatched.
+        void watch(Connection& connection)
+        {
+            if (connection.m_watchIndex == notWatched) {
+                connection.m_watchIndex = m_watched.size();
+                m_watched.push_back(&connection);
+            }
+            if (!m_armed)
+                arm();
+        }
+
+        void unwatch(Connection& connection)
+        {
+            const size_t index = connection.m_watchIndex;
+            if (index == notWatched)
+                return;
+            connection.m_watchIndex = notWatched;
+            // A timeout may stop other connections, the sweep skips them
+            // and compacts the list afterwards.
+            if (m_sweeping) {
+                m_watched[index] = nullptr;
+                return;
+            }
+            Connection* last = m_watched.back();
+            m_watched.pop_back();
+            if (last != &connection) {
+                m_watched[index] = last;
+                last->m_watchIndex = index;
+            }
+        }
+
+        // Begins the connection once the limits allow it. Its handshake
+        // counts against them until released.
+        void admit(Connection& connection)
+        {
+            release(connection);
+            const AdmissionLimits& limits = Connection::m_admissionLimits;
+            if (limits.rate <= 0 && limits.perHost == 0 && limits.jitter.count() == 0) {
+                connection.begin();
+                return;
+            }
+            const auto now = Clock::now();
+            auto notBefore = now;
+            if (limits.jitter.count() > 0) {
+                std::uniform_int_distribution<int64_t> jitter(0, limits.jitter.count());
+                notBefore += std::chrono::milliseconds(jitter(m_random));
+            }
+            m_waiting.push_back(Waiting{&connection, now, notBefore});
+            connection.m_admission = Admission::Waiting;
+            ++Metrics::instance().admission().waiting;
+            pump();
+        }
+
+        // The handshake is over, or the connection stopped waiting.
+        void release(Connection& connection)
+        {
+            const Admission admission = connection.m_admission;
+            connection.m_admission = Admission::None;
+            if (admission == Admission::Waiting) {
+                const auto it = std::find_if(m_waiting.begin(), m_waiting.end(),
+                                             [&connection](const Waiting& w) { return w.connection == &connection; });
+                m_waiting.erase(it);
+                --Metrics::instance().admission().waiting;
+            } else if (admission == Admission::Admitted) {
+                const auto it = m_connecting.find(connection.m_server.str());
+                if (it != m_connecting.end() && --it->second == 0)
+                    m_connecting.erase(it);
+                pump();
+            }
+        }
+
+    private:
+        struct Waiting {
+            Connection* connection;
+            Clock::time_point since;
+            Clock::time_point notBefore; // jitter
+        };
+
+        ba::steady_timer m_timer;
+        std::vector<Connection*> m_watched;
+        bool m_sweeping;
+        bool m_armed;
+        ba::steady_timer m_admissionTimer;
+        std::vector<Waiting> m_waiting; // in the order of start
+        std::map<std::string, unsigned> m_connecting; // handshakes per host
+        std::minstd_rand m_random;
+        Clock::time_point m_nextSlot; // of the rate limit
+        bool m_pumping;
+
+        void shutdown() override
+        {
+            bs::error_code ec;
+            m_timer.cancel(ec);
+            m_admissionTimer.cancel(ec);
+        }
+
+        // Admits what the limits allow, by priority and then in order, and
+        // waits for the next chance if anything is left.
+        void pump()
+        {
+            if (m_pumping)
+                return;
+            m_pumping = true;
+            const AdmissionLimits& limits = Connection::m_admissionLimits;
+            const auto now = Clock::now();
+            auto wake = Clock::time_point::max();
+            for (;;) {
+                auto best = m_waiting.end();
+                for (auto it = m_waiting.begin(); it != m_waiting.end(); ++it) {
+                    if (it->notBefore > now) {
+                        wake = std::min(wake, it->notBefore);
+                        continue;
+                    }
+                    if (limits.perHost > 0) {
+                        const auto host = m_connecting.find(it->connection->m_server.str());
+                        if (host != m_connecting.end() && host->second >= limits.perHost)
+                            continue;
+                    }
+                    if (best == m_waiting.end() || it->connection->m_priority > best->connection->m_priority)
+                        best = it;
+                }
+                if (best == m_waiting.end())
+                    break;
+                if (limits.rate > 0) {
+                    if (m_nextSlot > now) {
+                        wake = std::min(wake, m_nextSlot);
+                        break;
+                    }
+                    m_nextSlot = now + std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::duration<double>(1 / limits.rate));
+                }
+
+                Connection& connection = *best->connection;
+                auto& metrics = Metrics::instance().admission();
+                metrics.delay.add(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::milliseconds>(now - best->since).count()));
+                --metrics.waiting;
+                ++metrics.admitted;
+                m_waiting.erase(best);
+                ++m_connecting[connection.m_server.str()];
+                connection.m_admission = Admission::Admitted;
+                connection.begin();
+            }
+            m_pumping = false;
+            if (wake == Clock::time_point::max())
+                return;
+            m_admissionTimer.expires_at(wake);
+            m_admissionTimer.async_wait([this](const bs::error_code& ec)
+                                        {
+                                            if (!ec)
+                                                pump();
+                                        });
+        }
+
+        void arm()
+        {
+            m_armed = true;
+            m_timer.expires_from_now(sweepInterval);
+            m_timer.async_wait(std::bind(&Shared::sweep, this, pls::_1));
+        }
+
+        void sweep(const bs::error_code& ec)
+        {
+            if (ec)
+                return;
+            m_armed = false;
+            const auto now = Clock::now();
+            // The sweep doubles as a probe of how long ready handlers wait.
+            if (Metrics::instance().isHandlerProfiling())
+                Metrics::instance().loop().delay.add(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(now - m_timer.expiry()).count()));
+            m_sweeping = true;
+            for (size_t i = 0; i < m_watched.size(); ++i) {
+                Connection* connection = m_watched[i];
+                if (connection && connection->m_deadline <= now)
+                    connection->handleTimeout();
+            }
+            m_sweeping = false;
+
+            size_t kept = 0;
+            for (Connection* connection : m_watched) {
+                if (!connection)
+                    continue;
+                connection->m_watchIndex = kept;
+                m_watched[kept++] = connection;
+            }
+            m_watched.resize(kept);
+            if (!m_watched.empty() && !m_armed)
+                arm();
+        }
+};
+
+ba::io_service::id Connection::Shared::id;
+
+double Connection::m_timeoutSigmas = 4;
+Connection::Engine Connection::m_engine = Connection::Engine::Callbacks;
+Connection::AdmissionLimits Connection::m_admissionLimits;
+
 Connection::Connection(ba::io_service& ioService,
                        const std::string& server, uint16_t port)
     : m_server(server),
       m_port(port),
       m_uri("/"),
       m_timeout(0),
+      m_status(0),
       m_socket(ioService),
-      m_timeouter(ioService),
-      m_resolver(ioService),
-      m_response(1024),
+      m_shared(ba::use_service<Shared>(ioService)),
+      m_deadline(Clock::time_point::max()),
+      m_watchIndex(notWatched),
+      m_outstanding(0),
+      m_handlerMetrics(Metrics::instance().connection(server + ":" + std::to_string(port) + "/")),
+      m_traceId(0),
+      m_generation(0),
+      m_priority(0),
       m_chunked(false),
-      m_active(false)
+      m_active(false),
+      m_authRetried(false),
+      m_suspended(false),
+      m_writingData(false),
+      m_admission(Admission::None)
 {
 }
 
 Connection::Connection(ba::io_service& ioService,
                        const std::string& server, uint16_t port,
                        const std::string& mountpoint)
-    : m_server(server),
-      m_port(port),
-      m_timeout(0),
-      m_socket(ioService),
-      m_timeouter(ioService),
-      m_resolver(ioService),
-      m_response(1024),
-      m_chunked(false),
-      m_active(false)
+    : Connection(ioService, server, port)
 {
-    if (mountpoint[0] != '/')
-        m_uri = "/";
-    m_uri += mountpoint;
+    m_uri = mountpoint[0] != '/' ? "/" + mountpoint : mountpoint;
+    m_handlerMetrics = Metrics::instance().connection(server + ":" + std::to_string(port) + m_uri.str());
+    m_traceId = Tracer::instance().open(server + ":" + std::to_string(port) + m_uri.str());
+}
+
+Connection::~Connection()
+{
+    m_shared.unwatch(*this);
+    m_shared.release(*this);
+    releaseBuffers();
 }
 
 void Connection::start()
 {
-    m_resolver.async_resolve(tcp::resolver::query(m_server, boost::lexical_cast<std::string>(m_port)),
-                             std::bind(&Connection::handleResolve, this, pls::_1, pls::_2));
+    // A connection may be started again after it has been shut down.
+    ++m_generation;
+    m_status = 0;
+    m_headers.reset();
+    m_chunked = false;
+    m_authRetried = false;
+    m_suspended = false;
+    m_writingData = false;
+    m_arrivals.restart();
+    m_shared.admit(*this);
+}
+
+void Connection::begin()
+{
     restartTimer();
+    trace(TraceEvent::Resolve);
+#ifdef NTRIP_COROUTINES
+    if (m_engine == Engine::Coroutines) {
+        spawn(run(m_generation));
+        return;
+    }
+#endif
+    m_shared.resolver.async_resolve(tcp::resolver::query(m_server, boost::lexical_cast<std::string>(m_port)),
+                                    track(HandlerType::Resolve, std::bind(&Connection::handleResolve, this, m_generation, pls::_1, pls::_2)));
 }
 
 void Connection::start(unsigned timeout)
@@ -90,77 +358,339 @@ void Connection::setCredentials(const std::string& login,
     m_auth = Authenticator(login, password);
 }
 
-void Connection::handleResolve(const bs::error_code& error,
-                               tcp::resolver::iterator it)
+const std::map<std::string, std::string>& Connection::headers() const
+{
+    static const std::map<std::string, std::string> none;
+    return m_headers ? *m_headers : none;
+}
+
+// The steps of a connection, shared by both engines: each one reports an
+// error and shuts the connection down itself.
+
+bool Connection::resolved(const bs::error_code& error, tcp::resolver::iterator it)
 {
+    trace(TraceEvent::Resolved, static_cast<uint64_t>(error.value()));
     if (error)
     {
         reportError(error);
         shutdown();
-        return;
+        return false;
     }
 
     if (it == tcp::resolver::iterator())
     {
         reportError(resolveError);
         shutdown();
-        return;
+        return false;
     }
 
     ERRLOG(logDebug) << "Endpoints to connect:";
     for (auto i = it; i != tcp::resolver::iterator(); ++i)
         ERRLOG(logDebug) << i->endpoint();
+    return true;
+}
+
+bool Connection::nextEndpoint(const bs::error_code& error, tcp::resolver::iterator& it)
+{
+    ERRLOG(logDebug) << "Error connecting to " << it->endpoint() << ": " << error.message();
+    trace(TraceEvent::ConnectFailed, static_cast<uint64_t>(error.value()));
+    ++it;
+    if (it == tcp::resolver::iterator())
+    {
+        reportError(error);
+        shutdown();
+        releaseBuffers();
+        return false;
+    }
+    m_socket.close();
+    return true;
+}
+
+void Connection::connected(tcp::resolver::iterator it)
+{
+    ERRLOG(logDebug) << "Successfully connected to " << m_socket.remote_endpoint();
+    trace(TraceEvent::Connected);
+    m_endpoint = it;
 
     restartTimer();
-    ERRLOG(logDebug) << "Trying to connect to " << it->endpoint();
-    m_socket.async_connect(*it, std::bind(&Connection::handleConnect, this, pls::_1, it));
+    if (!m_request)
+        m_request = BufferPool<MessageBuffer>::instance().take();
+    prepareRequest();
 }
 
-void Connection::handleConnect(const bs::error_code& error,
-                               tcp::resolver::iterator it)
+bool Connection::requestWritten(const bs::error_code& error)
 {
+    BufferPool<MessageBuffer>::instance().give(std::move(m_request));
     if (error)
     {
-        ERRLOG(logDebug) << "Error connecting to " << it->endpoint() << ": " << error.message();
-        ++it;
-        ERRLOG(logDebug) << "Trying to connect to " << it->endpoint();
-        if (it == tcp::resolver::iterator())
-        {
-            reportError(error);
+        fail(error);
+        return false;
+    }
+    trace(TraceEvent::RequestWritten);
+
+    restartTimer();
+    if (!m_response)
+        m_response = BufferPool<MessageBuffer>::instance().take();
+    return true;
+}
+
+Connection::Reply Connection::readStatus()
+{
+    std::istream statusStream(m_response.get());
+    std::string proto;
+    statusStream >> proto;
+    unsigned code = 0;
+    statusStream >> code;
+    std::string message;
+    std::getline(statusStream, message);
+    m_status = code;
+    trace(TraceEvent::Status, code);
+    if (code == 401 && m_auth.authenticated()) {
+        if (!m_authRetried)
+            return Reply::Challenge;
+        NonceCache::instance().erase(host());
+        reportError(authenticationError);
+        shutdown();
+        releaseBuffers();
+        return Reply::Failed;
+    }
+    if (!isValidStatus(code)) {
+        ERRLOG(logError) << "Invalid status string:\n"
+                      << proto << " " << code << " " << message;
+        reportError(invalidStatus);
+        shutdown();
+        releaseBuffers();
+        return Reply::Failed;
+    }
+    return proto == "ICY" ? Reply::Data : Reply::Headers;
+}
+
+void Connection::readHeaders()
+{
+    std::istream headersStream(m_response.get());
+    std::string header;
+    m_headers.reset(new std::map<std::string, std::string>());
+    while (std::getline(headersStream, header) && header != "\r") {
+        const StringPair pair(trimStringPair(splitString(header, ':')));
+        m_headers->insert(pair);
+        if (pair.first == "Transfer-Encoding" &&
+            pair.second == "chunked") {
+            ERRLOG(logDebug) << "Transfer-Encoding: chunked";
+            m_chunked = true;
+        }
+    }
+    trace(TraceEvent::Headers);
+    if (m_headersCallback)
+        m_headersCallback();
+    // Nothing needs them once the stream is running.
+    m_headers.reset();
+}
+
+bool Connection::readChallenge()
+{
+    // A caster may offer several challenges, SHA-256 is preferred.
+    std::istream headersStream(m_response.get());
+    std::string header;
+    bool found = false;
+    DigestChallenge challenge;
+    while (std::getline(headersStream, header) && header != "\r") {
+        const StringPair pair(splitString(header, ':'));
+        if (!boost::algorithm::iequals(pair.first, "WWW-Authenticate"))
+            continue;
+        DigestChallenge candidate;
+        if (!parseDigestChallenge(pair.second, candidate))
+            continue;
+        if (!found || boost::algorithm::istarts_with(candidate.algorithm, "SHA-256"))
+            challenge = candidate;
+        found = true;
+    }
+    if (!found) {
+        ERRLOG(logError) << "No supported authentication challenge from " << host();
+        reportError(authenticationError);
+        shutdown();
+        releaseBuffers();
+        return false;
+    }
+
+    // The request is repeated on a new connection, the caster closes this
+    // one.
+    ERRLOG(logDebug) << "Answering " << challenge.algorithm << " digest challenge from " << host();
+    NonceCache::instance().set(host(), challenge);
+    m_authRetried = true;
+    m_status = 0;
+    bs::error_code ec;
+    m_socket.shutdown(tcp::socket::shutdown_both, ec);
+    m_socket.close(ec);
+    m_response->consume(m_response->size());
+    return true;
+}
+
+bool Connection::beginData()
+{
+    if (!m_socket.is_open()) {
+        releaseBuffers();
+        return false;
+    }
+    m_active = true;
+    m_shared.release(*this);
+    m_decoder.reset();
+    m_endpoint = tcp::resolver::iterator(); // holds all resolved endpoints
+    bs::error_code ec;
+    m_socket.non_blocking(true, ec);
+
+    // Whatever came along with the headers goes first, then the buffer goes
+    // back to the pool.
+    std::unique_ptr<MessageBuffer> response(std::move(m_response));
+    const size_t size = response->size();
+    bool open = true;
+    if (size > 0) {
+        dataArrived();
+        open = consume(ba::buffer_cast<const uint8_t*>(response->data()), size);
+    }
+    response->consume(size);
+    BufferPool<MessageBuffer>::instance().give(std::move(response));
+    BufferPool<MessageBuffer>::instance().give(std::move(m_request));
+    return open;
+}
+
+bool Connection::drain()
+{
+    // Readiness is reported once per arrival, everything there is has to be
+    // read now.
+    for (;;) {
+        bs::error_code ec;
+        const size_t size = m_socket.read_some(ba::buffer(m_shared.buffer), ec);
+        if (ec == ba::error::would_block)
+            return true;
+        if (ec == ba::error::eof) {
+            ended();
             shutdown();
-            return;
+            return false;
         }
+        if (ec) {
+            reportError(ec);
+            shutdown();
+            return false;
+        }
+        dataArrived();
         restartTimer();
-        m_socket.close();
-        m_socket.async_connect(*it, std::bind(&Connection::handleConnect, this, pls::_1, it));
+        if (!consume(m_shared.buffer.data(), size))
+            return false;
+    }
+}
+
+bool Connection::consume(const uint8_t* data, size_t size)
+{
+    trace(TraceEvent::Data, size);
+    // The transfer coding is known from the response headers, the only
+    // decision per buffer. Everything after it is compiled for each coding.
+    if (m_chunked)
+        return deliver(m_decoder, data, size);
+    IdentityDecoder identity;
+    return deliver(identity, data, size);
+}
+
+template <typename Decoder>
+bool Connection::deliver(Decoder& decoder, const uint8_t* data, size_t size)
+{
+    const bool more = decoder.feed(data, size, [this](const uint8_t* part, size_t partSize)
+                                   {
+                                       if (m_dataCallback)
+                                           m_dataCallback(ba::const_buffers_1(part, partSize));
+                                       return m_socket.is_open();
+                                   });
+    if (more || !m_socket.is_open())
+        return more;
+    // The last chunk, or framing that makes no sense, ends the stream.
+    ended();
+    shutdown();
+    return false;
+}
+
+void Connection::ended()
+{
+    // Nobody waits for the end of an upload, a caster that closes it cuts
+    // it short and the uploader has to know.
+    if (m_eofCallback)
+        m_eofCallback();
+    else
+        reportError(bs::error_code(ba::error::eof));
+}
+
+void Connection::fail(const bs::error_code& error)
+{
+    if (error != ba::error::operation_aborted) {
+        reportError(error);
+        shutdown();
+    }
+    releaseBuffers();
+}
+
+void Connection::readData()
+{
+#ifdef NTRIP_COROUTINES
+    if (m_engine == Engine::Coroutines) {
+        spawn(receive());
         return;
     }
+#endif
+    handleReadable(bs::error_code());
+}
 
-    ERRLOG(logDebug) << "Successfully connected to " << m_socket.remote_endpoint();
+// Callback engine: every step is a completion handler that starts the next
+// operation.
 
+void Connection::handleResolve(unsigned generation,
+                               const bs::error_code& error,
+                               tcp::resolver::iterator it)
+{
+    // The resolver is shared, a stopped connection cannot cancel its query.
+    if (generation != m_generation || !resolved(error, it))
+        return;
+
+    connect(it);
+}
+
+void Connection::connect(tcp::resolver::iterator it)
+{
     restartTimer();
-    prepareRequest();
-    ba::async_write(m_socket, m_request, ba::transfer_all(), std::bind(&Connection::handleWriteRequest, this, pls::_1));
+    ERRLOG(logDebug) << "Trying to connect to " << it->endpoint();
+    trace(TraceEvent::Connect);
+    m_socket.async_connect(*it, track(HandlerType::Connect, std::bind(&Connection::handleConnect, this, pls::_1, it)));
 }
 
-void Connection::handleWriteRequest(const bs::error_code& error)
+void Connection::handleConnect(const bs::error_code& error,
+                               tcp::resolver::iterator it)
 {
     if (error)
     {
-        if (error != ba::error::operation_aborted)
-        {
-            reportError(error);
-            shutdown();
-        }
+        if (error == ba::error::operation_aborted)
+            releaseBuffers();
+        else if (nextEndpoint(error, it))
+            connect(it);
         return;
     }
 
-    restartTimer();
-    ba::async_read_until(m_socket, m_response, "\r\n", std::bind(&Connection::handleReadStatus, this, pls::_1));
+    connected(it);
+    ba::async_write(m_socket, static_cast<ba::streambuf&>(*m_request), ba::transfer_all(), track(HandlerType::WriteRequest, std::bind(&Connection::handleWriteRequest, this, pls::_1)));
+}
+
+void Connection::handleWriteRequest(const bs::error_code& error)
+{
+    if (!requestWritten(error))
+        return;
+
+    ba::async_read_until(m_socket, static_cast<ba::streambuf&>(*m_response), "\r\n", track(HandlerType::ReadStatus, std::bind(&Connection::handleReadStatus, this, pls::_1)));
 }
 
 void Connection::handleWriteData(const bs::error_code& error)
 {
+    m_writingData = false;
+    if (m_suspended) {
+        bs::error_code ec;
+        m_socket.cancel(ec);
+        return;
+    }
     if (error)
     {
         if (error != ba::error::operation_aborted)
@@ -172,262 +702,340 @@ void Connection::handleWriteData(const bs::error_code& error)
     }
 
     restartTimer();
+    writeComplete();
 }
 
 void Connection::handleReadStatus(const bs::error_code& error)
 {
     restartTimer();
-    if (!error) {
-        std::istream statusStream(&m_response);
-        std::string proto;
-        statusStream >> proto;
-        unsigned code;
-        statusStream >> code;
-        std::string message;
-        std::getline(statusStream, message);
-        if (code != 200) {
-            ERRLOG(logError) << "Invalid status string:\n"
-                          << proto << " " << code << " " << message;
-            reportError(invalidStatus);
-            shutdown();
-            return;
-        }
-        if (proto == "ICY") {
-            m_active = true;
-            ba::async_read(
-                m_socket,
-                m_response,
-                std::bind(
-                    &Connection::handleReadData,
-                    this,
-                    pls::_1
-                )
-            );
-        } else {
-            ba::async_read_until(
-                m_socket,
-                m_response,
-                "\r\n\r\n",
-                std::bind(
-                    &Connection::handleReadHeaders,
-                    this,
-                    pls::_1
-                )
-            );
-        }
-    } else if (error != ba::error::operation_aborted) {
-        reportError(error);
-        shutdown();
+    if (error) {
+        fail(error);
+        return;
+    }
+
+    switch (readStatus()) {
+        case Reply::Challenge:
+            ba::async_read_until(m_socket, static_cast<ba::streambuf&>(*m_response), "\r\n\r\n",
+                                 track(HandlerType::ReadChallenge, std::bind(&Connection::handleReadChallenge, this, pls::_1)));
+            break;
+        case Reply::Headers:
+            ba::async_read_until(m_socket, static_cast<ba::streambuf&>(*m_response), "\r\n\r\n",
+                                 track(HandlerType::ReadHeaders, std::bind(&Connection::handleReadHeaders, this, pls::_1)));
+            break;
+        case Reply::Data:
+            if (beginData())
+                handleReadable(bs::error_code());
+            break;
+        case Reply::Failed:
+            break;
     }
 }
 
 void Connection::handleReadHeaders(const bs::error_code& error)
 {
     restartTimer();
-    if (!error) {
-        std::istream headersStream(&m_response);
-        std::string header;
-        while (std::getline(headersStream, header) && header != "\r") {
-            const StringPair pair(trimStringPair(splitString(header, ':')));
-            m_headers.insert(pair);
-            if (pair.first == "Transfer-Encoding" &&
-                pair.second == "chunked") {
-                ERRLOG(logDebug) << "Transfer-Encoding: chunked";
-                m_chunked = true;
-            }
-        }
-        if (m_headersCallback)
-            m_headersCallback();
-        m_active = true;
-        if (m_chunked) {
-            ba::async_read_until(
-                m_socket,
-                m_response,
-                "\r\n",
-                std::bind(
-                    &Connection::handleReadChunkLength,
-                    this,
-                    pls::_1
-                )
-            );
-        } else {
-            ba::async_read(
-                m_socket,
-                m_response,
-                std::bind(
-                    &Connection::handleReadData,
-                    this,
-                    pls::_1
-                )
-            );
-        }
-    } else if (error != ba::error::operation_aborted) {
-        reportError(error);
-        shutdown();
+    if (error) {
+        fail(error);
+        return;
     }
+
+    readHeaders();
+    if (beginData())
+        handleReadable(bs::error_code());
 }
 
-void Connection::handleReadData(const bs::error_code& error)
+void Connection::handleReadChallenge(const bs::error_code& error)
 {
     restartTimer();
-
-    if (m_response.size() > 0) {
-        if (m_dataCallback)
-            m_dataCallback(m_response.data());
-        m_response.consume(m_response.size());
+    if (error) {
+        fail(error);
+        return;
     }
 
-    if (!error) {
-        ba::async_read(
-            m_socket,
-            m_response,
-            ba::transfer_at_least(1),
-            std::bind(
-                &Connection::handleReadData,
-                this,
-                pls::_1
-            )
-        );
-    } else if (error == ba::error::eof) {
-        if (m_eofCallback)
-            m_eofCallback();
-        shutdown();
-    } else if (error != ba::error::operation_aborted) {
-        reportError(error);
-        shutdown();
-    }
+    if (readChallenge())
+        connect(m_endpoint);
 }
 
-void Connection::handleReadChunkLength(const bs::error_code& error)
+void Connection::waitReadable()
 {
-    restartTimer();
+    m_socket.async_wait(tcp::socket::wait_read, track(HandlerType::Readable, std::bind(&Connection::handleReadable, this, pls::_1)));
+}
 
-    if (!error) {
-        size_t length = 0;
-        m_response.consume(parseChunkLength(m_response.data(), length));
-        if (length == 0) {
-            if (m_eofCallback)
-                m_eofCallback();
-            shutdown();
-        } else {
-            if (m_response.size() < length + 2) {
-                ba::async_read(
-                    m_socket,
-                    m_response,
-                    ba::transfer_at_least(length + 2 - m_response.size()),
-                    std::bind(
-                        &Connection::handleReadChunkData,
-                        this,
-                        pls::_1,
-                        length
-                    )
-                );
-            } else {
-                handleReadChunkData(bs::error_code(), length);
-            }
-        }
-    } else if (error == ba::error::eof) {
-        if (m_eofCallback)
-            m_eofCallback();
-        shutdown();
-    } else if (error != ba::error::operation_aborted) {
-        reportError(error);
-        shutdown();
+void Connection::handleReadable(const bs::error_code& error)
+{
+    if (error) {
+        fail(error);
+        return;
     }
+
+    if (drain())
+        waitReadable();
 }
 
-void Connection::handleReadChunkData(const bs::error_code& error,
-                                       size_t size)
+#ifdef NTRIP_COROUTINES
+
+// Coroutine engine: the same steps as one linear coroutine. Asio recycles
+// the coroutine frames, and the handlers it resumes are not type-erased.
+
+void Connection::spawn(ba::awaitable<void> task)
 {
-    restartTimer();
+    ++m_outstanding;
+    ba::co_spawn(m_socket.get_executor(), std::move(task),
+                 [this](std::exception_ptr e)
+                 {
+                     --m_outstanding;
+                     if (e)
+                         std::rethrow_exception(e);
+                 });
+}
 
-    if (size > 0) {
-        if (size > m_response.size()) {
-            if (m_dataCallback)
-                m_dataCallback(m_response.data());
-        } else {
-            if (m_dataCallback)
-                m_dataCallback(buffer(m_response.data(), size));
+ba::awaitable<void> Connection::run(unsigned generation)
+{
+    bs::error_code ec;
+    auto token = ba::redirect_error(ba::use_awaitable, ec);
+    tcp::resolver::iterator it = co_await m_shared.resolver.async_resolve(
+        tcp::resolver::query(m_server, boost::lexical_cast<std::string>(m_port)), token);
+    // The resolver is shared, a stopped connection cannot cancel its query.
+    if (generation != m_generation || !resolved(ec, it))
+        co_return;
+
+    for (;;) {
+        restartTimer();
+        ERRLOG(logDebug) << "Trying to connect to " << it->endpoint();
+        trace(TraceEvent::Connect);
+        co_await m_socket.async_connect(*it, token);
+        if (ec == ba::error::operation_aborted) {
+            releaseBuffers();
+            co_return;
+        }
+        if (ec) {
+            if (!nextEndpoint(ec, it))
+                co_return;
+            continue;
+        }
+
+        connected(it);
+        co_await ba::async_write(m_socket, static_cast<ba::streambuf&>(*m_request), ba::transfer_all(), token);
+        if (!requestWritten(ec))
+            co_return;
+
+        co_await ba::async_read_until(m_socket, static_cast<ba::streambuf&>(*m_response), "\r\n", token);
+        restartTimer();
+        if (ec) {
+            fail(ec);
+            co_return;
+        }
+        const Reply reply = readStatus();
+        if (reply == Reply::Failed)
+            co_return;
+        if (reply == Reply::Data)
+            break;
+
+        co_await ba::async_read_until(m_socket, static_cast<ba::streambuf&>(*m_response), "\r\n\r\n", token);
+        restartTimer();
+        if (ec) {
+            fail(ec);
+            co_return;
+        }
+        if (reply == Reply::Headers) {
+            readHeaders();
+            break;
         }
+        if (!readChallenge())
+            co_return;
+        it = m_endpoint;
     }
-    if (!error) {
-        if (size > m_response.size()) {
-            const size_t remainder = size + 2 - m_response.size();
-            m_response.consume(m_response.size());
-            ba::async_read(
-                m_socket,
-                m_response,
-                ba::transfer_at_least(remainder),
-                std::bind(
-                    &Connection::handleReadChunkData,
-                    this,
-                    pls::_1,
-                    remainder - 2
-                )
-            );
-        } else {
-            m_response.consume(size + 2);
-            ba::async_read_until(
-                m_socket,
-                m_response,
-                "\r\n",
-                std::bind(
-                    &Connection::handleReadChunkLength,
-                    this,
-                    pls::_1
-                )
-            );
+
+    if (beginData())
+        co_await receive();
+}
+
+ba::awaitable<void> Connection::receive()
+{
+    bs::error_code ec;
+    while (drain()) {
+        co_await m_socket.async_wait(tcp::socket::wait_read, ba::redirect_error(ba::use_awaitable, ec));
+        if (ec) {
+            fail(ec);
+            co_return;
         }
-    } else if (error == ba::error::eof) {
-        if (m_eofCallback)
-            m_eofCallback();
-        shutdown();
-    } else if (error != ba::error::operation_aborted) {
-        reportError(error);
-        shutdown();
     }
 }
 
+#endif
+
+void Connection::suspend()
+{
+    m_suspended = true;
+    setDeadline(Clock::time_point::max());
+    // A write cut short would corrupt the stream, reads are cancelled once
+    // it is done, see handleWriteData.
+    bs::error_code ec;
+    if (!m_writingData)
+        m_socket.cancel(ec);
+}
+
+bool Connection::detach(Handover::ConnectionState& state, int& fd)
+{
+    if (!m_suspended || !m_active || !isIdle() || !m_socket.is_open())
+        return false;
+    state.status = m_status;
+    state.chunked = m_chunked;
+    state.chunkState = static_cast<unsigned>(m_decoder.state());
+    state.chunkLeft = m_decoder.left();
+    // Data is passed on as soon as it is read, nothing is left over.
+    state.input.clear();
+    bs::error_code ec;
+    fd = m_socket.release(ec);
+    if (ec)
+        return false;
+    m_active = false;
+    return true;
+}
+
+void Connection::adopt(int fd, const Handover::ConnectionState& state, unsigned timeout)
+{
+    m_timeout = timeout;
+    ++m_generation;
+    m_status = state.status;
+    m_headers.reset();
+    m_chunked = state.chunked;
+    m_suspended = false;
+    m_writingData = false;
+    releaseBuffers();
+    m_arrivals.restart();
+    const auto chunkState = static_cast<ChunkDecoder::State>(
+        std::min(state.chunkState, static_cast<unsigned>(ChunkDecoder::State::Invalid)));
+    m_decoder.restore(chunkState, state.chunkLeft);
+
+    sockaddr_storage address;
+    socklen_t size = sizeof(address);
+    bs::error_code ec;
+    if (::getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size) != 0)
+        ec = bs::error_code(errno, bs::system_category());
+    else
+        m_socket.assign(address.ss_family == AF_INET6 ? tcp::v6() : tcp::v4(), fd, ec);
+    if (ec) {
+        // Not from within start(), the owner is not done starting yet.
+        ba::post(m_socket.get_executor(), track(HandlerType::Adopt, [this, ec]()
+                                                {
+                                                    reportError(ec);
+                                                    shutdown();
+                                                }));
+        return;
+    }
+
+    m_active = true;
+    m_socket.non_blocking(true, ec);
+    restartTimer();
+    // Input left over by the other process goes first.
+    ba::post(m_socket.get_executor(), track(HandlerType::Adopt, [this, input = state.input]()
+                                            {
+                                                if (!m_socket.is_open())
+                                                    return;
+                                                if (input.empty() ||
+                                                    consume(reinterpret_cast<const uint8_t*>(input.data()), input.size()))
+                                                    readData();
+                                            }));
+}
+
+void Connection::releaseBuffers()
+{
+    auto& pool = BufferPool<MessageBuffer>::instance();
+    if (m_request)
+        m_request->consume(m_request->size());
+    if (m_response)
+        m_response->consume(m_response->size());
+    pool.give(std::move(m_request));
+    pool.give(std::move(m_response));
+}
+
 void Connection::shutdown()
 {
     m_active = false;
+    m_shared.release(*this);
+    // A resolve still running is ignored once it completes.
+    ++m_generation;
+    setDeadline(Clock::time_point::max());
     if (!m_socket.is_open())
         return;
     ERRLOG(logDebug) << "Connection::shutdown()";
+    trace(TraceEvent::Closed);
     bs::error_code ec;
     m_socket.shutdown(tcp::socket::shutdown_both, ec);
     m_socket.close(ec);
 }
 
-void Connection::handleTimeout(const bs::error_code& ec)
+std::string Connection::host() const
 {
-    if (ec == ba::error::operation_aborted)
-        return;
-    if (!m_socket.is_open())
-        return;
+    return m_server.str() + ":" + boost::lexical_cast<std::string>(m_port);
+}
 
-    // Check whether the deadline has passed. We compare the deadline against
-    // the current time since a new asynchronous operation may have moved the
-    // deadline before this actor had a chance to run.
-    if (m_timeouter.expires_at() > std::chrono::steady_clock::now())
-        m_timeouter.async_wait(std::bind(&Connection::handleTimeout, this, pls::_1));
+std::string Connection::authorization(const std::string& method)
+{
+    if (!m_auth.authenticated())
+        return "";
+    DigestChallenge* challenge = NonceCache::instance().find(host());
+    if (challenge)
+        return "Authorization: " + m_auth.digest(method, m_uri, *challenge) + "\r\n";
+    return "Authorization: Basic " + m_auth.basic() + "\r\n";
+}
 
-    ERRLOG(logInfo) << "Connection timeout detected, shutting it down" << std::endl;
+void Connection::handleTimeout()
+{
+    // Resolving is bounded by the resolver itself.
+    if (!m_socket.is_open()) {
+        setDeadline(Clock::time_point::max());
+        return;
+    }
+
+    if (m_active && m_arrivals.ready() && m_timeoutSigmas > 0) {
+        ERRLOG(logInfo) << "No data from " << host() << m_uri << " for "
+                        << std::chrono::duration_cast<std::chrono::milliseconds>(timeoutPeriod()).count()
+                        << " ms, usually every " << static_cast<int64_t>(m_arrivals.mean())
+                        << " ms, shutting it down";
+    } else {
+        ERRLOG(logInfo) << "Connection timeout detected, shutting it down" << std::endl;
+    }
     reportError(connectionTimeout);
     shutdown();
 }
 
+void Connection::dataArrived()
+{
+    m_arrivals.arrived(Clock::now());
+}
+
+Connection::Clock::duration Connection::timeoutPeriod() const
+{
+    const Clock::duration fixed = std::chrono::seconds(m_timeout);
+    // Connecting and waiting for the response keep the fixed timeout, the
+    // learned one applies to the data.
+    if (!m_active || !m_arrivals.ready() || m_timeoutSigmas <= 0)
+        return fixed;
+    return std::min(fixed, m_arrivals.limit(m_timeoutSigmas));
+}
+
 void Connection::restartTimer()
 {
-    if (m_timeout > 0)
+    if (m_timeout == 0 || m_suspended)
         return;
 
-    m_timeouter.expires_from_now(std::chrono::seconds(m_timeout));
-    m_timeouter.async_wait(std::bind(&Connection::handleTimeout, this, pls::_1));
+    setDeadline(Clock::now() + timeoutPeriod());
+}
+
+void Connection::setDeadline(Clock::time_point deadline)
+{
+    m_deadline = deadline;
+    if (deadline == Clock::time_point::max())
+        m_shared.unwatch(*this);
+    else
+        m_shared.watch(*this);
 }
 
 void Connection::reportError(const bs::error_code& ec)
 {
+    trace(TraceEvent::Error, static_cast<uint64_t>(ec.value()));
     if (m_errorCallback)
         m_errorCallback(ec);
 }
@@ -3,19 +3,42 @@
 
 #include "authenticator.h"
 #include "callbacks.h"
+#include "arrival_estimator.h"
+#include "handover.h"
+#include "chunk_decoder.h"
+#include "string_pool.h"
+#include "handler_allocator.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <boost/asio.hpp>
 
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 #include <functional>
 #include <chrono>
+#include <utility>
 #include <cstdint>
 
 namespace Caster
 {
 
+// Request or response headers, lent from a pool while they are in flight.
+class MessageBuffer : public boost::asio::streambuf
+{
+    public:
+        static constexpr size_t maxSize = 4096;
+
+        MessageBuffer() : boost::asio::streambuf(maxSize) {}
+};
+
+// One HTTP/NTRIP connection to a caster. There may be tens of thousands of
+// them, so an idle one is kept small: host and mountpoint are interned,
+// buffers are lent from pools while data is in flight, the resolver, read
+// buffer and deadline timer are shared per io_service and the headers are
+// dropped once the headers callback has seen them.
 class Connection
 {
     public:
@@ -25,11 +48,14 @@ class Connection
         Connection(boost::asio::io_service& ioService,
                    const std::string& server, uint16_t port,
                    const std::string& mountpoint);
-        virtual ~Connection() = default;
+        virtual ~Connection();
 
         void start();
         void start(unsigned timeout);
         void stop() { shutdown(); }
+        // Changes the timeout of a running connection, it applies from the
+        // next write or read on.
+        void setTimeout(unsigned timeout) { m_timeout = timeout; }
 
         template <typename ConstBufferSequence>
         void send(const ConstBufferSequence& buffers);
@@ -47,69 +73,245 @@ class Connection
         void resetEOFCallback() { m_eofCallback = {}; }
         void resetHeadersCallback() { m_headersCallback = {}; }
 
-        const std::map<std::string, std::string>& headers() const { return m_headers; }
+        // Response headers, available from within the headers callback.
+        const std::map<std::string, std::string>& headers() const;
+        unsigned status() const { return m_status; }
 
         bool isActive() const { return m_active; }
 
+        // Stops reading and writing once the write in progress is done, so
+        // the socket can be handed over to another process when the
+        // connection is idle.
+        void suspend();
+        // Releases the socket of a suspended idle connection and tells
+        // where the stream stopped. False if it cannot be handed over.
+        bool detach(Handover::ConnectionState& state, int& fd);
+        // Goes on with a socket and state received from another process,
+        // without a new request.
+        void adopt(int fd, const Handover::ConnectionState& state, unsigned timeout);
+        // Once the data cadence of a connection is learned, it times out
+        // after this many standard deviations beyond the usual gap between
+        // data, the fixed timeout stays the upper bound. Zero disables it.
+        static void setTimeoutSigmas(double sigmas) { m_timeoutSigmas = sigmas; }
+
+        // How connections run: as a chain of completion handlers, or as one
+        // C++20 coroutine each when built with COROUTINES.
+        enum class Engine { Callbacks, Coroutines };
+        static void setEngine(Engine engine) { m_engine = engine; }
+
+        // Connection attempts are paced, so that a restart or the end of an
+        // outage does not hit the casters all at once: at most rate per
+        // second in total, at most perHost handshakes in progress per host,
+        // each one held back by up to jitter at random. Zero disables a
+        // limit. Waiting connections of higher priority go first.
+        struct AdmissionLimits {
+            double rate = 0;
+            unsigned perHost = 0;
+            std::chrono::milliseconds jitter{0};
+        };
+        static void setAdmissionLimits(const AdmissionLimits& limits) { m_admissionLimits = limits; }
+        void setPriority(unsigned priority) { m_priority = priority; }
+
+        // No completion handler refers to the connection, it is safe to
+        // destroy it.
+        bool isIdle() const { return m_outstanding == 0; }
+
     protected:
         using tcp = boost::asio::ip::tcp;
+        using Clock = std::chrono::steady_clock;
 
-        std::string m_server;
+        SharedString m_server;
         uint16_t m_port;
-        std::string m_uri;
+        SharedString m_uri;
         Authenticator m_auth;
         unsigned m_timeout;
-        std::map<std::string, std::string> m_headers;
+        unsigned m_status;
         tcp::socket m_socket;
-        boost::asio::steady_timer m_timeouter;
-        boost::asio::streambuf m_request;
+        std::unique_ptr<MessageBuffer> m_request; // lent while the request is written
+
+        // Authorization header line for the request, empty without
+        // credentials. Digest is used once the caster has sent a challenge.
+        std::string authorization(const std::string& method);
+
+        template <typename Handler>
+        class Tracked;
+
+        template <typename Handler>
+        auto track(HandlerType type, Handler handler);
 
         virtual void prepareRequest() = 0;
+        virtual bool isValidStatus(unsigned code) const { return code == 200; }
+        virtual void writeComplete() {}
+
+        // Reports the error and closes the connection, also from within the
+        // data callback.
+        void fail(const boost::system::error_code& error);
 
     private:
-        tcp::resolver m_resolver;
-        boost::asio::streambuf m_response;
+        class Shared;
+
+        Shared& m_shared;
+        std::unique_ptr<MessageBuffer> m_response; // lent until the headers are read
+        std::unique_ptr<std::map<std::string, std::string>> m_headers;
         ErrorCallback m_errorCallback;
         DataCallback m_dataCallback;
         EOFCallback m_eofCallback;
         HeadersCallback m_headersCallback;
+        tcp::resolver::iterator m_endpoint;
+        Clock::time_point m_deadline; // max while no timeout is running
+        size_t m_watchIndex; // in the deadline sweep of m_shared
+        size_t m_outstanding;
+        ConnectionMetrics* m_handlerMetrics; // null unless handlers are profiled
+        uint32_t m_traceId; // zero unless tracing
+        unsigned m_generation; // of the start, a resolve of an earlier one is ignored
+        unsigned m_priority; // of admission
+        ArrivalEstimator m_arrivals;
+        ChunkDecoder m_decoder;
         bool m_chunked;
         bool m_active;
+        bool m_authRetried;
+        bool m_suspended;
+        bool m_writingData;
+        enum class Admission : uint8_t { None, Waiting, Admitted } m_admission; // see Shared::admit
+        static double m_timeoutSigmas;
+        static Engine m_engine;
+        static AdmissionLimits m_admissionLimits;
+
+        // Steps shared by both engines. They report errors and shut the
+        // connection down themselves, false or Failed means it is over.
+        enum class Reply { Headers, Challenge, Data, Failed };
+
+        // Connects once admitted.
+        void begin();
+        bool resolved(const boost::system::error_code& error,
+                      tcp::resolver::iterator it);
+        bool nextEndpoint(const boost::system::error_code& error,
+                          tcp::resolver::iterator& it);
+        void connected(tcp::resolver::iterator it);
+        bool requestWritten(const boost::system::error_code& error);
+        Reply readStatus();
+        void readHeaders();
+        bool readChallenge();
+        // Data phase: the rest of the response buffer goes first, then data
+        // is read whenever the socket is readable.
+        bool beginData();
+        // Reads what the socket has, true if it is to be waited on again.
+        bool drain();
+        // False once the connection is closed.
+        bool consume(const uint8_t* data, size_t size);
+        template <typename Decoder>
+        bool deliver(Decoder& decoder, const uint8_t* data, size_t size);
+        // End of the stream, an error without an EOF callback.
+        void ended();
+        void readData();
 
-        void handleResolve(const boost::system::error_code& error,
+        void handleResolve(unsigned generation,
+                           const boost::system::error_code& error,
                            tcp::resolver::iterator it);
+        void connect(tcp::resolver::iterator it);
         void handleConnect(const boost::system::error_code& error,
                            tcp::resolver::iterator it);
         void handleWriteRequest(const boost::system::error_code& error);
         void handleWriteData(const boost::system::error_code& error);
         void handleReadStatus(const boost::system::error_code& error);
         void handleReadHeaders(const boost::system::error_code& error);
-        void handleReadData(const boost::system::error_code& error);
-        void handleReadChunkLength(const boost::system::error_code& error);
-        void handleReadChunkData(const boost::system::error_code& error,
-                                 size_t size);
+        void handleReadChallenge(const boost::system::error_code& error);
 
+        void waitReadable();
+        void handleReadable(const boost::system::error_code& error);
+
+#ifdef NTRIP_COROUTINES
+        void spawn(boost::asio::awaitable<void> task);
+        boost::asio::awaitable<void> run(unsigned generation);
+        boost::asio::awaitable<void> receive();
+#endif
+
+        void releaseBuffers();
         void shutdown();
+        std::string host() const;
 
+        void dataArrived();
+        Clock::duration timeoutPeriod() const;
         void restartTimer();
-        void handleTimeout(const boost::system::error_code& ec);
+        void setDeadline(Clock::time_point deadline);
+        void handleTimeout();
 
         void reportError(const boost::system::error_code& ec);
         void reportError(int val);
+
+        void trace(TraceEvent event, uint64_t arg = 0)
+        {
+            if (m_traceId)
+                Tracer::instance().record(m_traceId, event, arg);
+        }
+};
+
+// Completion handler counted in m_outstanding until it runs. The operation
+// memory comes from HandlerMemory. With handler profiling its run time goes
+// to the histogram of its type.
+template <typename Handler>
+class Connection::Tracked {
+    public:
+        using allocator_type = HandlerAllocator<void>;
+
+        Tracked(size_t& outstanding, Histogram* runTime, Handler handler)
+            : m_outstanding(&outstanding),
+              m_runTime(runTime),
+              m_handler(std::move(handler))
+        {
+        }
+
+        template <typename... Args>
+        void operator()(Args&&... args)
+        {
+            --*m_outstanding;
+            if (!m_runTime) {
+                m_handler(std::forward<Args>(args)...);
+                return;
+            }
+            // The handler may destroy the connection, the histogram stays.
+            Histogram* const runTime = m_runTime;
+            --Metrics::instance().loop().pendingHandlers;
+            const auto start = Clock::now();
+            m_handler(std::forward<Args>(args)...);
+            runTime->add(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+        }
+
+        allocator_type get_allocator() const noexcept { return allocator_type(); }
+
+    private:
+        size_t* m_outstanding;
+        Histogram* m_runTime;
+        Handler m_handler;
 };
 
+template <typename Handler>
+inline
+auto Connection::track(HandlerType type, Handler handler)
+{
+    ++m_outstanding;
+    Histogram* runTime = nullptr;
+    if (m_handlerMetrics) {
+        runTime = &m_handlerMetrics->runTime[static_cast<size_t>(type)];
+        ++Metrics::instance().loop().pendingHandlers;
+    }
+    return Tracked<Handler>(m_outstanding, runTime, std::move(handler));
+}
+
 template <typename ConstBufferSequence>
 inline
 void Connection::send(const ConstBufferSequence& buffers)
 {
     if (m_timeout)
-        m_timeouter.expires_from_now(std::chrono::seconds(m_timeout));
+        setDeadline(Clock::now() + timeoutPeriod());
 
+    m_writingData = true;
     async_write(
         m_socket,
         buffers,
         boost::asio::transfer_all(),
-        std::bind(&Connection::handleWriteData, this, std::placeholders::_1)
+        track(HandlerType::WriteData, std::bind(&Connection::handleWriteData, this, std::placeholders::_1))
     );
 }
 
@@ -0,0 +1,229 @@
+#include "control_server.h"
+
+#include "error.h"
+#include "logger.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <memory>
+#include <cerrno>
+#include <cstring>
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::ControlServer;
+
+namespace pls = std::placeholders;
+namespace bs = boost::system;
+namespace ba = boost::asio;
+
+namespace
+{
+
+const size_t maxLineSize = 4096;
+
+}
+
+class ControlServer::Session : public std::enable_shared_from_this<Session>
+{
+    public:
+        Session(protocol::socket s, ControlServer& server)
+            : m_socket(std::move(s)),
+              m_input(maxLineSize),
+              m_server(server)
+        {
+        }
+
+        void read()
+        {
+            ba::async_read_until(m_socket, m_input, "\n",
+                                 std::bind(&Session::handleRead, shared_from_this(), pls::_1));
+        }
+
+    private:
+        protocol::socket m_socket;
+        ba::streambuf m_input;
+        std::string m_output;
+        ControlServer& m_server;
+
+        void handleRead(const bs::error_code& error)
+        {
+            if (error)
+                return;
+            std::istream stream(&m_input);
+            std::string line;
+            std::getline(stream, line);
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line == "handover") {
+                ERRLOG(logInfo) << "Handing the relays over";
+                m_server.m_manager.handOver(std::bind(&Session::handOver, shared_from_this(), pls::_1));
+                return;
+            }
+            m_output = m_server.execute(line);
+            ba::async_write(m_socket, ba::buffer(m_output),
+                            [self = shared_from_this()](const bs::error_code& ec, size_t /*size*/)
+                            {
+                                if (!ec)
+                                    self->read();
+                            });
+        }
+
+        void handOver(Handover::RelayStates& states)
+        {
+            // A few lines, written right away with their sockets.
+            bs::error_code ec;
+            m_socket.native_non_blocking(false, ec);
+            try
+            {
+                for (const auto& kv : states)
+                    Handover::send(m_socket.native_handle(), kv.first, kv.second);
+                m_output = "OK\n";
+            }
+            catch (const CasterError& e)
+            {
+                ERRLOG(logError) << e.what();
+                m_output = std::string("ERROR ") + e.what() + "\n";
+            }
+            // The new process holds the sockets now.
+            Handover::close(states);
+            m_server.release();
+            ba::async_write(m_socket, ba::buffer(m_output),
+                            [self = shared_from_this()](const bs::error_code& /*ec*/, size_t /*size*/)
+                            {
+                                if (self->m_server.m_handoverCallback)
+                                    self->m_server.m_handoverCallback();
+                            });
+        }
+};
+
+ControlServer::ControlServer(ba::io_service& ioService,
+                             const std::string& path, RelayManager& manager)
+    : m_ioService(ioService),
+      m_path(path),
+      m_manager(manager),
+      m_acceptor(ioService),
+      m_socket(ioService),
+      m_device(0),
+      m_inode(0)
+{
+}
+
+ControlServer::~ControlServer()
+{
+    stop();
+}
+
+void ControlServer::start()
+{
+    // A socket file left by a previous run blocks the bind, anything else
+    // at the path is not ours to delete.
+    struct stat st;
+    if (::lstat(m_path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode))
+            throw CasterError("Control socket path " + m_path + " exists and is not a socket");
+        if (::unlink(m_path.c_str()) != 0)
+            throw CasterError("Failed to remove control socket " + m_path + ": " + std::strerror(errno));
+    }
+    bs::error_code ec;
+    m_acceptor.open(protocol(), ec);
+    if (!ec)
+        m_acceptor.bind(protocol::endpoint(m_path), ec);
+    // Anyone who can connect controls the relays. Nobody can connect before
+    // the listen, so the mode is set in between.
+    if (!ec && ::chmod(m_path.c_str(), S_IRUSR | S_IWUSR) != 0)
+        ec = bs::error_code(errno, bs::system_category());
+    if (!ec && ::lstat(m_path.c_str(), &st) != 0)
+        ec = bs::error_code(errno, bs::system_category());
+    if (!ec)
+        m_acceptor.listen(ba::socket_base::max_connections, ec);
+    if (ec)
+        throw CasterError("Failed to listen on control socket " + m_path + ": " + ec.message());
+    m_device = st.st_dev;
+    m_inode = st.st_ino;
+    ERRLOG(logDebug) << "Control socket " << m_path;
+    accept();
+}
+
+void ControlServer::stop()
+{
+    if (!m_acceptor.is_open())
+        return;
+    bs::error_code ec;
+    m_acceptor.close(ec);
+    struct stat st;
+    if (::lstat(m_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) &&
+        st.st_dev == m_device && st.st_ino == m_inode)
+        ::unlink(m_path.c_str());
+}
+
+void ControlServer::release()
+{
+    // The socket file belongs to the new process, it binds its own.
+    bs::error_code ec;
+    m_acceptor.close(ec);
+}
+
+void ControlServer::accept()
+{
+    m_acceptor.async_accept(m_socket, std::bind(&ControlServer::handleAccept, this, pls::_1));
+}
+
+void ControlServer::handleAccept(const bs::error_code& error)
+{
+    if (error == ba::error::operation_aborted)
+        return;
+    if (error) {
+        ERRLOG(logWarning) << "Failed to accept a control connection: " << error.message();
+    } else {
+        std::make_shared<Session>(std::move(m_socket), *this)->read();
+    }
+    m_socket = protocol::socket(m_ioService);
+    accept();
+}
+
+std::string ControlServer::execute(const std::string& line)
+{
+    ERRLOG(logDebug) << "Control command: " << line;
+    std::istringstream stream(line);
+    std::string command;
+    stream >> command;
+    std::ostringstream reply;
+    try
+    {
+        if (command == "list") {
+            m_manager.list(reply);
+        } else if (command == "add" || command == "modify" || command == "remove") {
+            std::string name;
+            if (!(stream >> name))
+                throw CasterError("Relay name expected");
+            if (command == "remove") {
+                m_manager.remove(name);
+            } else if (command == "add") {
+                RelayConfig config;
+                config.parse(stream);
+                m_manager.add(name, config);
+            } else {
+                RelayConfig config = m_manager.config(name);
+                config.parse(stream);
+                m_manager.modify(name, config);
+            }
+        } else if (command == "reload") {
+            if (!m_reloadCallback)
+                throw CasterError("No config file to reload");
+            m_reloadCallback();
+        } else if (!command.empty()) {
+            throw CasterError("Unknown command " + command);
+        }
+        reply << "OK\n";
+    }
+    catch (const CasterError& e)
+    {
+        reply.str("");
+        reply << "ERROR " << e.what() << "\n";
+    }
+    return reply.str();
+}
@@ -0,0 +1,76 @@
+#ifndef __CASTER_CONTROL_SERVER_H__
+#define __CASTER_CONTROL_SERVER_H__
+
+#include "relay_manager.h"
+
+#include <boost/asio.hpp>
+
+#include <sys/types.h>
+
+#include <string>
+#include <functional>
+
+namespace Caster {
+
+// Line protocol on a Unix domain socket to change relays at runtime:
+//
+//   list
+//   add <name> key=value ...
+//   modify <name> key=value ...   (only the given keys change)
+//   remove <name>
+//   reload                        (re-reads the config file)
+//   handover                      (see below)
+//
+// Every reply ends with an "OK" or "ERROR <message>" line.
+//
+// "handover" is sent by a new process on upgrade: the relays are handed
+// over with their sockets, see Handover::send, the socket file is left to
+// the new process and the handover callback is called after the reply.
+//
+// The socket file is readable and writable by the owner only. A socket
+// left by a previous run is replaced, any other file at the path is an
+// error; at stop the file is removed only if it is still the one bound here.
+class ControlServer
+{
+    public:
+        using ReloadCallback = std::function<void ()>;
+        using HandoverCallback = std::function<void ()>;
+
+        ControlServer(boost::asio::io_service& ioService,
+                      const std::string& path, RelayManager& manager);
+        ~ControlServer();
+
+        ControlServer(const ControlServer&) = delete;
+        ControlServer& operator=(const ControlServer&) = delete;
+
+        // Throws CasterError on failure, like the command.
+        void setReloadCallback(const ReloadCallback& cb) { m_reloadCallback = cb; }
+        // The relays are gone, the process is expected to exit.
+        void setHandoverCallback(const HandoverCallback& cb) { m_handoverCallback = cb; }
+
+        void start();
+        void stop();
+
+    private:
+        class Session;
+        using protocol = boost::asio::local::stream_protocol;
+
+        boost::asio::io_service& m_ioService;
+        std::string m_path;
+        RelayManager& m_manager;
+        ReloadCallback m_reloadCallback;
+        HandoverCallback m_handoverCallback;
+        protocol::acceptor m_acceptor;
+        protocol::socket m_socket;
+        dev_t m_device;
+        ino_t m_inode;
+
+        void accept();
+        void handleAccept(const boost::system::error_code& error);
+        std::string execute(const std::string& line);
+        void release();
+};
+
+}
+
+#endif
@@ -0,0 +1,112 @@
+#include "datagram.h"
+
+#include <algorithm>
+#include <cerrno>
+
+using Caster::DatagramBatch;
+using Caster::DatagramReceiver;
+
+namespace bs = boost::system;
+
+DatagramBatch::DatagramBatch(size_t headerSize, size_t maxPayload, size_t capacity)
+    : m_headerSize(headerSize),
+      m_slotSize(headerSize + maxPayload),
+      m_storage(m_slotSize * capacity),
+      m_sizes(capacity, 0),
+      m_messages(capacity),
+      m_iovecs(capacity),
+      m_first(0),
+      m_count(0),
+      m_sealed(0)
+{
+}
+
+bool DatagramBatch::append(const uint8_t* data, size_t size)
+{
+    const size_t maxPayload = m_slotSize - m_headerSize;
+    if (size > maxPayload)
+        return false;
+    if (m_count > m_sealed && m_sizes[slot(m_count - 1)] + size <= maxPayload) {
+        size_t& used = m_sizes[slot(m_count - 1)];
+        std::copy(data, data + size, header(m_count - 1) + m_headerSize + used);
+        used += size;
+        return true;
+    }
+    if (m_count == m_sizes.size())
+        return false;
+    std::copy(data, data + size, header(m_count) + m_headerSize);
+    m_sizes[slot(m_count)] = size;
+    ++m_count;
+    return true;
+}
+
+bs::error_code DatagramBatch::send(int fd)
+{
+    while (m_sealed > 0) {
+        // Slots wrap around, a call covers the contiguous part.
+        const size_t count = std::min(m_sealed, m_sizes.size() - m_first);
+        for (size_t i = 0; i < count; ++i) {
+            m_iovecs[i].iov_base = header(i);
+            m_iovecs[i].iov_len = m_headerSize + m_sizes[slot(i)];
+            m_messages[i] = mmsghdr();
+            m_messages[i].msg_hdr.msg_iov = &m_iovecs[i];
+            m_messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        const int res = sendmmsg(fd, m_messages.data(), static_cast<unsigned>(count), MSG_DONTWAIT);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return bs::error_code(errno, bs::system_category());
+        }
+        const size_t sent = static_cast<size_t>(res);
+        m_first = (m_first + sent) % m_sizes.size();
+        m_count -= sent;
+        m_sealed -= sent;
+    }
+    return bs::error_code();
+}
+
+void DatagramBatch::clear() noexcept
+{
+    m_first = 0;
+    m_count = 0;
+    m_sealed = 0;
+}
+
+DatagramReceiver::DatagramReceiver(size_t maxSize, size_t capacity)
+    : m_maxSize(maxSize),
+      m_storage(maxSize * capacity),
+      m_messages(capacity),
+      m_iovecs(capacity)
+{
+}
+
+size_t DatagramReceiver::receive(int fd, bs::error_code& ec)
+{
+    for (size_t i = 0; i < m_messages.size(); ++i) {
+        m_iovecs[i].iov_base = m_storage.data() + i * m_maxSize;
+        m_iovecs[i].iov_len = m_maxSize;
+        m_messages[i] = mmsghdr();
+        m_messages[i].msg_hdr.msg_iov = &m_iovecs[i];
+        m_messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (;;) {
+        const int res = recvmmsg(fd, m_messages.data(), static_cast<unsigned>(m_messages.size()), MSG_DONTWAIT, nullptr);
+        if (res >= 0) {
+            ec = bs::error_code();
+            return static_cast<size_t>(res);
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN)
+            ec = bs::error_code();
+        else
+            ec = bs::error_code(errno, bs::system_category());
+        return 0;
+    }
+}
+
+size_t DatagramReceiver::size(size_t i) const noexcept
+{
+    return m_messages[i].msg_len;
+}
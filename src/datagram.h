@@ -0,0 +1,84 @@
+#ifndef __CASTER_DATAGRAM_H__
+#define __CASTER_DATAGRAM_H__
+
+#include <boost/system/error_code.hpp>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace Caster {
+
+// Datagrams waiting for one sendmmsg call. Frames are packed into
+// datagrams of up to maxPayload bytes, each datagram starts with a header
+// of a fixed size that is filled in before it is sent. Storage is
+// allocated once.
+class DatagramBatch
+{
+    public:
+        DatagramBatch(size_t headerSize, size_t maxPayload, size_t capacity);
+
+        // Appends data to the last datagram if it has room, to a new one
+        // otherwise. Fails when the batch is full.
+        bool append(const uint8_t* data, size_t size);
+        // Calls fill(header, payload, size) for every datagram that has no
+        // header yet, they are closed for appending after that.
+        template <typename F>
+        void seal(F&& fill);
+        // Sends sealed datagrams until the socket would block, which is
+        // reported as would_block with datagrams left.
+        boost::system::error_code send(int fd);
+
+        bool empty() const noexcept { return m_count == 0; }
+        size_t size() const noexcept { return m_count; }
+        void clear() noexcept;
+
+    private:
+        size_t m_headerSize;
+        size_t m_slotSize;
+        std::vector<uint8_t> m_storage;
+        std::vector<size_t> m_sizes; // payload sizes
+        std::vector<mmsghdr> m_messages;
+        std::vector<iovec> m_iovecs;
+        size_t m_first;
+        size_t m_count;
+        size_t m_sealed;
+
+        size_t slot(size_t i) const noexcept { return (m_first + i) % m_sizes.size(); }
+        uint8_t* header(size_t i) noexcept { return m_storage.data() + slot(i) * m_slotSize; }
+};
+
+template <typename F>
+inline
+void DatagramBatch::seal(F&& fill)
+{
+    for (; m_sealed < m_count; ++m_sealed)
+        fill(header(m_sealed), header(m_sealed) + m_headerSize, m_sizes[slot(m_sealed)]);
+}
+
+// Receives up to capacity datagrams with one recvmmsg call.
+class DatagramReceiver
+{
+    public:
+        DatagramReceiver(size_t maxSize, size_t capacity);
+
+        // Number of datagrams received without blocking, zero with
+        // nothing waiting.
+        size_t receive(int fd, boost::system::error_code& ec);
+
+        const uint8_t* data(size_t i) const noexcept { return m_storage.data() + i * m_maxSize; }
+        size_t size(size_t i) const noexcept;
+
+    private:
+        size_t m_maxSize;
+        std::vector<uint8_t> m_storage;
+        std::vector<mmsghdr> m_messages;
+        std::vector<iovec> m_iovecs;
+};
+
+}
+
+#endif
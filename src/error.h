@@ -12,7 +12,9 @@ enum {
     resolveError,
     invalidStatus,
     connectionTimeout,
-    invalidChunkLength
+    invalidChunkLength,
+    authenticationError,
+    responseTooLarge
 };
 
 struct CasterError : std::runtime_error {
@@ -36,6 +38,10 @@ class CasterCategory : public boost::system::error_category
                     return "Connection timeout";
                 case invalidChunkLength:
                     return "Invalid chunk length";
+                case authenticationError:
+                    return "Authentication failed";
+                case responseTooLarge:
+                    return "Response too large";
                 default:
                     return "Unknown error";
             };
@@ -0,0 +1,178 @@
+#include "file_source.h"
+
+#include "error.h"
+#include "logger.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <functional> // std::bind
+#include <cstring>
+#include <cerrno>
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::FileSource;
+
+namespace pls = std::placeholders;
+namespace bs = boost::system;
+namespace ba = boost::asio;
+
+FileSource::FileSource(ba::io_service& ioService, const std::string& path)
+    : m_ioService(ioService),
+      m_path(path),
+      m_timeout(0),
+      m_running(false),
+      m_file(-1),
+      m_stream(ioService),
+      m_timer(ioService),
+      m_buffer(),
+      m_outstanding(0)
+{
+}
+
+void FileSource::start(unsigned timeout)
+{
+    m_timeout = timeout;
+    m_running = true;
+
+    struct stat st;
+    if (stat(m_path.c_str(), &st) < 0) {
+        postFailure(bs::error_code(errno, bs::system_category()));
+        return;
+    }
+    const bool isFifo = S_ISFIFO(st.st_mode);
+    const bool isRegular = S_ISREG(st.st_mode);
+    const int flags = (isFifo ? O_RDWR : O_RDONLY) | O_NOCTTY | O_CLOEXEC | (isRegular ? 0 : O_NONBLOCK);
+    const int fd = ::open(m_path.c_str(), flags);
+    if (fd < 0) {
+        postFailure(bs::error_code(errno, bs::system_category()));
+        return;
+    }
+    ERRLOG(logInfo) << "Reading RTCM stream from " << m_path;
+
+    if (isRegular) {
+        // Epoll does not take regular files.
+        m_file = fd;
+        m_ioService.post(track(std::bind(&FileSource::readFile, this)));
+        return;
+    }
+    bs::error_code ec;
+    m_stream.assign(fd, ec);
+    if (ec) {
+        ::close(fd);
+        postFailure(ec);
+        return;
+    }
+    restartTimer();
+    read();
+}
+
+void FileSource::stop()
+{
+    m_running = false;
+    bs::error_code ec;
+    m_timer.cancel(ec);
+    close();
+}
+
+void FileSource::readFile()
+{
+    if (!m_running)
+        return;
+    const ssize_t res = ::read(m_file, m_buffer.data(), m_buffer.size());
+    if (res < 0) {
+        if (errno == EINTR) {
+            m_ioService.post(track(std::bind(&FileSource::readFile, this)));
+            return;
+        }
+        finish(bs::error_code(errno, bs::system_category()));
+        return;
+    }
+    if (res == 0) {
+        finish(ba::error::eof);
+        return;
+    }
+    if (m_dataCallback)
+        m_dataCallback(ba::const_buffers_1(m_buffer.data(), static_cast<size_t>(res)));
+    // Other handlers run between chunks.
+    if (m_running)
+        m_ioService.post(track(std::bind(&FileSource::readFile, this)));
+}
+
+void FileSource::read()
+{
+    m_stream.async_read_some(ba::buffer(m_buffer),
+                             track(std::bind(&FileSource::handleRead, this, pls::_1, pls::_2)));
+}
+
+void FileSource::handleRead(const bs::error_code& ec, size_t size)
+{
+    if (!m_running)
+        return;
+    if (size > 0) {
+        restartTimer();
+        if (m_dataCallback)
+            m_dataCallback(ba::const_buffers_1(m_buffer.data(), size));
+        // The relay may stop the source from the callback.
+        if (!m_running)
+            return;
+    }
+    if (ec) {
+        finish(ec);
+        return;
+    }
+    read();
+}
+
+void FileSource::restartTimer()
+{
+    if (m_timeout == 0)
+        return;
+    m_timer.expires_from_now(std::chrono::seconds(m_timeout));
+    m_timer.async_wait(track(std::bind(&FileSource::handleTimeout, this, pls::_1)));
+}
+
+void FileSource::handleTimeout(const bs::error_code& ec)
+{
+    if (ec || !m_running)
+        return;
+    if (m_timer.expires_at() > std::chrono::steady_clock::now())
+        return;
+    finish(bs::error_code(connectionTimeout, CasterCategory::getInstance()));
+}
+
+void FileSource::close()
+{
+    bs::error_code ec;
+    m_stream.close(ec);
+    if (m_file >= 0) {
+        ::close(m_file);
+        m_file = -1;
+    }
+}
+
+void FileSource::postFailure(const bs::error_code& ec)
+{
+    // Not from within start(), the relay is not done starting yet.
+    m_ioService.post(track([this, ec]()
+                           {
+                               if (m_running)
+                                   finish(ec);
+                           }));
+}
+
+void FileSource::finish(const bs::error_code& ec)
+{
+    stop();
+    if (ec == ba::error::eof) {
+        if (m_eofCallback)
+            m_eofCallback();
+        return;
+    }
+    ERRLOG(logError) << "Failed to read " << m_path << ": " << ec.message();
+    if (m_errorCallback)
+        m_errorCallback(ec);
+}
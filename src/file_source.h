@@ -0,0 +1,74 @@
+#ifndef __CASTER_FILE_SOURCE_H__
+#define __CASTER_FILE_SOURCE_H__
+
+#include "source.h"
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <string>
+#include <utility>
+#include <cstdint>
+
+namespace Caster {
+
+// Reads RTCM 3 from a local file, a FIFO or a character device such as a
+// serial port configured beforehand. A regular file is read to its end
+// without pacing, a chunk per handler, see ReplaySource for timed replays.
+// A FIFO is kept open for writing too, so writers may come and go without
+// ending the stream.
+class FileSource : public Source
+{
+    public:
+        FileSource(boost::asio::io_service& ioService, const std::string& path);
+
+        void start(unsigned timeout) override;
+        void stop() override;
+        bool isIdle() const override { return m_outstanding == 0; }
+
+        void setErrorCallback(const ErrorCallback& cb) override { m_errorCallback = cb; }
+        void setDataCallback(const DataCallback& cb) override { m_dataCallback = cb; }
+        void setEOFCallback(const EOFCallback& cb) override { m_eofCallback = cb; }
+
+    private:
+        boost::asio::io_service& m_ioService;
+        std::string m_path;
+        unsigned m_timeout;
+        bool m_running;
+        int m_file; // regular file, read synchronously
+        boost::asio::posix::stream_descriptor m_stream;
+        boost::asio::steady_timer m_timer;
+        std::array<uint8_t, 4096> m_buffer;
+        size_t m_outstanding;
+        ErrorCallback m_errorCallback;
+        DataCallback m_dataCallback;
+        EOFCallback m_eofCallback;
+
+        template <typename Handler>
+        auto track(Handler handler);
+
+        void readFile();
+        void read();
+        void handleRead(const boost::system::error_code& ec, size_t size);
+        void restartTimer();
+        void handleTimeout(const boost::system::error_code& ec);
+        void close();
+        void postFailure(const boost::system::error_code& ec);
+        void finish(const boost::system::error_code& ec);
+};
+
+template <typename Handler>
+inline
+auto FileSource::track(Handler handler)
+{
+    ++m_outstanding;
+    return [this, handler](auto&&... args) mutable
+           {
+               --m_outstanding;
+               handler(std::forward<decltype(args)>(args)...);
+           };
+}
+
+}
+
+#endif
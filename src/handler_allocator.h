@@ -0,0 +1,90 @@
+#ifndef __CASTER_HANDLER_ALLOCATOR_H__
+#define __CASTER_HANDLER_ALLOCATOR_H__
+
+#include <array>
+#include <new>
+#include <cstddef>
+
+namespace Caster {
+
+// Memory of pending asynchronous operations. Asio keeps only two freed
+// operations per thread, while a relay has a read, a write and a few timers
+// in flight at any time; the rest would go through the heap on every
+// completion. Freed blocks are kept per size class instead, their number is
+// bounded by the most operations that were ever in flight at once.
+class HandlerMemory {
+    public:
+        static void* allocate(size_t size)
+        {
+            const size_t index = sizeClass(size);
+            if (index >= classCount)
+                return ::operator new(size);
+            Block*& head = freeList()[index];
+            if (!head)
+                return ::operator new((index + 1) * granularity);
+            Block* res = head;
+            head = head->next;
+            return res;
+        }
+
+        static void deallocate(void* pointer, size_t size) noexcept
+        {
+            const size_t index = sizeClass(size);
+            if (index >= classCount) {
+                ::operator delete(pointer);
+                return;
+            }
+            Block*& head = freeList()[index];
+            head = new (pointer) Block{head};
+        }
+
+    private:
+        static constexpr size_t granularity = 64;
+        static constexpr size_t classCount = 16;
+
+        struct Block {
+            Block* next;
+        };
+
+        static size_t sizeClass(size_t size) noexcept
+        {
+            return size == 0 ? 0 : (size - 1) / granularity;
+        }
+
+        // The resolver completes on its own thread, so a block may change
+        // threads; it is plain heap memory either way.
+        static std::array<Block*, classCount>& freeList() noexcept
+        {
+            thread_local std::array<Block*, classCount> lists{};
+            return lists;
+        }
+};
+
+template <typename T>
+class HandlerAllocator {
+    public:
+        using value_type = T;
+
+        HandlerAllocator() noexcept = default;
+        template <typename U>
+        HandlerAllocator(const HandlerAllocator<U>&) noexcept {}
+
+        T* allocate(size_t n)
+        {
+            return static_cast<T*>(HandlerMemory::allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T* pointer, size_t n) noexcept
+        {
+            HandlerMemory::deallocate(pointer, n * sizeof(T));
+        }
+
+        template <typename U>
+        bool operator==(const HandlerAllocator<U>&) const noexcept { return true; }
+        template <typename U>
+        bool operator!=(const HandlerAllocator<U>&) const noexcept { return false; }
+};
+
+}
+
+#endif
@@ -0,0 +1,242 @@
+#include "handover.h"
+
+#include "base64.h"
+#include "error.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <deque>
+#include <sstream>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+
+using Caster::CasterError;
+using namespace Caster::Handover;
+
+namespace
+{
+
+const size_t maxFds = 16;
+const int receiveTimeout = 30; // seconds
+
+std::string encode(const std::string& data)
+{
+    if (data.empty())
+        return "-";
+    return base64_encode(reinterpret_cast<const unsigned char*>(data.data()),
+                         static_cast<unsigned>(data.size()));
+}
+
+std::string decode(const std::string& text)
+{
+    return text == "-" ? "" : base64_decode(text);
+}
+
+// status,chunked,chunkState,chunkLeft,input,pending
+std::string encode(const ConnectionState& state)
+{
+    std::ostringstream stream;
+    stream << state.status << "," << state.chunked << "," << state.chunkState << ","
+           << state.chunkLeft << "," << encode(state.input) << "," << encode(state.pending);
+    return stream.str();
+}
+
+bool decode(const std::string& text, ConnectionState& state)
+{
+    std::istringstream stream(text);
+    std::vector<std::string> fields;
+    std::string field;
+    while (std::getline(stream, field, ','))
+        fields.push_back(field);
+    if (fields.size() != 6)
+        return false;
+    try
+    {
+        state.status = static_cast<unsigned>(std::stoul(fields[0]));
+        state.chunked = fields[1] == "1";
+        state.chunkState = static_cast<unsigned>(std::stoul(fields[2]));
+        state.chunkLeft = std::stoul(fields[3]);
+    }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+    state.input = decode(fields[4]);
+    state.pending = decode(fields[5]);
+    return true;
+}
+
+std::string errorText()
+{
+    return std::strerror(errno);
+}
+
+}
+
+void Caster::Handover::send(int socket, const std::string& name, const RelayState& state)
+{
+    const std::string line = "relay " + name +
+                             " source=" + encode(state.source) +
+                             " sink=" + encode(state.sink) +
+                             " framer=" + encode(state.framer) +
+                             " config=" + encode(state.config) + "\n";
+    const int fds[2] = {state.sourceFd, state.sinkFd};
+    union {
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        cmsghdr align;
+    } control;
+    std::memset(&control, 0, sizeof(control));
+
+    iovec iov;
+    iov.iov_base = const_cast<char*>(line.data());
+    iov.iov_len = line.size();
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    // The sockets go with the first byte, the rest of the line may follow
+    // in further writes.
+    ssize_t res = ::sendmsg(socket, &message, MSG_NOSIGNAL);
+    size_t sent = res > 0 ? static_cast<size_t>(res) : 0;
+    while (res >= 0 && sent < line.size()) {
+        res = ::send(socket, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+        if (res > 0)
+            sent += static_cast<size_t>(res);
+    }
+    if (res < 0)
+        throw CasterError("Failed to hand relay " + name + " over: " + errorText());
+}
+
+RelayStates Caster::Handover::receive(const std::string& path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        throw CasterError("Control socket path is too long: " + path);
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw CasterError("Failed to create a socket: " + errorText());
+    RelayStates res;
+    std::deque<int> fds;
+    try
+    {
+        if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+            throw CasterError("Failed to connect to " + path + ": " + errorText());
+        const timeval timeout = {receiveTimeout, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        const std::string request = "handover\n";
+        if (::send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+            throw CasterError("Failed to request a handover: " + errorText());
+
+        std::string input;
+        for (;;) {
+            char buffer[4096];
+            union {
+                char buffer[CMSG_SPACE(sizeof(int) * maxFds)];
+                cmsghdr align;
+            } control;
+            iovec iov;
+            iov.iov_base = buffer;
+            iov.iov_len = sizeof(buffer);
+            msghdr message;
+            std::memset(&message, 0, sizeof(message));
+            message.msg_iov = &iov;
+            message.msg_iovlen = 1;
+            message.msg_control = control.buffer;
+            message.msg_controllen = sizeof(control.buffer);
+            const ssize_t size = ::recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+            if (size < 0)
+                throw CasterError("Failed to receive the handover: " + errorText());
+            if (size == 0)
+                throw CasterError("Handover ended without an answer");
+            for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+                if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+                    continue;
+                const size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (size_t i = 0; i < count; ++i) {
+                    int received = -1;
+                    std::memcpy(&received, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+                    fds.push_back(received);
+                }
+            }
+            input.append(buffer, static_cast<size_t>(size));
+
+            size_t end = 0;
+            while ((end = input.find('\n')) != std::string::npos) {
+                const std::string line = input.substr(0, end);
+                input.erase(0, end + 1);
+                if (line == "OK") {
+                    ::close(fd);
+                    return res;
+                }
+                if (line.compare(0, 6, "ERROR ") == 0)
+                    throw CasterError("Handover refused: " + line.substr(6));
+
+                std::istringstream stream(line);
+                std::string word;
+                std::string name;
+                stream >> word >> name;
+                if (word != "relay" || fds.size() < 2)
+                    throw CasterError("Unexpected handover line: " + line);
+                RelayState& state = res[name];
+                state.sourceFd = fds[0];
+                state.sinkFd = fds[1];
+                fds.erase(fds.begin(), fds.begin() + 2);
+                while (stream >> word) {
+                    const size_t pos = word.find('=');
+                    const std::string key = word.substr(0, pos);
+                    const std::string value = pos == std::string::npos ? "" : word.substr(pos + 1);
+                    bool valid = true;
+                    if (key == "source")
+                        valid = decode(value, state.source);
+                    else if (key == "sink")
+                        valid = decode(value, state.sink);
+                    else if (key == "framer")
+                        state.framer = decode(value);
+                    else if (key == "config")
+                        state.config = decode(value);
+                    if (!valid)
+                        throw CasterError("Invalid handover state of relay " + name);
+                }
+            }
+        }
+    }
+    catch (const CasterError&)
+    {
+        ::close(fd);
+        for (int received : fds)
+            ::close(received);
+        close(res);
+        throw;
+    }
+}
+
+void Caster::Handover::close(RelayState& state)
+{
+    if (state.sourceFd >= 0)
+        ::close(state.sourceFd);
+    if (state.sinkFd >= 0)
+        ::close(state.sinkFd);
+    state.sourceFd = -1;
+    state.sinkFd = -1;
+}
+
+void Caster::Handover::close(RelayStates& states)
+{
+    for (auto& kv : states)
+        close(kv.second);
+}
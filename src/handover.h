@@ -0,0 +1,48 @@
+#ifndef __CASTER_HANDOVER_H__
+#define __CASTER_HANDOVER_H__
+
+#include <map>
+#include <string>
+#include <cstddef>
+
+namespace Caster {
+namespace Handover {
+
+// Where a suspended NTRIP connection stopped, enough for another process to
+// go on with its socket without a new handshake.
+struct ConnectionState {
+    unsigned status = 0;
+    bool chunked = false;
+    unsigned chunkState = 0; // ChunkDecoder::State
+    size_t chunkLeft = 0; // chunk size read so far, or data bytes still to come
+    std::string input; // read from the socket but not consumed yet
+    std::string pending; // frames queued for writing
+};
+
+struct RelayState {
+    std::string config; // RelayConfig text with passwords
+    std::string framer; // incomplete frame of the source stream
+    ConnectionState source;
+    ConnectionState sink;
+    int sourceFd = -1;
+    int sinkFd = -1;
+};
+
+using RelayStates = std::map<std::string, RelayState>;
+
+// Writes one relay to a Unix domain socket as a line, its sockets go along
+// as SCM_RIGHTS. Throws CasterError.
+void send(int socket, const std::string& name, const RelayState& state);
+
+// Asks the process with the given control socket to hand its relays over
+// and receives them, until it answers OK. Throws CasterError.
+RelayStates receive(const std::string& path);
+
+// Closes the sockets of relays that were not taken over.
+void close(RelayState& state);
+void close(RelayStates& states);
+
+}
+}
+
+#endif
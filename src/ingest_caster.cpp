@@ -0,0 +1,447 @@
+#include "ingest_caster.h"
+
+#include "base64.h"
+#include "chunk_decoder.h"
+#include "logger.h"
+#include "version.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <sstream>
+#include <functional> // std::bind
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::IngestCaster;
+using Caster::IngestSource;
+
+namespace pls = std::placeholders;
+namespace bs = boost::system;
+namespace ba = boost::asio;
+
+namespace
+{
+
+const size_t maxRequestSize = 4096;
+const auto requestTimeout = std::chrono::seconds(10);
+const auto sweepInterval = std::chrono::seconds(1);
+
+std::string trim(const std::string& value)
+{
+    const size_t lpos = value.find_first_not_of(" \t");
+    if (lpos == std::string::npos)
+        return "";
+    const size_t rpos = value.find_last_not_of(" \t\r\n");
+    return value.substr(lpos, rpos - lpos + 1);
+}
+
+}
+
+// One base station connection: reads the request, then the upload, chunked
+// or not, and passes the data on to the sources of its mountpoint.
+class IngestCaster::Session : public std::enable_shared_from_this<Session>
+{
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        Session(const IngestCasterPtr& caster, tcp::socket s)
+            : socket(std::move(s)),
+              lastActive(Clock::now()),
+              m_caster(caster),
+              m_mountpoint(nullptr),
+              m_state(State::Request)
+        {
+        }
+
+        void start()
+        {
+            bs::error_code ec;
+            socket.non_blocking(true, ec);
+            socket.set_option(ba::socket_base::keep_alive(true), ec);
+            wait();
+        }
+
+        // A pending wait still holds the session, it goes away with it.
+        void close()
+        {
+            m_mountpoint = nullptr;
+            bs::error_code ec;
+            socket.shutdown(tcp::socket::shutdown_both, ec);
+            socket.close(ec);
+        }
+
+        bool isUploading() const { return m_state != State::Request; }
+
+        tcp::socket socket;
+        Clock::time_point lastActive;
+
+    private:
+        enum class State : uint8_t {
+            Request,
+            Raw,
+            Chunked
+        };
+
+        IngestCasterPtr m_caster;
+        Mountpoint* m_mountpoint;
+        std::string m_name;
+        std::string m_request; // until it is complete
+        ChunkDecoder m_decoder;
+        State m_state;
+
+        void wait()
+        {
+            socket.async_wait(tcp::socket::wait_read,
+                              std::bind(&Session::handleReady, shared_from_this(), pls::_1));
+        }
+
+        void handleReady(const bs::error_code& error)
+        {
+            if (error || !socket.is_open())
+                return;
+            // Readiness is reported once per arrival, everything there is
+            // has to be read now.
+            for (;;) {
+                bs::error_code ec;
+                const size_t size = socket.read_some(ba::buffer(m_caster->m_buffer), ec);
+                if (ec == ba::error::would_block)
+                    break;
+                if (ec) {
+                    if (isUploading()) {
+                        ERRLOG(logInfo) << "Upload to " << m_name << " ended: " << ec.message();
+                    }
+                    close();
+                    return;
+                }
+                lastActive = Clock::now();
+                if (!consume(m_caster->m_buffer.data(), size))
+                    return;
+            }
+            wait();
+        }
+
+        // False once the session is closed.
+        bool consume(const uint8_t* data, size_t size)
+        {
+            if (m_state != State::Request)
+                return feed(data, size);
+
+            m_request.append(reinterpret_cast<const char*>(data), size);
+            const size_t end = m_request.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                if (m_request.size() <= maxRequestSize)
+                    return true;
+                close();
+                return false;
+            }
+            const std::string rest = m_request.substr(end + 4);
+            m_request.resize(end + 2);
+            if (!handleRequest())
+                return false;
+            std::string().swap(m_request);
+            return rest.empty() ||
+                   feed(reinterpret_cast<const uint8_t*>(rest.data()), rest.size());
+        }
+
+        bool handleRequest()
+        {
+            std::istringstream stream(m_request);
+            std::string line;
+            std::getline(stream, line);
+            std::istringstream requestLine(line);
+            std::string method;
+            std::string first;
+            std::string second;
+            requestLine >> method >> first >> second;
+
+            // NTRIP 1.0: SOURCE <password> /<mountpoint>, NTRIP 2.0: POST
+            // /<mountpoint> HTTP/1.1 with Basic authorization.
+            const bool isSource = method == "SOURCE";
+            std::string login;
+            std::string password;
+            bool chunked = false;
+            if (isSource) {
+                password = first;
+                m_name = second;
+            } else if (method == "POST") {
+                m_name = first;
+                while (std::getline(stream, line) && line != "\r") {
+                    const size_t pos = line.find(':');
+                    if (pos == std::string::npos)
+                        continue;
+                    const std::string key = trim(line.substr(0, pos));
+                    const std::string value = trim(line.substr(pos + 1));
+                    if (key == "Transfer-Encoding") {
+                        chunked = value == "chunked";
+                    } else if (key == "Authorization" && value.compare(0, 6, "Basic ") == 0) {
+                        const std::string credentials = base64_decode(value.substr(6));
+                        const size_t colon = credentials.find(':');
+                        login = credentials.substr(0, colon);
+                        if (colon != std::string::npos)
+                            password = credentials.substr(colon + 1);
+                    }
+                }
+            } else {
+                ERRLOG(logWarning) << "Unsupported upload request from " << remote() << ": " << trim(line);
+                respond("HTTP/1.1 405 Method Not Allowed\r\nConnection: close\r\n\r\n", false);
+                return false;
+            }
+            if (!m_name.empty() && m_name[0] == '/')
+                m_name.erase(0, 1);
+
+            Mountpoint* mountpoint = m_caster->find(m_name);
+            if (!mountpoint) {
+                ERRLOG(logWarning) << "Upload to unknown mountpoint " << m_name << " from " << remote();
+                respond(isSource ? "ERROR - Bad Mountpoint\r\n" :
+                                   "HTTP/1.1 404 Not Found\r\nNtrip-Version: Ntrip/2.0\r\nConnection: close\r\n\r\n",
+                        false);
+                return false;
+            }
+            if (!m_caster->authorize(*mountpoint, login, password, !isSource)) {
+                ERRLOG(logWarning) << "Upload to " << m_name << " from " << remote() << " is not authorized";
+                respond(isSource ? "ERROR - Bad Password\r\n" :
+                                   "HTTP/1.1 401 Unauthorized\r\nNtrip-Version: Ntrip/2.0\r\n"
+                                   "WWW-Authenticate: Basic realm=\"/" + m_name + "\"\r\n"
+                                   "Connection: close\r\n\r\n",
+                        false);
+                return false;
+            }
+
+            // A base station that reconnects may find its old connection
+            // still open.
+            const auto current = mountpoint->upload.lock();
+            if (current) {
+                ERRLOG(logInfo) << "New upload to " << m_name << " replaces the current one";
+                current->close();
+            }
+            mountpoint->upload = shared_from_this();
+            m_mountpoint = mountpoint;
+            m_state = isSource || !chunked ? State::Raw : State::Chunked;
+            ERRLOG(logInfo) << "Upload to " << m_name << " from " << remote();
+
+            std::ostringstream response;
+            if (isSource) {
+                response << "ICY 200 OK\r\n";
+            } else {
+                response << "HTTP/1.1 200 OK\r\n"
+                         << "Ntrip-Version: Ntrip/2.0\r\n"
+                         << "Server: NTRIP Relay " << version << "\r\n"
+                         << "Connection: close\r\n"
+                         << "\r\n";
+            }
+            respond(response.str(), true);
+            return true;
+        }
+
+        // Data is dispatched in place, between the chunk framing.
+        bool feed(const uint8_t* data, size_t size)
+        {
+            if (m_state == State::Raw) {
+                if (m_mountpoint)
+                    m_caster->dispatch(*m_mountpoint, data, size);
+                return socket.is_open();
+            }
+
+            const bool more = m_decoder.feed(data, size, [this](const uint8_t* part, size_t partSize)
+                                             {
+                                                 if (m_mountpoint)
+                                                     m_caster->dispatch(*m_mountpoint, part, partSize);
+                                                 return socket.is_open();
+                                             });
+            if (!more && socket.is_open()) { // Trailers after the last chunk are not read
+                if (m_decoder.state() == ChunkDecoder::State::Finished) {
+                    ERRLOG(logInfo) << "Upload to " << m_name << " finished";
+                }
+                close();
+                return false;
+            }
+            return socket.is_open();
+        }
+
+        void respond(const std::string& text, bool keepOpen)
+        {
+            auto response = std::make_shared<std::string>(text);
+            ba::async_write(socket, ba::buffer(*response),
+                            [self = shared_from_this(), response, keepOpen](const bs::error_code& ec, size_t /*size*/)
+                            {
+                                if (ec || !keepOpen)
+                                    self->close();
+                            });
+        }
+
+        std::string remote() const
+        {
+            bs::error_code ec;
+            const auto endpoint = socket.remote_endpoint(ec);
+            if (ec)
+                return "unknown peer";
+            std::ostringstream stream;
+            stream << endpoint;
+            return stream.str();
+        }
+};
+
+IngestCaster::IngestCaster(ba::io_service& ioService, uint16_t port)
+    : m_ioService(ioService),
+      m_acceptor(ioService),
+      m_socket(ioService),
+      m_timer(ioService),
+      m_timeout(0),
+      m_running(false),
+      m_buffer()
+{
+    const tcp::endpoint endpoint(tcp::v4(), port);
+    m_acceptor.open(endpoint.protocol());
+    m_acceptor.set_option(tcp::acceptor::reuse_address(true));
+    m_acceptor.bind(endpoint);
+    m_acceptor.listen();
+}
+
+IngestCaster::~IngestCaster() = default;
+
+void IngestCaster::start()
+{
+    ERRLOG(logDebug) << "Accepting uploads on " << m_acceptor.local_endpoint();
+    m_running = true;
+    accept();
+    scheduleSweep();
+}
+
+void IngestCaster::stop()
+{
+    m_running = false;
+    bs::error_code ec;
+    m_acceptor.close(ec);
+    m_timer.cancel(ec);
+    for (const auto& weak : m_sessions) {
+        const auto session = weak.lock();
+        if (session)
+            session->close();
+    }
+    m_sessions.clear();
+}
+
+std::unique_ptr<IngestSource> IngestCaster::source(const std::string& mountpoint)
+{
+    return std::unique_ptr<IngestSource>(new IngestSource(shared_from_this(), mountpoint));
+}
+
+void IngestCaster::accept()
+{
+    m_acceptor.async_accept(m_socket, std::bind(&IngestCaster::handleAccept, shared_from_this(), pls::_1));
+}
+
+void IngestCaster::handleAccept(const bs::error_code& error)
+{
+    if (error == ba::error::operation_aborted || !m_running)
+        return;
+    if (error) {
+        ERRLOG(logWarning) << "Failed to accept an upload: " << error.message();
+    } else {
+        auto session = std::make_shared<Session>(shared_from_this(), std::move(m_socket));
+        m_sessions.push_back(session);
+        session->start();
+    }
+    m_socket = tcp::socket(m_ioService);
+    accept();
+}
+
+void IngestCaster::scheduleSweep()
+{
+    m_timer.expires_from_now(sweepInterval);
+    m_timer.async_wait(std::bind(&IngestCaster::handleSweep, shared_from_this(), pls::_1));
+}
+
+void IngestCaster::handleSweep(const bs::error_code& error)
+{
+    if (error || !m_running)
+        return;
+    const auto now = Session::Clock::now();
+    for (size_t i = 0; i < m_sessions.size();) {
+        const auto session = m_sessions[i].lock();
+        bool expired = !session || !session->socket.is_open();
+        if (!expired) {
+            const bool idle = session->isUploading() ?
+                              m_timeout > 0 && now - session->lastActive > std::chrono::seconds(m_timeout) :
+                              now - session->lastActive > requestTimeout;
+            if (idle) {
+                ERRLOG(logInfo) << "Closing an idle upload connection";
+                session->close();
+                expired = true;
+            }
+        }
+        if (!expired) {
+            ++i;
+            continue;
+        }
+        m_sessions[i] = std::move(m_sessions.back());
+        m_sessions.pop_back();
+    }
+    scheduleSweep();
+}
+
+void IngestCaster::attach(IngestSource* source)
+{
+    m_mountpoints[source->m_mountpoint].sources.push_back(source);
+}
+
+void IngestCaster::detach(IngestSource* source)
+{
+    std::replace(m_dispatch.begin(), m_dispatch.end(), source, static_cast<IngestSource*>(nullptr));
+    const auto it = m_mountpoints.find(source->m_mountpoint);
+    if (it == m_mountpoints.end())
+        return;
+    auto& sources = it->second.sources;
+    sources.erase(std::remove(sources.begin(), sources.end(), source), sources.end());
+    if (!sources.empty())
+        return;
+    // Nobody reads the mountpoint anymore, its upload is refused from now.
+    const auto upload = it->second.upload.lock();
+    if (upload)
+        upload->close();
+    m_mountpoints.erase(it);
+}
+
+IngestCaster::Mountpoint* IngestCaster::find(const std::string& name)
+{
+    const auto it = m_mountpoints.find(name);
+    return it == m_mountpoints.end() ? nullptr : &it->second;
+}
+
+bool IngestCaster::authorize(const Mountpoint& mountpoint, const std::string& login,
+                             const std::string& password, bool checkLogin) const
+{
+    for (const IngestSource* source : mountpoint.sources) {
+        if (source->m_password.empty())
+            continue;
+        if (source->m_password == password && (!checkLogin || source->m_login == login))
+            return true;
+    }
+    return false;
+}
+
+void IngestCaster::dispatch(Mountpoint& mountpoint, const uint8_t* data, size_t size)
+{
+    // A callback may stop or drop sources of the mountpoint, detach() clears
+    // them from this copy.
+    m_dispatch.assign(mountpoint.sources.begin(), mountpoint.sources.end());
+    const ba::const_buffers_1 buffers(data, size);
+    for (const IngestSource* source : m_dispatch)
+        if (source && source->m_running && source->m_dataCallback)
+            source->m_dataCallback(buffers);
+}
+
+IngestSource::IngestSource(const IngestCasterPtr& caster, const std::string& mountpoint)
+    : m_caster(caster),
+      m_mountpoint(mountpoint),
+      m_running(false)
+{
+    m_caster->attach(this);
+}
+
+IngestSource::~IngestSource()
+{
+    m_caster->detach(this);
+}
@@ -0,0 +1,124 @@
+#ifndef __CASTER_INGEST_CASTER_H__
+#define __CASTER_INGEST_CASTER_H__
+
+#include "source.h"
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+namespace Caster {
+
+class IngestSource;
+
+// Caster side for base stations: accepts NTRIP 1.0 SOURCE and NTRIP 2.0
+// POST uploads and hands the data of each mountpoint to the IngestSources
+// reading it, so relays take it without a caster in between.
+//
+// An upload costs its socket and a few words of state. Nothing is read into
+// a buffer of its own: a session waits for readiness and then reads into a
+// buffer shared by all of them, and idle uploads are found by one periodic
+// sweep instead of a timer each.
+class IngestCaster : public std::enable_shared_from_this<IngestCaster>
+{
+    public:
+        IngestCaster(boost::asio::io_service& ioService, uint16_t port);
+        ~IngestCaster();
+
+        // An upload without data for this many seconds is closed, zero
+        // keeps it open.
+        void setTimeout(unsigned seconds) { m_timeout = seconds; }
+
+        void start();
+        void stop();
+
+        // Uploads to the mountpoint are accepted while it has a source. All
+        // sources of a mountpoint get its data, one upload can feed several
+        // relays.
+        std::unique_ptr<IngestSource> source(const std::string& mountpoint);
+
+    private:
+        friend class IngestSource;
+        class Session;
+        using tcp = boost::asio::ip::tcp;
+
+        struct Mountpoint {
+            std::vector<IngestSource*> sources;
+            std::weak_ptr<Session> upload;
+        };
+
+        boost::asio::io_service& m_ioService;
+        tcp::acceptor m_acceptor;
+        tcp::socket m_socket;
+        boost::asio::steady_timer m_timer;
+        unsigned m_timeout;
+        bool m_running;
+        std::map<std::string, Mountpoint> m_mountpoints;
+        std::vector<std::weak_ptr<Session>> m_sessions;
+        std::array<uint8_t, 16384> m_buffer; // shared by all sessions
+        std::vector<IngestSource*> m_dispatch;
+
+        void accept();
+        void handleAccept(const boost::system::error_code& error);
+        void scheduleSweep();
+        void handleSweep(const boost::system::error_code& error);
+
+        void attach(IngestSource* source);
+        void detach(IngestSource* source);
+        Mountpoint* find(const std::string& name);
+        // Any source of the mountpoint may accept the credentials, NTRIP
+        // 1.0 uploads do not check the login. Sources without credentials
+        // accept nothing.
+        bool authorize(const Mountpoint& mountpoint, const std::string& login,
+                       const std::string& password, bool checkLogin) const;
+        void dispatch(Mountpoint& mountpoint, const uint8_t* data, size_t size);
+};
+
+using IngestCasterPtr = std::shared_ptr<IngestCaster>;
+
+// Data uploaded to one mountpoint of an IngestCaster. The stream never
+// ends: when a base station goes away the source waits for it to upload
+// again, and a new upload replaces the current one.
+class IngestSource : public Source
+{
+    public:
+        ~IngestSource() override;
+
+        void start(unsigned /*timeout*/) override { m_running = true; }
+        void stop() override { m_running = false; }
+        // Data comes from the caster, no completion handler refers to the
+        // source.
+        bool isIdle() const override { return true; }
+
+        // What the base station has to present, NTRIP 1.0 sends the
+        // password only. Without credentials every upload is refused, so
+        // nobody on the network can inject data relayed to rovers.
+        void setCredentials(const std::string& login,
+                            const std::string& password) override
+        { m_login = login; m_password = password; }
+
+        void setErrorCallback(const ErrorCallback& /*cb*/) override {}
+        void setDataCallback(const DataCallback& cb) override { m_dataCallback = cb; }
+        void setEOFCallback(const EOFCallback& /*cb*/) override {}
+
+    private:
+        friend class IngestCaster;
+
+        IngestCasterPtr m_caster;
+        std::string m_mountpoint;
+        std::string m_login;
+        std::string m_password;
+        bool m_running;
+        DataCallback m_dataCallback;
+
+        IngestSource(const IngestCasterPtr& caster, const std::string& mountpoint);
+};
+
+}
+
+#endif
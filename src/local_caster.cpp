@@ -0,0 +1,394 @@
+#include "local_caster.h"
+
+#include "logger.h"
+#include "version.h"
+
+#include "base64.h"
+
+#include <charconv>
+#include <sstream>
+#include <iomanip>
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::LocalCaster;
+using Caster::RoverSession;
+
+namespace pls = std::placeholders;
+namespace bs = boost::system;
+namespace ba = boost::asio;
+
+using tcp = ba::ip::tcp;
+
+namespace
+{
+
+const size_t maxRequestSize = 8192;
+const size_t maxInputSize = 4096;
+// A rover that does not take this much data is dropped.
+const size_t maxQueued = 256 * 1024;
+const unsigned requestTimeout = 10;
+
+std::string trim(const std::string& value)
+{
+    const size_t lpos = value.find_first_not_of(" \t");
+    if (lpos == std::string::npos)
+        return "";
+    const size_t rpos = value.find_last_not_of(" \t\r\n");
+    return value.substr(lpos, rpos - lpos + 1);
+}
+
+}
+
+// Reads the request line and headers of an incoming connection.
+class LocalCaster::Request : public std::enable_shared_from_this<Request>
+{
+    public:
+        Request(ba::io_service& ioService, tcp::socket s)
+            : socket(std::move(s)),
+              buffer(maxRequestSize),
+              version2(false),
+              m_timer(ioService)
+        {
+        }
+
+        void start(LocalCaster& caster)
+        {
+            m_timer.expires_from_now(std::chrono::seconds(requestTimeout));
+            m_timer.async_wait([self = shared_from_this()](const bs::error_code& ec)
+                               {
+                                   if (!ec)
+                                       self->socket.close();
+                               });
+            ba::async_read_until(socket, buffer, "\r\n\r\n",
+                                 [self = shared_from_this(), &caster](const bs::error_code& ec, size_t /*size*/)
+                                 {
+                                     self->m_timer.cancel();
+                                     if (!ec && self->parse())
+                                         caster.handleRequest(self);
+                                 });
+        }
+
+        std::string rest()
+        {
+            std::string res(ba::buffers_begin(buffer.data()), ba::buffers_end(buffer.data()));
+            buffer.consume(buffer.size());
+            return res;
+        }
+
+        tcp::socket socket;
+        ba::streambuf buffer;
+        std::string method;
+        std::string uri;
+        bool version2;
+        Headers headers;
+
+    private:
+        ba::steady_timer m_timer;
+
+        bool parse()
+        {
+            std::istream stream(&buffer);
+            std::string line;
+            if (!std::getline(stream, line))
+                return false;
+            std::istringstream requestLine(line);
+            std::string proto;
+            requestLine >> method >> uri >> proto;
+            if (method.empty() || uri.empty())
+                return false;
+            while (std::getline(stream, line) && line != "\r") {
+                const size_t pos = line.find(':');
+                if (pos == std::string::npos)
+                    continue;
+                headers[trim(line.substr(0, pos))] = trim(line.substr(pos + 1));
+            }
+            const auto it = headers.find("Ntrip-Version");
+            version2 = it != headers.end() && it->second == "Ntrip/2.0";
+            return true;
+        }
+};
+
+RoverSession::RoverSession(tcp::socket socket, bool chunked,
+                           const std::string& input)
+    : m_socket(std::move(socket)),
+      m_chunked(chunked),
+      m_input(maxInputSize),
+      m_queued(0),
+      m_writing(false)
+{
+    std::ostream stream(&m_input);
+    stream << input;
+}
+
+void RoverSession::start(const std::string& response)
+{
+    m_response = response;
+    m_writing = true;
+    ba::async_write(m_socket, ba::buffer(m_response),
+                    std::bind(&RoverSession::handleWrite, shared_from_this(), pls::_1));
+    read();
+}
+
+void RoverSession::send(const SharedBuffer& data)
+{
+    if (!m_socket.is_open() || data->empty())
+        return;
+    m_queue.push_back(data);
+    m_queued += data->size();
+    if (m_queued > maxQueued) {
+        ERRLOG(logWarning) << "Rover does not keep up with the stream, dropping it";
+        close();
+        return;
+    }
+    if (!m_writing)
+        write();
+}
+
+void RoverSession::close()
+{
+    if (m_socket.is_open()) {
+        bs::error_code ec;
+        m_socket.shutdown(tcp::socket::shutdown_both, ec);
+        m_socket.close(ec);
+    }
+    m_queue.clear();
+    m_ggaCallback = {};
+    if (m_closeCallback) {
+        const auto cb = std::move(m_closeCallback);
+        m_closeCallback = {};
+        cb();
+    }
+}
+
+void RoverSession::read()
+{
+    ba::async_read_until(m_socket, m_input, "\n",
+                         std::bind(&RoverSession::handleRead, shared_from_this(), pls::_1));
+}
+
+void RoverSession::handleRead(const bs::error_code& error)
+{
+    if (error) {
+        if (error != ba::error::operation_aborted)
+            close();
+        return;
+    }
+
+    std::istream stream(&m_input);
+    std::string line;
+    std::getline(stream, line);
+    line = trim(line);
+    if (line.size() > 6 && line[0] == '$' && line.compare(3, 4, "GGA,") == 0 && m_ggaCallback)
+        m_ggaCallback(line);
+    read();
+}
+
+void RoverSession::write()
+{
+    m_inFlight.assign(m_queue.begin(), m_queue.end());
+    m_queue.clear();
+    m_buffers.clear();
+    size_t size = 0;
+    for (const auto& data : m_inFlight)
+        size += data->size();
+    if (m_chunked) {
+        const auto res = std::to_chars(m_chunkHeader.data(), m_chunkHeader.data() + m_chunkHeader.size() - 2,
+                                       size, 16);
+        res.ptr[0] = '\r';
+        res.ptr[1] = '\n';
+        m_buffers.push_back(ba::buffer(m_chunkHeader.data(), static_cast<size_t>(res.ptr + 2 - m_chunkHeader.data())));
+    }
+    for (const auto& data : m_inFlight)
+        m_buffers.push_back(ba::buffer(*data));
+    if (m_chunked)
+        m_buffers.push_back(ba::buffer("\r\n", 2));
+    m_writing = true;
+    ba::async_write(m_socket, m_buffers,
+                    std::bind(&RoverSession::handleWrite, shared_from_this(), pls::_1));
+}
+
+void RoverSession::handleWrite(const bs::error_code& error)
+{
+    m_writing = false;
+    for (const auto& data : m_inFlight)
+        m_queued -= data->size();
+    m_inFlight.clear();
+    if (error) {
+        if (error != ba::error::operation_aborted)
+            close();
+        return;
+    }
+    if (!m_queue.empty())
+        write();
+}
+
+LocalCaster::LocalCaster(ba::io_service& ioService,
+                         const std::string& address, uint16_t port)
+    : m_ioService(ioService),
+      m_acceptor(ioService, tcp::endpoint(ba::ip::make_address(address), port)),
+      m_socket(ioService)
+{
+}
+
+void LocalCaster::addMountpoint(const std::string& name, const std::string& source,
+                                bool nmea, const RoverHandler& handler)
+{
+    m_mountpoints[name] = Mountpoint{source, nmea, handler};
+}
+
+void LocalCaster::start()
+{
+    ERRLOG(logDebug) << "Listening on " << m_acceptor.local_endpoint();
+    accept();
+}
+
+void LocalCaster::stop()
+{
+    bs::error_code ec;
+    m_acceptor.close(ec);
+}
+
+void LocalCaster::accept()
+{
+    m_acceptor.async_accept(m_socket, std::bind(&LocalCaster::handleAccept, this, pls::_1));
+}
+
+void LocalCaster::handleAccept(const bs::error_code& error)
+{
+    if (error == ba::error::operation_aborted)
+        return;
+    if (error) {
+        ERRLOG(logWarning) << "Failed to accept a connection: " << error.message();
+    } else {
+        ERRLOG(logDebug) << "Accepted connection from " << m_socket.remote_endpoint();
+        std::make_shared<Request>(m_ioService, std::move(m_socket))->start(*this);
+    }
+    m_socket = tcp::socket(m_ioService);
+    accept();
+}
+
+void LocalCaster::handleRequest(const std::shared_ptr<Request>& request)
+{
+    ERRLOG(logDebug) << "Request: " << request->method << " " << request->uri;
+
+    const std::string name = request->uri.size() > 1 ? request->uri.substr(1) : "";
+    const auto it = m_mountpoints.find(name);
+    if (request->method == "GET" && it != m_mountpoints.end()) {
+        if (!isAuthorized(request->headers)) {
+            ERRLOG(logWarning) << "Rover request for " << name << " is not authorized";
+            auto text = std::make_shared<std::string>(
+                std::string(request->version2 ? "HTTP/1.1" : "HTTP/1.0") + " 401 Unauthorized\r\n" +
+                (request->version2 ? "Ntrip-Version: Ntrip/2.0\r\n" : "") +
+                "WWW-Authenticate: Basic realm=\"/" + name + "\"\r\n"
+                "Connection: close\r\n\r\n");
+            ba::async_write(request->socket, ba::buffer(*text),
+                            [request, text](const bs::error_code& /*ec*/, size_t /*size*/)
+                            {
+                                bs::error_code ec;
+                                request->socket.shutdown(tcp::socket::shutdown_both, ec);
+                                request->socket.close(ec);
+                            });
+            return;
+        }
+        std::ostringstream response;
+        if (request->version2) {
+            response << "HTTP/1.1 200 OK\r\n"
+                     << "Ntrip-Version: Ntrip/2.0\r\n"
+                     << "Server: NTRIP Relay " << version << "\r\n"
+                     << "Content-Type: gnss/data\r\n"
+                     << "Cache-Control: no-store, no-cache, max-age=0\r\n"
+                     << "Connection: close\r\n"
+                     << "Transfer-Encoding: chunked\r\n"
+                     << "\r\n";
+        } else {
+            response << "ICY 200 OK\r\n";
+        }
+        auto rover = std::make_shared<RoverSession>(std::move(request->socket), request->version2, request->rest());
+        rover->start(response.str());
+        it->second.handler(rover, request->headers);
+        return;
+    }
+
+    // NTRIP 1.0 casters answer unknown mountpoints with the sourcetable.
+    std::ostringstream response;
+    const std::string table = sourceTable();
+    if (request->version2 && !(request->method == "GET" && name.empty())) {
+        response << "HTTP/1.1 404 Not Found\r\n"
+                 << "Ntrip-Version: Ntrip/2.0\r\n"
+                 << "Connection: close\r\n"
+                 << "\r\n";
+    } else if (request->version2) {
+        response << "HTTP/1.1 200 OK\r\n"
+                 << "Ntrip-Version: Ntrip/2.0\r\n"
+                 << "Server: NTRIP Relay " << version << "\r\n"
+                 << "Content-Type: gnss/sourcetable\r\n"
+                 << "Content-Length: " << table.size() << "\r\n"
+                 << "Connection: close\r\n"
+                 << "\r\n"
+                 << table;
+    } else {
+        response << "SOURCETABLE 200 OK\r\n"
+                 << "Server: NTRIP Relay " << version << "\r\n"
+                 << "Content-Type: text/plain\r\n"
+                 << "Content-Length: " << table.size() << "\r\n"
+                 << "\r\n"
+                 << table;
+    }
+    auto text = std::make_shared<std::string>(response.str());
+    ba::async_write(request->socket, ba::buffer(*text),
+                    [request, text](const bs::error_code& /*ec*/, size_t /*size*/)
+                    {
+                        bs::error_code ec;
+                        request->socket.shutdown(tcp::socket::shutdown_both, ec);
+                        request->socket.close(ec);
+                    });
+}
+
+bool LocalCaster::isAuthorized(const Headers& headers) const
+{
+    if (m_login.empty() && m_password.empty())
+        return true;
+    const auto it = headers.find("Authorization");
+    if (it == headers.end() || it->second.compare(0, 6, "Basic ") != 0)
+        return false;
+    const std::string credentials = base64_decode(it->second.substr(6));
+    const size_t colon = credentials.find(':');
+    return colon != std::string::npos &&
+           credentials.compare(0, colon, m_login) == 0 &&
+           credentials.compare(colon + 1, std::string::npos, m_password) == 0;
+}
+
+std::string LocalCaster::sourceTable() const
+{
+    std::ostringstream stream;
+    stream << std::fixed << std::setprecision(2);
+    for (const auto& kv : m_mountpoints) {
+        const Mountpoint& mountpoint = kv.second;
+        size_t index = 0;
+        const SourceTable::Streams* streams = m_table ? &m_table->streams() : nullptr;
+        if (streams) {
+            while (index < streams->size() && m_table->string(streams->mountpoint[index]) != mountpoint.source)
+                ++index;
+            if (index == streams->size())
+                streams = nullptr;
+        }
+        stream << "STR;" << kv.first << ";";
+        if (streams) {
+            stream << m_table->string(streams->identifier[index]) << ";"
+                   << m_table->string(streams->format[index]) << ";"
+                   << m_table->string(streams->formatDetails[index]) << ";;"
+                   << m_table->string(streams->navSystem[index]) << ";"
+                   << m_table->string(streams->network[index]) << ";"
+                   << m_table->string(streams->country[index]) << ";"
+                   << streams->latitude[index] << ";"
+                   << streams->longitude[index] << ";";
+        } else {
+            stream << kv.first << ";RTCM 3;;;;;;0.00;0.00;";
+        }
+        stream << (mountpoint.nmea ? 1 : 0) << ";0;ntriprelay;none;N;N;0;\r\n";
+    }
+    stream << "ENDSOURCETABLE\r\n";
+    return stream.str();
+}
@@ -0,0 +1,121 @@
+#ifndef __CASTER_LOCAL_CASTER_H__
+#define __CASTER_LOCAL_CASTER_H__
+
+#include "sourcetable.h"
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <functional>
+#include <cstdint>
+
+namespace Caster {
+
+// Data shared by all rovers it is sent to, without a copy per rover.
+using SharedBuffer = std::shared_ptr<const std::vector<uint8_t>>;
+
+// Connection of a rover to the local caster. Streams data to the rover and
+// reports GGA sentences the rover sends back.
+class RoverSession : public std::enable_shared_from_this<RoverSession>
+{
+    public:
+        using GGACallback = std::function<void (const std::string&)>;
+        using CloseCallback = std::function<void ()>;
+
+        // Input holds bytes received after the request headers.
+        RoverSession(boost::asio::ip::tcp::socket socket, bool chunked,
+                     const std::string& input);
+
+        // Writes the response headers and starts streaming.
+        void start(const std::string& response);
+        void send(const SharedBuffer& data);
+        void close();
+
+        void setGGACallback(const GGACallback& cb) { m_ggaCallback = cb; }
+        void setCloseCallback(const CloseCallback& cb) { m_closeCallback = cb; }
+
+        bool isOpen() const { return m_socket.is_open(); }
+
+    private:
+        boost::asio::ip::tcp::socket m_socket;
+        bool m_chunked;
+        boost::asio::streambuf m_input;
+        std::string m_response;
+        std::deque<SharedBuffer> m_queue;
+        size_t m_queued;
+        std::vector<SharedBuffer> m_inFlight;
+        std::array<char, 2 * sizeof(size_t) + 2> m_chunkHeader; // hex size and CRLF
+        std::vector<boost::asio::const_buffer> m_buffers;
+        bool m_writing;
+        GGACallback m_ggaCallback;
+        CloseCallback m_closeCallback;
+
+        void read();
+        void handleRead(const boost::system::error_code& error);
+        void write();
+        void handleWrite(const boost::system::error_code& error);
+};
+
+using RoverSessionPtr = std::shared_ptr<RoverSession>;
+
+// Minimal NTRIP caster for local rovers: serves the sourcetable and hands
+// stream requests over to the registered mountpoint handlers.
+class LocalCaster
+{
+    public:
+        using Headers = std::map<std::string, std::string>;
+        using RoverHandler = std::function<void (const RoverSessionPtr&, const Headers&)>;
+
+        // Throws boost::system::system_error if it cannot listen there.
+        LocalCaster(boost::asio::io_service& ioService,
+                    const std::string& address, uint16_t port);
+
+        // Source is the upstream mountpoint, its sourcetable record describes
+        // the local one. NMEA tells rovers to send their position.
+        void addMountpoint(const std::string& name, const std::string& source,
+                           bool nmea, const RoverHandler& handler);
+        void setSourceTable(const SourceTablePtr& table) { m_table = table; }
+        // Rovers then have to present them with Basic authorization, the
+        // sourcetable stays open.
+        void setCredentials(const std::string& login,
+                            const std::string& password)
+        {
+            m_login = login;
+            m_password = password;
+        }
+
+        void start();
+        void stop();
+
+    private:
+        struct Mountpoint {
+            std::string source;
+            bool nmea;
+            RoverHandler handler;
+        };
+
+        class Request;
+
+        boost::asio::io_service& m_ioService;
+        boost::asio::ip::tcp::acceptor m_acceptor;
+        boost::asio::ip::tcp::socket m_socket;
+        std::map<std::string, Mountpoint> m_mountpoints;
+        SourceTablePtr m_table;
+        std::string m_login;
+        std::string m_password;
+
+        void accept();
+        void handleAccept(const boost::system::error_code& error);
+        void handleRequest(const std::shared_ptr<Request>& request);
+        bool isAuthorized(const Headers& headers) const;
+        std::string sourceTable() const;
+};
+
+}
+
+#endif
@@ -3,8 +3,25 @@
 #include "settings.h"
 #include "version.h"
 #include "error.h"
+#include "metrics.h"
+#include "sourcetable.h"
+#include "local_caster.h"
+#include "vrs_pool.h"
+#include "relay_manager.h"
+#include "control_server.h"
+#include "replay_source.h"
+#include "rtp_client.h"
+#include "rtp_server.h"
+#include "multicast_sink.h"
+#include "cluster_sink.h"
+#include "tcp_source.h"
+#include "file_source.h"
+#include "ingest_caster.h"
+#include "handover.h"
+#include "trace.h"
 
 #include <boost/system/error_code.hpp>
+#include <boost/asio/signal_set.hpp>
 
 #include <iostream>
 #include <functional> // std::bind
@@ -21,6 +38,11 @@ using namespace Caster;
 void configureLogger(const SettingsParser& parser);
 void printError(const boost::system::error_code& code);
 void printHeaders(const RelayPtr& relayPtr);
+void waitMetricsSignal(boost::asio::signal_set& signals);
+int runVrsPool(const Settings& settings);
+int runRelayManager(const Settings& settings);
+void waitControlSignal(boost::asio::io_service& ioService, boost::asio::signal_set& signals,
+                       RelayManager& manager, const std::string& configFile);
 
 int main(int argc, char* argv[])
 {
@@ -54,13 +76,63 @@ int main(int argc, char* argv[])
         return 0;
     }
 
-    if (sParser.settings().sourceServer().empty())
+    Connection::setTimeoutSigmas(sParser.settings().timeoutSigmas());
+    Connection::AdmissionLimits admission;
+    admission.rate = sParser.settings().admissionRate();
+    admission.perHost = sParser.settings().admissionPerHost();
+    admission.jitter = std::chrono::milliseconds(sParser.settings().admissionJitter());
+    Connection::setAdmissionLimits(admission);
+    if (sParser.settings().isCoroutineEngine())
+        Connection::setEngine(Connection::Engine::Coroutines);
+    if (sParser.settings().isProfileHandlers())
+        Metrics::instance().enableHandlerProfiling();
+    if (!sParser.settings().trace().empty())
+        Tracer::instance().enable(sParser.settings().trace(), sParser.settings().traceSize());
+
+    if (!sParser.settings().configFile().empty() || !sParser.settings().controlSocket().empty())
+    {
+        configureLogger(sParser);
+        return runRelayManager(sParser.settings());
+    }
+
+    const bool isReplay = !sParser.settings().replay().empty();
+    const bool isLocalSource = isReplay || !sParser.settings().sourceFile().empty() ||
+                               sParser.settings().sourceListenPort() != 0;
+    const bool isIngest = sParser.settings().ingestPort() != 0;
+    if (sParser.settings().sourceServer().empty() && !isLocalSource && !isIngest)
     {
         std::cerr << "You must specify source server location" << std::endl;
         return -1;
     }
 
-    if (sParser.settings().destinationServer().empty())
+    if (isIngest && sParser.settings().sourcePassword().empty())
+    {
+        std::cerr << "You must specify the source password uploads have to present" << std::endl;
+        return -1;
+    }
+
+    if (sParser.settings().sourceMountpoint().empty() && !sParser.settings().isNearest() &&
+        !isLocalSource && !sParser.settings().isSourceTcp())
+    {
+        std::cerr << "You must specify source mountpoint or enable nearest mountpoint selection" << std::endl;
+        return -1;
+    }
+
+    const bool isVrs = sParser.settings().vrsCell() > 0;
+    if (isVrs && sParser.settings().listenPort() == 0)
+    {
+        std::cerr << "You must specify listen port to share VRS streams" << std::endl;
+        return -1;
+    }
+
+    if (isVrs && sParser.settings().sourceMountpoint().empty())
+    {
+        std::cerr << "You must specify source VRS mountpoint" << std::endl;
+        return -1;
+    }
+
+    if (sParser.settings().destinationServer().empty() && !isVrs &&
+        sParser.settings().shm().empty() && sParser.settings().multicast().empty())
     {
         std::cerr << "You must specify destination server location" << std::endl;
         return -1;
@@ -71,24 +143,60 @@ int main(int argc, char* argv[])
     if (sParser.settings().isDebug())
     {
         std::cout << "Settings dump:\n"
+                  << "\t- admission jitter: " << sParser.settings().admissionJitter() << "\n"
+                  << "\t- admission per host: " << sParser.settings().admissionPerHost() << "\n"
+                  << "\t- admission rate: " << sParser.settings().admissionRate() << "\n"
+                  << "\t- batch deadline: " << sParser.settings().batchDeadline() << "\n"
                   << "\t- connection timeout: " << sParser.settings().connectionTimeout() << "\n"
                   << "\t- debug: " << (sParser.settings().isDebug() ? "yes" : "no") << "\n"
+                  << "\t- destination cluster: " << sParser.settings().destinationCluster() << "\n"
                   << "\t- destination login: " << sParser.settings().destinationLogin() << "\n"
                   << "\t- destination mountpoint: " << sParser.settings().destinationMountpoint() << "\n"
                   << "\t- destination password: " << sParser.settings().destinationPassword() << "\n"
+                  << "\t- destination RTP: " << (sParser.settings().isDestinationRtp() ? "yes" : "no") << "\n"
                   << "\t- destination port: " << sParser.settings().destinationPort() << "\n"
+                  << "\t- destination replay: " << sParser.settings().destinationReplay() << "\n"
                   << "\t- destination server: " << sParser.settings().destinationServer() << "\n"
+                  << "\t- engine: " << (sParser.settings().isCoroutineEngine() ? "coroutines" : "callbacks") << "\n"
                   << "\t- GGA: " << sParser.settings().gga() << "\n"
+                  << "\t- GGA interval: " << sParser.settings().ggaInterval() << "\n"
                   << "\t- help: " << (sParser.settings().isHelp() ? "yes" : "no") << "\n"
+                  << "\t- hysteresis: " << sParser.settings().hysteresis() << "\n"
+                  << "\t- ingest port: " << sParser.settings().ingestPort() << "\n"
+                  << "\t- listen address: " << sParser.settings().listenAddress() << "\n"
+                  << "\t- listen mountpoint: " << sParser.settings().listenMountpoint() << "\n"
+                  << "\t- listen port: " << sParser.settings().listenPort() << "\n"
+                  << "\t- multicast: " << sParser.settings().multicast() << "\n"
+                  << "\t- multicast TTL: " << sParser.settings().multicastTTL() << "\n"
+                  << "\t- max age: " << sParser.settings().maxAge() << "\n"
+                  << "\t- nearest: " << (sParser.settings().isNearest() ? "yes" : "no") << "\n"
+                  << "\t- nav system: " << sParser.settings().navSystem() << "\n"
+                  << "\t- profile handlers: " << (sParser.settings().isProfileHandlers() ? "yes" : "no") << "\n"
+                  << "\t- record: " << sParser.settings().record() << "\n"
+                  << "\t- replay: " << sParser.settings().replay() << "\n"
+                  << "\t- replay speed: " << sParser.settings().replaySpeed() << "\n"
+                  << "\t- shared memory: " << sParser.settings().shm() << "\n"
+                  << "\t- shared memory size: " << sParser.settings().shmSize() << "\n"
                   << "\t- source login: " << sParser.settings().sourceLogin() << "\n"
                   << "\t- source mountpoint: " << sParser.settings().sourceMountpoint() << "\n"
                   << "\t- source password: " << sParser.settings().sourcePassword() << "\n"
+                  << "\t- source file: " << sParser.settings().sourceFile() << "\n"
+                  << "\t- source listen port: " << sParser.settings().sourceListenPort() << "\n"
+                  << "\t- source TCP: " << (sParser.settings().isSourceTcp() ? "yes" : "no") << "\n"
+                  << "\t- source RTP: " << (sParser.settings().isSourceRtp() ? "yes" : "no") << "\n"
                   << "\t- source port: " << sParser.settings().sourcePort() << "\n"
                   << "\t- source server: " << sParser.settings().sourceServer() << "\n"
+                  << "\t- timeout sigmas: " << sParser.settings().timeoutSigmas() << "\n"
+                  << "\t- trace: " << sParser.settings().trace() << "\n"
+                  << "\t- trace size: " << sParser.settings().traceSize() << "\n"
                   << "\t- verbosity level: " << sParser.settings().verbosity() << "\n"
+                  << "\t- VRS cell: " << sParser.settings().vrsCell() << "\n"
                   << "\t- version: " << (sParser.settings().isVersion() ? "yes" : "no") << std::endl;
     }
 
+    if (isVrs)
+        return runVrsPool(sParser.settings());
+
     try
     {
         boost::asio::io_service ioService;
@@ -100,9 +208,36 @@ int main(int argc, char* argv[])
                                              sParser.settings().destinationPort(),
                                              sParser.settings().destinationMountpoint());
 
-        relay->setErrorCallback(printError);
+        // SIGUSR1 dumps metrics to stdout while the relay is running.
+        boost::asio::signal_set signals(ioService, SIGUSR1);
+        waitMetricsSignal(signals);
+
+        SourceTableCache sourceTable(ioService,
+                                     sParser.settings().sourceServer(),
+                                     sParser.settings().sourcePort());
 
-        relay->setHeadersCallback(std::bind(printHeaders, relay));
+        IngestCasterPtr ingest;
+        if (isIngest)
+        {
+            ingest = std::make_shared<IngestCaster>(ioService, sParser.settings().ingestPort());
+            ingest->setTimeout(sParser.settings().connectionTimeout());
+        }
+
+        relay->setErrorCallback([&signals, &sourceTable, &ingest](const boost::system::error_code& ec)
+                                {
+                                    printError(ec);
+                                    sourceTable.stop();
+                                    if (ingest)
+                                        ingest->stop();
+                                    signals.cancel();
+                                });
+        relay->setEOFCallback([&signals, &sourceTable]()
+                              {
+                                  sourceTable.stop();
+                                  signals.cancel();
+                              });
+
+        relay->setHeadersCallback(std::bind(printHeaders, std::cref(relay)));
 
         if (!sParser.settings().sourceLogin().empty() ||
             !sParser.settings().sourcePassword().empty())
@@ -121,8 +256,119 @@ int main(int argc, char* argv[])
         if (!sParser.settings().gga().empty())
             relay->setGGA(sParser.settings().gga());
 
+        relay->setMaxAge(std::chrono::milliseconds(sParser.settings().maxAge()));
+        relay->setBatchDeadline(std::chrono::microseconds(sParser.settings().batchDeadline()));
+
+        if (ingest)
+        {
+            relay->setSource(ingest->source(sParser.settings().sourceMountpoint()),
+                             sParser.settings().sourceMountpoint());
+        }
+        else if (!sParser.settings().sourceFile().empty())
+        {
+            relay->setSource(SourcePtr(new FileSource(ioService, sParser.settings().sourceFile())),
+                             sParser.settings().sourceFile());
+        }
+        else if (sParser.settings().sourceListenPort() != 0)
+        {
+            relay->setSource(SourcePtr(new TcpSource(ioService, sParser.settings().sourceListenPort())),
+                             "listen:" + std::to_string(sParser.settings().sourceListenPort()));
+        }
+        else if (sParser.settings().isSourceTcp())
+        {
+            relay->setSource(SourcePtr(new TcpSource(ioService,
+                                                     sParser.settings().sourceServer(),
+                                                     sParser.settings().sourcePort())),
+                             sParser.settings().sourceMountpoint().empty() ?
+                                 sParser.settings().sourceServer() + ":" + std::to_string(sParser.settings().sourcePort()) :
+                                 sParser.settings().sourceMountpoint());
+        }
+        else if (sParser.settings().isSourceRtp() && !isReplay)
+        {
+            relay->setSource(SourcePtr(new RtpClient(ioService,
+                                                     sParser.settings().sourceServer(),
+                                                     sParser.settings().sourcePort(),
+                                                     sParser.settings().sourceMountpoint())),
+                             sParser.settings().sourceMountpoint());
+        }
+
+        if (sParser.settings().isDestinationRtp())
+        {
+            relay->setSink(SinkPtr(new RtpServer(ioService,
+                                                 sParser.settings().destinationServer(),
+                                                 sParser.settings().destinationPort(),
+                                                 sParser.settings().destinationMountpoint())));
+        }
+        else if (!sParser.settings().multicast().empty())
+        {
+            std::unique_ptr<MulticastSink> sink(new MulticastSink(ioService, sParser.settings().multicast()));
+            sink->setTTL(sParser.settings().multicastTTL());
+            relay->setSink(std::move(sink));
+        }
+        else if (!sParser.settings().destinationCluster().empty())
+        {
+            std::unique_ptr<ClusterSink> sink(new ClusterSink(ioService,
+                                                              sParser.settings().destinationServer(),
+                                                              sParser.settings().destinationPort(),
+                                                              sParser.settings().destinationCluster(),
+                                                              sParser.settings().destinationMountpoint()));
+            sink->setReplayWindow(std::chrono::milliseconds(sParser.settings().destinationReplay()));
+            relay->setSink(std::move(sink));
+        }
+
+        if (isReplay)
+        {
+            relay->setSource(SourcePtr(new ReplaySource(ioService,
+                                                        Recording::open(sParser.settings().replay()),
+                                                        sParser.settings().replaySpeed())),
+                             sParser.settings().replay());
+        }
+
+        if (!sParser.settings().record().empty())
+        {
+            relay->setRecorder(std::make_shared<Recorder>(sParser.settings().record(),
+                                                          static_cast<size_t>(sParser.settings().recordSegmentSize()) * 1024 * 1024,
+                                                          std::chrono::seconds(sParser.settings().recordSegmentTime())));
+        }
+
+        if (!sParser.settings().shm().empty())
+        {
+            relay->setShmRing(std::unique_ptr<Shm::Writer>(new Shm::Writer(sParser.settings().shm(),
+                                                                           static_cast<size_t>(sParser.settings().shmSize()) * 1024)));
+        }
+
         ERRLOG(logDebug) << "Before starting...";
 
+        if (sParser.settings().isNearest())
+        {
+            if (!sParser.settings().sourceLogin().empty() ||
+                !sParser.settings().sourcePassword().empty())
+            {
+                sourceTable.setCredentials(sParser.settings().sourceLogin(),
+                                           sParser.settings().sourcePassword());
+            }
+            sourceTable.setCacheFile(sParser.settings().sourceTableCache());
+            sourceTable.setRefreshInterval(sParser.settings().sourceTableRefresh());
+            sourceTable.setTableCallback([&relay, &sParser](const SourceTablePtr& table)
+                                         {
+                                             relay->setSourceTable(table, sParser.settings().hysteresis(),
+                                                                  sParser.settings().navSystem());
+                                         });
+            sourceTable.setErrorCallback([&relay, &signals, &sourceTable, &sParser](const boost::system::error_code& ec)
+                                         {
+                                             ERRLOG(logError) << "Failed to get sourcetable: " << ec.message();
+                                             if (!sParser.settings().sourceMountpoint().empty() || sourceTable.table())
+                                                 return;
+                                             sourceTable.stop();
+                                             relay->stop();
+                                             signals.cancel();
+                                         });
+            sourceTable.start(sParser.settings().connectionTimeout());
+        }
+
+        if (ingest)
+            ingest->start();
+
         relay->start(sParser.settings().connectionTimeout());
 
         ERRLOG(logDebug) << "Starting...";
@@ -188,3 +434,188 @@ void printHeaders(const RelayPtr& relayPtr)
     for (const auto& kv : relayPtr->headers())
         ERRLOG(logInfo) << kv.first << ": " << kv.second;
 }
+
+void waitMetricsSignal(boost::asio::signal_set& signals)
+{
+    signals.async_wait([&signals](const boost::system::error_code& ec, int /*signal*/)
+                       {
+                           if (ec)
+                               return;
+                           Metrics::instance().write(std::cout);
+                           std::cout.flush();
+                           Tracer::instance().dump();
+                           waitMetricsSignal(signals);
+                       });
+}
+
+int runVrsPool(const Settings& settings)
+{
+    try
+    {
+        boost::asio::io_service ioService;
+
+        boost::asio::signal_set signals(ioService, SIGUSR1);
+        waitMetricsSignal(signals);
+
+        auto pool = std::make_shared<VrsPool>(ioService,
+                                              settings.sourceServer(),
+                                              settings.sourcePort(),
+                                              settings.sourceMountpoint(),
+                                              settings.vrsCell());
+        if (!settings.sourceLogin().empty() || !settings.sourcePassword().empty())
+            pool->setCredentials(settings.sourceLogin(), settings.sourcePassword());
+        pool->setGGAInterval(settings.ggaInterval());
+
+        LocalCaster caster(ioService, settings.listenAddress(), settings.listenPort());
+        if (!settings.listenLogin().empty() || !settings.listenPassword().empty())
+            caster.setCredentials(settings.listenLogin(), settings.listenPassword());
+        const std::string& mountpoint = settings.listenMountpoint().empty() ?
+                                        settings.sourceMountpoint() :
+                                        settings.listenMountpoint();
+        caster.addMountpoint(mountpoint, settings.sourceMountpoint(), true,
+                             std::bind(&VrsPool::addRover, pool, std::placeholders::_1, std::placeholders::_2));
+
+        // The upstream record describes the local mountpoint.
+        SourceTableCache sourceTable(ioService, settings.sourceServer(), settings.sourcePort());
+        if (!settings.sourceLogin().empty() || !settings.sourcePassword().empty())
+            sourceTable.setCredentials(settings.sourceLogin(), settings.sourcePassword());
+        sourceTable.setCacheFile(settings.sourceTableCache());
+        sourceTable.setRefreshInterval(settings.sourceTableRefresh());
+        sourceTable.setTableCallback([&caster](const SourceTablePtr& table)
+                                     {
+                                         caster.setSourceTable(table);
+                                     });
+        sourceTable.setErrorCallback([](const boost::system::error_code& ec)
+                                     {
+                                         ERRLOG(logWarning) << "Failed to get sourcetable: " << ec.message();
+                                     });
+
+        sourceTable.start(settings.connectionTimeout());
+        pool->start(settings.connectionTimeout());
+        caster.start();
+
+        ERRLOG(logDebug) << "Starting...";
+
+        ioService.run();
+
+        ERRLOG(logDebug) << "Stopping...";
+    }
+    catch (const std::exception& e)
+    {
+        ERRLOG(logFatal) << "System error: " << e.what();
+        return -1;
+    }
+
+    return 0;
+}
+
+int runRelayManager(const Settings& settings)
+{
+    try
+    {
+        boost::asio::io_service ioService;
+
+        boost::asio::signal_set signals(ioService, SIGUSR1);
+        waitMetricsSignal(signals);
+
+        RelayManager manager(ioService);
+        if (!settings.takeover().empty())
+        {
+            // The old process stops once its relays are handed over, ours
+            // go on with their connections.
+            try
+            {
+                manager.setHandedOver(Handover::receive(settings.takeover()));
+            }
+            catch (const CasterError& e)
+            {
+                ERRLOG(logError) << "Connecting anew, " << e.what();
+            }
+        }
+        IngestCasterPtr ingest;
+        if (settings.ingestPort() != 0)
+        {
+            ingest = std::make_shared<IngestCaster>(ioService, settings.ingestPort());
+            ingest->setTimeout(settings.connectionTimeout());
+            manager.setIngestCaster(ingest);
+            ingest->start();
+        }
+        if (!settings.configFile().empty())
+            manager.apply(loadRelayConfigs(settings.configFile()));
+        manager.dropHandedOver();
+
+        // SIGHUP reloads the config file, SIGINT and SIGTERM stop the relays.
+        boost::asio::signal_set control(ioService, SIGHUP, SIGINT, SIGTERM);
+        waitControlSignal(ioService, control, manager, settings.configFile());
+
+        std::unique_ptr<ControlServer> server;
+        if (!settings.controlSocket().empty())
+        {
+            server.reset(new ControlServer(ioService, settings.controlSocket(), manager));
+            if (!settings.configFile().empty())
+            {
+                const std::string& configFile = settings.configFile();
+                server->setReloadCallback([&manager, &configFile]()
+                                          {
+                                              manager.apply(loadRelayConfigs(configFile));
+                                          });
+            }
+            server->setHandoverCallback([&ioService, &manager, &ingest]()
+                                        {
+                                            manager.stop();
+                                            if (ingest)
+                                                ingest->stop();
+                                            ioService.stop();
+                                        });
+            server->start();
+        }
+
+        ERRLOG(logDebug) << "Starting...";
+
+        ioService.run();
+
+        ERRLOG(logDebug) << "Stopping...";
+    }
+    catch (const CasterError& e)
+    {
+        ERRLOG(logError) << "Relay error: " << e.what();
+        return -1;
+    }
+    catch (const std::exception& e)
+    {
+        ERRLOG(logFatal) << "System error: " << e.what();
+        return -1;
+    }
+
+    return 0;
+}
+
+void waitControlSignal(boost::asio::io_service& ioService, boost::asio::signal_set& signals,
+                       RelayManager& manager, const std::string& configFile)
+{
+    signals.async_wait([&ioService, &signals, &manager, &configFile](const boost::system::error_code& ec, int signal)
+                       {
+                           if (ec)
+                               return;
+                           if (signal != SIGHUP)
+                           {
+                               manager.stop();
+                               ioService.stop();
+                               return;
+                           }
+                           if (!configFile.empty())
+                           {
+                               ERRLOG(logInfo) << "Reloading " << configFile;
+                               try
+                               {
+                                   // A broken file leaves the running relays as they are.
+                                   manager.apply(loadRelayConfigs(configFile));
+                               }
+                               catch (const CasterError& e)
+                               {
+                                   ERRLOG(logError) << "Failed to reload config: " << e.what();
+                               }
+                           }
+                           waitControlSignal(ioService, signals, manager, configFile);
+                       });
+}
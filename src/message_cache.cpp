@@ -0,0 +1,58 @@
+#include "message_cache.h"
+
+#include <algorithm>
+#include <map>
+
+using Caster::MessageCache;
+
+MessageCache& MessageCache::mountpoint(const std::string& name)
+{
+    static std::map<std::string, MessageCache> caches;
+    return caches[name];
+}
+
+bool MessageCache::isCached(uint16_t type) noexcept
+{
+    const RTCM::MessageClass messageClass = RTCM::classify(type);
+    return messageClass == RTCM::MessageClass::Station ||
+           messageClass == RTCM::MessageClass::Ephemeris;
+}
+
+void MessageCache::update(const RTCM::Frame& frame)
+{
+    if (!isCached(frame.info.type))
+        return;
+    const uint32_t k = key(frame);
+    auto it = std::lower_bound(m_entries.begin(), m_entries.end(), k,
+                               [](const Entry& entry, uint32_t value) { return entry.key < value; });
+    if (it == m_entries.end() || it->key != k)
+        it = m_entries.insert(it, Entry{k, {}, {}});
+    it->info = frame.info;
+    // Reuses the storage of the previous copy, frames of one type and
+    // satellite keep their size.
+    it->data.assign(frame.data, frame.data + frame.size);
+}
+
+std::vector<uint8_t> MessageCache::snapshot() const
+{
+    size_t size = 0;
+    for (const auto& entry : m_entries)
+        size += entry.data.size();
+    std::vector<uint8_t> res;
+    res.reserve(size);
+    for (const auto& entry : m_entries)
+        res.insert(res.end(), entry.data.begin(), entry.data.end());
+    return res;
+}
+
+uint32_t MessageCache::key(const RTCM::Frame& frame) noexcept
+{
+    const uint32_t type = frame.info.type;
+    const bool isStation = frame.info.messageClass == RTCM::MessageClass::Station;
+    uint32_t satellite = 0;
+    // Ephemerides carry the satellite id right after the message type, 4
+    // bits wide for QZSS and 6 bits for the others.
+    if (!isStation && frame.size >= RTCM::headerSize + 3 + RTCM::crcSize)
+        satellite = RTCM::getBits(frame.data + RTCM::headerSize, 12, type == 1044 ? 4 : 6);
+    return (isStation ? 0 : 1u << 24) | (type << 8) | satellite;
+}
@@ -0,0 +1,58 @@
+#ifndef __CASTER_MESSAGE_CACHE_H__
+#define __CASTER_MESSAGE_CACHE_H__
+
+#include "rtcm.h"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace Caster {
+
+// Latest copy of every station description and ephemeris message of a
+// stream, one per message type and, for ephemerides, per satellite. A rover
+// needs them before it can fix, but a base station repeats them only every
+// 10-60 seconds, so a new downstream connection gets them from here first.
+class MessageCache {
+    public:
+        // The cache of a mountpoint outlives the relays reading it, so a
+        // restarted relay primes its destination right away.
+        static MessageCache& mountpoint(const std::string& name);
+
+        static bool isCached(uint16_t type) noexcept;
+
+        // Keeps a copy of the frame if its type is cached.
+        void update(const RTCM::Frame& frame);
+        void clear() noexcept { m_entries.clear(); }
+
+        bool empty() const noexcept { return m_entries.empty(); }
+        size_t size() const noexcept { return m_entries.size(); }
+
+        // Calls f(const RTCM::Frame&) for every cached frame, station
+        // messages first, ordered by message type and satellite.
+        template <typename F>
+        void forEach(F&& f) const
+        {
+            for (const auto& entry : m_entries)
+                f(RTCM::Frame{entry.data.data(), entry.data.size(), entry.info});
+        }
+
+        // All cached frames back to back.
+        std::vector<uint8_t> snapshot() const;
+
+    private:
+        struct Entry {
+            uint32_t key; // station messages sort before ephemerides
+            RTCM::FrameInfo info;
+            std::vector<uint8_t> data;
+        };
+
+        std::vector<Entry> m_entries; // sorted by key
+
+        static uint32_t key(const RTCM::Frame& frame) noexcept;
+};
+
+}
+
+#endif
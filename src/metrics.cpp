@@ -0,0 +1,119 @@
+#include "metrics.h"
+#include "connection.h"
+#include "buffer_pool.h"
+#ifdef NTRIP_ALLOCATION_COUNT
+#include "allocation_counter.h"
+#endif
+
+#include <algorithm>
+
+using Caster::Histogram;
+using Caster::Metrics;
+
+void Histogram::add(uint64_t value) noexcept
+{
+    size_t bucket = 0;
+    while (bucket < bucketCount && value > (uint64_t(1) << bucket))
+        ++bucket;
+    ++m_buckets[bucket];
+    ++m_count;
+    m_sum += value;
+    m_max = std::max(m_max, value);
+}
+
+void Histogram::write(std::ostream& stream, const std::string& name,
+                      const std::string& labels) const
+{
+    const std::string prefix = labels.empty() ? labels : labels + ",";
+    uint64_t total = 0;
+    for (size_t i = 0; i < bucketCount; ++i) {
+        total += m_buckets[i];
+        stream << name << "_bucket{" << prefix << "le=\"" << (uint64_t(1) << i) << "\"} " << total << "\n";
+    }
+    stream << name << "_bucket{" << prefix << "le=\"+Inf\"} " << m_count << "\n"
+           << name << "_sum{" << labels << "} " << m_sum << "\n"
+           << name << "_count{" << labels << "} " << m_count << "\n"
+           << name << "_max{" << labels << "} " << m_max << "\n";
+}
+
+Metrics& Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+Caster::ObjectMetrics& Metrics::objects(const std::string& type, size_t size)
+{
+    ObjectMetrics& res = m_objects[type];
+    res.size = size;
+    return res;
+}
+
+const char* Caster::handlerName(HandlerType type) noexcept
+{
+    static const char* const names[handlerTypeCount] = {
+        "resolve",
+        "connect",
+        "write_request",
+        "read_status",
+        "read_headers",
+        "read_challenge",
+        "readable",
+        "write_data",
+        "batch_timer",
+        "adopt"
+    };
+    return names[static_cast<size_t>(type)];
+}
+
+Caster::ConnectionMetrics* Metrics::connection(const std::string& name)
+{
+    return m_handlerProfiling ? &m_connections[name] : nullptr;
+}
+
+void Metrics::write(std::ostream& stream) const
+{
+    for (const auto& kv : m_mountpoints) {
+        const std::string labels = "mountpoint=\"" + kv.first + "\"";
+        kv.second.epochAge.write(stream, "ntriprelay_epoch_age_ms", labels);
+        stream << "ntriprelay_stale_frames_total{" << labels << "} " << kv.second.staleFrames << "\n";
+    }
+    for (const auto& kv : m_destinations) {
+        const std::string labels = "destination=\"" + kv.first + "\"";
+        stream << "ntriprelay_destination_writes_total{" << labels << "} " << kv.second.writes << "\n"
+               << "ntriprelay_destination_epochs_total{" << labels << "} " << kv.second.epochs << "\n"
+               << "ntriprelay_destination_takeovers_total{" << labels << "} " << kv.second.takeovers << "\n"
+               << "ntriprelay_destination_replayed_frames_total{" << labels << "} " << kv.second.replayed << "\n";
+        kv.second.batchDelay.write(stream, "ntriprelay_destination_batch_delay_us", labels);
+    }
+    for (const auto& kv : m_objects) {
+        const std::string labels = "type=\"" + kv.first + "\"";
+        stream << "ntriprelay_objects{" << labels << "} " << kv.second.live << "\n"
+               << "ntriprelay_object_bytes{" << labels << "} " << kv.second.size << "\n";
+    }
+    for (const auto& kv : m_connections) {
+        for (size_t i = 0; i < handlerTypeCount; ++i) {
+            const Histogram& runTime = kv.second.runTime[i];
+            if (runTime.count() == 0)
+                continue;
+            const std::string labels = "connection=\"" + kv.first + "\",handler=\"" +
+                                       handlerName(static_cast<HandlerType>(i)) + "\"";
+            runTime.write(stream, "ntriprelay_handler_run_ns", labels);
+        }
+    }
+    if (m_handlerProfiling) {
+        m_loop.delay.write(stream, "ntriprelay_loop_delay_us", "loop=\"main\"");
+        stream << "ntriprelay_handlers_pending " << m_loop.pendingHandlers << "\n";
+    }
+    if (m_admission.admitted > 0 || m_admission.waiting > 0) {
+        stream << "ntriprelay_admission_waiting " << m_admission.waiting << "\n"
+               << "ntriprelay_admission_admitted_total " << m_admission.admitted << "\n";
+        m_admission.delay.write(stream, "ntriprelay_admission_delay_ms", "");
+    }
+    // Buffers held by connections with data in flight.
+    stream << "ntriprelay_buffers_lent{buffer=\"message\"} " << Caster::BufferPool<Caster::MessageBuffer>::instance().lent() << "\n"
+           << "ntriprelay_buffers_lent{buffer=\"payload\"} " << Caster::BufferPool<std::vector<uint8_t>>::instance().lent() << "\n";
+#ifdef NTRIP_ALLOCATION_COUNT
+    stream << "ntriprelay_heap_allocations_total " << Caster::allocationCount() << "\n";
+#endif
+}
@@ -0,0 +1,121 @@
+#ifndef __CASTER_METRICS_H__
+#define __CASTER_METRICS_H__
+
+#include <array>
+#include <map>
+#include <string>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+namespace Caster {
+
+// Histogram with power of two bucket bounds: 1, 2, 4, ... and +Inf.
+class Histogram {
+    public:
+        static constexpr size_t bucketCount = 18;
+
+        void add(uint64_t value) noexcept;
+
+        uint64_t count() const noexcept { return m_count; }
+        uint64_t sum() const noexcept { return m_sum; }
+        uint64_t max() const noexcept { return m_max; }
+
+        void write(std::ostream& stream, const std::string& name,
+                   const std::string& labels) const;
+
+    private:
+        std::array<uint64_t, bucketCount + 1> m_buckets{};
+        uint64_t m_count = 0;
+        uint64_t m_sum = 0;
+        uint64_t m_max = 0;
+};
+
+struct MountpointMetrics {
+    Histogram epochAge; // ms, from the base station epoch to the reception
+    uint64_t staleFrames = 0;
+};
+
+struct DestinationMetrics {
+    uint64_t writes = 0;
+    uint64_t epochs = 0; // observation messages that ended an epoch
+    Histogram batchDelay; // us, from the first frame of a batch to its write
+    uint64_t takeovers = 0; // from a failed member of the cluster
+    uint64_t replayed = 0; // frames sent again on takeover
+};
+
+// Completion handlers of a connection, see Connection::track.
+enum class HandlerType {
+    Resolve,
+    Connect,
+    WriteRequest,
+    ReadStatus,
+    ReadHeaders,
+    ReadChallenge,
+    Readable,
+    WriteData,
+    BatchTimer,
+    Adopt
+};
+
+constexpr size_t handlerTypeCount = 10;
+
+const char* handlerName(HandlerType type) noexcept;
+
+struct ConnectionMetrics {
+    std::array<Histogram, handlerTypeCount> runTime; // ns, per handler type
+};
+
+struct LoopMetrics {
+    Histogram delay; // us, from a timer expiry to its handler running
+    uint64_t pendingHandlers = 0; // profiled operations in flight
+};
+
+// Connection attempts held back by the admission limits.
+struct AdmissionMetrics {
+    Histogram delay; // ms, from the start to the admission
+    uint64_t waiting = 0;
+    uint64_t admitted = 0;
+};
+
+// Live objects of a type and the size of each, heap memory they hold while
+// idle is not included.
+struct ObjectMetrics {
+    uint64_t live = 0;
+    size_t size = 0;
+};
+
+// Process-wide counters, written in Prometheus text format. Accessed from the
+// io_service thread only.
+class Metrics {
+    public:
+        static Metrics& instance();
+
+        MountpointMetrics& mountpoint(const std::string& name) { return m_mountpoints[name]; }
+        DestinationMetrics& destination(const std::string& name) { return m_destinations[name]; }
+        ObjectMetrics& objects(const std::string& type, size_t size);
+
+        // Handlers are profiled only if enabled before the connections are
+        // created, otherwise connection() is null and the cost is a check
+        // per handler.
+        void enableHandlerProfiling() noexcept { m_handlerProfiling = true; }
+        bool isHandlerProfiling() const noexcept { return m_handlerProfiling; }
+        ConnectionMetrics* connection(const std::string& name);
+        LoopMetrics& loop() noexcept { return m_loop; }
+        AdmissionMetrics& admission() noexcept { return m_admission; }
+
+        void write(std::ostream& stream) const;
+
+    private:
+        std::map<std::string, MountpointMetrics> m_mountpoints;
+        std::map<std::string, DestinationMetrics> m_destinations;
+        std::map<std::string, ObjectMetrics> m_objects;
+        std::map<std::string, ConnectionMetrics> m_connections;
+        LoopMetrics m_loop;
+        AdmissionMetrics m_admission;
+        bool m_handlerProfiling = false;
+};
+
+}
+
+#endif
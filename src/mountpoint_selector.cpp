@@ -0,0 +1,70 @@
+#include "mountpoint_selector.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <algorithm>
+
+using Caster::MountpointSelector;
+
+MountpointSelector::MountpointSelector(const SourceTablePtr& table, double hysteresis,
+                                       const std::string& navSystems)
+    : m_table(table),
+      m_hysteresis(hysteresis),
+      m_current(SpatialIndex::npos)
+{
+    if (!navSystems.empty())
+        boost::algorithm::split(m_navSystems, navSystems, boost::algorithm::is_any_of("+"));
+    const auto& streams = m_table->streams();
+    for (size_t i = 0; i < streams.size(); ++i)
+        if (isCandidate(i))
+            m_index.add(streams.latitude[i], streams.longitude[i], i);
+    m_index.build();
+}
+
+bool MountpointSelector::isCandidate(size_t stream) const
+{
+    const auto& streams = m_table->streams();
+    if (streams.latitude[stream] == 0 && streams.longitude[stream] == 0)
+        return false;
+    if (streams.nmea[stream])
+        return false;
+    // "RTCM 3", "RTCM 3.2", "RTCM3" and the like.
+    std::string format = boost::algorithm::to_upper_copy(m_table->string(streams.format[stream]));
+    boost::algorithm::erase_all(format, " ");
+    if (format.compare(0, 5, "RTCM3") != 0)
+        return false;
+    if (m_navSystems.empty())
+        return true;
+    std::vector<std::string> carried;
+    const std::string navSystem = boost::algorithm::to_upper_copy(m_table->string(streams.navSystem[stream]));
+    boost::algorithm::split(carried, navSystem, boost::algorithm::is_any_of("+"));
+    for (const auto& system : m_navSystems)
+        if (std::find(carried.begin(), carried.end(), boost::algorithm::to_upper_copy(system)) == carried.end())
+            return false;
+    return true;
+}
+
+void MountpointSelector::setCurrent(const std::string& mountpoint)
+{
+    m_current = SpatialIndex::npos;
+    const auto& streams = m_table->streams();
+    for (size_t i = 0; i < streams.size(); ++i)
+        if (m_table->string(streams.mountpoint[i]) == mountpoint)
+            m_current = i;
+}
+
+std::string MountpointSelector::update(double lat, double lon)
+{
+    const size_t nearest = m_index.nearest(lat, lon);
+    if (nearest == SpatialIndex::npos || nearest == m_current)
+        return "";
+
+    const auto& streams = m_table->streams();
+    if (m_current != SpatialIndex::npos &&
+        distance(lat, lon, streams.latitude[m_current], streams.longitude[m_current]) -
+        distance(lat, lon, streams.latitude[nearest], streams.longitude[nearest]) <= m_hysteresis)
+        return "";
+
+    m_current = nearest;
+    return m_table->string(streams.mountpoint[nearest]);
+}
@@ -0,0 +1,49 @@
+#ifndef __CASTER_MOUNTPOINT_SELECTOR_H__
+#define __CASTER_MOUNTPOINT_SELECTOR_H__
+
+#include "sourcetable.h"
+#include "spatial_index.h"
+
+#include <string>
+#include <vector>
+
+namespace Caster {
+
+// Chooses the nearest stream of a sourcetable for a moving position.
+//
+// Only RTCM 3 streams of a single base are candidates: streams that expect
+// GGA from the client are network solutions whose position says nothing
+// about the distance to a base, and streams without a position would all
+// collapse to 0N 0E.
+//
+// A switch happens only when another stream is closer than the current one
+// by more than the hysteresis distance, so a position near the midpoint
+// between two bases does not flip-flop.
+class MountpointSelector {
+    public:
+        // Nav systems are "+"-separated, as in the sourcetable, a stream has
+        // to carry all of them. Empty accepts any.
+        MountpointSelector(const SourceTablePtr& table, double hysteresis,
+                           const std::string& navSystems = "");
+
+        // Marks the stream that is currently in use, if it is in the table.
+        void setCurrent(const std::string& mountpoint);
+
+        // Returns the mountpoint to switch to or an empty string to stay.
+        std::string update(double lat, double lon);
+
+        size_t size() const noexcept { return m_index.size(); }
+
+    private:
+        SourceTablePtr m_table;
+        std::vector<std::string> m_navSystems;
+        SpatialIndex m_index;
+        double m_hysteresis;
+        size_t m_current;
+
+        bool isCandidate(size_t stream) const;
+};
+
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include "multicast_sink.h"
+
+#include "error.h"
+#include "logger.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <functional> // std::bind
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::MulticastSink;
+
+namespace pls = std::placeholders;
+namespace bs = boost::system;
+namespace ba = boost::asio;
+using udp = ba::ip::udp;
+
+namespace
+{
+
+// Below a typical MTU, every RTCM 3 frame fits.
+const size_t maxPayload = 1400;
+const size_t batchCapacity = 64;
+
+}
+
+MulticastSink::MulticastSink(ba::io_service& ioService, const std::string& address)
+    : m_ioService(ioService),
+      m_socket(ioService),
+      m_ttl(1),
+      m_batch(0, maxPayload, batchCapacity),
+      m_flushPosted(false),
+      m_writing(false),
+      m_dropped(0),
+      m_outstanding(0)
+{
+    const size_t pos = address.rfind(':');
+    bs::error_code ec;
+    const auto group = ba::ip::make_address(address.substr(0, pos), ec);
+    if (pos == std::string::npos || ec)
+        throw CasterError("Invalid multicast address: " + address);
+    try {
+        m_endpoint = udp::endpoint(group, boost::lexical_cast<uint16_t>(address.substr(pos + 1)));
+    } catch (const boost::bad_lexical_cast&) {
+        throw CasterError("Invalid multicast port: " + address);
+    }
+}
+
+void MulticastSink::start(unsigned /*timeout*/)
+{
+    m_batch.clear();
+    m_finishCallback = {};
+    bs::error_code ec;
+    m_socket.open(m_endpoint.protocol(), ec);
+    if (!ec)
+        m_socket.set_option(ba::ip::multicast::hops(static_cast<int>(m_ttl)), ec);
+    if (!ec)
+        m_socket.connect(m_endpoint, ec);
+    if (ec) {
+        m_ioService.post(track([this, ec]() { reportError(ec); }));
+        return;
+    }
+    ERRLOG(logDebug) << "Sending frames to " << m_endpoint;
+    // Nothing to wait for, the sink is ready once the caller's handler
+    // returns.
+    m_ioService.post(track([this]()
+                           {
+                               if (m_socket.is_open() && m_headersCallback)
+                                   m_headersCallback();
+                           }));
+}
+
+void MulticastSink::stop()
+{
+    bs::error_code ec;
+    m_socket.close(ec);
+}
+
+void MulticastSink::send(const FrameBatch& frames)
+{
+    if (!m_socket.is_open())
+        return;
+    const auto now = Clock::now();
+    for (const OutgoingFrame& outgoing : frames) {
+        if (outgoing.expires < now)
+            continue;
+        if (!m_batch.append(outgoing.frame.data, outgoing.frame.size)) {
+            if (++m_dropped % 100 == 1) {
+                ERRLOG(logWarning) << "Multicast send queue is full, " << m_dropped << " frames dropped";
+            }
+        }
+    }
+    postFlush();
+}
+
+void MulticastSink::finish(const EOFCallback& done)
+{
+    m_finishCallback = done;
+    postFlush();
+}
+
+void MulticastSink::postFlush()
+{
+    if (m_flushPosted)
+        return;
+    m_flushPosted = true;
+    m_ioService.post(track([this]()
+                           {
+                               m_flushPosted = false;
+                               flush();
+                           }));
+}
+
+void MulticastSink::flush()
+{
+    if (m_writing)
+        return;
+    if (m_socket.is_open() && !m_batch.empty()) {
+        m_batch.seal([](uint8_t* /*header*/, const uint8_t* /*payload*/, size_t /*size*/) {});
+        const bs::error_code ec = m_batch.send(m_socket.native_handle());
+        if (ec == ba::error::would_block) {
+            m_writing = true;
+            m_socket.async_wait(udp::socket::wait_write,
+                                track(std::bind(&MulticastSink::handleWritable, this, pls::_1)));
+            return;
+        }
+        if (ec) {
+            // Nobody may be listening yet, a unicast target reports that
+            // through ICMP. The stream goes on.
+            ERRLOG(logDebug) << "Multicast send failed: " << ec.message();
+            m_batch.clear();
+        }
+    }
+    if (m_finishCallback && m_batch.empty()) {
+        const auto done = std::move(m_finishCallback);
+        m_finishCallback = {};
+        stop();
+        done();
+    }
+}
+
+void MulticastSink::handleWritable(const bs::error_code& ec)
+{
+    m_writing = false;
+    if (ec || !m_socket.is_open())
+        return;
+    flush();
+}
+
+void MulticastSink::reportError(const bs::error_code& ec)
+{
+    if (m_errorCallback)
+        m_errorCallback(ec);
+}
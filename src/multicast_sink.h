@@ -0,0 +1,73 @@
+#ifndef __CASTER_MULTICAST_SINK_H__
+#define __CASTER_MULTICAST_SINK_H__
+
+#include "sink.h"
+#include "datagram.h"
+
+#include <boost/asio.hpp>
+
+#include <string>
+#include <utility>
+#include <cstdint>
+
+namespace Caster {
+
+// Plain UDP output of raw RTCM 3 frames, meant for a multicast group on the
+// LAN: one send reaches every receiver that joined it. Frames sent within
+// one handler are packed into datagrams and leave with one sendmmsg call.
+class MulticastSink final : public Sink {
+    public:
+        // Address is "group:port", throws CasterError if it does not parse.
+        MulticastSink(boost::asio::io_service& ioService, const std::string& address);
+
+        void setTTL(unsigned ttl) { m_ttl = ttl; }
+
+        void start(unsigned timeout) override;
+        void stop() override;
+        bool isIdle() const override { return m_outstanding == 0; }
+        bool isActive() const override { return m_socket.is_open(); }
+
+        void send(const FrameBatch& frames) override;
+        void finish(const EOFCallback& done) override;
+
+        void setErrorCallback(const ErrorCallback& cb) override { m_errorCallback = cb; }
+        void setHeadersCallback(const HeadersCallback& cb) override { m_headersCallback = cb; }
+
+    private:
+        boost::asio::io_service& m_ioService;
+        boost::asio::ip::udp::endpoint m_endpoint;
+        boost::asio::ip::udp::socket m_socket;
+        unsigned m_ttl;
+        DatagramBatch m_batch;
+        bool m_flushPosted;
+        bool m_writing;
+        uint64_t m_dropped;
+        ErrorCallback m_errorCallback;
+        HeadersCallback m_headersCallback;
+        EOFCallback m_finishCallback;
+        size_t m_outstanding;
+
+        template <typename Handler>
+        auto track(Handler handler);
+
+        void postFlush();
+        void flush();
+        void handleWritable(const boost::system::error_code& ec);
+        void reportError(const boost::system::error_code& ec);
+};
+
+template <typename Handler>
+inline
+auto MulticastSink::track(Handler handler)
+{
+    ++m_outstanding;
+    return [this, handler](auto&&... args) mutable
+           {
+               --m_outstanding;
+               handler(std::forward<decltype(args)>(args)...);
+           };
+}
+
+}
+
+#endif
@@ -0,0 +1,88 @@
+#include "nmea.h"
+
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+
+enum GGAField {
+    ggaType,
+    ggaTime,
+    ggaLatitude,
+    ggaNS,
+    ggaLongitude,
+    ggaEW,
+    ggaQuality,
+    ggaFieldCount
+};
+
+// NMEA angles are packed as (d)ddmm.mmmm
+double toDegrees(const std::string& value)
+{
+    const double raw = std::strtod(value.c_str(), nullptr);
+    const double degrees = static_cast<int>(raw / 100);
+    return degrees + (raw - degrees * 100) / 60;
+}
+
+// NMEA checksum: XOR of all characters between '$' and '*'
+unsigned checksum(const std::string& body)
+{
+    unsigned res = 0;
+    for (const char c : body)
+        res ^= static_cast<unsigned char>(c);
+    return res;
+}
+
+// Angle in 1e-4 minutes, rounded before it is split into degrees and
+// minutes so that 59.99996 minutes carry into the degrees instead of
+// printing as an invalid 60.0000.
+long long toTenThousandthMinutes(double degrees)
+{
+    return std::llround(std::fabs(degrees) * 60 * 10000);
+}
+
+}
+
+bool Caster::parseGGA(const std::string& gga, double& lat, double& lon)
+{
+    std::vector<std::string> fields;
+    boost::algorithm::split(fields, gga, boost::algorithm::is_any_of(",*"));
+    if (fields.size() < ggaFieldCount ||
+        fields[ggaType].size() != 6 ||
+        fields[ggaType].compare(3, 3, "GGA") != 0)
+        return false;
+    if (fields[ggaLatitude].empty() || fields[ggaLongitude].empty() ||
+        fields[ggaQuality].empty() || fields[ggaQuality] == "0")
+        return false;
+
+    lat = toDegrees(fields[ggaLatitude]);
+    if (fields[ggaNS] == "S")
+        lat = -lat;
+    lon = toDegrees(fields[ggaLongitude]);
+    if (fields[ggaEW] == "W")
+        lon = -lon;
+    return true;
+}
+
+std::string Caster::makeGGA(double lat, double lon, time_t time)
+{
+    struct tm brokenTime;
+    gmtime_r(&time, &brokenTime);
+    const long long latUnits = toTenThousandthMinutes(lat);
+    const long long lonUnits = toTenThousandthMinutes(lon);
+    const long long unitsPerDegree = 60 * 10000;
+    char body[96];
+    snprintf(body, sizeof(body), "GPGGA,%02d%02d%02d.00,%02lld%02lld.%04lld,%c,%03lld%02lld.%04lld,%c,1,12,1.0,0.0,M,0.0,M,,",
+             brokenTime.tm_hour, brokenTime.tm_min, brokenTime.tm_sec,
+             latUnits / unitsPerDegree, latUnits % unitsPerDegree / 10000, latUnits % 10000, lat < 0 ? 'S' : 'N',
+             lonUnits / unitsPerDegree, lonUnits % unitsPerDegree / 10000, lonUnits % 10000, lon < 0 ? 'W' : 'E');
+    char sum[4];
+    snprintf(sum, sizeof(sum), "*%02X", checksum(body));
+    return std::string("$") + body + sum;
+}
@@ -0,0 +1,18 @@
+#ifndef __CASTER_NMEA_H__
+#define __CASTER_NMEA_H__
+
+#include <string>
+#include <ctime>
+
+namespace Caster {
+
+// Extracts the position in degrees from a GGA sentence. Returns false if the
+// sentence is not GGA or carries no fix.
+bool parseGGA(const std::string& gga, double& lat, double& lon);
+
+// Builds a GGA sentence with a standalone fix at the given position.
+std::string makeGGA(double lat, double lon, time_t time);
+
+}
+
+#endif
@@ -0,0 +1,240 @@
+#include "recorder.h"
+
+#include "logger.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <cstddef>
+#include <cerrno>
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::Recorder;
+
+namespace Capture = Caster::Capture;
+
+namespace
+{
+
+// The writer wakes up for a batch this big, or after flushInterval.
+const size_t batchSize = 1024 * 1024;
+const auto flushInterval = std::chrono::milliseconds(500);
+// Buffers beyond this are dropped rather than growing memory without bound
+// when the disk is slow.
+const size_t maxPending = 64 * 1024 * 1024;
+
+uint64_t nanoseconds(std::chrono::nanoseconds value)
+{
+    return static_cast<uint64_t>(value.count());
+}
+
+}
+
+Recorder::Recorder(const std::string& prefix, size_t segmentSize,
+                   std::chrono::seconds segmentDuration)
+    : m_prefix(prefix),
+      m_segmentSize(segmentSize),
+      m_segmentDuration(segmentDuration),
+      m_dropped(0),
+      m_stopping(false),
+      m_fd(-1),
+      m_indexFd(-1),
+      m_size(0),
+      m_indexed(0),
+      m_segmentStart(0)
+{
+    m_pending.reserve(batchSize);
+    m_thread = std::thread(&Recorder::run, this);
+}
+
+Recorder::~Recorder()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+    closeSegment();
+}
+
+void Recorder::write(const uint8_t* data, size_t size)
+{
+    const uint64_t monotonic = nanoseconds(std::chrono::steady_clock::now().time_since_epoch());
+    const uint64_t wall = nanoseconds(std::chrono::system_clock::now().time_since_epoch());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pending.size() + Capture::recordHeaderSize + size > maxPending) {
+        ++m_dropped;
+        return;
+    }
+    const size_t pos = m_pending.size();
+    m_pending.resize(pos + Capture::recordHeaderSize + size);
+    Capture::storeRecordHeader(&m_pending[pos], monotonic, wall, static_cast<uint32_t>(size));
+    memcpy(&m_pending[pos + Capture::recordHeaderSize], data, size);
+    if (m_pending.size() >= batchSize)
+        m_cv.notify_one();
+}
+
+uint64_t Recorder::dropped() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dropped;
+}
+
+void Recorder::run()
+{
+    std::vector<uint8_t> batch;
+    batch.reserve(batchSize);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_cv.wait_for(lock, flushInterval, [this]() { return m_stopping || m_pending.size() >= batchSize; });
+        const bool stopping = m_stopping;
+        batch.swap(m_pending);
+        lock.unlock();
+        const size_t stored = batch.empty() ? 0 : store(batch);
+        lock.lock();
+        const bool failed = stored < batch.size();
+        if (failed)
+            keep(batch, stored, stopping);
+        batch.clear();
+        if (stopping && m_pending.empty())
+            return;
+        // The disk is not retried before the next interval.
+        if (failed && !stopping)
+            m_cv.wait_for(lock, flushInterval, [this]() { return m_stopping; });
+    }
+}
+
+void Recorder::keep(const std::vector<uint8_t>& batch, size_t pos, bool stopping)
+{
+    // Records that were not written go first in the next batch, unless
+    // the recorder stops or they would exceed the pending limit.
+    if (!stopping && batch.size() - pos + m_pending.size() <= maxPending) {
+        m_pending.insert(m_pending.begin(), batch.begin() + static_cast<std::ptrdiff_t>(pos), batch.end());
+        return;
+    }
+    uint64_t count = 0;
+    while (pos + Capture::recordHeaderSize <= batch.size()) {
+        uint64_t monotonic = 0;
+        uint64_t wall = 0;
+        uint32_t size = 0;
+        Capture::loadRecordHeader(&batch[pos], monotonic, wall, size);
+        pos += Capture::recordHeaderSize + size;
+        ++count;
+    }
+    m_dropped += count;
+    ERRLOG(logError) << "Dropped " << count << " unwritten capture records";
+}
+
+size_t Recorder::store(const std::vector<uint8_t>& batch)
+{
+    // Records are walked to find segment boundaries and index points, the
+    // runs between them are written with one call each.
+    size_t runStart = 0;
+    size_t pos = 0;
+    while (pos + Capture::recordHeaderSize <= batch.size()) {
+        uint64_t monotonic = 0;
+        uint64_t wall = 0;
+        uint32_t size = 0;
+        Capture::loadRecordHeader(&batch[pos], monotonic, wall, size);
+        const size_t length = Capture::recordHeaderSize + size;
+
+        // A record larger than a segment gets one of its own.
+        const bool full = m_segmentSize > 0 && m_size > Capture::magicSize &&
+                          m_size + length > m_segmentSize;
+        const bool expired = m_segmentDuration.count() > 0 && wall >= m_segmentStart &&
+                             wall - m_segmentStart >= nanoseconds(m_segmentDuration);
+        if (m_fd < 0 || full || expired) {
+            if (m_fd >= 0 && !storeRun(&batch[runStart], pos - runStart))
+                return runStart;
+            runStart = pos;
+            rotate(wall);
+            if (m_fd < 0)
+                return pos;
+        }
+        const size_t offset = m_size;
+        if (m_indexFd >= 0 && (m_indexed == 0 || offset - m_indexed >= Capture::indexInterval)) {
+            const size_t at = m_indexBatch.size();
+            m_indexBatch.resize(at + Capture::indexEntrySize);
+            Capture::storeIndexEntry(&m_indexBatch[at], Capture::IndexEntry{wall, monotonic, offset});
+            m_indexed = offset;
+        }
+        m_size += length;
+        pos += length;
+    }
+    if (m_fd >= 0 && !storeRun(&batch[runStart], pos - runStart))
+        return runStart;
+    return batch.size();
+}
+
+bool Recorder::storeRun(const uint8_t* data, size_t size)
+{
+    if (!writeAll(m_fd, data, size)) {
+        // The offsets of the run are void, the segment ends with what was
+        // written and its records go to the next one.
+        m_indexBatch.clear();
+        closeSegment();
+        return false;
+    }
+    // The index is written after the data it points to.
+    if (m_indexFd >= 0 && !m_indexBatch.empty())
+        writeAll(m_indexFd, m_indexBatch.data(), m_indexBatch.size());
+    m_indexBatch.clear();
+    return true;
+}
+
+void Recorder::rotate(uint64_t wall)
+{
+    closeSegment();
+
+    const std::string path = Capture::segmentPath(m_prefix, wall);
+    ERRLOG(logInfo) << "Recording to " << path;
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        ERRLOG(logError) << "Failed to create " << path << ": " << strerror(errno);
+        return;
+    }
+    m_indexFd = ::open(Capture::indexPath(path).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_indexFd < 0) {
+        ERRLOG(logWarning) << "Failed to create index for " << path << ": " << strerror(errno);
+    }
+    if (!writeAll(m_fd, reinterpret_cast<const uint8_t*>(Capture::segmentMagic), Capture::magicSize)) {
+        closeSegment();
+        return;
+    }
+    if (m_indexFd >= 0)
+        writeAll(m_indexFd, reinterpret_cast<const uint8_t*>(Capture::indexMagic), Capture::magicSize);
+    m_size = Capture::magicSize;
+    m_indexed = 0;
+    m_segmentStart = wall;
+}
+
+void Recorder::closeSegment()
+{
+    if (m_indexFd >= 0)
+        ::close(m_indexFd);
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    m_indexFd = -1;
+}
+
+bool Recorder::writeAll(int fd, const uint8_t* data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t res = ::write(fd, data, size);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            ERRLOG(logError) << "Failed to write capture: " << strerror(errno);
+            return false;
+        }
+        data += res;
+        size -= static_cast<size_t>(res);
+    }
+    return true;
+}
@@ -0,0 +1,77 @@
+#ifndef __CASTER_RECORDER_H__
+#define __CASTER_RECORDER_H__
+
+#include "capture.h"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <cstdint>
+
+namespace Caster {
+
+// Appends received buffers to capture segments, see capture.h. Buffers are
+// collected on the caller's thread and written in large batches by a
+// background thread, so the caller never waits for the disk.
+class Recorder
+{
+    public:
+        // Segments are named <prefix>-<UTC start time>.rec and rotate when
+        // they exceed segmentSize bytes or segmentDuration, zero disables
+        // either limit.
+        Recorder(const std::string& prefix, size_t segmentSize,
+                 std::chrono::seconds segmentDuration);
+        ~Recorder();
+
+        Recorder(const Recorder&) = delete;
+        Recorder& operator=(const Recorder&) = delete;
+
+        void write(const uint8_t* data, size_t size);
+
+        // Buffers dropped because the writer fell behind, or could not write
+        // them before the recorder stopped.
+        uint64_t dropped() const;
+
+    private:
+        std::string m_prefix;
+        size_t m_segmentSize;
+        std::chrono::seconds m_segmentDuration;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::vector<uint8_t> m_pending;
+        uint64_t m_dropped;
+        bool m_stopping;
+
+        // Writer thread only.
+        int m_fd;
+        int m_indexFd;
+        size_t m_size;
+        size_t m_indexed;
+        uint64_t m_segmentStart;
+        std::vector<uint8_t> m_indexBatch;
+
+        std::thread m_thread;
+
+        void run();
+        // Puts records back into m_pending after a failure, m_mutex held.
+        void keep(const std::vector<uint8_t>& batch, size_t pos, bool stopping);
+        // Returns the position of the first record not written.
+        size_t store(const std::vector<uint8_t>& batch);
+        // Writes a run of records of the current segment and then their
+        // index entries, closes the segment on failure.
+        bool storeRun(const uint8_t* data, size_t size);
+        void rotate(uint64_t wall);
+        void closeSegment();
+        bool writeAll(int fd, const uint8_t* data, size_t size);
+};
+
+using RecorderPtr = std::shared_ptr<Recorder>;
+
+}
+
+#endif
@@ -1,7 +1,16 @@
 #include "relay.h"
 
+#include "logger.h"
+#include "nmea.h"
+#include "utils.h"
+
+#include <unistd.h>
+
 #include <functional> // std::bind
 
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
 using Caster::Relay;
 
 namespace pls = std::placeholders;
@@ -11,70 +20,465 @@ Relay::Relay(boost::asio::io_service& ioService,
              const std::string& srcMountpoint,
              const std::string& dstServer, uint16_t dstPort,
              const std::string& dstMountpoint)
-    : m_client(ioService, srcServer, srcPort, srcMountpoint),
-      m_server(ioService, dstServer, dstPort, dstMountpoint)
+    : m_ioService(ioService),
+      m_srcServer(srcServer),
+      m_srcPort(srcPort),
+      m_srcMountpoint(srcMountpoint),
+      m_deferSource(false),
+      m_timeout(0),
+      m_priority(0),
+      m_started(false),
+      m_server(dstServer.empty() ? nullptr : new Server(ioService, dstServer, dstPort, dstMountpoint)),
+      m_maxAge(0),
+      m_batchDeadline(0),
+      m_metrics(srcMountpoint.empty() ? nullptr : &Metrics::instance().mountpoint(srcMountpoint)),
+      m_cache(srcMountpoint.empty() ? nullptr : &MessageCache::mountpoint(srcMountpoint))
+{
+    ++Metrics::instance().objects("relay", sizeof(Relay)).live;
+    if (!srcMountpoint.empty())
+        m_client = makeClient(srcMountpoint);
+}
+
+Relay::~Relay()
+{
+    --Metrics::instance().objects("relay", sizeof(Relay)).live;
+}
+
+Relay::Relay(boost::asio::io_service& ioService,
+             SourcePtr source, const std::string& name, SinkPtr sink)
+    : Relay(ioService, "", 0, "", "", 0, "")
+{
+    setSource(std::move(source), name);
+    setSink(std::move(sink));
+}
+
+void Relay::start(unsigned timeout)
+{
+    m_timeout = timeout;
+    m_started = true;
+    initCallbacks();
+    if (m_client && (!m_deferSource || !m_server))
+        m_client->start(timeout);
+    if (m_pending)
+        m_pending->start(timeout);
+    if (m_server)
+        m_server->start(timeout);
+}
+
+void Relay::stop()
+{
+    clearCallbacks();
+    if (m_client)
+        m_client->stop();
+    if (m_pending)
+        m_pending->stop();
+    if (m_server)
+        m_server->stop();
+}
+
+bool Relay::suspend()
+{
+    // A source switch in progress would be lost.
+    if (!m_started || !m_client || m_pending || !m_server || !m_server->isActive() ||
+        !m_client->canHandOver() || !m_server->canHandOver())
+        return false;
+    m_client->suspend();
+    m_server->suspend();
+    return true;
+}
+
+bool Relay::detach(Handover::RelayState& state)
+{
+    bool res = m_client->detach(state.source, state.sourceFd);
+    if (res && !m_server->detach(state.sink, state.sinkFd)) {
+        ::close(state.sourceFd);
+        state.sourceFd = -1;
+        res = false;
+    }
+    if (res)
+        state.framer.assign(m_framer.pending().begin(), m_framer.pending().end());
+    stop();
+    return res;
+}
+
+void Relay::adopt(Handover::RelayState& state, unsigned timeout)
+{
+    if (!m_client || m_pending || !m_server) {
+        Handover::close(state);
+        start(timeout);
+        return;
+    }
+    m_timeout = timeout;
+    m_started = true;
+    // Both sides are running already, a sink that reconnects must not
+    // start the source again.
+    m_deferSource = false;
+    initCallbacks();
+    m_framer.restore(reinterpret_cast<const uint8_t*>(state.framer.data()), state.framer.size());
+    // A side that cannot go on with its socket connects anew.
+    if (!m_client->adopt(state.sourceFd, state.source, timeout)) {
+        ::close(state.sourceFd);
+        m_client->start(timeout);
+    }
+    state.sourceFd = -1;
+    if (!m_server->adopt(state.sinkFd, state.sink, timeout)) {
+        ::close(state.sinkFd);
+        m_server->start(timeout);
+    }
+    state.sinkFd = -1;
+}
+
+bool Relay::isIdle() const
+{
+    for (const auto& client : m_retired)
+        if (!client->isIdle())
+            return false;
+    return (!m_client || m_client->isIdle()) &&
+           (!m_pending || m_pending->isIdle()) &&
+           (!m_server || m_server->isIdle());
+}
+
+void Relay::setGGA(const std::string& gga)
+{
+    m_gga = gga;
+    if (m_client)
+        m_client->setGGA(gga);
+    if (m_pending)
+        m_pending->setGGA(gga);
+    if (m_selector)
+        select();
+}
+
+void Relay::setSrcCredentials(const std::string& login,
+                              const std::string& password)
+{
+    m_srcLogin = login;
+    m_srcPassword = password;
+    if (m_client)
+        m_client->setCredentials(login, password);
+}
+
+void Relay::setDstCredentials(const std::string& login,
+                              const std::string& password)
+{
+    m_dstLogin = login;
+    m_dstPassword = password;
+    if (m_server)
+        m_server->setCredentials(login, password);
+}
+
+void Relay::setPriority(unsigned priority)
 {
+    m_priority = priority;
+    if (m_client)
+        m_client->setPriority(priority);
+    if (m_pending)
+        m_pending->setPriority(priority);
+    if (m_server)
+        m_server->setPriority(priority);
+}
+
+void Relay::setBatchDeadline(std::chrono::microseconds deadline)
+{
+    m_batchDeadline = deadline;
+    if (m_server)
+        m_server->setBatchDeadline(deadline);
+}
+
+void Relay::setSourceTable(const SourceTablePtr& table, double hysteresis,
+                           const std::string& navSystems)
+{
+    m_selector.reset(new MountpointSelector(table, hysteresis, navSystems));
+    m_selector->setCurrent(m_srcMountpoint);
+    ERRLOG(logDebug) << "Source mountpoint selection over " << m_selector->size() << " streams";
+    select();
+}
+
+void Relay::setHeadersCallback(const HeadersCallback& cb)
+{
+    m_headersCallback = cb;
+    if (m_client)
+        m_client->setHeadersCallback(cb);
+}
+
+const std::map<std::string, std::string>& Relay::headers() const
+{
+    static const std::map<std::string, std::string> none;
+    return m_client ? m_client->headers() : none;
+}
+
+void Relay::setSource(SourcePtr source, const std::string& name)
+{
+    m_client = std::move(source);
+    m_srcMountpoint = name;
+    // Started once the destination accepts data, so nothing of a recorded
+    // stream is dropped before it is connected.
+    m_deferSource = true;
+    m_metrics = &Metrics::instance().mountpoint(name);
+    m_cache = &MessageCache::mountpoint(name);
+    if (!m_srcLogin.empty() || !m_srcPassword.empty())
+        m_client->setCredentials(m_srcLogin, m_srcPassword);
+    if (!m_gga.empty())
+        m_client->setGGA(m_gga);
+    m_client->setPriority(m_priority);
+    if (m_headersCallback)
+        m_client->setHeadersCallback(m_headersCallback);
+}
+
+void Relay::setSink(SinkPtr sink)
+{
+    m_server = std::move(sink);
+    if (!m_server)
+        return;
+    if (!m_dstLogin.empty() || !m_dstPassword.empty())
+        m_server->setCredentials(m_dstLogin, m_dstPassword);
+    m_server->setPriority(m_priority);
+    m_server->setBatchDeadline(m_batchDeadline);
+}
+
+Caster::SourcePtr Relay::makeClient(const std::string& mountpoint) const
+{
+    SourcePtr client(new Client(m_ioService, m_srcServer, m_srcPort, mountpoint));
+    if (!m_srcLogin.empty() || !m_srcPassword.empty())
+        client->setCredentials(m_srcLogin, m_srcPassword);
+    if (!m_gga.empty())
+        client->setGGA(m_gga);
+    client->setPriority(m_priority);
+    return client;
+}
+
+void Relay::select()
+{
+    double lat = 0;
+    double lon = 0;
+    if (!parseGGA(m_gga, lat, lon))
+        return;
+    const std::string mountpoint = m_selector->update(lat, lon);
+    if (!mountpoint.empty())
+        switchTo(mountpoint);
+}
+
+void Relay::switchTo(const std::string& mountpoint)
+{
+    ERRLOG(logInfo) << "Switching source to the nearest mountpoint " << mountpoint;
+    if (m_pending)
+        retire(std::move(m_pending));
+    m_pending = makeClient(mountpoint);
+    m_pendingMountpoint = mountpoint;
+    // The first selection has no source to keep streaming meanwhile.
+    const bool first = !m_client;
+    if (first)
+        promote();
+    if (!m_started)
+        return;
+    Source& client = first ? *m_client : *m_pending;
+    initCallbacks(client);
+    client.start(m_timeout);
+}
+
+void Relay::promote()
+{
+    if (m_client)
+        retire(std::move(m_client));
+    m_client = std::move(m_pending);
+    m_srcMountpoint = m_pendingMountpoint;
+    if (m_headersCallback)
+        m_client->setHeadersCallback(m_headersCallback);
+    m_framer.reset();
+    m_metrics = &Metrics::instance().mountpoint(m_srcMountpoint);
+    m_cache = &MessageCache::mountpoint(m_srcMountpoint);
+}
+
+void Relay::retire(SourcePtr client)
+{
+    // Completion handlers of a stopped client still refer to it, so it is
+    // destroyed only after they all have run, see handleData.
+    clearCallbacks(*client);
+    client->stop();
+    m_retired.push_back(std::move(client));
 }
 
 void Relay::initCallbacks()
 {
-    m_client.setErrorCallback(
+    if (m_client)
+        initCallbacks(*m_client);
+    if (m_pending)
+        initCallbacks(*m_pending);
+    if (!m_server)
+        return;
+    m_server->setErrorCallback(
         std::bind(
             &Relay::handleError,
             shared_from_this(),
             pls::_1
         )
     );
-    m_client.setDataCallback(
+    m_server->setHeadersCallback(std::bind(&Relay::handleServerReady, shared_from_this()));
+}
+
+void Relay::initCallbacks(Source& client)
+{
+    client.setErrorCallback(
         std::bind(
-            &Relay::handleData,
+            &Relay::handleSourceError,
             shared_from_this(),
+            &client,
             pls::_1
         )
     );
-    m_client.setEOFCallback(
+    client.setDataCallback(
         std::bind(
-            &Relay::handleEOF,
-            shared_from_this()
+            &Relay::handleData,
+            shared_from_this(),
+            &client,
+            pls::_1
         )
     );
-    m_server.setErrorCallback(
+    client.setEOFCallback(
         std::bind(
-            &Relay::handleError,
+            &Relay::handleEOF,
             shared_from_this(),
-            pls::_1
+            &client
         )
     );
 }
 
 void Relay::clearCallbacks()
 {
-    m_client.resetErrorCallback();
-    m_client.resetDataCallback();
-    m_client.resetEOFCallback();
-    m_server.resetErrorCallback();
+    if (m_client)
+        clearCallbacks(*m_client);
+    if (m_pending)
+        clearCallbacks(*m_pending);
+    if (m_server)
+        m_server->resetCallbacks();
+}
+
+void Relay::clearCallbacks(Source& client)
+{
+    client.resetCallbacks();
 }
 
 void Relay::handleError(const boost::system::error_code& ec)
 {
     if (m_errorCallback)
         m_errorCallback(ec);
-    clearCallbacks();
-    m_client.stop();
-    m_server.stop();
+    stop();
 }
 
-void Relay::handleData(const boost::asio::const_buffers_1& buffers)
+void Relay::handleSourceError(const Source* client,
+                              const boost::system::error_code& ec)
 {
-    if (m_server.isActive())
-        m_server.send(buffers);
+    if (client != m_pending.get()) {
+        handleError(ec);
+        return;
+    }
+    // The current source keeps working, the switch is retried when a
+    // position update picks the stream again.
+    ERRLOG(logWarning) << "Failed to switch source to " << m_pendingMountpoint << ": " << ec.message();
+    m_ioService.post([self = shared_from_this()]()
+                     {
+                         if (self->m_pending)
+                             self->retire(std::move(self->m_pending));
+                     });
+    m_selector->setCurrent(m_srcMountpoint);
 }
 
-void Relay::handleEOF()
+void Relay::handleData(const Source* client,
+                       const boost::asio::const_buffers_1& buffers)
 {
-    if (m_eofCallback)
-        m_eofCallback();
-    clearCallbacks();
-    m_client.stop();
-    m_server.stop();
+    // The first data from the next source completes the switch.
+    if (client == m_pending.get())
+        promote();
+    if (!m_retired.empty())
+        purgeIdle(m_retired);
+
+    const auto& buffer = *buffers.begin();
+    if (m_recorder && client == m_client.get())
+        m_recorder->write(boost::asio::buffer_cast<const uint8_t*>(buffer),
+                          boost::asio::buffer_size(buffer));
+    // The frames of a buffer arrived together, they share the clock readings.
+    const auto now = std::chrono::system_clock::now();
+    const auto steadyNow = FrameScheduler::Clock::now();
+    m_framer.feed(boost::asio::buffer_cast<const uint8_t*>(buffer),
+                  boost::asio::buffer_size(buffer),
+                  [this, now, steadyNow](const RTCM::Frame& frame) { handleFrame(frame, now, steadyNow); },
+                  [this]() { sendFrames(); });
+}
+
+void Relay::handleFrame(const RTCM::Frame& frame,
+                        std::chrono::system_clock::time_point now,
+                        FrameScheduler::Clock::time_point steadyNow)
+{
+    auto expires = FrameScheduler::Clock::time_point::max();
+    if (frame.info.hasEpoch) {
+        const auto age = RTCM::epochAge(frame.info, now);
+        m_metrics->epochAge.add(age.count() > 0 ? static_cast<uint64_t>(age.count()) : 0);
+        if (m_maxAge.count() > 0) {
+            if (age > m_maxAge) {
+                ++m_metrics->staleFrames;
+                return;
+            }
+            expires = steadyNow + (m_maxAge - age);
+        }
+    }
+
+    m_cache->update(frame);
+    if (m_shmRing)
+        m_shmRing->write(frame.data, frame.size, frame.info.type);
+    m_frames.push_back(OutgoingFrame{frame, expires});
+}
+
+void Relay::sendFrames()
+{
+    // One call into the sink per source buffer.
+    if (!m_frames.empty() && m_server && m_server->isActive())
+        m_server->send(m_frames);
+    m_frames.clear();
+}
+
+void Relay::handleEOF(const Source* client)
+{
+    if (client == m_pending.get()) {
+        handleSourceError(client, boost::system::error_code(boost::asio::error::eof));
+        return;
+    }
+    if (!m_server || !m_server->isActive()) {
+        if (m_eofCallback)
+            m_eofCallback();
+        stop();
+        return;
+    }
+    // Frames still queued for the destination are delivered first.
+    m_server->finish([self = shared_from_this()]()
+                     {
+                         if (self->m_eofCallback)
+                             self->m_eofCallback();
+                         self->stop();
+                     });
+}
+
+void Relay::handleServerReady()
+{
+    prime();
+    // A sink that fails over to another caster is ready again, the source
+    // is running by then.
+    if (m_deferSource && m_client) {
+        m_deferSource = false;
+        m_client->start(m_timeout);
+    }
+}
+
+void Relay::prime()
+{
+    // A rover fixes only once it has the station position and ephemerides,
+    // the latest ones go out ahead of the live stream instead of waiting
+    // for the base station to repeat them.
+    if (!m_cache || m_cache->empty())
+        return;
+    ERRLOG(logDebug) << "Priming destination with " << m_cache->size() << " cached messages of " << m_srcMountpoint;
+    const auto expires = FrameScheduler::Clock::time_point::max();
+    m_frames.clear();
+    m_cache->forEach([this, expires](const RTCM::Frame& frame) { m_frames.push_back(OutgoingFrame{frame, expires}); });
+    m_server->send(m_frames);
+    m_frames.clear();
 }
@@ -2,15 +2,28 @@
 #define __CASTER_RELAY_H__
 
 #include "client.h"
+#include "source.h"
 #include "server.h"
+#include "sink.h"
 #include "callbacks.h"
+#include "rtcm.h"
+#include "metrics.h"
+#include "message_cache.h"
+#include "sourcetable.h"
+#include "mountpoint_selector.h"
+#include "recorder.h"
+#include "shm_ring.h"
+#include "handover.h"
+#include "string_pool.h"
 
 #include <boost/system/error_code.hpp>
 #include <boost/asio.hpp>
 
 #include <memory>
 #include <string>
+#include <vector>
 #include <map>
+#include <chrono>
 #include <cstdint>
 
 namespace Caster {
@@ -18,47 +31,133 @@ namespace Caster {
 class Relay : public std::enable_shared_from_this<Relay>
 {
     public:
+        // Empty source mountpoint means that it is chosen from the
+        // sourcetable, see setSourceTable(). Empty destination server means
+        // that there is no destination caster, see setSink().
         Relay(boost::asio::io_service& ioService,
               const std::string& srcServer, uint16_t srcPort,
               const std::string& srcMountpoint,
               const std::string& dstServer, uint16_t dstPort,
               const std::string& dstMountpoint);
+        // Relays from any source to any sink, the name labels the source in
+        // metrics.
+        Relay(boost::asio::io_service& ioService,
+              SourcePtr source, const std::string& name, SinkPtr sink);
+        ~Relay();
 
-        void start()
-        { initCallbacks(); m_client.start(); m_server.start(); }
+        void start() { start(0); }
+        void start(unsigned timeout);
+        void stop();
 
-        void start(unsigned timeout)
-        {
-            initCallbacks();
-            m_client.start(timeout);
-            m_server.start(timeout);
-        }
+        // Upgrade without reconnecting, see RelayManager::handOver. Stops
+        // the I/O of a relay whose connections can go on in another
+        // process, false if they cannot.
+        bool suspend();
+        // Releases the sockets of a suspended idle relay and tells where its
+        // streams stopped, false if it cannot be handed over. The relay is
+        // stopped either way.
+        bool detach(Handover::RelayState& state);
+        // Starts with the connections of a relay handed over by another
+        // process instead of connecting, the sockets belong to the relay
+        // from now on.
+        void adopt(Handover::RelayState& state, unsigned timeout);
 
-        void setGGA(const std::string& gga) { m_client.setGGA(gga); }
+        void setGGA(const std::string& gga);
+        // Observations older than this are not relayed, zero disables the check.
+        void setMaxAge(std::chrono::milliseconds maxAge) { m_maxAge = maxAge; }
+        // Destination writes wait for the end of an epoch up to this long,
+        // zero writes every frame right away.
+        void setBatchDeadline(std::chrono::microseconds deadline);
         void setSrcCredentials(const std::string& login,
-                               const std::string& password)
-        { m_client.setCredentials(login, password); }
+                               const std::string& password);
         void setDstCredentials(const std::string& login,
-                               const std::string& password)
-        { m_server.setCredentials(login, password); }
+                               const std::string& password);
+        // Connections of relays with a higher priority are admitted first
+        // when connection attempts are paced.
+        void setPriority(unsigned priority);
+
+        // Follows the nearest stream of the source caster as the GGA position
+        // changes. The new source is connected before the old one is
+        // dropped. Only streams that carry the given systems are followed,
+        // see MountpointSelector.
+        void setSourceTable(const SourceTablePtr& table, double hysteresis,
+                            const std::string& navSystems = "");
+        // Takes data from the given source instead of the source caster,
+        // before start().
+        void setSource(SourcePtr source, const std::string& name);
+        // Sends frames to the given sink instead of the destination caster,
+        // before start().
+        void setSink(SinkPtr sink);
+        // Records every buffer received from the source.
+        void setRecorder(const RecorderPtr& recorder) { m_recorder = recorder; }
+        // Publishes every frame to a shared memory ring for local readers.
+        // With an empty destination server it is the only output.
+        void setShmRing(std::unique_ptr<Shm::Writer> ring) { m_shmRing = std::move(ring); }
 
         void setErrorCallback(const ErrorCallback& cb) { m_errorCallback = cb; }
         void setEOFCallback(const EOFCallback& cb) { m_eofCallback = cb; }
-        void setHeadersCallback(const HeadersCallback& cb) { m_client.setHeadersCallback(cb); }
+        void setHeadersCallback(const HeadersCallback& cb);
 
-        const std::map<std::string, std::string>& headers() const { return m_client.headers(); }
+        const std::map<std::string, std::string>& headers() const;
+        const std::string& srcMountpoint() const { return m_srcMountpoint.str(); }
+        // A stopped relay can be destroyed once no completion handler refers
+        // to its connections.
+        bool isIdle() const;
 
     private:
-        Client m_client;
-        Server m_server;
+        boost::asio::io_service& m_ioService;
+        SharedString m_srcServer;
+        uint16_t m_srcPort;
+        SharedString m_srcMountpoint;
+        SharedString m_pendingMountpoint;
+        bool m_deferSource; // started once the destination accepts data
+        std::string m_srcLogin;
+        std::string m_srcPassword;
+        std::string m_gga;
+        unsigned m_timeout;
+        unsigned m_priority;
+        bool m_started;
+        SourcePtr m_client;
+        SourcePtr m_pending; // next source, until it delivers data
+        std::vector<SourcePtr> m_retired;
+        std::string m_dstLogin;
+        std::string m_dstPassword;
+        SinkPtr m_server;
+        std::unique_ptr<MountpointSelector> m_selector;
+        RTCM::Framer m_framer;
+        FrameBatch m_frames; // of the source buffer being framed
+        std::chrono::milliseconds m_maxAge;
+        std::chrono::microseconds m_batchDeadline;
+        MountpointMetrics* m_metrics;
+        MessageCache* m_cache; // station and ephemeris messages of the source
+        RecorderPtr m_recorder;
+        std::unique_ptr<Shm::Writer> m_shmRing;
         ErrorCallback m_errorCallback;
         EOFCallback m_eofCallback;
+        HeadersCallback m_headersCallback;
+
+        SourcePtr makeClient(const std::string& mountpoint) const;
+        void select();
+        void switchTo(const std::string& mountpoint);
+        void promote();
+        void retire(SourcePtr client);
 
         void initCallbacks();
+        void initCallbacks(Source& client);
         void clearCallbacks();
+        void clearCallbacks(Source& client);
         void handleError(const boost::system::error_code& ec);
-        void handleData(const boost::asio::const_buffers_1& buffers);
-        void handleEOF();
+        void handleSourceError(const Source* client,
+                               const boost::system::error_code& ec);
+        void handleData(const Source* client,
+                        const boost::asio::const_buffers_1& buffers);
+        void handleFrame(const RTCM::Frame& frame,
+                         std::chrono::system_clock::time_point now,
+                         FrameScheduler::Clock::time_point steadyNow);
+        void sendFrames();
+        void handleEOF(const Source* client);
+        void handleServerReady();
+        void prime();
 };
 
 using RelayPtr = std::shared_ptr<Relay>;
@@ -0,0 +1,254 @@
+#include "relay_config.h"
+#include "error.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <fstream>
+#include <sstream>
+
+using Caster::RelayConfig;
+using Caster::RelayConfigs;
+using Caster::CasterError;
+
+namespace
+{
+
+template <typename T>
+T toNumber(const std::string& key, const std::string& value)
+{
+    try
+    {
+        return boost::lexical_cast<T>(value);
+    }
+    catch (const boost::bad_lexical_cast&)
+    {
+        throw CasterError("Invalid " + key + " value: " + value);
+    }
+}
+
+bool toBool(const std::string& key, const std::string& value)
+{
+    if (value == "1" || value == "yes" || value == "true")
+        return true;
+    if (value == "0" || value == "no" || value == "false")
+        return false;
+    throw CasterError("Invalid " + key + " value: " + value);
+}
+
+}
+
+RelayConfig::RelayConfig() noexcept
+    : srcPort(2101),
+      dstPort(2101),
+      replaySpeed(1),
+      srcRtp(false),
+      srcTcp(false),
+      srcListen(0),
+      srcIngest(false),
+      dstRtp(false),
+      dstReplay(1000),
+      dstSpread(false),
+      multicastTTL(1),
+      timeout(120),
+      maxAge(0),
+      batchDeadline(0),
+      priority(0)
+{
+}
+
+void RelayConfig::set(const std::string& key, const std::string& value)
+{
+    if (key == "src-server")
+        srcServer = value;
+    else if (key == "src-port")
+        srcPort = toNumber<uint16_t>(key, value);
+    else if (key == "src-mountpoint")
+        srcMountpoint = value;
+    else if (key == "src-login")
+        srcLogin = value;
+    else if (key == "src-password")
+        srcPassword = value;
+    else if (key == "dst-server")
+        dstServer = value;
+    else if (key == "dst-port")
+        dstPort = toNumber<uint16_t>(key, value);
+    else if (key == "dst-mountpoint")
+        dstMountpoint = value;
+    else if (key == "dst-login")
+        dstLogin = value;
+    else if (key == "dst-password")
+        dstPassword = value;
+    else if (key == "gga")
+        gga = value;
+    else if (key == "record")
+        record = value;
+    else if (key == "replay")
+        replay = value;
+    else if (key == "replay-speed")
+        replaySpeed = toNumber<double>(key, value);
+    else if (key == "shm")
+        shm = value;
+    else if (key == "src-rtp")
+        srcRtp = toBool(key, value);
+    else if (key == "src-tcp")
+        srcTcp = toBool(key, value);
+    else if (key == "src-listen")
+        srcListen = toNumber<uint16_t>(key, value);
+    else if (key == "src-file")
+        srcFile = value;
+    else if (key == "src-ingest")
+        srcIngest = toBool(key, value);
+    else if (key == "dst-rtp")
+        dstRtp = toBool(key, value);
+    else if (key == "dst-cluster")
+        dstCluster = value;
+    else if (key == "dst-replay")
+        dstReplay = toNumber<unsigned>(key, value);
+    else if (key == "dst-spread")
+        dstSpread = toBool(key, value);
+    else if (key == "multicast")
+        multicast = value;
+    else if (key == "multicast-ttl")
+        multicastTTL = toNumber<unsigned>(key, value);
+    else if (key == "timeout")
+        timeout = toNumber<unsigned>(key, value);
+    else if (key == "max-age")
+        maxAge = toNumber<unsigned>(key, value);
+    else if (key == "batch-deadline")
+        batchDeadline = toNumber<unsigned>(key, value);
+    else if (key == "priority")
+        priority = toNumber<unsigned>(key, value);
+    else
+        throw CasterError("Unknown relay parameter: " + key);
+}
+
+void RelayConfig::parse(std::istream& stream)
+{
+    std::string word;
+    while (stream >> word) {
+        const size_t pos = word.find('=');
+        if (pos == std::string::npos)
+            throw CasterError("Expected key=value, got: " + word);
+        set(word.substr(0, pos), word.substr(pos + 1));
+    }
+}
+
+void RelayConfig::validate() const
+{
+    const bool isLocal = !replay.empty() || !srcFile.empty() || srcListen != 0;
+    if (srcServer.empty() && !isLocal && !srcIngest)
+        throw CasterError("Source server is not set");
+    if (srcMountpoint.empty() && !isLocal && !srcTcp)
+        throw CasterError("Source mountpoint is not set");
+    if (srcIngest && srcPassword.empty())
+        throw CasterError("Uploads need a source password");
+    if (dstServer.empty() && shm.empty() && multicast.empty())
+        throw CasterError("Destination server is not set");
+    if (!dstCluster.empty() && (dstServer.empty() || dstRtp || !multicast.empty()))
+        throw CasterError("Destination cluster needs an NTRIP destination server");
+}
+
+bool RelayConfig::needsRestart(const RelayConfig& rhs) const
+{
+    return srcServer != rhs.srcServer || srcPort != rhs.srcPort ||
+           srcMountpoint != rhs.srcMountpoint ||
+           srcLogin != rhs.srcLogin || srcPassword != rhs.srcPassword ||
+           dstServer != rhs.dstServer || dstPort != rhs.dstPort ||
+           dstMountpoint != rhs.dstMountpoint ||
+           dstLogin != rhs.dstLogin || dstPassword != rhs.dstPassword ||
+           record != rhs.record || replay != rhs.replay ||
+           replaySpeed != rhs.replaySpeed || shm != rhs.shm ||
+           srcRtp != rhs.srcRtp || dstRtp != rhs.dstRtp ||
+           dstCluster != rhs.dstCluster || dstReplay != rhs.dstReplay ||
+           dstSpread != rhs.dstSpread ||
+           srcTcp != rhs.srcTcp || srcListen != rhs.srcListen ||
+           srcFile != rhs.srcFile || srcIngest != rhs.srcIngest ||
+           multicast != rhs.multicast || multicastTTL != rhs.multicastTTL ||
+           timeout != rhs.timeout;
+}
+
+std::string RelayConfig::text(bool withPasswords) const
+{
+    std::ostringstream stream;
+    if (!replay.empty())
+        stream << "replay=" << replay << " replay-speed=" << replaySpeed << " ";
+    stream << "src-server=" << srcServer
+           << " src-port=" << srcPort
+           << " src-mountpoint=" << srcMountpoint;
+    if (!srcLogin.empty())
+        stream << " src-login=" << srcLogin;
+    if (!srcPassword.empty())
+        stream << " src-password=" << (withPasswords ? srcPassword : "***");
+    if (srcRtp)
+        stream << " src-rtp=1";
+    if (srcTcp)
+        stream << " src-tcp=1";
+    if (srcListen != 0)
+        stream << " src-listen=" << srcListen;
+    if (!srcFile.empty())
+        stream << " src-file=" << srcFile;
+    if (srcIngest)
+        stream << " src-ingest=1";
+    stream << " dst-server=" << dstServer
+           << " dst-port=" << dstPort;
+    if (!dstMountpoint.empty())
+        stream << " dst-mountpoint=" << dstMountpoint;
+    if (!dstLogin.empty())
+        stream << " dst-login=" << dstLogin;
+    if (!dstPassword.empty())
+        stream << " dst-password=" << (withPasswords ? dstPassword : "***");
+    if (dstRtp)
+        stream << " dst-rtp=1";
+    if (!dstCluster.empty())
+        stream << " dst-cluster=" << dstCluster << " dst-replay=" << dstReplay;
+    if (dstSpread)
+        stream << " dst-spread=1";
+    if (!multicast.empty())
+        stream << " multicast=" << multicast << " multicast-ttl=" << multicastTTL;
+    if (!gga.empty())
+        stream << " gga=" << gga;
+    if (!record.empty())
+        stream << " record=" << record;
+    if (!shm.empty())
+        stream << " shm=" << shm;
+    stream << " timeout=" << timeout
+           << " max-age=" << maxAge
+           << " batch-deadline=" << batchDeadline;
+    if (priority != 0)
+        stream << " priority=" << priority;
+    return stream.str();
+}
+
+RelayConfigs Caster::loadRelayConfigs(const std::string& fileName)
+{
+    std::ifstream file(fileName);
+    if (!file)
+        throw CasterError("Failed to open config file " + fileName);
+
+    RelayConfigs res;
+    std::string line;
+    size_t number = 0;
+    while (std::getline(file, line)) {
+        ++number;
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+        std::istringstream stream(line);
+        std::string name;
+        if (!(stream >> name))
+            continue;
+        try
+        {
+            RelayConfig config;
+            config.parse(stream);
+            config.validate();
+            if (!res.emplace(name, config).second)
+                throw CasterError("Duplicate relay " + name);
+        }
+        catch (const CasterError& e)
+        {
+            throw CasterError(fileName + ":" + std::to_string(number) + ": " + e.what());
+        }
+    }
+    return res;
+}
@@ -0,0 +1,67 @@
+#ifndef __CASTER_RELAY_CONFIG_H__
+#define __CASTER_RELAY_CONFIG_H__
+
+#include <istream>
+#include <string>
+#include <map>
+#include <cstdint>
+
+namespace Caster {
+
+// Parameters of one relay. Keys are named after the command line options.
+struct RelayConfig
+{
+    RelayConfig() noexcept;
+
+    std::string srcServer;
+    uint16_t srcPort;
+    std::string srcMountpoint;
+    std::string srcLogin;
+    std::string srcPassword;
+    std::string dstServer;
+    uint16_t dstPort;
+    std::string dstMountpoint;
+    std::string dstLogin;
+    std::string dstPassword;
+    std::string gga;
+    std::string record; // capture prefix, empty - no recording
+    std::string replay; // recording to use instead of the source caster
+    double replaySpeed;
+    std::string shm; // shared memory ring name, empty - none
+    bool srcRtp; // NTRIP 2.0 over RTP/UDP
+    bool srcTcp; // raw RTCM from srcServer:srcPort
+    uint16_t srcListen; // raw RTCM from whoever connects, zero - none
+    std::string srcFile; // raw RTCM from a file, FIFO or device
+    bool srcIngest; // uploads to srcMountpoint of the ingest caster
+    bool dstRtp;
+    std::string dstCluster; // "host[:port],..." of the other destination casters
+    unsigned dstReplay; // ms of frames sent again on failover
+    bool dstSpread; // relays of a cluster start on its members in turn
+    std::string multicast; // "group:port" instead of the destination caster
+    unsigned multicastTTL;
+    unsigned timeout;
+    unsigned maxAge;
+    unsigned batchDeadline; // us, zero - write every frame right away
+    unsigned priority; // of connection admission, higher first
+
+    // Throws CasterError on unknown keys and invalid values.
+    void set(const std::string& key, const std::string& value);
+    // Reads "key=value" words up to the end of the stream.
+    void parse(std::istream& stream);
+    // Checks that the relay can be started.
+    void validate() const;
+    // Whether switching to the other config requires reconnecting, GGA, max
+    // age, batch deadline and priority are applied to a running relay.
+    bool needsRestart(const RelayConfig& rhs) const;
+
+    std::string text(bool withPasswords) const;
+};
+
+using RelayConfigs = std::map<std::string, RelayConfig>;
+
+// One relay per line: "name key=value ...", '#' starts a comment.
+RelayConfigs loadRelayConfigs(const std::string& fileName);
+
+}
+
+#endif
@@ -0,0 +1,418 @@
+#include "relay_manager.h"
+
+#include "error.h"
+#include "logger.h"
+#include "utils.h"
+#include "rtp_client.h"
+#include "rtp_server.h"
+#include "multicast_sink.h"
+#include "cluster_sink.h"
+#include "tcp_source.h"
+#include "file_source.h"
+#include "string_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::RelayManager;
+using Caster::RelayConfig;
+
+namespace
+{
+
+const size_t defaultSegmentSize = 64 * 1024 * 1024;
+const auto defaultSegmentDuration = std::chrono::hours(1);
+const size_t defaultShmSize = 1024 * 1024;
+// How long suspended relays may take to finish the writes in progress.
+const auto handOverWait = std::chrono::seconds(2);
+const auto handOverPoll = std::chrono::milliseconds(10);
+// A failed relay is restarted after this long, twice as long after every
+// failure in a row up to the maximum. A relay that ran longer than that
+// starts over.
+const auto restartDelay = std::chrono::seconds(1);
+const auto maxRestartDelay = std::chrono::seconds(60);
+
+// Whether a relay handed over with the given config text can go on with
+// its connections under the new config.
+bool sameConnections(const std::string& text, const RelayConfig& config)
+{
+    RelayConfig old;
+    try
+    {
+        std::istringstream stream(text);
+        old.parse(stream);
+    }
+    catch (const Caster::CasterError&)
+    {
+        return false;
+    }
+    return !old.needsRestart(config);
+}
+
+}
+
+RelayManager::RelayManager(boost::asio::io_service& ioService)
+    : m_ioService(ioService),
+      m_timer(ioService)
+{
+}
+
+RelayManager::~RelayManager()
+{
+    stop();
+}
+
+void RelayManager::add(const std::string& name, const RelayConfig& config)
+{
+    config.validate();
+    if (m_relays.count(name) > 0)
+        throw CasterError("Relay " + name + " already exists");
+    Entry& entry = m_relays[name];
+    entry.config = config;
+    try
+    {
+        start(name, entry);
+    }
+    catch (const CasterError&)
+    {
+        m_relays.erase(name);
+        throw;
+    }
+}
+
+void RelayManager::modify(const std::string& name, const RelayConfig& config)
+{
+    config.validate();
+    const auto it = m_relays.find(name);
+    if (it == m_relays.end())
+        throw CasterError("No relay " + name);
+    Entry& entry = it->second;
+    const bool restart = !entry.relay || entry.config.needsRestart(config);
+    entry.config = config;
+    if (restart) {
+        ERRLOG(logInfo) << "Restarting relay " << name;
+        try
+        {
+            start(name, entry);
+        }
+        catch (const CasterError& e)
+        {
+            entry.error = e.what();
+            throw;
+        }
+        return;
+    }
+    entry.relay->setGGA(config.gga);
+    entry.relay->setMaxAge(std::chrono::milliseconds(config.maxAge));
+    entry.relay->setBatchDeadline(std::chrono::microseconds(config.batchDeadline));
+    entry.relay->setPriority(config.priority);
+}
+
+void RelayManager::remove(const std::string& name)
+{
+    const auto it = m_relays.find(name);
+    if (it == m_relays.end())
+        throw CasterError("No relay " + name);
+    ERRLOG(logInfo) << "Removing relay " << name;
+    retire(it->second);
+    m_relays.erase(it);
+}
+
+void RelayManager::apply(const RelayConfigs& configs)
+{
+    // A config that does not validate rejects the whole set before any
+    // running relay is touched.
+    for (const auto& kv : configs) {
+        try {
+            kv.second.validate();
+        } catch (const CasterError& e) {
+            throw CasterError("Relay " + kv.first + ": " + e.what());
+        }
+    }
+    for (auto it = m_relays.begin(); it != m_relays.end();) {
+        if (configs.count(it->first) == 0) {
+            ERRLOG(logInfo) << "Removing relay " << it->first;
+            retire(it->second);
+            it = m_relays.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // A relay that fails to start does not keep the others from being
+    // applied, the failures are reported together.
+    std::string errors;
+    for (const auto& kv : configs) {
+        try {
+            if (m_relays.count(kv.first) == 0)
+                add(kv.first, kv.second);
+            else
+                modify(kv.first, kv.second);
+        } catch (const CasterError& e) {
+            errors += (errors.empty() ? "" : "; ") + kv.first + ": " + e.what();
+        }
+    }
+    if (!errors.empty())
+        throw CasterError("Failed to start relays: " + errors);
+}
+
+void RelayManager::handOver(const HandOverCallback& done)
+{
+    std::vector<std::string> suspended;
+    for (auto& kv : m_relays)
+        if (kv.second.relay && kv.second.relay->suspend())
+            suspended.push_back(kv.first);
+    ERRLOG(logInfo) << "Handing over " << suspended.size() << " of " << m_relays.size() << " relays";
+    m_handOverDeadline = std::chrono::steady_clock::now() + handOverWait;
+    waitForIdle(suspended, done);
+}
+
+void RelayManager::waitForIdle(const std::vector<std::string>& names, const HandOverCallback& done)
+{
+    bool idle = true;
+    for (const auto& name : names) {
+        const auto it = m_relays.find(name);
+        if (it != m_relays.end() && it->second.relay && !it->second.relay->isIdle())
+            idle = false;
+    }
+    if (!idle && std::chrono::steady_clock::now() < m_handOverDeadline) {
+        m_timer.expires_from_now(handOverPoll);
+        m_timer.async_wait([this, names, done](const boost::system::error_code& ec)
+                           {
+                               if (!ec)
+                                   waitForIdle(names, done);
+                           });
+        return;
+    }
+
+    Handover::RelayStates states;
+    for (const auto& name : names) {
+        const auto it = m_relays.find(name);
+        if (it == m_relays.end() || !it->second.relay)
+            continue;
+        Handover::RelayState state;
+        state.config = it->second.config.text(true);
+        if (it->second.relay->detach(state))
+            states[name] = std::move(state);
+        else
+            ERRLOG(logWarning) << "Relay " << name << " could not be handed over";
+    }
+    // The new process listens on the upload port once it has the reply.
+    if (m_ingest)
+        m_ingest->stop();
+    stop();
+    done(states);
+}
+
+void RelayManager::dropHandedOver()
+{
+    for (const auto& kv : m_handedOver)
+        ERRLOG(logInfo) << "Closing connections of relay " << kv.first << ", it is gone";
+    Handover::close(m_handedOver);
+    m_handedOver.clear();
+}
+
+void RelayManager::stop()
+{
+    boost::system::error_code ec;
+    m_timer.cancel(ec);
+    for (auto& kv : m_relays)
+        retire(kv.second);
+    m_relays.clear();
+}
+
+const RelayConfig& RelayManager::config(const std::string& name) const
+{
+    const auto it = m_relays.find(name);
+    if (it == m_relays.end())
+        throw CasterError("No relay " + name);
+    return it->second.config;
+}
+
+void RelayManager::list(std::ostream& stream) const
+{
+    for (const auto& kv : m_relays) {
+        stream << kv.first << " "
+               << (kv.second.relay ? "running" : "failed") << " "
+               << kv.second.config.text(false);
+        if (!kv.second.error.empty())
+            stream << " error=\"" << kv.second.error << "\"";
+        stream << "\n";
+    }
+}
+
+void RelayManager::start(const std::string& name, Entry& entry)
+{
+    if (entry.relay)
+        retire(entry);
+    entry.restart.reset();
+    purgeIdle(m_retired);
+
+    const RelayConfig& config = entry.config;
+    ERRLOG(logInfo) << "Starting relay " << name << ": " << config.text(false);
+    auto relay = std::make_shared<Relay>(m_ioService, makeSource(config),
+                                         config.srcMountpoint.empty() ? name : config.srcMountpoint,
+                                         makeSink(config));
+    if (!config.srcLogin.empty() || !config.srcPassword.empty())
+        relay->setSrcCredentials(config.srcLogin, config.srcPassword);
+    if (!config.dstLogin.empty() || !config.dstPassword.empty())
+        relay->setDstCredentials(config.dstLogin, config.dstPassword);
+    if (!config.gga.empty())
+        relay->setGGA(config.gga);
+    relay->setMaxAge(std::chrono::milliseconds(config.maxAge));
+    relay->setBatchDeadline(std::chrono::microseconds(config.batchDeadline));
+    relay->setPriority(config.priority);
+    if (!config.record.empty())
+        relay->setRecorder(std::make_shared<Recorder>(config.record, defaultSegmentSize, defaultSegmentDuration));
+    if (!config.shm.empty())
+        relay->setShmRing(std::unique_ptr<Shm::Writer>(new Shm::Writer(config.shm, defaultShmSize)));
+
+    const Relay* ptr = relay.get();
+    const SharedString key(name);
+    relay->setErrorCallback([this, key, ptr](const boost::system::error_code& ec)
+                            {
+                                handleError(key, ptr, ec.message());
+                            });
+    relay->setEOFCallback([this, key, ptr]()
+                          {
+                              handleError(key, ptr, "end of stream");
+                          });
+    entry.relay = relay;
+    entry.error.clear();
+    entry.started = std::chrono::steady_clock::now();
+
+    const auto handed = m_handedOver.find(name);
+    if (handed == m_handedOver.end()) {
+        relay->start(config.timeout);
+        return;
+    }
+    Handover::RelayState state = std::move(handed->second);
+    m_handedOver.erase(handed);
+    if (!sameConnections(state.config, config)) {
+        ERRLOG(logInfo) << "Relay " << name << " has changed, connecting anew";
+        Handover::close(state);
+        relay->start(config.timeout);
+        return;
+    }
+    ERRLOG(logInfo) << "Taking over the connections of relay " << name;
+    relay->adopt(state, config.timeout);
+}
+
+Caster::SourcePtr RelayManager::makeSource(const RelayConfig& config)
+{
+    if (!config.replay.empty())
+        return SourcePtr(new ReplaySource(m_ioService, recording(config.replay), config.replaySpeed));
+    if (config.srcIngest) {
+        if (!m_ingest)
+            throw CasterError("Uploads are not accepted, the ingest port is not set");
+        return m_ingest->source(config.srcMountpoint);
+    }
+    if (!config.srcFile.empty())
+        return SourcePtr(new FileSource(m_ioService, config.srcFile));
+    if (config.srcListen != 0)
+        return SourcePtr(new TcpSource(m_ioService, config.srcListen));
+    if (config.srcTcp)
+        return SourcePtr(new TcpSource(m_ioService, config.srcServer, config.srcPort));
+    if (config.srcRtp)
+        return SourcePtr(new RtpClient(m_ioService, config.srcServer, config.srcPort, config.srcMountpoint));
+    return SourcePtr(new Client(m_ioService, config.srcServer, config.srcPort, config.srcMountpoint));
+}
+
+Caster::SinkPtr RelayManager::makeSink(const RelayConfig& config)
+{
+    if (config.dstRtp)
+        return SinkPtr(new RtpServer(m_ioService, config.dstServer, config.dstPort, config.dstMountpoint));
+    if (!config.multicast.empty()) {
+        std::unique_ptr<MulticastSink> sink(new MulticastSink(m_ioService, config.multicast));
+        sink->setTTL(config.multicastTTL);
+        return SinkPtr(std::move(sink));
+    }
+    if (!config.dstCluster.empty()) {
+        std::unique_ptr<ClusterSink> sink(new ClusterSink(m_ioService, config.dstServer, config.dstPort,
+                                                          config.dstCluster, config.dstMountpoint));
+        sink->setReplayWindow(std::chrono::milliseconds(config.dstReplay));
+        sink->setSpread(config.dstSpread);
+        return SinkPtr(std::move(sink));
+    }
+    if (!config.dstServer.empty())
+        return SinkPtr(new Server(m_ioService, config.dstServer, config.dstPort, config.dstMountpoint));
+    return nullptr; // Shared memory only
+}
+
+Caster::RecordingPtr RelayManager::recording(const std::string& path)
+{
+    RecordingPtr res = m_recordings[path].lock();
+    if (!res) {
+        res = Recording::open(path);
+        m_recordings[path] = res;
+    }
+    return res;
+}
+
+void RelayManager::retire(Entry& entry)
+{
+    if (!entry.relay)
+        return;
+    // Completion handlers of the relay connections still refer to them.
+    entry.relay->setErrorCallback({});
+    entry.relay->setEOFCallback({});
+    entry.relay->stop();
+    m_retired.push_back(std::move(entry.relay));
+}
+
+void RelayManager::handleError(const std::string& name, const Relay* relay,
+                               const std::string& error)
+{
+    const auto it = m_relays.find(name);
+    if (it == m_relays.end() || it->second.relay.get() != relay)
+        return;
+    ERRLOG(logError) << "Relay " << name << " failed: " << error;
+    // The relay stops itself after reporting.
+    it->second.error = error;
+    m_ioService.post([this, name, relay]()
+                     {
+                         const auto entry = m_relays.find(name);
+                         if (entry == m_relays.end() || entry->second.relay.get() != relay)
+                             return;
+                         retire(entry->second);
+                         scheduleRestart(name, entry->second);
+                     });
+}
+
+void RelayManager::scheduleRestart(const std::string& name, Entry& entry)
+{
+    // A replay or a file ends for good, a modification or reload starts it
+    // again.
+    const RelayConfig& config = entry.config;
+    if (!config.replay.empty() || !config.srcFile.empty())
+        return;
+    if (std::chrono::steady_clock::now() - entry.started > maxRestartDelay)
+        entry.failures = 0;
+    const auto delay = std::min<std::chrono::steady_clock::duration>(
+        restartDelay * (1u << std::min(entry.failures, 6u)), maxRestartDelay);
+    ++entry.failures;
+    ERRLOG(logInfo) << "Restarting relay " << name << " in "
+                    << std::chrono::duration_cast<std::chrono::milliseconds>(delay).count() << " ms";
+    entry.restart.reset(new boost::asio::steady_timer(m_ioService));
+    entry.restart->expires_from_now(delay);
+    entry.restart->async_wait([this, name](const boost::system::error_code& ec)
+                              {
+                                  if (ec)
+                                      return;
+                                  const auto it = m_relays.find(name);
+                                  if (it == m_relays.end() || it->second.relay)
+                                      return;
+                                  try
+                                  {
+                                      start(name, it->second);
+                                  }
+                                  catch (const CasterError& e)
+                                  {
+                                      it->second.error = e.what();
+                                      ERRLOG(logError) << "Failed to restart relay " << name << ": " << e.what();
+                                  }
+                              });
+}
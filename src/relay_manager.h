@@ -0,0 +1,100 @@
+#ifndef __CASTER_RELAY_MANAGER_H__
+#define __CASTER_RELAY_MANAGER_H__
+
+#include "relay.h"
+#include "relay_config.h"
+#include "replay_source.h"
+#include "ingest_caster.h"
+#include "handover.h"
+
+#include <boost/asio.hpp>
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <memory>
+#include <chrono>
+
+namespace Caster {
+
+// Runs a set of named relays and changes it on the fly. Only relays whose
+// connection parameters change are restarted. A relay that fails is
+// restarted after a delay that doubles with every failure in a row, its
+// connections are then paced like any other, see
+// Connection::setAdmissionLimits.
+class RelayManager
+{
+    public:
+        explicit RelayManager(boost::asio::io_service& ioService);
+        ~RelayManager();
+
+        RelayManager(const RelayManager&) = delete;
+        RelayManager& operator=(const RelayManager&) = delete;
+
+        // These throw CasterError if the relay exists (add) or does not
+        // exist (modify, remove), or the config is invalid.
+        void add(const std::string& name, const RelayConfig& config);
+        void modify(const std::string& name, const RelayConfig& config);
+        void remove(const std::string& name);
+        // Brings the running set to the given one: adds, removes and
+        // restarts changed relays, and restarts failed ones. Throws
+        // CasterError without changing anything if a config does not
+        // validate, and after applying the rest if some relays fail to start.
+        void apply(const RelayConfigs& configs);
+        void stop();
+
+        // Upgrade, old process: suspends the relays whose connections can
+        // go on in another process and, once they are idle, calls done
+        // with where they stopped. All relays are stopped by then, the new
+        // process connects the others anew.
+        using HandOverCallback = std::function<void (Handover::RelayStates& states)>;
+        void handOver(const HandOverCallback& done);
+        // Upgrade, new process: relays started later with the connection
+        // parameters they had in the old process go on with its
+        // connections. dropHandedOver() closes what no relay took.
+        void setHandedOver(Handover::RelayStates states) { m_handedOver = std::move(states); }
+        void dropHandedOver();
+
+        // Takes uploads of base stations for relays with src-ingest.
+        void setIngestCaster(const IngestCasterPtr& caster) { m_ingest = caster; }
+
+        const RelayConfig& config(const std::string& name) const;
+        // One line per relay: name, state and parameters without passwords.
+        void list(std::ostream& stream) const;
+
+    private:
+        struct Entry {
+            RelayConfig config;
+            RelayPtr relay;
+            std::string error; // empty while running
+            unsigned failures = 0; // in a row
+            std::chrono::steady_clock::time_point started;
+            std::unique_ptr<boost::asio::steady_timer> restart; // while failed
+        };
+
+        boost::asio::io_service& m_ioService;
+        std::map<std::string, Entry> m_relays;
+        std::vector<RelayPtr> m_retired;
+        // Replays of the same file share its mapping.
+        std::map<std::string, std::weak_ptr<const Recording>> m_recordings;
+        IngestCasterPtr m_ingest;
+        Handover::RelayStates m_handedOver;
+        boost::asio::steady_timer m_timer;
+        std::chrono::steady_clock::time_point m_handOverDeadline;
+
+        void start(const std::string& name, Entry& entry);
+        void waitForIdle(const std::vector<std::string>& names, const HandOverCallback& done);
+        void retire(Entry& entry);
+        SourcePtr makeSource(const RelayConfig& config);
+        SinkPtr makeSink(const RelayConfig& config);
+        RecordingPtr recording(const std::string& path);
+        void handleError(const std::string& name, const Relay* relay,
+                         const std::string& error);
+        void scheduleRestart(const std::string& name, Entry& entry);
+};
+
+}
+
+#endif
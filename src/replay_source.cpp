@@ -0,0 +1,175 @@
+#include "replay_source.h"
+
+#include "error.h"
+#include "logger.h"
+#include "rtcm.h"
+
+#include <algorithm>
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::Recording;
+using Caster::RecordingPtr;
+using Caster::ReplaySource;
+
+namespace ba = boost::asio;
+
+namespace
+{
+
+// Chunks delivered in one go before other handlers get a chance to run.
+const size_t maxBatch = 64;
+// Longer pauses between epochs of a raw file are gaps, not timing.
+const auto maxEpochGap = std::chrono::minutes(1);
+
+bool endsWith(const std::string& value, const std::string& suffix)
+{
+    return value.size() >= suffix.size() &&
+           value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+}
+
+RecordingPtr Recording::open(const std::string& path)
+{
+    auto res = std::shared_ptr<Recording>(new Recording());
+    if (endsWith(path, ".rec")) {
+        res->loadCapture({path});
+    } else {
+        const auto segments = Capture::segments(path);
+        if (!segments.empty())
+            res->loadCapture(segments);
+        else
+            res->loadRaw(path);
+    }
+    if (res->m_chunks.empty())
+        throw CasterError("Nothing to replay in " + path);
+    ERRLOG(logDebug) << "Loaded " << res->m_chunks.size() << " chunks from " << path;
+    return res;
+}
+
+void Recording::loadCapture(const std::vector<std::string>& segments)
+{
+    m_capture.reset(new Capture::CaptureReader(segments));
+    Capture::Record record;
+    uint64_t first = 0;
+    while (m_capture->next(record)) {
+        if (m_chunks.empty())
+            first = record.monotonic;
+        // Monotonic times do not compare across restarts of the recorder.
+        const uint64_t time = record.monotonic >= first ? record.monotonic - first :
+                              (m_chunks.empty() ? 0 : m_chunks.back().time);
+        m_chunks.push_back(Chunk{time, record.data, record.size});
+    }
+}
+
+void Recording::loadRaw(const std::string& path)
+{
+    m_raw = Capture::MappedFile(path);
+    const uint8_t* data = m_raw.data();
+
+    // A new epoch of the first observation message type starts a chunk, the
+    // frames up to the next one go with it.
+    uint64_t time = 0;
+    size_t chunkStart = 0;
+    uint16_t pacingType = 0;
+    RTCM::FrameInfo last;
+    RTCM::Framer framer;
+    framer.feed(data, m_raw.size(),
+                [&](const RTCM::Frame& frame)
+                {
+                    if (!frame.info.hasEpoch)
+                        return;
+                    if (pacingType == 0) {
+                        pacingType = frame.info.type;
+                        last = frame.info;
+                        return;
+                    }
+                    if (frame.info.type != pacingType || frame.info.epoch == last.epoch)
+                        return;
+                    const size_t offset = static_cast<size_t>(frame.data - data);
+                    m_chunks.push_back(Chunk{time, data + chunkStart, static_cast<uint32_t>(offset - chunkStart)});
+                    chunkStart = offset;
+                    const auto diff = RTCM::epochDifference(frame.info, last);
+                    if (diff.count() > 0 && diff < maxEpochGap)
+                        time += static_cast<uint64_t>(std::chrono::nanoseconds(diff).count());
+                    last = frame.info;
+                });
+    if (chunkStart < m_raw.size())
+        m_chunks.push_back(Chunk{time, data + chunkStart, static_cast<uint32_t>(m_raw.size() - chunkStart)});
+}
+
+ReplaySource::ReplaySource(ba::io_service& ioService,
+                           const RecordingPtr& recording, double speed)
+    : m_recording(recording),
+      m_speed(speed),
+      m_timer(ioService),
+      m_next(0),
+      m_running(false),
+      m_outstanding(0)
+{
+}
+
+void ReplaySource::start(unsigned /*timeout*/)
+{
+    m_running = true;
+    m_next = 0;
+    m_start = Clock::now();
+    schedule(m_start);
+}
+
+void ReplaySource::stop()
+{
+    m_running = false;
+    boost::system::error_code ec;
+    m_timer.cancel(ec);
+}
+
+ReplaySource::Clock::time_point ReplaySource::due(const Recording::Chunk& chunk) const
+{
+    if (m_speed <= 0)
+        return m_start;
+    // Computed from the start rather than the previous chunk, so the
+    // timing does not drift.
+    return m_start + std::chrono::nanoseconds(static_cast<int64_t>(static_cast<double>(chunk.time) / m_speed));
+}
+
+void ReplaySource::schedule(Clock::time_point when)
+{
+    ++m_outstanding;
+    m_timer.expires_at(when);
+    m_timer.async_wait([this](const boost::system::error_code& ec)
+                       {
+                           --m_outstanding;
+                           handleTimer(ec);
+                       });
+}
+
+void ReplaySource::handleTimer(const boost::system::error_code& ec)
+{
+    if (ec || !m_running)
+        return;
+
+    const auto& chunks = m_recording->chunks();
+    const auto now = Clock::now();
+    for (size_t count = 0; m_next < chunks.size() && count < maxBatch; ++count) {
+        const Recording::Chunk& chunk = chunks[m_next];
+        if (due(chunk) > now)
+            break;
+        ++m_next;
+        if (m_dataCallback)
+            m_dataCallback(ba::const_buffers_1(chunk.data, chunk.size));
+        // The relay may stop the source from the callback.
+        if (!m_running)
+            return;
+    }
+
+    if (m_next < chunks.size()) {
+        schedule(std::max(due(chunks[m_next]), now));
+        return;
+    }
+    m_running = false;
+    if (m_eofCallback)
+        m_eofCallback();
+}
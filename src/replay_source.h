@@ -0,0 +1,85 @@
+#ifndef __CASTER_REPLAY_SOURCE_H__
+#define __CASTER_REPLAY_SOURCE_H__
+
+#include "source.h"
+#include "capture.h"
+
+#include <boost/asio.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+namespace Caster {
+
+// Recorded stream split into chunks with their times relative to the start.
+// Chunks point into memory-mapped files, one recording serves any number of
+// replays.
+class Recording
+{
+    public:
+        struct Chunk {
+            uint64_t time; // ns since the first chunk
+            const uint8_t* data;
+            uint32_t size;
+        };
+
+        // Accepts a capture segment, a capture prefix (see Recorder) or a
+        // raw RTCM 3 file, which is paced by the observation epochs. Throws
+        // CasterError.
+        static std::shared_ptr<const Recording> open(const std::string& path);
+
+        const std::vector<Chunk>& chunks() const noexcept { return m_chunks; }
+
+    private:
+        std::unique_ptr<Capture::CaptureReader> m_capture;
+        Capture::MappedFile m_raw;
+        std::vector<Chunk> m_chunks;
+
+        void loadCapture(const std::vector<std::string>& segments);
+        void loadRaw(const std::string& path);
+};
+
+using RecordingPtr = std::shared_ptr<const Recording>;
+
+// Stands in for Client: plays a recording back through the data callback
+// with its original timing scaled by the speed factor.
+class ReplaySource : public Source
+{
+    public:
+        // Zero speed replays as fast as the relay takes the data.
+        ReplaySource(boost::asio::io_service& ioService,
+                     const RecordingPtr& recording, double speed);
+
+        void start(unsigned timeout) override;
+        void stop() override;
+        bool isIdle() const override { return m_outstanding == 0; }
+
+        void setErrorCallback(const ErrorCallback& cb) override { m_errorCallback = cb; }
+        void setDataCallback(const DataCallback& cb) override { m_dataCallback = cb; }
+        void setEOFCallback(const EOFCallback& cb) override { m_eofCallback = cb; }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        RecordingPtr m_recording;
+        double m_speed;
+        boost::asio::steady_timer m_timer;
+        Clock::time_point m_start;
+        size_t m_next;
+        bool m_running;
+        size_t m_outstanding;
+        ErrorCallback m_errorCallback;
+        DataCallback m_dataCallback;
+        EOFCallback m_eofCallback;
+
+        Clock::time_point due(const Recording::Chunk& chunk) const;
+        void schedule(Clock::time_point when);
+        void handleTimer(const boost::system::error_code& ec);
+};
+
+}
+
+#endif
@@ -0,0 +1,187 @@
+#include "rtcm.h"
+
+#include <array>
+
+namespace RTCM = Caster::RTCM;
+
+namespace
+{
+
+std::array<uint32_t, 256> makeCRCTable() noexcept
+{
+    constexpr uint32_t poly = 0x1864CFB;
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < table.size(); ++i) {
+        uint32_t crc = i << 16;
+        for (unsigned j = 0; j < 8; ++j) {
+            crc <<= 1;
+            if (crc & 0x1000000)
+                crc ^= poly;
+        }
+        table[i] = crc & 0xFFFFFF;
+    }
+    return table;
+}
+
+const std::array<uint32_t, 256> crcTable = makeCRCTable();
+
+const int64_t msPerDay = 86400000;
+const int64_t msPerWeek = 7 * msPerDay;
+const int64_t gpsEpoch = 315964800000; // 1980-01-06 in Unix time, ms
+const int64_t gpsLeapSeconds = 18; // GPS - UTC since 2017-01-01
+const int64_t bdsOffset = 14000; // GPS - BDT, ms
+const int64_t moscowOffset = 3 * 3600000; // GLONASS time is UTC(SU) + 3h
+const int64_t unixWeekday = 4; // 1970-01-01 was Thursday
+
+bool isGLONASS(uint16_t type) noexcept
+{
+    return (type >= 1009 && type <= 1012) || (type >= 1081 && type <= 1087);
+}
+
+bool isBDS(uint16_t type) noexcept
+{
+    return type >= 1121 && type <= 1127;
+}
+
+int64_t modulo(int64_t value, int64_t period) noexcept
+{
+    const int64_t res = value % period;
+    return res < 0 ? res + period : res;
+}
+
+}
+
+uint32_t RTCM::crc24q(const uint8_t* data, size_t size) noexcept
+{
+    uint32_t crc = 0;
+    for (size_t i = 0; i < size; ++i)
+        crc = ((crc << 8) & 0xFFFFFF) ^ crcTable[(crc >> 16) ^ data[i]];
+    return crc;
+}
+
+bool RTCM::isMSM(uint16_t type) noexcept
+{
+    return type >= 1071 && type <= 1137 && type % 10 >= 1 && type % 10 <= 7;
+}
+
+bool RTCM::isObservation(uint16_t type) noexcept
+{
+    return (type >= 1001 && type <= 1004) ||
+           (type >= 1009 && type <= 1012) ||
+           isMSM(type);
+}
+
+RTCM::MessageClass RTCM::classify(uint16_t type) noexcept
+{
+    if (isObservation(type))
+        return MessageClass::Observation;
+
+    switch (type) {
+        case 1005:
+        case 1006:
+        case 1007:
+        case 1008:
+        case 1013:
+        case 1033:
+        case 1230:
+            return MessageClass::Station;
+        case 1019:
+        case 1020:
+        case 1041:
+        case 1042:
+        case 1043:
+        case 1044:
+        case 1045:
+        case 1046:
+            return MessageClass::Ephemeris;
+        default:
+            return MessageClass::Other;
+    }
+}
+
+RTCM::FrameInfo RTCM::decode(const uint8_t* frame, size_t size) noexcept
+{
+    FrameInfo info;
+    if (size < headerSize + 2 + crcSize)
+        return info;
+
+    const uint8_t* payload = frame + headerSize;
+    const size_t payloadSize = size - headerSize - crcSize;
+    info.type = static_cast<uint16_t>(getBits(payload, 0, 12));
+    info.messageClass = classify(info.type);
+
+    // Observation headers: type (12), station id (12), epoch time, sync flag.
+    if (payloadSize < 7)
+        return info;
+    if (isMSM(info.type) || (info.type >= 1001 && info.type <= 1004)) {
+        info.hasEpoch = true;
+        info.epoch = getBits(payload, 24, 30);
+        info.multipleMessage = getBits(payload, 54, 1) != 0;
+    } else if (info.type >= 1009 && info.type <= 1012) {
+        info.hasEpoch = true;
+        info.epoch = getBits(payload, 24, 27);
+        info.multipleMessage = getBits(payload, 51, 1) != 0;
+    }
+    return info;
+}
+
+std::chrono::milliseconds RTCM::epochAge(const FrameInfo& info,
+                                         std::chrono::system_clock::time_point now) noexcept
+{
+    const int64_t utc = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+
+    int64_t period = msPerWeek;
+    int64_t current = 0;
+    int64_t epoch = info.epoch;
+    if (isGLONASS(info.type)) {
+        // MSM: day of week (3 bits, 7 - unknown) and time of day (27 bits).
+        // Legacy 1009-1012: time of day only.
+        const int64_t moscow = utc + moscowOffset;
+        const int64_t day = isMSM(info.type) ? info.epoch >> 27 : 7;
+        epoch = info.epoch & 0x7FFFFFF;
+        if (day < 7) {
+            epoch += day * msPerDay;
+            current = modulo(moscow + unixWeekday * msPerDay, msPerWeek);
+        } else {
+            period = msPerDay;
+            current = modulo(moscow, msPerDay);
+        }
+    } else {
+        // GPS, Galileo, QZSS, SBAS and NavIC use GPS time of week, BDS is
+        // shifted by the constant offset.
+        current = utc - gpsEpoch + gpsLeapSeconds * 1000;
+        if (isBDS(info.type))
+            current -= bdsOffset;
+        current = modulo(current, msPerWeek);
+    }
+
+    int64_t age = modulo(current - epoch, period);
+    if (age >= period / 2)
+        age -= period;
+    return std::chrono::milliseconds(age);
+}
+
+std::chrono::milliseconds RTCM::epochDifference(const FrameInfo& later,
+                                                const FrameInfo& earlier) noexcept
+{
+    int64_t period = msPerWeek;
+    int64_t to = later.epoch;
+    int64_t from = earlier.epoch;
+    if (isGLONASS(later.type)) {
+        const int64_t toDay = isMSM(later.type) ? later.epoch >> 27 : 7;
+        const int64_t fromDay = isMSM(earlier.type) ? earlier.epoch >> 27 : 7;
+        to = later.epoch & 0x7FFFFFF;
+        from = earlier.epoch & 0x7FFFFFF;
+        if (toDay < 7 && fromDay < 7) {
+            to += toDay * msPerDay;
+            from += fromDay * msPerDay;
+        } else {
+            period = msPerDay;
+        }
+    }
+
+    int64_t diff = modulo(to - from, period);
+    if (diff >= period / 2)
+        diff -= period;
+    return std::chrono::milliseconds(diff);
+}
@@ -0,0 +1,168 @@
+#ifndef __CASTER_RTCM_H__
+#define __CASTER_RTCM_H__
+
+#include <vector>
+#include <chrono>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+namespace Caster {
+namespace RTCM {
+
+// Scheduling classes, in the order of their importance for a rover.
+enum class MessageClass {
+    Observation,
+    Station,
+    Ephemeris,
+    Other
+};
+
+constexpr size_t messageClassCount = 4;
+
+struct FrameInfo {
+    uint16_t type = 0; // 0 - not an RTCM 3 frame
+    MessageClass messageClass = MessageClass::Other;
+    bool hasEpoch = false;
+    uint32_t epoch = 0; // raw epoch time field, see epochAge
+    bool multipleMessage = false; // more messages for the same epoch follow
+};
+
+struct Frame {
+    const uint8_t* data;
+    size_t size;
+    FrameInfo info;
+};
+
+constexpr uint8_t preamble = 0xD3;
+constexpr size_t headerSize = 3;
+constexpr size_t crcSize = 3;
+constexpr size_t maxPayloadSize = 1023;
+
+// Big-endian bit field of up to 32 bits, inline since the framer and the
+// header decoder call it for every frame.
+inline
+uint32_t getBits(const uint8_t* buf, size_t pos, size_t len) noexcept
+{
+    if (len == 0)
+        return 0;
+    const size_t first = pos / 8;
+    const size_t last = (pos + len + 7) / 8;
+    uint64_t bits = 0;
+    for (size_t i = first; i < last; ++i)
+        bits = (bits << 8) | buf[i];
+    bits >>= last * 8 - pos - len;
+    return static_cast<uint32_t>(bits & ((uint64_t(1) << len) - 1));
+}
+
+uint32_t crc24q(const uint8_t* data, size_t size) noexcept;
+
+bool isMSM(uint16_t type) noexcept;
+bool isObservation(uint16_t type) noexcept;
+MessageClass classify(uint16_t type) noexcept;
+
+// Decodes message header of a complete frame (preamble, length, payload, CRC).
+FrameInfo decode(const uint8_t* frame, size_t size) noexcept;
+
+// Time passed since the observation epoch of the frame, negative if the
+// epoch is ahead of the local clock. Meaningful only if info.hasEpoch is set.
+std::chrono::milliseconds epochAge(const FrameInfo& info,
+                                   std::chrono::system_clock::time_point now) noexcept;
+
+// Time from the earlier epoch to the later one, both of the same message
+// type and less than half a week (GLONASS legacy: half a day) apart.
+std::chrono::milliseconds epochDifference(const FrameInfo& later,
+                                          const FrameInfo& earlier) noexcept;
+
+// Splits a byte stream into RTCM 3 frames. Bytes that do not belong to a
+// valid frame are passed through as frames with zero type, so that non-RTCM
+// streams are relayed unchanged.
+class Framer {
+    public:
+        template <typename F>
+        void feed(const uint8_t* data, size_t size, F&& onFrame);
+        // Calls onParsed() once the frames of the data are through onFrame,
+        // while they are still valid: a frame completed by the data points
+        // into the framer, and only until it takes the next data.
+        template <typename F, typename G>
+        void feed(const uint8_t* data, size_t size, F&& onFrame, G&& onParsed);
+
+        void reset() { m_buffer.clear(); }
+        // Bytes of an incomplete frame, so that another framer can go on
+        // with the stream.
+        const std::vector<uint8_t>& pending() const { return m_buffer; }
+        void restore(const uint8_t* data, size_t size) { m_buffer.assign(data, data + size); }
+
+    private:
+        std::vector<uint8_t> m_buffer;
+
+        // Returns the number of bytes consumed from data.
+        template <typename F>
+        size_t parse(const uint8_t* data, size_t size, F& onFrame);
+};
+
+template <typename F>
+inline
+void Framer::feed(const uint8_t* data, size_t size, F&& onFrame)
+{
+    feed(data, size, std::forward<F>(onFrame), []() {});
+}
+
+template <typename F, typename G>
+inline
+void Framer::feed(const uint8_t* data, size_t size, F&& onFrame, G&& onParsed)
+{
+    if (m_buffer.empty()) {
+        const size_t used = parse(data, size, onFrame);
+        onParsed();
+        m_buffer.assign(data + used, data + size);
+        return;
+    }
+    m_buffer.insert(m_buffer.end(), data, data + size);
+    const size_t used = parse(m_buffer.data(), m_buffer.size(), onFrame);
+    onParsed();
+    m_buffer.erase(m_buffer.begin(), m_buffer.begin() + static_cast<std::ptrdiff_t>(used));
+}
+
+template <typename F>
+inline
+size_t Framer::parse(const uint8_t* data, size_t size, F& onFrame)
+{
+    size_t pos = 0;
+    size_t raw = 0; // start of pending non-RTCM bytes
+    while (pos < size) {
+        if (data[pos] != preamble) {
+            ++pos;
+            continue;
+        }
+        if (size - pos < headerSize)
+            break;
+        const size_t length = getBits(data + pos, 14, 10);
+        if ((data[pos + 1] & 0xFC) != 0 || length == 0) {
+            ++pos;
+            continue;
+        }
+        const size_t frameSize = headerSize + length + crcSize;
+        if (size - pos < frameSize)
+            break;
+        if (crc24q(data + pos, headerSize + length) != getBits(data + pos + headerSize + length, 0, 24)) {
+            ++pos;
+            continue;
+        }
+        if (raw < pos)
+            onFrame(Frame{data + raw, pos - raw, FrameInfo()});
+        onFrame(Frame{data + pos, frameSize, decode(data + pos, frameSize)});
+        pos += frameSize;
+        raw = pos;
+    }
+    // A possible frame start is kept until the rest of it arrives, the
+    // garbage before it is not worth delaying.
+    if (raw < pos)
+        onFrame(Frame{data + raw, pos - raw, FrameInfo()});
+    return pos;
+}
+
+}
+}
+
+#endif
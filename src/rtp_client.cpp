@@ -0,0 +1,39 @@
+#include "rtp_client.h"
+
+using Caster::RtpClient;
+
+RtpClient::RtpClient(boost::asio::io_service& ioService,
+                     const std::string& server, uint16_t port,
+                     const std::string& mountpoint)
+    : RtpSession(ioService, server, port, mountpoint, "GET")
+{
+}
+
+std::string RtpClient::requestHeaders() const
+{
+    if (m_gga.empty())
+        return "";
+    return "Ntrip-GGA: " + m_gga + "\r\n";
+}
+
+void RtpClient::handlePayload(const uint8_t* data, size_t size)
+{
+    if (m_dataCallback)
+        m_dataCallback(boost::asio::buffer(data, size));
+}
+
+void RtpClient::handleClose()
+{
+    if (m_eofCallback)
+        m_eofCallback();
+}
+
+void RtpClient::keepAlive()
+{
+    if (m_gga.empty()) {
+        RtpSession::keepAlive();
+        return;
+    }
+    const std::string line = m_gga + "\r\n";
+    sendPacket(RTP::data, reinterpret_cast<const uint8_t*>(line.data()), line.size());
+}
@@ -0,0 +1,52 @@
+#ifndef __CASTER_RTP_CLIENT_H__
+#define __CASTER_RTP_CLIENT_H__
+
+#include "rtp_session.h"
+#include "source.h"
+
+#include <boost/asio/io_service.hpp>
+
+#include <string>
+#include <cstdint>
+
+namespace Caster {
+
+// NTRIP 2.0 client over RTP/UDP. Payloads of the packets received at once
+// are delivered as one buffer. The GGA is repeated as keepalive.
+class RtpClient : public Source, private RtpSession {
+    public:
+        RtpClient(boost::asio::io_service& ioService,
+                  const std::string& server, uint16_t port,
+                  const std::string& mountpoint);
+
+        void start(unsigned timeout) override { RtpSession::start(timeout); }
+        void stop() override { RtpSession::stop(); }
+        bool isIdle() const override { return RtpSession::isIdle(); }
+
+        void setGGA(const std::string& gga) override { m_gga = gga; }
+        void setCredentials(const std::string& login,
+                            const std::string& password) override
+        { RtpSession::setCredentials(login, password); }
+        const std::map<std::string, std::string>& headers() const override
+        { return RtpSession::headers(); }
+
+        void setErrorCallback(const ErrorCallback& cb) override { RtpSession::setErrorCallback(cb); }
+        void setDataCallback(const DataCallback& cb) override { m_dataCallback = cb; }
+        void setEOFCallback(const EOFCallback& cb) override { m_eofCallback = cb; }
+        void setHeadersCallback(const HeadersCallback& cb) override { RtpSession::setHeadersCallback(cb); }
+
+    private:
+        std::string m_gga;
+        DataCallback m_dataCallback;
+        EOFCallback m_eofCallback;
+
+        std::string requestHeaders() const override;
+        void handlePayload(const uint8_t* data, size_t size) override;
+        void handleClose() override;
+        void keepAlive() override;
+        bool expectsData() const override { return true; }
+};
+
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include "rtp_server.h"
+
+#include "error.h"
+#include "logger.h"
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::RtpServer;
+
+RtpServer::RtpServer(boost::asio::io_service& ioService,
+                     const std::string& server, uint16_t port,
+                     const std::string& mountpoint)
+    : RtpSession(ioService, server, port, mountpoint, "POST"),
+      m_flushPosted(false),
+      m_dropped(0)
+{
+}
+
+void RtpServer::start(unsigned timeout)
+{
+    m_finishCallback = {};
+    RtpSession::start(timeout);
+}
+
+void RtpServer::send(const FrameBatch& frames)
+{
+    if (!isActive())
+        return;
+    const auto now = Clock::now();
+    for (const OutgoingFrame& outgoing : frames) {
+        if (outgoing.expires < now)
+            continue;
+        if (!queue(outgoing.frame.data, outgoing.frame.size)) {
+            // The socket has not taken the previous batch yet.
+            if (++m_dropped % 100 == 1) {
+                ERRLOG(logWarning) << "RTP send queue is full, " << m_dropped << " frames dropped";
+            }
+        }
+    }
+    postFlush();
+}
+
+void RtpServer::finish(const EOFCallback& done)
+{
+    m_finishCallback = done;
+    postFlush();
+}
+
+void RtpServer::postFlush()
+{
+    if (m_flushPosted)
+        return;
+    // Everything sent by the current handler goes out together.
+    m_flushPosted = true;
+    m_ioService.post(track([this]()
+                           {
+                               m_flushPosted = false;
+                               if (isActive())
+                                   flush();
+                               else
+                                   flushComplete();
+                           }));
+}
+
+void RtpServer::flushComplete()
+{
+    if (!m_finishCallback || !isFlushed())
+        return;
+    const auto done = std::move(m_finishCallback);
+    m_finishCallback = {};
+    RtpSession::stop();
+    done();
+}
+
+void RtpServer::handleClose()
+{
+    reportError(boost::asio::error::eof);
+}
@@ -0,0 +1,54 @@
+#ifndef __CASTER_RTP_SERVER_H__
+#define __CASTER_RTP_SERVER_H__
+
+#include "rtp_session.h"
+#include "sink.h"
+
+#include <boost/asio/io_service.hpp>
+
+#include <string>
+#include <cstdint>
+
+namespace Caster {
+
+// NTRIP 2.0 server over RTP/UDP. Frames sent within one handler are packed
+// into as few packets as possible and leave with one sendmmsg call, so a
+// lost packet delays nothing that follows it.
+class RtpServer final : public Sink, private RtpSession {
+    public:
+        using Clock = Sink::Clock;
+
+        RtpServer(boost::asio::io_service& ioService,
+                  const std::string& server, uint16_t port,
+                  const std::string& mountpoint);
+
+        void start(unsigned timeout) override;
+        void stop() override { RtpSession::stop(); }
+        bool isIdle() const override { return RtpSession::isIdle(); }
+        bool isActive() const override { return RtpSession::isActive(); }
+
+        void setCredentials(const std::string& login,
+                            const std::string& password) override
+        { RtpSession::setCredentials(login, password); }
+
+        void send(const FrameBatch& frames) override;
+        void finish(const EOFCallback& done) override;
+
+        void setErrorCallback(const ErrorCallback& cb) override { RtpSession::setErrorCallback(cb); }
+        void setHeadersCallback(const HeadersCallback& cb) override { RtpSession::setHeadersCallback(cb); }
+
+    private:
+        bool m_flushPosted;
+        uint64_t m_dropped;
+        EOFCallback m_finishCallback;
+
+        void postFlush();
+        void handlePayload(const uint8_t* /*data*/, size_t /*size*/) override {}
+        void handleClose() override;
+        void flushComplete() override;
+        bool expectsData() const override { return false; }
+};
+
+}
+
+#endif
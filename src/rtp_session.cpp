@@ -0,0 +1,411 @@
+#include "rtp_session.h"
+
+#include "error.h"
+#include "logger.h"
+#include "version.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <sys/socket.h>
+
+#include <sstream>
+#include <algorithm>
+#include <functional> // std::bind
+#include <cstring>
+#include <cerrno>
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::RtpSession;
+
+namespace pls = std::placeholders;
+namespace bs = boost::system;
+namespace ba = boost::asio;
+using udp = ba::ip::udp;
+
+namespace
+{
+
+// Requests are repeated and the session is checked with this period.
+const auto tickInterval = std::chrono::seconds(1);
+// Casters drop sessions that stay silent, the client speaks at least this
+// often.
+const auto keepAliveInterval = std::chrono::seconds(10);
+const size_t batchCapacity = 64;
+const size_t receiveCapacity = 32;
+const size_t receiveSize = 2048;
+
+void store16(uint8_t* dst, uint16_t value)
+{
+    dst[0] = static_cast<uint8_t>(value >> 8);
+    dst[1] = static_cast<uint8_t>(value);
+}
+
+void store32(uint8_t* dst, uint32_t value)
+{
+    store16(dst, static_cast<uint16_t>(value >> 16));
+    store16(dst + 2, static_cast<uint16_t>(value));
+}
+
+uint16_t load16(const uint8_t* src)
+{
+    return static_cast<uint16_t>((src[0] << 8) | src[1]);
+}
+
+uint32_t load32(const uint8_t* src)
+{
+    return (static_cast<uint32_t>(load16(src)) << 16) | load16(src + 2);
+}
+
+std::string trim(const std::string& value)
+{
+    const size_t lpos = value.find_first_not_of(" \t");
+    if (lpos == std::string::npos)
+        return "";
+    const size_t rpos = value.find_last_not_of(" \t\r\n");
+    return value.substr(lpos, rpos - lpos + 1);
+}
+
+}
+
+void Caster::RTP::writeHeader(uint8_t* dst, const Header& header) noexcept
+{
+    dst[0] = 0x80; // version 2, no padding, extension or CSRC
+    dst[1] = header.type & 0x7F;
+    store16(dst + 2, header.sequence);
+    store32(dst + 4, header.timestamp);
+    store32(dst + 8, header.ssrc);
+}
+
+size_t Caster::RTP::parseHeader(const uint8_t* src, size_t& size, Header& header) noexcept
+{
+    if (size < headerSize || (src[0] >> 6) != 2)
+        return 0;
+    size_t offset = headerSize + 4 * (src[0] & 0x0F);
+    if ((src[0] & 0x10) != 0) {
+        if (size < offset + 4)
+            return 0;
+        offset += 4 + 4 * load16(src + offset + 2);
+    }
+    if ((src[0] & 0x20) != 0 && size > 0)
+        size -= std::min<size_t>(src[size - 1], size);
+    if (size < offset)
+        return 0;
+    header.type = src[1] & 0x7F;
+    header.sequence = load16(src + 2);
+    header.timestamp = load32(src + 4);
+    header.ssrc = load32(src + 8);
+    return offset;
+}
+
+RtpSession::RtpSession(ba::io_service& ioService,
+                       const std::string& server, uint16_t port,
+                       const std::string& mountpoint, const std::string& method)
+    : m_ioService(ioService),
+      m_server(server),
+      m_port(port),
+      m_uri(mountpoint.empty() || mountpoint[0] != '/' ? "/" + mountpoint : mountpoint),
+      m_method(method),
+      m_timeout(0),
+      m_socket(ioService),
+      m_resolver(ioService),
+      m_timer(ioService),
+      m_batch(RTP::headerSize, RTP::maxPayload, batchCapacity),
+      m_receiver(receiveSize, receiveCapacity),
+      m_session(0),
+      m_sequence(0),
+      m_nextSequence(0),
+      m_sequenced(false),
+      m_lost(0),
+      m_active(false),
+      m_writing(false),
+      m_stopped(true),
+      m_outstanding(0)
+{
+    m_packet.reserve(RTP::headerSize + RTP::maxPayload);
+}
+
+void RtpSession::start(unsigned timeout)
+{
+    m_timeout = timeout;
+    m_headers.clear();
+    m_batch.clear();
+    m_session = 0;
+    m_sequenced = false;
+    m_lost = 0;
+    m_stopped = false;
+    m_started = Clock::now();
+    m_resolver.async_resolve(udp::resolver::query(m_server, boost::lexical_cast<std::string>(m_port)),
+                             track(std::bind(&RtpSession::handleResolve, this, pls::_1, pls::_2)));
+    scheduleTick();
+}
+
+void RtpSession::stop()
+{
+    if (m_active)
+        sendPacket(RTP::close, nullptr, 0);
+    shutdown();
+}
+
+void RtpSession::handleResolve(const bs::error_code& ec,
+                               udp::resolver::iterator it)
+{
+    if (ec || it == udp::resolver::iterator()) {
+        if (ec != ba::error::operation_aborted) {
+            reportError(ec ? ec : bs::error_code(resolveError, CasterCategory::getInstance()));
+            shutdown();
+        }
+        return;
+    }
+
+    bs::error_code error;
+    m_socket.open(it->endpoint().protocol(), error);
+    if (!error)
+        m_socket.connect(*it, error);
+    if (error) {
+        reportError(error);
+        shutdown();
+        return;
+    }
+    ERRLOG(logDebug) << "RTP session with " << it->endpoint();
+    sendRequest();
+    read();
+}
+
+void RtpSession::sendRequest()
+{
+    std::ostringstream request;
+    request << m_method << " " << m_uri << " HTTP/1.1\r\n"
+            << "Host: " << m_server << "\r\n"
+            << "Ntrip-Version: Ntrip/2.0\r\n"
+            << "User-Agent: NTRIP Relay " << version << "\r\n";
+    if (m_auth.authenticated())
+        request << "Authorization: Basic " << m_auth.basic() << "\r\n";
+    request << requestHeaders()
+            << "\r\n";
+    const std::string text = request.str();
+    sendPacket(RTP::http, reinterpret_cast<const uint8_t*>(text.data()), text.size());
+}
+
+void RtpSession::sendPacket(uint8_t type, const uint8_t* data, size_t size)
+{
+    if (!m_socket.is_open())
+        return;
+    RTP::Header header;
+    header.type = type;
+    header.sequence = m_sequence++;
+    header.timestamp = timestamp();
+    header.ssrc = m_session;
+    m_packet.resize(RTP::headerSize);
+    RTP::writeHeader(m_packet.data(), header);
+    m_packet.insert(m_packet.end(), data, data + size);
+    // Control packets are not queued, one lost is repeated or replaced by
+    // the next keepalive.
+    if (::send(m_socket.native_handle(), m_packet.data(), m_packet.size(), MSG_DONTWAIT) < 0) {
+        ERRLOG(logDebug) << "Failed to send RTP packet: " << strerror(errno);
+    }
+    m_lastSent = Clock::now();
+}
+
+void RtpSession::flush()
+{
+    if (m_writing || !m_active)
+        return;
+    m_batch.seal([this](uint8_t* dst, const uint8_t* /*payload*/, size_t /*size*/)
+                 {
+                     RTP::Header header;
+                     header.type = RTP::data;
+                     header.sequence = m_sequence++;
+                     header.timestamp = timestamp();
+                     header.ssrc = m_session;
+                     RTP::writeHeader(dst, header);
+                 });
+    const bs::error_code ec = m_batch.send(m_socket.native_handle());
+    if (ec == ba::error::would_block) {
+        m_writing = true;
+        m_socket.async_wait(udp::socket::wait_write,
+                            track(std::bind(&RtpSession::handleWritable, this, pls::_1)));
+        return;
+    }
+    if (ec) {
+        reportError(ec);
+        shutdown();
+        return;
+    }
+    m_lastSent = Clock::now();
+    flushComplete();
+}
+
+void RtpSession::handleWritable(const bs::error_code& ec)
+{
+    m_writing = false;
+    if (ec || !m_socket.is_open())
+        return;
+    flush();
+}
+
+void RtpSession::read()
+{
+    m_socket.async_wait(udp::socket::wait_read,
+                        track(std::bind(&RtpSession::handleReadable, this, pls::_1)));
+}
+
+void RtpSession::handleReadable(const bs::error_code& ec)
+{
+    if (ec) {
+        if (ec != ba::error::operation_aborted) {
+            reportError(ec);
+            shutdown();
+        }
+        return;
+    }
+    if (!m_socket.is_open())
+        return;
+
+    bs::error_code error;
+    const size_t count = m_receiver.receive(m_socket.native_handle(), error);
+    if (error) {
+        // An ICMP error for an earlier packet, typically nobody listens.
+        reportError(error);
+        shutdown();
+        return;
+    }
+
+    m_payload.clear();
+    bool closed = false;
+    for (size_t i = 0; i < count && !closed; ++i) {
+        size_t size = m_receiver.size(i);
+        RTP::Header header;
+        const size_t offset = RTP::parseHeader(m_receiver.data(i), size, header);
+        if (offset == 0)
+            continue;
+        const uint8_t* payload = m_receiver.data(i) + offset;
+        if (!m_active) {
+            if (header.type != RTP::http)
+                continue;
+            if (!handleResponse(payload, size - offset, header.ssrc))
+                return;
+            continue;
+        }
+        if (header.ssrc != m_session)
+            continue;
+        m_lastReceived = Clock::now();
+        if (header.type == RTP::close) {
+            closed = true;
+        } else if (header.type == RTP::data) {
+            if (m_sequenced && header.sequence != m_nextSequence) {
+                m_lost += static_cast<uint16_t>(header.sequence - m_nextSequence);
+                ERRLOG(logDebug) << "RTP packets lost: " << m_lost;
+            }
+            m_sequenced = true;
+            m_nextSequence = static_cast<uint16_t>(header.sequence + 1);
+            m_payload.insert(m_payload.end(), payload, payload + (size - offset));
+        }
+    }
+
+    // Callbacks may stop the session.
+    if (!m_payload.empty())
+        handlePayload(m_payload.data(), m_payload.size());
+    if (closed && m_socket.is_open()) {
+        shutdown();
+        handleClose();
+        return;
+    }
+    if (m_socket.is_open())
+        read();
+}
+
+bool RtpSession::handleResponse(const uint8_t* data, size_t size, uint32_t ssrc)
+{
+    std::istringstream response(std::string(reinterpret_cast<const char*>(data), size));
+    std::string protocol;
+    unsigned status = 0;
+    response >> protocol >> status;
+    if (status != 200) {
+        ERRLOG(logError) << "RTP session refused with status " << status;
+        reportError(bs::error_code(status == 401 ? authenticationError : invalidStatus,
+                                   CasterCategory::getInstance()));
+        shutdown();
+        return false;
+    }
+
+    std::string line;
+    std::getline(response, line);
+    while (std::getline(response, line) && line != "\r" && !line.empty()) {
+        const size_t pos = line.find(':');
+        if (pos != std::string::npos)
+            m_headers.emplace(line.substr(0, pos), trim(line.substr(pos + 1)));
+    }
+    m_session = ssrc;
+    const auto it = m_headers.find("Session");
+    if (it != m_headers.end()) {
+        try {
+            m_session = boost::lexical_cast<uint32_t>(it->second);
+        } catch (const boost::bad_lexical_cast&) {
+            ERRLOG(logWarning) << "Invalid RTP session id: " << it->second;
+        }
+    }
+    ERRLOG(logDebug) << "RTP session " << m_session << " established";
+    m_active = true;
+    m_lastReceived = Clock::now();
+    if (m_headersCallback)
+        m_headersCallback();
+    return m_socket.is_open();
+}
+
+void RtpSession::scheduleTick()
+{
+    m_timer.expires_from_now(tickInterval);
+    m_timer.async_wait(track(std::bind(&RtpSession::handleTick, this, pls::_1)));
+}
+
+void RtpSession::handleTick(const bs::error_code& ec)
+{
+    if (ec || m_stopped)
+        return;
+
+    const auto now = Clock::now();
+    const auto timeout = std::chrono::seconds(m_timeout);
+    if (!m_active) {
+        if (m_timeout > 0 && now - m_started > timeout) {
+            reportError(bs::error_code(connectionTimeout, CasterCategory::getInstance()));
+            shutdown();
+            return;
+        }
+        // The request or its response may have been lost.
+        if (m_socket.is_open())
+            sendRequest();
+    } else {
+        if (m_timeout > 0 && expectsData() && now - m_lastReceived > timeout) {
+            ERRLOG(logInfo) << "RTP session timeout detected, shutting it down";
+            reportError(bs::error_code(connectionTimeout, CasterCategory::getInstance()));
+            shutdown();
+            return;
+        }
+        if (now - m_lastSent >= keepAliveInterval)
+            keepAlive();
+    }
+    scheduleTick();
+}
+
+void RtpSession::shutdown()
+{
+    m_active = false;
+    m_stopped = true;
+    m_resolver.cancel();
+    bs::error_code ec;
+    m_timer.cancel(ec);
+    m_socket.close(ec);
+}
+
+void RtpSession::reportError(const bs::error_code& ec)
+{
+    if (m_errorCallback)
+        m_errorCallback(ec);
+}
+
+uint32_t RtpSession::timestamp() const
+{
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - m_started).count());
+}
@@ -0,0 +1,162 @@
+#ifndef __CASTER_RTP_SESSION_H__
+#define __CASTER_RTP_SESSION_H__
+
+#include "authenticator.h"
+#include "callbacks.h"
+#include "datagram.h"
+
+#include <boost/asio.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <utility>
+#include <cstdint>
+
+namespace Caster {
+
+namespace RTP {
+
+const size_t headerSize = 12;
+// Payload of a data packet, well below a typical MTU. Every RTCM 3 frame
+// fits, so frames are never split.
+const size_t maxPayload = 1400;
+
+enum PayloadType : uint8_t {
+    data = 96, // GNSS data, NMEA from the client
+    http = 97, // request and response headers
+    close = 98 // end of the session
+};
+
+struct Header {
+    uint8_t type = 0;
+    uint16_t sequence = 0;
+    uint32_t timestamp = 0;
+    uint32_t ssrc = 0;
+};
+
+void writeHeader(uint8_t* dst, const Header& header) noexcept;
+// Returns the offset of the payload, zero if the packet is not valid RTP.
+// Padding is removed from size.
+size_t parseHeader(const uint8_t* src, size_t& size, Header& header) noexcept;
+
+}
+
+// NTRIP 2.0 over RTP/UDP: the request and the response are carried in
+// packets of the HTTP payload type, the Session header of the response
+// becomes the SSRC of the data packets. The session is kept alive by
+// packets from the client and ended with a close packet by either side.
+//
+// Like Connection, the session may be started again after it has been
+// stopped, and completion handlers are tracked to tell when it is safe to
+// destroy it.
+class RtpSession
+{
+    public:
+        RtpSession(boost::asio::io_service& ioService,
+                   const std::string& server, uint16_t port,
+                   const std::string& mountpoint, const std::string& method);
+        virtual ~RtpSession() = default;
+
+        void start(unsigned timeout);
+        void stop();
+
+        void setCredentials(const std::string& login,
+                            const std::string& password)
+        { m_auth = Authenticator(login, password); }
+
+        void setErrorCallback(const ErrorCallback& cb) { m_errorCallback = cb; }
+        void setHeadersCallback(const HeadersCallback& cb) { m_headersCallback = cb; }
+
+        const std::map<std::string, std::string>& headers() const { return m_headers; }
+        bool isActive() const { return m_active; }
+        bool isIdle() const { return m_outstanding == 0; }
+
+    protected:
+        using Clock = std::chrono::steady_clock;
+
+        boost::asio::io_service& m_ioService;
+
+        template <typename Handler>
+        auto track(Handler handler);
+
+        // Data packets are batched and sent by flush().
+        bool queue(const uint8_t* data, size_t size) { return m_batch.append(data, size); }
+        void flush();
+        bool isFlushed() const { return m_batch.empty(); }
+        // Sends a single packet right away, for control and keepalive.
+        void sendPacket(uint8_t type, const uint8_t* data, size_t size);
+        void reportError(const boost::system::error_code& ec);
+
+        // Extra request header lines.
+        virtual std::string requestHeaders() const { return ""; }
+        // Payload of the data packets received at once, in order.
+        virtual void handlePayload(const uint8_t* data, size_t size) = 0;
+        virtual void handleClose() = 0;
+        // Called when the batch has been sent.
+        virtual void flushComplete() {}
+        // Called when nothing has been sent for a while.
+        virtual void keepAlive() { sendPacket(RTP::data, nullptr, 0); }
+        // The caster is expected to send data, a silence longer than the
+        // timeout is an error.
+        virtual bool expectsData() const = 0;
+
+    private:
+        std::string m_server;
+        uint16_t m_port;
+        std::string m_uri;
+        std::string m_method;
+        Authenticator m_auth;
+        unsigned m_timeout;
+        boost::asio::ip::udp::socket m_socket;
+        boost::asio::ip::udp::resolver m_resolver;
+        boost::asio::steady_timer m_timer;
+        DatagramBatch m_batch;
+        DatagramReceiver m_receiver;
+        std::vector<uint8_t> m_payload;
+        std::vector<uint8_t> m_packet;
+        std::map<std::string, std::string> m_headers;
+        ErrorCallback m_errorCallback;
+        HeadersCallback m_headersCallback;
+        uint32_t m_session;
+        uint16_t m_sequence;
+        uint16_t m_nextSequence; // expected from the caster
+        bool m_sequenced;
+        uint64_t m_lost;
+        Clock::time_point m_started;
+        Clock::time_point m_lastSent;
+        Clock::time_point m_lastReceived;
+        bool m_active;
+        bool m_writing;
+        bool m_stopped;
+        size_t m_outstanding;
+
+        void handleResolve(const boost::system::error_code& ec,
+                           boost::asio::ip::udp::resolver::iterator it);
+        void sendRequest();
+        void read();
+        void handleReadable(const boost::system::error_code& ec);
+        void handleWritable(const boost::system::error_code& ec);
+        bool handleResponse(const uint8_t* data, size_t size, uint32_t ssrc);
+        void scheduleTick();
+        void handleTick(const boost::system::error_code& ec);
+        void shutdown();
+        uint32_t timestamp() const;
+};
+
+template <typename Handler>
+inline
+auto RtpSession::track(Handler handler)
+{
+    ++m_outstanding;
+    return [this, handler](auto&&... args) mutable
+           {
+               --m_outstanding;
+               handler(std::forward<decltype(args)>(args)...);
+           };
+}
+
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+using Caster::FrameScheduler;
+
+namespace RTCM = Caster::RTCM;
+
+FrameScheduler::FrameScheduler(size_t quantum, size_t capacity) noexcept
+    : m_quantum(quantum),
+      m_capacity(capacity),
+      m_next(0),
+      m_visited(false),
+      m_epochComplete(false),
+      m_epochCount(0),
+      m_bytes(0),
+      m_dropped(0)
+{
+}
+
+void FrameScheduler::push(const RTCM::Frame& frame, Clock::time_point expires)
+{
+    if (frame.info.messageClass == RTCM::MessageClass::Observation && frame.info.hasEpoch) {
+        if (m_epochComplete || isNewEpoch(frame.info)) {
+            supersede();
+            m_epochComplete = false;
+        }
+        enqueue(m_current, frame, expires);
+        remember(frame.info);
+        if (!frame.info.multipleMessage)
+            m_epochComplete = true;
+    } else {
+        enqueue(m_queues[static_cast<size_t>(frame.info.messageClass)], frame, expires);
+    }
+    shrink();
+}
+
+void FrameScheduler::pop(std::vector<uint8_t>& out, size_t limit)
+{
+    const auto now = Clock::now();
+    const size_t start = out.size();
+    expire(m_current, now);
+    while (!m_current.frames.empty())
+        take(m_current, out);
+
+    while (m_bytes > 0 && (out.size() == start || out.size() - start < limit)) {
+        Queue& queue = m_queues[m_next];
+        if (!m_visited) {
+            queue.deficit += m_quantum;
+            m_visited = true;
+        }
+        expire(queue, now);
+        if (!queue.frames.empty() && queue.frames.frontSize() <= queue.deficit) {
+            queue.deficit -= queue.frames.frontSize();
+            take(queue, out);
+            continue;
+        }
+        if (queue.frames.empty())
+            queue.deficit = 0;
+        m_next = (m_next + 1) % m_queues.size();
+        m_visited = false;
+    }
+}
+
+void FrameScheduler::clear()
+{
+    m_current = Queue();
+    for (auto& queue : m_queues)
+        queue = Queue();
+    m_next = 0;
+    m_visited = false;
+    m_epochComplete = false;
+    m_epochCount = 0;
+    m_bytes = 0;
+}
+
+void FrameScheduler::enqueue(Queue& queue, const RTCM::Frame& frame, Clock::time_point expires)
+{
+    queue.frames.push_back(frame.data, frame.size, expires);
+    queue.bytes += frame.size;
+    m_bytes += frame.size;
+}
+
+void FrameScheduler::take(Queue& queue, std::vector<uint8_t>& out)
+{
+    const size_t size = queue.frames.frontSize();
+    out.insert(out.end(), queue.frames.frontData(), queue.frames.frontData() + size);
+    queue.bytes -= size;
+    m_bytes -= size;
+    queue.frames.pop_front();
+}
+
+void FrameScheduler::drop(Queue& queue)
+{
+    queue.bytes -= queue.frames.frontSize();
+    m_bytes -= queue.frames.frontSize();
+    queue.frames.pop_front();
+    ++m_dropped;
+}
+
+void FrameScheduler::expire(Queue& queue, Clock::time_point now)
+{
+    while (!queue.frames.empty() && queue.frames.frontExpires() < now)
+        drop(queue);
+}
+
+bool FrameScheduler::isNewEpoch(const RTCM::FrameInfo& info) const noexcept
+{
+    for (size_t i = 0; i < m_epochCount; ++i)
+        if (m_epochs[i].type == info.type)
+            return RTCM::epochDifference(info, m_epochs[i]).count() > 0;
+    return false;
+}
+
+void FrameScheduler::remember(const RTCM::FrameInfo& info) noexcept
+{
+    for (size_t i = 0; i < m_epochCount; ++i) {
+        if (m_epochs[i].type == info.type) {
+            m_epochs[i] = info;
+            return;
+        }
+    }
+    if (m_epochCount < m_epochs.size())
+        m_epochs[m_epochCount++] = info;
+}
+
+void FrameScheduler::supersede()
+{
+    m_epochCount = 0;
+    Queue& late = m_queues[static_cast<size_t>(RTCM::MessageClass::Observation)];
+    m_current.frames.moveTo(late.frames);
+    late.bytes += m_current.bytes;
+    m_current.bytes = 0;
+}
+
+void FrameScheduler::shrink()
+{
+    // Under a long congestion drop the oldest frames of the most bloated
+    // class first, fresh observations go last.
+    while (m_bytes > m_capacity) {
+        auto it = std::max_element(m_queues.begin(), m_queues.end(),
+                                   [](const Queue& a, const Queue& b) { return a.bytes < b.bytes; });
+        drop(it->frames.empty() ? m_current : *it);
+    }
+}
+
+void FrameScheduler::Frames::push_back(const uint8_t* data, size_t size, Clock::time_point expires)
+{
+    m_entries.push_back(Entry{m_data.size(), size, expires});
+    m_data.insert(m_data.end(), data, data + size);
+}
+
+void FrameScheduler::Frames::pop_front()
+{
+    ++m_head;
+    if (empty()) {
+        clear();
+        return;
+    }
+    // Taken frames are compacted away once they make up half of the queue.
+    if (m_head >= 32 && m_head * 2 >= m_entries.size()) {
+        const size_t offset = m_entries[m_head].offset;
+        m_entries.erase(m_entries.begin(), m_entries.begin() + static_cast<std::ptrdiff_t>(m_head));
+        m_data.erase(m_data.begin(), m_data.begin() + static_cast<std::ptrdiff_t>(offset));
+        for (auto& entry : m_entries)
+            entry.offset -= offset;
+        m_head = 0;
+    }
+}
+
+void FrameScheduler::Frames::moveTo(Frames& other)
+{
+    for (size_t i = m_head; i < m_entries.size(); ++i)
+        other.push_back(m_data.data() + m_entries[i].offset, m_entries[i].size, m_entries[i].expires);
+    clear();
+}
+
+void FrameScheduler::Frames::clear() noexcept
+{
+    m_entries.clear();
+    m_data.clear();
+    m_head = 0;
+}
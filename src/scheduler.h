@@ -0,0 +1,107 @@
+#ifndef __CASTER_SCHEDULER_H__
+#define __CASTER_SCHEDULER_H__
+
+#include "rtcm.h"
+
+#include <array>
+#include <chrono>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace Caster {
+
+// Outbound frame queue of a congested destination.
+//
+// Observations of the newest epoch are sent strictly first. An epoch ends
+// with an observation message that has the multiple message bit cleared, or,
+// if that message was lost, when an observation message of the same type
+// with a later epoch arrives.
+// Everything else, including observations of an epoch that was superseded
+// before it could be sent, is scheduled with deficit round-robin over the
+// message classes, so large ephemeris and station messages neither delay
+// fresh observations nor starve.
+class FrameScheduler {
+    public:
+        explicit FrameScheduler(size_t quantum = 1024,
+                                size_t capacity = 1024 * 1024) noexcept;
+
+        using Clock = std::chrono::steady_clock;
+
+        // Frames still queued after the expiration time are dropped.
+        void push(const RTCM::Frame& frame,
+                  Clock::time_point expires = Clock::time_point::max());
+
+        // Appends queued frames to out in the scheduling order. Stops after
+        // limit bytes, but always takes the current epoch observations and
+        // at least one frame if there is any left.
+        void pop(std::vector<uint8_t>& out, size_t limit);
+
+        bool empty() const noexcept { return m_bytes == 0; }
+        size_t bytes() const noexcept { return m_bytes; }
+        size_t dropped() const noexcept { return m_dropped; }
+
+        void clear();
+
+    private:
+        // FIFO that allocates nothing until it is first used, unlike
+        // std::deque: most destinations are never congested. Frames are
+        // stored back to back in one buffer whose capacity is kept while
+        // the queue drains, so steady congestion allocates nothing either.
+        class Frames {
+            public:
+                bool empty() const noexcept { return m_head == m_entries.size(); }
+                const uint8_t* frontData() const noexcept { return m_data.data() + m_entries[m_head].offset; }
+                size_t frontSize() const noexcept { return m_entries[m_head].size; }
+                Clock::time_point frontExpires() const noexcept { return m_entries[m_head].expires; }
+                void push_back(const uint8_t* data, size_t size, Clock::time_point expires);
+                void pop_front();
+                // Moves all entries to the back of other.
+                void moveTo(Frames& other);
+                void clear() noexcept;
+
+            private:
+                struct Entry {
+                    size_t offset;
+                    size_t size;
+                    Clock::time_point expires;
+                };
+
+                std::vector<Entry> m_entries;
+                std::vector<uint8_t> m_data;
+                size_t m_head = 0;
+        };
+
+        struct Queue {
+            Frames frames;
+            size_t bytes = 0;
+            size_t deficit = 0;
+        };
+
+        size_t m_quantum;
+        size_t m_capacity;
+        Queue m_current;
+        std::array<Queue, RTCM::messageClassCount> m_queues;
+        size_t m_next;
+        bool m_visited;
+        bool m_epochComplete;
+        // Epoch of each observation message type in the current epoch, a
+        // few systems at most, in place so that tracking allocates nothing.
+        std::array<RTCM::FrameInfo, 8> m_epochs;
+        size_t m_epochCount;
+        size_t m_bytes;
+        size_t m_dropped;
+
+        void enqueue(Queue& queue, const RTCM::Frame& frame, Clock::time_point expires);
+        void take(Queue& queue, std::vector<uint8_t>& out);
+        void drop(Queue& queue);
+        void expire(Queue& queue, Clock::time_point now);
+        bool isNewEpoch(const RTCM::FrameInfo& info) const noexcept;
+        void remember(const RTCM::FrameInfo& info) noexcept;
+        void supersede();
+        void shrink();
+};
+
+}
+
+#endif
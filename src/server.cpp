@@ -2,42 +2,199 @@
 
 #include "version.h"
 
-#include <boost/format.hpp>
 #include <boost/asio/buffer.hpp>
 
 #include <iostream>
+#include <functional> // std::bind
 #include <array>
+#include <charconv>
+#include <limits>
+#include <string>
 
 using Caster::Server;
 
+namespace
+{
+
+// Frames queued behind a slow write are sent as one chunk of about this size,
+// so a fresh epoch never waits for more than one such chunk.
+const size_t batchLimit = 4096;
+
+}
+
 Server::Server(boost::asio::io_service& ioService,
                const std::string& server, uint16_t port,
                const std::string& mountpoint)
-    : Connection(ioService, server, port, mountpoint)
+    : Connection(ioService, server, port, mountpoint),
+      m_chunkHeader(),
+      m_writing(false),
+      m_finished(false),
+      m_batchDeadline(0),
+      m_batchTimer(ioService),
+      m_batchPending(false),
+      m_metrics(Metrics::instance().destination(server + ":" + std::to_string(port) + m_uri.str())),
+      m_suspended(false)
+{
+    ++Metrics::instance().objects("destination", sizeof(Server)).live;
+}
+
+Server::~Server()
+{
+    PayloadPool::instance().give(std::move(m_payload));
+    --Metrics::instance().objects("destination", sizeof(Server)).live;
+}
+
+void Server::send(const FrameBatch& frames)
+{
+    // The frames of a source buffer arrived together, they are queued
+    // together and go out in one chunk.
+    bool epochEnd = false;
+    for (const OutgoingFrame& outgoing : frames) {
+        const RTCM::Frame& frame = outgoing.frame;
+        m_scheduler.push(frame, outgoing.expires);
+        if (frame.info.messageClass == RTCM::MessageClass::Observation && !frame.info.multipleMessage) {
+            ++m_metrics.epochs;
+            epochEnd = true;
+        }
+    }
+    if (frames.empty() || m_writing || m_suspended)
+        return;
+    if (m_batchDeadline.count() == 0 || epochEnd) {
+        flush();
+        return;
+    }
+    // The first frame of a batch starts the clock, an epoch that does not
+    // end in time is written as far as it got.
+    if (m_batchPending)
+        return;
+    m_batchPending = true;
+    m_batchStart = Clock::now();
+    m_batchTimer.expires_at(m_batchStart + m_batchDeadline);
+    m_batchTimer.async_wait(track(HandlerType::BatchTimer, std::bind(&Server::handleBatchTimer, this, std::placeholders::_1)));
+}
+
+void Server::handleBatchTimer(const boost::system::error_code& ec)
+{
+    if (ec || !m_batchPending)
+        return;
+    if (!m_writing && !m_suspended)
+        flush();
+}
+
+void Server::finish(const EOFCallback& done)
+{
+    m_finishCallback = done;
+    if (!m_writing && !m_suspended)
+        flush();
+}
+
+void Server::flush()
 {
+    if (m_batchPending) {
+        m_batchPending = false;
+        m_metrics.batchDelay.add(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - m_batchStart).count()));
+        boost::system::error_code ec;
+        m_batchTimer.cancel(ec);
+    }
+    if (!m_payload)
+        m_payload = PayloadPool::instance().take();
+    m_payload->clear();
+    m_scheduler.pop(*m_payload, batchLimit);
+    if (m_payload->empty()) { // Everything has expired, an empty chunk would end the stream
+        PayloadPool::instance().give(std::move(m_payload));
+        if (m_finishCallback && !m_finished) {
+            m_finished = true;
+            m_writing = true;
+            Connection::send(boost::asio::buffer("0\r\n\r\n", 5));
+        }
+        return;
+    }
+    writePayload();
 }
 
-void Server::send(const boost::asio::const_buffer& buffer)
+void Server::writePayload()
 {
-    const std::string dataLength((boost::format("%|x|\r\n") % boost::asio::buffer_size(buffer)).str());
+    const auto res = std::to_chars(m_chunkHeader.data(), m_chunkHeader.data() + m_chunkHeader.size() - 2,
+                                   m_payload->size(), 16);
+    res.ptr[0] = '\r';
+    res.ptr[1] = '\n';
     const std::array<boost::asio::const_buffer, 3> bufs = {{
-        boost::asio::buffer(dataLength),
-        boost::asio::buffer(buffer),
+        boost::asio::buffer(m_chunkHeader.data(), static_cast<size_t>(res.ptr + 2 - m_chunkHeader.data())),
+        boost::asio::buffer(*m_payload),
         boost::asio::buffer("\r\n", 2)
     }};
+    m_writing = true;
+    ++m_metrics.writes;
+    // Chunk header, frames and trailer leave in one gathering write.
     Connection::send(bufs);
 }
 
+void Server::suspend()
+{
+    m_suspended = true;
+    boost::system::error_code ec;
+    m_batchTimer.cancel(ec);
+    Connection::suspend();
+}
+
+bool Server::detach(Handover::ConnectionState& state, int& fd)
+{
+    // The chunk being written is complete once the connection is idle.
+    if (!Connection::detach(state, fd))
+        return false;
+    PayloadPool::instance().give(std::move(m_payload));
+    std::vector<uint8_t> pending;
+    m_scheduler.pop(pending, std::numeric_limits<size_t>::max());
+    state.pending.assign(pending.begin(), pending.end());
+    m_writing = false;
+    m_batchPending = false;
+    return true;
+}
+
+bool Server::adopt(int fd, const Handover::ConnectionState& state, unsigned timeout)
+{
+    m_writing = false;
+    m_finished = false;
+    m_batchPending = false;
+    m_suspended = false;
+    Connection::adopt(fd, state, timeout);
+    if (Connection::isActive() && !state.pending.empty()) {
+        m_payload = PayloadPool::instance().take();
+        m_payload->assign(state.pending.begin(), state.pending.end());
+        writePayload();
+    }
+    return true;
+}
+
+void Server::writeComplete()
+{
+    m_writing = false;
+    PayloadPool::instance().give(std::move(m_payload));
+    if (m_finished) {
+        const auto done = std::move(m_finishCallback);
+        m_finishCallback = {};
+        done();
+        return;
+    }
+    if (!m_scheduler.empty() || m_finishCallback)
+        flush();
+}
+
 void Server::prepareRequest()
 {
-    std::ostream requestStream(&m_request);
+    PayloadPool::instance().give(std::move(m_payload));
+    m_writing = false;
+    m_finished = false;
+    m_batchPending = false;
+    m_suspended = false;
+    std::ostream requestStream(m_request.get());
     requestStream << "POST " << m_uri << " HTTP/1.1\r\n"
                   << "Host: " << m_server << "\r\n"
                   << "Ntrip-Version: Ntrip/2.0\r\n"
                   << "User-Agent: Boost.Asio NTRIP Server " << version
                   << "\r\n";
-    if (m_auth.authenticated())
-        requestStream << "Authorization: Basic " << m_auth.basic() << "\r\n";
+    requestStream << authorization("POST");
     requestStream << "Connection: close\r\n"
                   << "Transfer-Encoding: chunked\r\n"
                   << "\r\n";
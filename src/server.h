@@ -2,31 +2,79 @@
 #define __CASTER_SERVER_H__
 
 #include "connection.h"
+#include "sink.h"
+#include "scheduler.h"
+#include "rtcm.h"
+#include "metrics.h"
+#include "buffer_pool.h"
 
 #include <boost/asio.hpp>
 
+#include <array>
 #include <string>
+#include <vector>
 #include <cstdint>
 
 namespace Caster {
 
-class Server : private Connection {
+// Final, so that ClusterSink calls its members without dispatch.
+class Server final : public Sink, private Connection {
     public:
+        using Sink::Clock;
+
         Server(boost::asio::io_service& ioService,
                const std::string& server, uint16_t port,
                const std::string& mountpoint);
+        ~Server() override;
+
+        void start(unsigned timeout) override { Connection::start(timeout); }
+        void stop() override { Connection::stop(); }
+        // A standby destination runs without a timeout until it takes over.
+        void setTimeout(unsigned timeout) { Connection::setTimeout(timeout); }
+        bool isIdle() const override { return Connection::isIdle(); }
+        bool isActive() const override { return Connection::isActive(); }
+
+        void setCredentials(const std::string& login,
+                            const std::string& password) override
+        { Connection::setCredentials(login, password); }
+        void setPriority(unsigned priority) override { Connection::setPriority(priority); }
+        void setBatchDeadline(std::chrono::microseconds deadline) override { m_batchDeadline = deadline; }
+
+        void send(const FrameBatch& frames) override;
+        // Sends what is queued, ends the chunked stream and calls done.
+        void finish(const EOFCallback& done) override;
 
-        using Connection::start;
-        using Connection::stop;
-        using Connection::setCredentials;
-        using Connection::setErrorCallback;
-        using Connection::resetErrorCallback;
-        using Connection::isActive;
+        void setErrorCallback(const ErrorCallback& cb) override { Connection::setErrorCallback(cb); }
+        void setHeadersCallback(const HeadersCallback& cb) override { Connection::setHeadersCallback(cb); }
 
-        void send(const boost::asio::const_buffer& buffer);
+        bool canHandOver() const override { return true; }
+        void suspend() override;
+        bool detach(Handover::ConnectionState& state, int& fd) override;
+        bool adopt(int fd, const Handover::ConnectionState& state, unsigned timeout) override;
 
     private:
+        using PayloadPool = BufferPool<std::vector<uint8_t>>;
+
+        FrameScheduler m_scheduler;
+        PayloadPool::Ptr m_payload; // lent while a chunk is written
+        std::array<char, 2 * sizeof(size_t) + 2> m_chunkHeader; // hex size and CRLF
+        bool m_writing;
+        bool m_finished;
+        EOFCallback m_finishCallback;
+        std::chrono::microseconds m_batchDeadline;
+        boost::asio::steady_timer m_batchTimer;
+        bool m_batchPending; // frames wait for the epoch end or the timer
+        Clock::time_point m_batchStart;
+        DestinationMetrics& m_metrics;
+
+        bool m_suspended; // frames stay queued to go along with the socket
+
+        void flush();
+        void writePayload();
+        void handleBatchTimer(const boost::system::error_code& ec);
+
         void prepareRequest() override;
+        void writeComplete() override;
 };
 
 }
@@ -13,10 +13,36 @@ Settings::Settings() noexcept
     : m_isHelp(true),
       m_isVersion(false),
       m_isDebug(false),
+      m_isNearest(false),
+      m_isSourceRtp(false),
+      m_isSourceTcp(false),
+      m_isDestinationRtp(false),
+      m_isCoroutineEngine(false),
+      m_isProfileHandlers(false),
       m_sourcePort(2101),
       m_destinationPort(2101),
+      m_listenPort(0),
+      m_sourceListenPort(0),
+      m_ingestPort(0),
+      m_replaySpeed(1),
       m_verbosity(1),
-      m_connectionTimeout(120)
+      m_connectionTimeout(120),
+      m_timeoutSigmas(4),
+      m_admissionRate(0),
+      m_admissionPerHost(0),
+      m_admissionJitter(0),
+      m_maxAge(0),
+      m_destinationReplay(1000),
+      m_batchDeadline(0),
+      m_hysteresis(2000),
+      m_sourceTableRefresh(3600),
+      m_vrsCell(0),
+      m_ggaInterval(10),
+      m_recordSegmentSize(64),
+      m_recordSegmentTime(3600),
+      m_shmSize(1024),
+      m_multicastTTL(1),
+      m_traceSize(65536)
 {
 }
 
@@ -28,6 +54,14 @@ SettingsParser::SettingsParser() noexcept
         ("debug,d", "NTRIP clinet debugging")
         ("gga,g", po::value<std::string>(), "GPGGA string")
         ("src-mountpoint,M", po::value<std::string>(), "source mountpoint name")
+        ("nearest,N", "follow the source mountpoint nearest to the GGA position")
+        ("hysteresis", po::value<unsigned>(), "distance in meters a nearer mountpoint has to win by before switching to it")
+        ("nav-system", po::value<std::string>(), "systems a nearest mountpoint has to carry, e.g. GPS+GLO")
+        ("sourcetable-refresh", po::value<unsigned>(), "source sourcetable refresh interval in seconds (0 - download once)")
+        ("sourcetable-cache", po::value<std::string>(), "file to keep a copy of the source sourcetable in")
+        ("config,c", po::value<std::string>(), "file with relays to run, one per line, SIGHUP reloads it")
+        ("control", po::value<std::string>(), "Unix socket path to manage relays at runtime")
+        ("takeover", po::value<std::string>(), "control socket path of a running relay to take the connections over from")
         ("src-login,L", po::value<std::string>(), "source login")
         ("src-password,W", po::value<std::string>(), "source password")
         ("src-port,P", po::value<uint16_t>(), "source server port")
@@ -37,7 +71,41 @@ SettingsParser::SettingsParser() noexcept
         ("dst-password,w", po::value<std::string>(), "destination password")
         ("dst-port,p", po::value<uint16_t>(), "destination server port")
         ("dst-server,s", po::value<std::string>(), "destination server address")
+        ("listen-port,b", po::value<uint16_t>(), "port to serve local rovers on")
+        ("listen-mountpoint", po::value<std::string>(), "mountpoint name for local rovers (default - source mountpoint name)")
+        ("listen-address", po::value<std::string>(), "address to serve local rovers on (default - 127.0.0.1)")
+        ("listen-login", po::value<std::string>(), "login local rovers have to present")
+        ("listen-password", po::value<std::string>(), "password local rovers have to present")
+        ("vrs-cell", po::value<unsigned>(), "share source VRS streams between rovers within grid cells of this size in meters")
+        ("gga-interval", po::value<unsigned>(), "interval in seconds to send GGA to the source VRS mountpoint")
+        ("record", po::value<std::string>(), "record the source stream to <prefix>-<time>.rec segments")
+        ("record-segment-size", po::value<unsigned>(), "record segment size limit in megabytes (0 - unlimited)")
+        ("record-segment-time", po::value<unsigned>(), "record segment duration limit in seconds (0 - unlimited)")
+        ("replay", po::value<std::string>(), "take the source stream from a recording or a raw RTCM 3 file")
+        ("replay-speed", po::value<double>(), "replay speed factor (0 - as fast as possible)")
+        ("shm", po::value<std::string>(), "publish frames to the shared memory ring of this name for local readers")
+        ("shm-size", po::value<unsigned>(), "shared memory ring size in kilobytes")
+        ("src-rtp", "connect to the source caster with NTRIP 2.0 over RTP/UDP")
+        ("src-tcp", "read raw RTCM 3 from the source server port instead of an NTRIP caster")
+        ("src-listen", po::value<uint16_t>(), "read raw RTCM 3 from whoever connects to this port")
+        ("src-file", po::value<std::string>(), "read raw RTCM 3 from a file, FIFO or serial device")
+        ("ingest-port", po::value<uint16_t>(), "accept NTRIP SOURCE and POST uploads from base stations on this port")
+        ("dst-rtp", "connect to the destination caster with NTRIP 2.0 over RTP/UDP")
+        ("dst-cluster", po::value<std::string>(), "other casters of the destination cluster as <host>[:<port>],..., a standby connection to one of them takes over when the destination fails")
+        ("dst-replay", po::value<unsigned>(), "frames sent this many milliseconds before a destination failure are sent again to the standby that takes over")
+        ("multicast", po::value<std::string>(), "send frames over UDP to <group>:<port> instead of the destination caster")
+        ("multicast-ttl", po::value<unsigned>(), "multicast time to live")
         ("timeout,t", po::value<unsigned>(), "connection timeout")
+        ("timeout-sigmas", po::value<double>(), "time out streams this many standard deviations beyond their usual gap between data (0 - fixed timeout only)")
+        ("admission-rate", po::value<double>(), "start at most this many connection attempts per second (0 - unlimited)")
+        ("admission-per-host", po::value<unsigned>(), "connection attempts in progress per caster host (0 - unlimited)")
+        ("admission-jitter", po::value<unsigned>(), "hold back each connection attempt by up to this many milliseconds at random")
+        ("engine", po::value<std::string>(), "connection engine: callbacks or coroutines (built with COROUTINES)")
+        ("trace", po::value<std::string>(), "record connection lifecycle events and write them to this file in Chrome trace JSON on SIGUSR1")
+        ("trace-size", po::value<unsigned>(), "trace events kept per thread, the latest ones")
+        ("profile-handlers", "export the run time of completion handlers per connection and the event loop delay in metrics")
+        ("max-age,a", po::value<unsigned>(), "drop observations older than this number of milliseconds (0 - never)")
+        ("batch-deadline", po::value<unsigned>(), "collect frames of an epoch for up to this number of microseconds before writing (0 - write at once)")
         ("verbosity,V", po::value<int>(), "log file verbosity (0 - quiet, 1 - normal, 2 - extra)")
         ("version,v", "show NTRIP client version and exit")
     ;
@@ -55,6 +123,30 @@ void SettingsParser::init(int argc, char* argv[])
     if (vm.count("debug") > 0)
         m_settings.m_isDebug = true;
 
+    if (vm.count("nearest") > 0)
+        m_settings.m_isNearest = true;
+
+    if (vm.count("hysteresis") > 0)
+        m_settings.m_hysteresis = vm["hysteresis"].as<unsigned>();
+
+    if (vm.count("sourcetable-refresh") > 0)
+        m_settings.m_sourceTableRefresh = vm["sourcetable-refresh"].as<unsigned>();
+
+    if (vm.count("nav-system") > 0)
+        m_settings.m_navSystem = vm["nav-system"].as<std::string>();
+
+    if (vm.count("sourcetable-cache") > 0)
+        m_settings.m_sourceTableCache = vm["sourcetable-cache"].as<std::string>();
+
+    if (vm.count("config") > 0)
+        m_settings.m_configFile = vm["config"].as<std::string>();
+
+    if (vm.count("control") > 0)
+        m_settings.m_controlSocket = vm["control"].as<std::string>();
+
+    if (vm.count("takeover") > 0)
+        m_settings.m_takeover = vm["takeover"].as<std::string>();
+
     if (vm.count("src-server") > 0)
         m_settings.m_sourceServer = vm["src-server"].as<std::string>();
 
@@ -103,6 +195,87 @@ void SettingsParser::init(int argc, char* argv[])
         }
     }
 
+    if (vm.count("listen-port") > 0)
+    {
+        try
+        {
+            m_settings.m_listenPort = vm["listen-port"].as<uint16_t>();
+        }
+        catch (boost::bad_lexical_cast &)
+        {
+            throw CasterError("Invalid listen port value");
+        }
+    }
+
+    if (vm.count("listen-mountpoint") > 0)
+        m_settings.m_listenMountpoint = vm["listen-mountpoint"].as<std::string>();
+
+    m_settings.m_listenAddress = vm.count("listen-address") > 0 ?
+                                 vm["listen-address"].as<std::string>() : "127.0.0.1";
+
+    if (vm.count("listen-login") > 0)
+        m_settings.m_listenLogin = vm["listen-login"].as<std::string>();
+
+    if (vm.count("listen-password") > 0)
+        m_settings.m_listenPassword = vm["listen-password"].as<std::string>();
+
+    if (vm.count("vrs-cell") > 0)
+        m_settings.m_vrsCell = vm["vrs-cell"].as<unsigned>();
+
+    if (vm.count("gga-interval") > 0)
+        m_settings.m_ggaInterval = vm["gga-interval"].as<unsigned>();
+
+    if (vm.count("record") > 0)
+        m_settings.m_record = vm["record"].as<std::string>();
+
+    if (vm.count("record-segment-size") > 0)
+        m_settings.m_recordSegmentSize = vm["record-segment-size"].as<unsigned>();
+
+    if (vm.count("record-segment-time") > 0)
+        m_settings.m_recordSegmentTime = vm["record-segment-time"].as<unsigned>();
+
+    if (vm.count("replay") > 0)
+        m_settings.m_replay = vm["replay"].as<std::string>();
+
+    if (vm.count("replay-speed") > 0)
+        m_settings.m_replaySpeed = vm["replay-speed"].as<double>();
+
+    if (vm.count("shm") > 0)
+        m_settings.m_shm = vm["shm"].as<std::string>();
+
+    if (vm.count("shm-size") > 0)
+        m_settings.m_shmSize = vm["shm-size"].as<unsigned>();
+
+    if (vm.count("src-rtp") > 0)
+        m_settings.m_isSourceRtp = true;
+
+    if (vm.count("src-tcp") > 0)
+        m_settings.m_isSourceTcp = true;
+
+    if (vm.count("src-listen") > 0)
+        m_settings.m_sourceListenPort = vm["src-listen"].as<uint16_t>();
+
+    if (vm.count("ingest-port") > 0)
+        m_settings.m_ingestPort = vm["ingest-port"].as<uint16_t>();
+
+    if (vm.count("src-file") > 0)
+        m_settings.m_sourceFile = vm["src-file"].as<std::string>();
+
+    if (vm.count("dst-rtp") > 0)
+        m_settings.m_isDestinationRtp = true;
+
+    if (vm.count("dst-cluster") > 0)
+        m_settings.m_destinationCluster = vm["dst-cluster"].as<std::string>();
+
+    if (vm.count("dst-replay") > 0)
+        m_settings.m_destinationReplay = vm["dst-replay"].as<unsigned>();
+
+    if (vm.count("multicast") > 0)
+        m_settings.m_multicast = vm["multicast"].as<std::string>();
+
+    if (vm.count("multicast-ttl") > 0)
+        m_settings.m_multicastTTL = vm["multicast-ttl"].as<unsigned>();
+
     if (vm.count("verbosity") > 0)
     {
         m_settings.m_verbosity = vm["verbosity"].as<int>();
@@ -119,6 +292,49 @@ void SettingsParser::init(int argc, char* argv[])
     if (vm.count("timeout") > 0)
         m_settings.m_connectionTimeout = vm["timeout"].as<unsigned>();
 
+    if (vm.count("timeout-sigmas") > 0)
+        m_settings.m_timeoutSigmas = vm["timeout-sigmas"].as<double>();
+
+    if (vm.count("admission-rate") > 0)
+        m_settings.m_admissionRate = vm["admission-rate"].as<double>();
+
+    if (vm.count("admission-per-host") > 0)
+        m_settings.m_admissionPerHost = vm["admission-per-host"].as<unsigned>();
+
+    if (vm.count("admission-jitter") > 0)
+        m_settings.m_admissionJitter = vm["admission-jitter"].as<unsigned>();
+
+    if (vm.count("engine") > 0)
+    {
+        const std::string engine = vm["engine"].as<std::string>();
+        if (engine == "coroutines")
+        {
+#ifndef NTRIP_COROUTINES
+            throw CasterError("Coroutine engine is not built in, configure with -DCOROUTINES=ON");
+#endif
+            m_settings.m_isCoroutineEngine = true;
+        }
+        else if (engine != "callbacks")
+        {
+            throw CasterError("Invalid engine: " + engine);
+        }
+    }
+
+    if (vm.count("trace") > 0)
+        m_settings.m_trace = vm["trace"].as<std::string>();
+
+    if (vm.count("trace-size") > 0)
+        m_settings.m_traceSize = vm["trace-size"].as<unsigned>();
+
+    if (vm.count("profile-handlers") > 0)
+        m_settings.m_isProfileHandlers = true;
+
+    if (vm.count("max-age") > 0)
+        m_settings.m_maxAge = vm["max-age"].as<unsigned>();
+
+    if (vm.count("batch-deadline") > 0)
+        m_settings.m_batchDeadline = vm["batch-deadline"].as<unsigned>();
+
     if (vm.count("gga") > 0)
         m_settings.m_gga = vm["gga"].as<std::string>();
 }
@@ -20,6 +20,12 @@ class Settings
         bool isHelp() const noexcept { return m_isHelp; }
         bool isVersion() const noexcept { return m_isVersion; }
         bool isDebug() const noexcept { return m_isDebug; }
+        bool isNearest() const noexcept { return m_isNearest; }
+        bool isSourceRtp() const noexcept { return m_isSourceRtp; }
+        bool isSourceTcp() const noexcept { return m_isSourceTcp; }
+        bool isDestinationRtp() const noexcept { return m_isDestinationRtp; }
+        bool isCoroutineEngine() const noexcept { return m_isCoroutineEngine; }
+        bool isProfileHandlers() const noexcept { return m_isProfileHandlers; }
 
         const std::string& sourceServer() const noexcept { return m_sourceServer; }
         const std::string& sourceMountpoint() const noexcept { return m_sourceMountpoint; }
@@ -30,18 +36,60 @@ class Settings
         const std::string& destinationMountpoint() const noexcept { return m_destinationMountpoint; }
         const std::string& destinationLogin() const noexcept { return m_destinationLogin; }
         const std::string& destinationPassword() const noexcept { return m_destinationPassword; }
+        const std::string& destinationCluster() const noexcept { return m_destinationCluster; }
 
         const std::string& gga() const noexcept { return m_gga; }
+        const std::string& sourceTableCache() const noexcept { return m_sourceTableCache; }
+        const std::string& navSystem() const noexcept { return m_navSystem; }
+        const std::string& listenMountpoint() const noexcept { return m_listenMountpoint; }
+        const std::string& listenAddress() const noexcept { return m_listenAddress; }
+        const std::string& listenLogin() const noexcept { return m_listenLogin; }
+        const std::string& listenPassword() const noexcept { return m_listenPassword; }
+        const std::string& configFile() const noexcept { return m_configFile; }
+        const std::string& controlSocket() const noexcept { return m_controlSocket; }
+        const std::string& takeover() const noexcept { return m_takeover; }
+        const std::string& record() const noexcept { return m_record; }
+        const std::string& replay() const noexcept { return m_replay; }
+        double replaySpeed() const noexcept { return m_replaySpeed; }
+        const std::string& shm() const noexcept { return m_shm; }
+        const std::string& multicast() const noexcept { return m_multicast; }
+        const std::string& trace() const noexcept { return m_trace; }
+        const std::string& sourceFile() const noexcept { return m_sourceFile; }
 
         int verbosity() const noexcept { return m_verbosity; }
         uint16_t destinationPort() const noexcept { return m_destinationPort; }
         uint16_t sourcePort() const noexcept { return m_sourcePort; }
+        uint16_t listenPort() const noexcept { return m_listenPort; }
+        uint16_t sourceListenPort() const noexcept { return m_sourceListenPort; }
+        uint16_t ingestPort() const noexcept { return m_ingestPort; }
         unsigned connectionTimeout() const noexcept { return m_connectionTimeout; }
+        double timeoutSigmas() const noexcept { return m_timeoutSigmas; }
+        double admissionRate() const noexcept { return m_admissionRate; }
+        unsigned admissionPerHost() const noexcept { return m_admissionPerHost; }
+        unsigned admissionJitter() const noexcept { return m_admissionJitter; }
+        unsigned maxAge() const noexcept { return m_maxAge; }
+        unsigned destinationReplay() const noexcept { return m_destinationReplay; }
+        unsigned batchDeadline() const noexcept { return m_batchDeadline; }
+        unsigned hysteresis() const noexcept { return m_hysteresis; }
+        unsigned sourceTableRefresh() const noexcept { return m_sourceTableRefresh; }
+        unsigned vrsCell() const noexcept { return m_vrsCell; }
+        unsigned ggaInterval() const noexcept { return m_ggaInterval; }
+        unsigned recordSegmentSize() const noexcept { return m_recordSegmentSize; }
+        unsigned recordSegmentTime() const noexcept { return m_recordSegmentTime; }
+        unsigned shmSize() const noexcept { return m_shmSize; }
+        unsigned multicastTTL() const noexcept { return m_multicastTTL; }
+        unsigned traceSize() const noexcept { return m_traceSize; }
 
     private:
         bool m_isHelp;
         bool m_isVersion;
         bool m_isDebug;
+        bool m_isNearest;
+        bool m_isSourceRtp;
+        bool m_isSourceTcp;
+        bool m_isDestinationRtp;
+        bool m_isCoroutineEngine;
+        bool m_isProfileHandlers;
 
         std::string m_sourceServer;
         std::string m_sourceMountpoint;
@@ -53,10 +101,46 @@ class Settings
         std::string m_destinationLogin;
         std::string m_destinationPassword;
         uint16_t m_destinationPort;
+        std::string m_destinationCluster;
         std::string m_gga;
+        std::string m_sourceTableCache;
+        std::string m_navSystem;
+        std::string m_listenMountpoint;
+        std::string m_listenAddress;
+        std::string m_listenLogin;
+        std::string m_listenPassword;
+        std::string m_configFile;
+        std::string m_controlSocket;
+        std::string m_takeover;
+        std::string m_record;
+        std::string m_replay;
+        std::string m_shm;
+        std::string m_multicast;
+        std::string m_trace;
+        std::string m_sourceFile;
+        uint16_t m_listenPort;
+        uint16_t m_sourceListenPort;
+        uint16_t m_ingestPort;
+        double m_replaySpeed;
 
         int m_verbosity;
         unsigned m_connectionTimeout;
+        double m_timeoutSigmas;
+        double m_admissionRate;
+        unsigned m_admissionPerHost;
+        unsigned m_admissionJitter;
+        unsigned m_maxAge;
+        unsigned m_destinationReplay;
+        unsigned m_batchDeadline;
+        unsigned m_hysteresis;
+        unsigned m_sourceTableRefresh;
+        unsigned m_vrsCell;
+        unsigned m_ggaInterval;
+        unsigned m_recordSegmentSize;
+        unsigned m_recordSegmentTime;
+        unsigned m_shmSize;
+        unsigned m_multicastTTL;
+        unsigned m_traceSize;
 
         friend class SettingsParser;
 };
@@ -0,0 +1,247 @@
+#include "shm_ring.h"
+#include "error.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <new>
+#include <cstring>
+#include <cerrno>
+
+using namespace Caster::Shm;
+using Caster::CasterError;
+
+namespace
+{
+
+size_t alignRecord(size_t size)
+{
+    return (recordHeaderSize + size + 7) & ~size_t(7);
+}
+
+size_t roundUp(size_t value)
+{
+    size_t res = 4096;
+    while (res < value)
+        res <<= 1;
+    return res;
+}
+
+uint32_t load32(const uint8_t* src)
+{
+    uint32_t res = 0;
+    memcpy(&res, src, sizeof(res));
+    return res;
+}
+
+uint16_t load16(const uint8_t* src)
+{
+    uint16_t res = 0;
+    memcpy(&res, src, sizeof(res));
+    return res;
+}
+
+}
+
+std::string Caster::Shm::objectName(const std::string& mountpoint)
+{
+    std::string res = "/ntriprelay.";
+    for (const char c : mountpoint)
+        res += c == '/' ? '_' : c;
+    return res;
+}
+
+Writer::Writer(const std::string& mountpoint, size_t capacity)
+    : m_name(objectName(mountpoint)),
+      m_header(nullptr),
+      m_data(nullptr),
+      m_mapSize(sizeof(Header) + roundUp(capacity))
+{
+    // Readers of a previous writer keep their mapping of the old object
+    // until they see it unlinked, new readers get the new one.
+    shm_unlink(m_name.c_str());
+    const int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw CasterError("Failed to create shared memory " + m_name + ": " + strerror(errno));
+    if (ftruncate(fd, static_cast<off_t>(m_mapSize)) < 0) {
+        const int error = errno;
+        ::close(fd);
+        shm_unlink(m_name.c_str());
+        throw CasterError("Failed to size shared memory " + m_name + ": " + strerror(error));
+    }
+    void* map = mmap(nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(m_name.c_str());
+        throw CasterError("Failed to map shared memory " + m_name + ": " + strerror(error));
+    }
+
+    m_header = new (map) Header();
+    m_header->capacity = m_mapSize - sizeof(Header);
+    m_header->generation = static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+    m_header->reserved.store(0, std::memory_order_relaxed);
+    m_header->published.store(0, std::memory_order_relaxed);
+    m_header->closed.store(0, std::memory_order_relaxed);
+    m_header->version = version;
+    // Readers check the magic last.
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->magic = magic;
+    m_data = static_cast<uint8_t*>(map) + sizeof(Header);
+}
+
+Writer::~Writer()
+{
+    m_header->closed.store(1, std::memory_order_release);
+    munmap(m_header, m_mapSize);
+    shm_unlink(m_name.c_str());
+}
+
+void Writer::write(const uint8_t* data, size_t size, uint16_t type)
+{
+    const size_t capacity = m_header->capacity;
+    const size_t length = alignRecord(size);
+    if (length > capacity / 2)
+        return;
+
+    uint64_t position = m_header->published.load(std::memory_order_relaxed);
+    size_t offset = position & (capacity - 1);
+    const size_t padding = offset + length > capacity ? capacity - offset : 0;
+
+    m_header->reserved.store(position + padding + length, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (padding > 0) {
+        const uint32_t marker = paddingRecord;
+        memcpy(m_data + offset, &marker, sizeof(marker));
+        position += padding;
+        offset = 0;
+    }
+    const uint32_t size32 = static_cast<uint32_t>(size);
+    const uint16_t flags = 0;
+    memcpy(m_data + offset, &size32, sizeof(size32));
+    memcpy(m_data + offset + 4, &type, sizeof(type));
+    memcpy(m_data + offset + 6, &flags, sizeof(flags));
+    memcpy(m_data + offset + recordHeaderSize, data, size);
+
+    m_header->published.store(position + length, std::memory_order_release);
+}
+
+Reader::Reader(const std::string& mountpoint)
+    : m_fd(-1),
+      m_header(nullptr),
+      m_data(nullptr),
+      m_mapSize(0),
+      m_generation(0),
+      m_position(0),
+      m_lost(0)
+{
+    const std::string name = objectName(mountpoint);
+    const int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+        throw CasterError("Failed to open shared memory " + name + ": " + strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        ::close(fd);
+        throw CasterError("Shared memory " + name + " is not a frame ring");
+    }
+    m_mapSize = static_cast<size_t>(st.st_size);
+    void* map = mmap(nullptr, m_mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    const int error = errno;
+    if (map == MAP_FAILED) {
+        ::close(fd);
+        throw CasterError("Failed to map shared memory " + name + ": " + strerror(error));
+    }
+    m_header = static_cast<const Header*>(map);
+    if (m_header->magic != magic || m_header->version != version ||
+        sizeof(Header) + m_header->capacity > m_mapSize) {
+        munmap(map, m_mapSize);
+        ::close(fd);
+        throw CasterError("Shared memory " + name + " is not a frame ring");
+    }
+    m_fd = fd;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    m_data = static_cast<const uint8_t*>(map) + sizeof(Header);
+    resync();
+}
+
+Reader::~Reader()
+{
+    munmap(const_cast<Header*>(m_header), m_mapSize);
+    ::close(m_fd);
+}
+
+void Reader::resync()
+{
+    m_generation = m_header->generation;
+    m_position = m_header->published.load(std::memory_order_acquire);
+}
+
+bool Reader::isClosed()
+{
+    if (m_header->closed.load(std::memory_order_acquire) != 0)
+        return true;
+    // A writer that died leaves the flag unset, the object is unlinked when
+    // another one takes its place. Checked now and then, it takes a syscall.
+    const auto now = std::chrono::steady_clock::now();
+    if (now < m_nextCheck)
+        return false;
+    m_nextCheck = now + checkInterval;
+    struct stat st;
+    return fstat(m_fd, &st) == 0 && st.st_nlink == 0;
+}
+
+Reader::Status Reader::next(std::vector<uint8_t>& frame, uint16_t& type)
+{
+    const size_t capacity = m_header->capacity;
+    for (;;) {
+        const uint64_t published = m_header->published.load(std::memory_order_acquire);
+        if (published == m_position) {
+            if (!isClosed())
+                return Status::Empty;
+            // The last frames may have been published just before.
+            if (m_header->published.load(std::memory_order_acquire) == m_position)
+                return Status::Closed;
+            continue;
+        }
+        if (published - m_position > capacity) {
+            ++m_lost;
+            resync();
+            return Status::Overrun;
+        }
+
+        const size_t offset = m_position & (capacity - 1);
+        const uint32_t size = load32(m_data + offset);
+        uint64_t next = 0;
+        if (size == paddingRecord) {
+            next = m_position + (capacity - offset);
+        } else {
+            const size_t length = alignRecord(size);
+            if (size > capacity / 2 || offset + length > capacity) {
+                // Overwritten under the reader's hands.
+                ++m_lost;
+                resync();
+                return Status::Overrun;
+            }
+            type = load16(m_data + offset + 4);
+            frame.assign(m_data + offset + recordHeaderSize, m_data + offset + recordHeaderSize + size);
+            next = m_position + length;
+        }
+
+        // The copy is valid if the writer has not reserved the space it
+        // came from in the meantime.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t reserved = m_header->reserved.load(std::memory_order_relaxed);
+        if (reserved - m_position > capacity) {
+            ++m_lost;
+            resync();
+            return Status::Overrun;
+        }
+        m_position = next;
+        if (size != paddingRecord)
+            return Status::Frame;
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef __CASTER_SHM_RING_H__
+#define __CASTER_SHM_RING_H__
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace Caster {
+namespace Shm {
+
+// POSIX shared memory ring with RTCM frames of one mountpoint, written by
+// the relay and read by any number of local processes. Neither side makes
+// a syscall per frame.
+//
+// Records are 8-byte aligned: u32 size, u16 message type, u16 flags, then
+// the frame. A record never wraps, the writer pads to the end of the ring
+// instead. The writer bumps `reserved` before it touches the data and
+// `published` after, so a reader that copied a record checks `reserved`
+// again to know the copy was not overwritten meanwhile (a seqlock per
+// ring position).
+//
+// A writer that goes away sets `closed`. One that died without doing so is
+// found out by its object having been unlinked, by its replacement at the
+// latest.
+
+const uint32_t magic = 0x4E545253; // "NTRS"
+const uint32_t version = 2;
+const size_t recordHeaderSize = 8;
+const uint32_t paddingRecord = 0xFFFFFFFF;
+
+struct alignas(64) Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity; // data bytes, a power of two
+    uint64_t generation; // changes when the writer restarts
+    alignas(64) std::atomic<uint64_t> reserved; // data up to here may be changing
+    alignas(64) std::atomic<uint64_t> published; // data up to here is complete
+    std::atomic<uint32_t> closed; // the writer has gone
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+              std::atomic<uint32_t>::is_always_lock_free, "shared memory needs lock-free atomics");
+
+// Shared memory object name of a mountpoint.
+std::string objectName(const std::string& mountpoint);
+
+class Writer
+{
+    public:
+        // Creates or replaces the ring of the mountpoint, capacity is
+        // rounded up to a power of two. Throws CasterError.
+        Writer(const std::string& mountpoint, size_t capacity);
+        ~Writer();
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        void write(const uint8_t* data, size_t size, uint16_t type);
+
+    private:
+        std::string m_name;
+        Header* m_header;
+        uint8_t* m_data;
+        size_t m_mapSize;
+};
+
+class Reader
+{
+    public:
+        enum class Status {
+            Frame,
+            Empty,
+            Overrun, // frames were lost, reading continues with the oldest one kept
+            Closed // the writer has gone or was replaced, attach a new reader
+        };
+
+        // Attaches to the ring of the mountpoint and starts with the next
+        // frame written. Throws CasterError.
+        explicit Reader(const std::string& mountpoint);
+        ~Reader();
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        // Copies the next frame, never blocks. Closed is returned once the
+        // frames written before are read, at most every checkInterval after
+        // the writer died.
+        Status next(std::vector<uint8_t>& frame, uint16_t& type);
+        // Frames lost to overruns so far.
+        uint64_t lost() const noexcept { return m_lost; }
+
+        static constexpr std::chrono::milliseconds checkInterval{100};
+
+    private:
+        int m_fd; // tells whether the object was unlinked
+        const Header* m_header;
+        const uint8_t* m_data;
+        size_t m_mapSize;
+        uint64_t m_generation;
+        uint64_t m_position;
+        uint64_t m_lost;
+        std::chrono::steady_clock::time_point m_nextCheck;
+
+        void resync();
+        bool isClosed();
+};
+
+}
+}
+
+#endif
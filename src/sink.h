@@ -0,0 +1,79 @@
+#ifndef __CASTER_SINK_H__
+#define __CASTER_SINK_H__
+
+#include "callbacks.h"
+#include "handover.h"
+#include "scheduler.h"
+#include "rtcm.h"
+
+#include <memory>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace Caster {
+
+// A frame for a sink, dropped if it is still queued after expires.
+struct OutgoingFrame {
+    RTCM::Frame frame;
+    FrameScheduler::Clock::time_point expires;
+};
+
+// The frames of one source buffer, in order. They point into the buffer and
+// are valid only during the call they are passed to.
+using FrameBatch = std::vector<OutgoingFrame>;
+
+// Where a relay sends its frames to, the counterpart of Source.
+class Sink
+{
+    public:
+        using Clock = FrameScheduler::Clock;
+
+        virtual ~Sink() = default;
+
+        virtual void start(unsigned timeout) = 0;
+        virtual void stop() = 0;
+        // No completion handler refers to the sink, it is safe to destroy
+        // it.
+        virtual bool isIdle() const = 0;
+        // Frames are accepted.
+        virtual bool isActive() const = 0;
+
+        virtual void setCredentials(const std::string& /*login*/,
+                                    const std::string& /*password*/) {}
+        virtual void setPriority(unsigned /*priority*/) {}
+        // Frames of an epoch are collected until it ends or the deadline
+        // passes, zero writes every frame right away. Datagram sinks batch
+        // per event loop turn anyway and ignore it.
+        virtual void setBatchDeadline(std::chrono::microseconds /*deadline*/) {}
+
+        // Called once per source buffer: the sink goes through the frames
+        // in a loop of its own, nothing is dispatched per frame.
+        virtual void send(const FrameBatch& frames) = 0;
+        // Sends what is queued, ends the stream and calls done.
+        virtual void finish(const EOFCallback& done) = 0;
+
+        virtual void setErrorCallback(const ErrorCallback& cb) = 0;
+        // Called once the sink is ready to accept frames.
+        virtual void setHeadersCallback(const HeadersCallback& cb) = 0;
+
+        // Handing the connection over to another process on upgrade, as
+        // for Source. Frames queued for writing go along.
+        virtual bool canHandOver() const { return false; }
+        virtual void suspend() {}
+        virtual bool detach(Handover::ConnectionState& /*state*/, int& /*fd*/) { return false; }
+        virtual bool adopt(int /*fd*/, const Handover::ConnectionState& /*state*/,
+                           unsigned /*timeout*/) { return false; }
+
+        void resetCallbacks()
+        {
+            setErrorCallback({});
+            setHeadersCallback({});
+        }
+};
+
+using SinkPtr = std::unique_ptr<Sink>;
+
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef __CASTER_SOURCE_H__
+#define __CASTER_SOURCE_H__
+
+#include "callbacks.h"
+#include "handover.h"
+
+#include <memory>
+#include <string>
+#include <map>
+
+namespace Caster {
+
+// Where a relay takes its data from: an NTRIP Client or RtpClient, a raw
+// TcpSource or FileSource, a ReplaySource. Buffers are delivered through the
+// data callback bound once at start, so a virtual call happens per start or
+// stop only, never per buffer.
+class Source
+{
+    public:
+        virtual ~Source() = default;
+
+        virtual void start(unsigned timeout) = 0;
+        virtual void stop() = 0;
+        // No completion handler refers to the source, it is safe to destroy
+        // it.
+        virtual bool isIdle() const = 0;
+
+        // NTRIP specifics, ignored by other sources.
+        virtual void setGGA(const std::string& /*gga*/) {}
+        virtual void setCredentials(const std::string& /*login*/,
+                                    const std::string& /*password*/) {}
+        // Connections of a higher priority are admitted first, see
+        // Connection::AdmissionLimits.
+        virtual void setPriority(unsigned /*priority*/) {}
+        virtual const std::map<std::string, std::string>& headers() const;
+
+        virtual void setErrorCallback(const ErrorCallback& cb) = 0;
+        virtual void setDataCallback(const DataCallback& cb) = 0;
+        virtual void setEOFCallback(const EOFCallback& cb) = 0;
+        virtual void setHeadersCallback(const HeadersCallback& /*cb*/) {}
+
+        // Handing the connection over to another process on upgrade, see
+        // Connection::suspend. Sources that cannot be handed over keep
+        // running and are connected anew by the other process.
+        virtual bool canHandOver() const { return false; }
+        virtual void suspend() {}
+        virtual bool detach(Handover::ConnectionState& /*state*/, int& /*fd*/) { return false; }
+        // False if the source cannot go on with the socket, it has to be
+        // started instead.
+        virtual bool adopt(int /*fd*/, const Handover::ConnectionState& /*state*/,
+                           unsigned /*timeout*/) { return false; }
+
+        void resetCallbacks()
+        {
+            setErrorCallback({});
+            setDataCallback({});
+            setEOFCallback({});
+            setHeadersCallback({});
+        }
+};
+
+inline
+const std::map<std::string, std::string>& Source::headers() const
+{
+    static const std::map<std::string, std::string> none;
+    return none;
+}
+
+using SourcePtr = std::unique_ptr<Source>;
+
+}
+
+#endif
@@ -0,0 +1,308 @@
+#include "sourcetable.h"
+
+#include "error.h"
+#include "logger.h"
+#include "version.h"
+
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <cstdio> // std::rename
+#include <cstdlib>
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::SourceTable;
+using Caster::SourceTableClient;
+using Caster::SourceTableCache;
+
+namespace
+{
+
+// The largest networks list a few thousand streams in well under this, a
+// caster sending more is broken or hostile.
+const size_t maxTextSize = 8 * 1024 * 1024;
+
+enum STRField {
+    strType,
+    strMountpoint,
+    strIdentifier,
+    strFormat,
+    strFormatDetails,
+    strCarrier,
+    strNavSystem,
+    strNetwork,
+    strCountry,
+    strLatitude,
+    strLongitude,
+    strNMEA,
+    strFieldCount
+};
+
+enum CASField {
+    casType,
+    casHost,
+    casPort,
+    casIdentifier,
+    casOperator,
+    casNMEA,
+    casCountry,
+    casLatitude,
+    casLongitude,
+    casFieldCount
+};
+
+enum NETField {
+    netType,
+    netIdentifier,
+    netOperator,
+    netAuthentication,
+    netFee,
+    netFieldCount
+};
+
+double toDouble(const std::string& value)
+{
+    return std::strtod(value.c_str(), nullptr);
+}
+
+}
+
+SourceTable SourceTable::parse(std::string text)
+{
+    SourceTable table;
+    table.m_text = std::move(text);
+    std::istringstream stream(table.m_text);
+    std::string line;
+    while (std::getline(stream, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        table.parseLine(line);
+    }
+    return table;
+}
+
+void SourceTable::parseLine(const std::string& line)
+{
+    std::vector<std::string> fields;
+    if (line.compare(0, 4, "STR;") == 0) {
+        boost::algorithm::split(fields, line, boost::algorithm::is_any_of(";"));
+        if (fields.size() < strFieldCount || fields[strMountpoint].empty())
+            return;
+        m_streams.mountpoint.push_back(m_strings.intern(fields[strMountpoint]));
+        m_streams.identifier.push_back(m_strings.intern(fields[strIdentifier]));
+        m_streams.format.push_back(m_strings.intern(fields[strFormat]));
+        m_streams.formatDetails.push_back(m_strings.intern(fields[strFormatDetails]));
+        m_streams.navSystem.push_back(m_strings.intern(fields[strNavSystem]));
+        m_streams.network.push_back(m_strings.intern(fields[strNetwork]));
+        m_streams.country.push_back(m_strings.intern(fields[strCountry]));
+        m_streams.latitude.push_back(toDouble(fields[strLatitude]));
+        m_streams.longitude.push_back(toDouble(fields[strLongitude]));
+        m_streams.nmea.push_back(fields[strNMEA] == "1");
+    } else if (line.compare(0, 4, "CAS;") == 0) {
+        boost::algorithm::split(fields, line, boost::algorithm::is_any_of(";"));
+        if (fields.size() < casFieldCount)
+            return;
+        m_casters.host.push_back(m_strings.intern(fields[casHost]));
+        m_casters.port.push_back(static_cast<uint16_t>(std::strtoul(fields[casPort].c_str(), nullptr, 10)));
+        m_casters.identifier.push_back(m_strings.intern(fields[casIdentifier]));
+        m_casters.operatorName.push_back(m_strings.intern(fields[casOperator]));
+        m_casters.country.push_back(m_strings.intern(fields[casCountry]));
+        m_casters.latitude.push_back(toDouble(fields[casLatitude]));
+        m_casters.longitude.push_back(toDouble(fields[casLongitude]));
+    } else if (line.compare(0, 4, "NET;") == 0) {
+        boost::algorithm::split(fields, line, boost::algorithm::is_any_of(";"));
+        if (fields.size() < netFieldCount)
+            return;
+        m_networks.identifier.push_back(m_strings.intern(fields[netIdentifier]));
+        m_networks.operatorName.push_back(m_strings.intern(fields[netOperator]));
+        m_networks.authentication.push_back(m_strings.intern(fields[netAuthentication]));
+        m_networks.fee.push_back(m_strings.intern(fields[netFee]));
+    }
+}
+
+SourceTableClient::SourceTableClient(boost::asio::io_service& ioService,
+                                     const std::string& server, uint16_t port)
+    : Connection(ioService, server, port)
+{
+    setDataCallback([this](const boost::asio::const_buffers_1& buffers)
+                    {
+                        const auto& buffer = *buffers.begin();
+                        if (m_text.size() + boost::asio::buffer_size(buffer) > maxTextSize) {
+                            ERRLOG(logError) << "Sourcetable of " << m_server << " exceeds "
+                                             << maxTextSize << " bytes";
+                            m_text.clear();
+                            fail(boost::system::error_code(responseTooLarge, CasterCategory::getInstance()));
+                            return;
+                        }
+                        m_text.append(boost::asio::buffer_cast<const char*>(buffer),
+                                      boost::asio::buffer_size(buffer));
+                    });
+    setHeadersCallback(std::bind(&SourceTableClient::handleHeaders, this));
+    setEOFCallback(std::bind(&SourceTableClient::handleEOF, this));
+}
+
+void SourceTableClient::prepareRequest()
+{
+    m_text.clear();
+    m_newLastModified.clear();
+    m_newEtag.clear();
+    std::ostream requestStream(m_request.get());
+    requestStream << "GET / HTTP/1.1\r\n"
+                  << "Host: " << m_server << "\r\n"
+                  << "Ntrip-Version: Ntrip/2.0\r\n"
+                  << "User-Agent: Boost.Asio NTRIP Client " << version
+                  << "\r\n";
+    requestStream << authorization("GET");
+    if (!m_lastModified.empty())
+        requestStream << "If-Modified-Since: " << m_lastModified << "\r\n";
+    if (!m_etag.empty())
+        requestStream << "If-None-Match: " << m_etag << "\r\n";
+    requestStream << "Connection: close\r\n"
+                  << "\r\n";
+}
+
+bool SourceTableClient::isValidStatus(unsigned code) const
+{
+    return code == 200 || code == 304;
+}
+
+void SourceTableClient::handleHeaders()
+{
+    // Headers are only available from within the callback.
+    const auto lastModified = headers().find("Last-Modified");
+    m_newLastModified = lastModified != headers().end() ? lastModified->second : "";
+    const auto etag = headers().find("ETag");
+    m_newEtag = etag != headers().end() ? etag->second : "";
+}
+
+void SourceTableClient::handleEOF()
+{
+    if (status() == 304) {
+        if (m_resultCallback)
+            m_resultCallback("");
+        return;
+    }
+
+    m_lastModified = std::move(m_newLastModified);
+    m_etag = std::move(m_newEtag);
+    m_newLastModified.clear();
+    m_newEtag.clear();
+    if (m_resultCallback)
+        m_resultCallback(m_text);
+}
+
+SourceTableCache::SourceTableCache(boost::asio::io_service& ioService,
+                                   const std::string& server, uint16_t port)
+    : m_client(ioService, server, port),
+      m_timer(ioService),
+      m_refreshInterval(0),
+      m_timeout(0),
+      m_active(false)
+{
+    m_client.setResultCallback(std::bind(&SourceTableCache::handleResult, this, std::placeholders::_1));
+    m_client.setErrorCallback(std::bind(&SourceTableCache::handleError, this, std::placeholders::_1));
+}
+
+void SourceTableCache::start(unsigned timeout)
+{
+    m_timeout = timeout;
+    m_active = true;
+    if (!m_cacheFile.empty())
+        load();
+    m_client.start(timeout);
+}
+
+void SourceTableCache::stop()
+{
+    m_active = false;
+    boost::system::error_code ec;
+    m_timer.cancel(ec);
+    m_client.stop();
+}
+
+void SourceTableCache::load()
+{
+    // Cache file: validator headers, an empty line and the table itself.
+    std::ifstream file(m_cacheFile, std::ios::binary);
+    if (!file)
+        return;
+    std::string lastModified;
+    std::string etag;
+    std::string line;
+    while (std::getline(file, line) && !line.empty()) {
+        if (line.compare(0, 15, "Last-Modified: ") == 0)
+            lastModified = line.substr(15);
+        else if (line.compare(0, 6, "ETag: ") == 0)
+            etag = line.substr(6);
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+    ERRLOG(logDebug) << "Loaded sourcetable from " << m_cacheFile;
+    m_client.setValidators(lastModified, etag);
+    update(text.str());
+}
+
+void SourceTableCache::save(const std::string& text) const
+{
+    const std::string temp = m_cacheFile + ".tmp";
+    {
+        std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+        file << "Last-Modified: " << m_client.lastModified() << "\n"
+             << "ETag: " << m_client.etag() << "\n"
+             << "\n"
+             << text;
+        if (!file) {
+            ERRLOG(logWarning) << "Failed to write sourcetable cache " << temp;
+            return;
+        }
+    }
+    if (std::rename(temp.c_str(), m_cacheFile.c_str()) != 0) {
+        ERRLOG(logWarning) << "Failed to replace sourcetable cache " << m_cacheFile;
+    }
+}
+
+void SourceTableCache::update(std::string text)
+{
+    m_table = std::make_shared<const SourceTable>(SourceTable::parse(std::move(text)));
+    ERRLOG(logDebug) << "Sourcetable: " << m_table->streams().size() << " streams, "
+                     << m_table->casters().size() << " casters, "
+                     << m_table->networks().size() << " networks";
+    if (m_tableCallback)
+        m_tableCallback(m_table);
+}
+
+void SourceTableCache::scheduleRefresh()
+{
+    if (!m_active || m_refreshInterval == 0)
+        return;
+    m_timer.expires_from_now(std::chrono::seconds(m_refreshInterval));
+    m_timer.async_wait([this](const boost::system::error_code& ec)
+                       {
+                           if (!ec && m_active)
+                               m_client.start(m_timeout);
+                       });
+}
+
+void SourceTableCache::handleResult(const std::string& text)
+{
+    if (text.empty()) {
+        ERRLOG(logDebug) << "Sourcetable is not modified";
+    } else {
+        if (!m_cacheFile.empty())
+            save(text);
+        update(text);
+    }
+    scheduleRefresh();
+}
+
+void SourceTableCache::handleError(const boost::system::error_code& ec)
+{
+    // The previous table, if any, stays in use until the next attempt.
+    if (m_errorCallback)
+        m_errorCallback(ec);
+    scheduleRefresh();
+}
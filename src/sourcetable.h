@@ -0,0 +1,168 @@
+#ifndef __CASTER_SOURCETABLE_H__
+#define __CASTER_SOURCETABLE_H__
+
+#include "connection.h"
+#include "callbacks.h"
+#include "string_pool.h"
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+namespace Caster {
+
+// Parsed NTRIP sourcetable. Records are stored by columns, text fields are
+// interned, so a table of a large network takes little more memory than its
+// raw text, which is kept to be served back verbatim.
+class SourceTable {
+    public:
+        using StringId = StringPool::Id;
+
+        struct Streams { // STR records
+            std::vector<StringId> mountpoint;
+            std::vector<StringId> identifier;
+            std::vector<StringId> format;
+            std::vector<StringId> formatDetails;
+            std::vector<StringId> navSystem;
+            std::vector<StringId> network;
+            std::vector<StringId> country;
+            std::vector<double> latitude;
+            std::vector<double> longitude;
+            std::vector<bool> nmea; // the stream expects GGA from the client
+
+            size_t size() const noexcept { return mountpoint.size(); }
+        };
+
+        struct Casters { // CAS records
+            std::vector<StringId> host;
+            std::vector<uint16_t> port;
+            std::vector<StringId> identifier;
+            std::vector<StringId> operatorName;
+            std::vector<StringId> country;
+            std::vector<double> latitude;
+            std::vector<double> longitude;
+
+            size_t size() const noexcept { return host.size(); }
+        };
+
+        struct Networks { // NET records
+            std::vector<StringId> identifier;
+            std::vector<StringId> operatorName;
+            std::vector<StringId> authentication;
+            std::vector<StringId> fee;
+
+            size_t size() const noexcept { return identifier.size(); }
+        };
+
+        static SourceTable parse(std::string text);
+
+        const std::string& text() const noexcept { return m_text; }
+        const std::string& string(StringId id) const { return m_strings.get(id); }
+
+        const Streams& streams() const noexcept { return m_streams; }
+        const Casters& casters() const noexcept { return m_casters; }
+        const Networks& networks() const noexcept { return m_networks; }
+
+    private:
+        std::string m_text;
+        StringPool m_strings;
+        Streams m_streams;
+        Casters m_casters;
+        Networks m_networks;
+
+        void parseLine(const std::string& line);
+};
+
+using SourceTablePtr = std::shared_ptr<const SourceTable>;
+using SourceTableCallback = std::function<void (const SourceTablePtr&)>;
+
+// Downloads the sourcetable of a caster (GET /), conditionally if validators
+// of a previous copy are known.
+class SourceTableClient : private Connection {
+    public:
+        // Empty text means that the table has not been modified.
+        using ResultCallback = std::function<void (const std::string& text)>;
+
+        SourceTableClient(boost::asio::io_service& ioService,
+                          const std::string& server, uint16_t port);
+
+        using Connection::start;
+        using Connection::stop;
+        using Connection::setCredentials;
+        using Connection::setErrorCallback;
+
+        void setValidators(const std::string& lastModified,
+                           const std::string& etag)
+        { m_lastModified = lastModified; m_etag = etag; }
+
+        const std::string& lastModified() const noexcept { return m_lastModified; }
+        const std::string& etag() const noexcept { return m_etag; }
+
+        void setResultCallback(const ResultCallback& cb) { m_resultCallback = cb; }
+
+    private:
+        std::string m_text;
+        std::string m_lastModified;
+        std::string m_etag;
+        // Validators of the table being read, they apply once it is complete.
+        std::string m_newLastModified;
+        std::string m_newEtag;
+        ResultCallback m_resultCallback;
+
+        void prepareRequest() override;
+        bool isValidStatus(unsigned code) const override;
+        void handleHeaders();
+        void handleEOF();
+};
+
+// Keeps the current sourcetable of a caster for the rest of the relay:
+// downloads it on start and then periodically, and optionally keeps a copy
+// on disk, so a restart can work from it before the caster answers.
+class SourceTableCache {
+    public:
+        SourceTableCache(boost::asio::io_service& ioService,
+                         const std::string& server, uint16_t port);
+
+        void setCredentials(const std::string& login,
+                            const std::string& password)
+        { m_client.setCredentials(login, password); }
+        void setCacheFile(const std::string& path) { m_cacheFile = path; }
+        // Zero means download once.
+        void setRefreshInterval(unsigned seconds) { m_refreshInterval = seconds; }
+
+        // Called with every new version of the table.
+        void setTableCallback(const SourceTableCallback& cb) { m_tableCallback = cb; }
+        void setErrorCallback(const ErrorCallback& cb) { m_errorCallback = cb; }
+
+        void start(unsigned timeout);
+        void stop();
+
+        const SourceTablePtr& table() const noexcept { return m_table; }
+
+    private:
+        SourceTableClient m_client;
+        boost::asio::steady_timer m_timer;
+        std::string m_cacheFile;
+        unsigned m_refreshInterval;
+        unsigned m_timeout;
+        bool m_active;
+        SourceTablePtr m_table;
+        SourceTableCallback m_tableCallback;
+        ErrorCallback m_errorCallback;
+
+        void load();
+        void save(const std::string& text) const;
+        void update(std::string text);
+        void scheduleRefresh();
+        void handleResult(const std::string& text);
+        void handleError(const boost::system::error_code& ec);
+};
+
+}
+
+#endif
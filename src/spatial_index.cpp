@@ -0,0 +1,97 @@
+#include "spatial_index.h"
+
+#include <algorithm>
+#include <cmath>
+
+using Caster::SpatialIndex;
+
+namespace
+{
+
+const double earthRadius = 6371000;
+const double degToRad = M_PI / 180;
+
+std::array<double, 3> unitVector(double lat, double lon) noexcept
+{
+    const double phi = lat * degToRad;
+    const double lambda = lon * degToRad;
+    return {{std::cos(phi) * std::cos(lambda), std::cos(phi) * std::sin(lambda), std::sin(phi)}};
+}
+
+double squaredDistance(const std::array<double, 3>& a, const std::array<double, 3>& b) noexcept
+{
+    const double dx = a[0] - b[0];
+    const double dy = a[1] - b[1];
+    const double dz = a[2] - b[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+}
+
+double Caster::distance(double lat1, double lon1, double lat2, double lon2) noexcept
+{
+    const double dphi = (lat2 - lat1) * degToRad;
+    const double dlambda = (lon2 - lon1) * degToRad;
+    const double a = std::sin(dphi / 2) * std::sin(dphi / 2) +
+                     std::cos(lat1 * degToRad) * std::cos(lat2 * degToRad) *
+                     std::sin(dlambda / 2) * std::sin(dlambda / 2);
+    return 2 * earthRadius * std::asin(std::min(1.0, std::sqrt(a)));
+}
+
+void SpatialIndex::add(double lat, double lon, size_t id)
+{
+    m_nodes.push_back(Node{unitVector(lat, lon), id});
+}
+
+void SpatialIndex::build()
+{
+    build(0, m_nodes.size(), 0);
+}
+
+size_t SpatialIndex::nearest(double lat, double lon) const noexcept
+{
+    size_t best = npos;
+    double bestDistance = INFINITY;
+    search(0, m_nodes.size(), 0, unitVector(lat, lon), best, bestDistance);
+    return best == npos ? npos : m_nodes[best].id;
+}
+
+void SpatialIndex::build(size_t begin, size_t end, size_t axis)
+{
+    if (end - begin < 2)
+        return;
+    const size_t middle = begin + (end - begin) / 2;
+    const auto first = m_nodes.begin();
+    std::nth_element(first + static_cast<std::ptrdiff_t>(begin),
+                     first + static_cast<std::ptrdiff_t>(middle),
+                     first + static_cast<std::ptrdiff_t>(end),
+                     [axis](const Node& a, const Node& b) { return a.point[axis] < b.point[axis]; });
+    build(begin, middle, (axis + 1) % 3);
+    build(middle + 1, end, (axis + 1) % 3);
+}
+
+void SpatialIndex::search(size_t begin, size_t end, size_t axis, const Point& point,
+                          size_t& best, double& bestDistance) const noexcept
+{
+    if (begin >= end)
+        return;
+    const size_t middle = begin + (end - begin) / 2;
+    const Node& node = m_nodes[middle];
+    const double d = squaredDistance(node.point, point);
+    if (d < bestDistance) {
+        bestDistance = d;
+        best = middle;
+    }
+
+    const double diff = point[axis] - node.point[axis];
+    const size_t next = (axis + 1) % 3;
+    if (diff < 0) {
+        search(begin, middle, next, point, best, bestDistance);
+        if (diff * diff < bestDistance)
+            search(middle + 1, end, next, point, best, bestDistance);
+    } else {
+        search(middle + 1, end, next, point, best, bestDistance);
+        if (diff * diff < bestDistance)
+            search(begin, middle, next, point, best, bestDistance);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef __CASTER_SPATIAL_INDEX_H__
+#define __CASTER_SPATIAL_INDEX_H__
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace Caster {
+
+// Great-circle distance in meters between two points given in degrees.
+double distance(double lat1, double lon1, double lat2, double lon2) noexcept;
+
+// Static k-d tree over points on the unit sphere. Points are stored as 3D
+// unit vectors, so the chord distance used by the search is monotonic with
+// the great-circle distance and there is no problem with the antimeridian.
+class SpatialIndex {
+    public:
+        static constexpr size_t npos = static_cast<size_t>(-1);
+
+        // Appends a point, the id is returned by nearest().
+        void add(double lat, double lon, size_t id);
+        // Must be called after the last add() and before nearest().
+        void build();
+
+        size_t nearest(double lat, double lon) const noexcept;
+
+        size_t size() const noexcept { return m_nodes.size(); }
+
+    private:
+        using Point = std::array<double, 3>;
+
+        struct Node {
+            Point point;
+            size_t id;
+        };
+
+        // Implicit balanced tree: the root of a range is its middle element,
+        // split by the coordinate depth % 3.
+        std::vector<Node> m_nodes;
+
+        void build(size_t begin, size_t end, size_t axis);
+        void search(size_t begin, size_t end, size_t axis, const Point& point,
+                    size_t& best, double& bestDistance) const noexcept;
+};
+
+}
+
+#endif
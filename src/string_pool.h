@@ -0,0 +1,86 @@
+#ifndef __CASTER_STRING_POOL_H__
+#define __CASTER_STRING_POOL_H__
+
+#include <deque>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
+
+namespace Caster {
+
+// Stores each distinct string once and refers to it by a small id. Strings
+// never move, so the index can be keyed by views into them.
+class StringPool {
+    public:
+        using Id = uint32_t;
+
+        StringPool() = default;
+        StringPool(const StringPool&) = delete;
+        StringPool& operator=(const StringPool&) = delete;
+        StringPool(StringPool&&) = default;
+        StringPool& operator=(StringPool&&) = default;
+
+        Id intern(std::string_view value)
+        {
+            const auto it = m_index.find(value);
+            if (it != m_index.end())
+                return it->second;
+            const Id id = static_cast<Id>(m_strings.size());
+            m_strings.emplace_back(value);
+            m_index.emplace(m_strings.back(), id);
+            return id;
+        }
+
+        const std::string& get(Id id) const { return m_strings[id]; }
+
+        size_t size() const noexcept { return m_strings.size(); }
+
+    private:
+        std::deque<std::string> m_strings;
+        std::unordered_map<std::string_view, Id> m_index;
+};
+
+// A string kept once per process, such as a caster host or a mountpoint
+// that many connections name. A copy is a pointer. Interned strings are
+// never freed: every host or mountpoint a reload or a control command ever
+// named stays, which is a few bytes each. Secrets such as credentials do
+// not belong here, they would outlive their last use.
+class SharedString {
+    public:
+        SharedString() : SharedString(std::string_view()) {}
+        SharedString(std::string_view value) : m_value(&pool().get(pool().intern(value))) {}
+        SharedString(const std::string& value) : SharedString(std::string_view(value)) {}
+        SharedString(const char* value) : SharedString(std::string_view(value)) {}
+
+        const std::string& str() const noexcept { return *m_value; }
+        operator const std::string&() const noexcept { return *m_value; }
+        bool empty() const noexcept { return m_value->empty(); }
+        size_t size() const noexcept { return m_value->size(); }
+        const char& operator[](size_t pos) const noexcept { return (*m_value)[pos]; }
+
+        // Equal strings are the same object.
+        bool operator==(const SharedString& rhs) const noexcept { return m_value == rhs.m_value; }
+        bool operator!=(const SharedString& rhs) const noexcept { return m_value != rhs.m_value; }
+
+    private:
+        const std::string* m_value;
+
+        // Connections run on the io_service thread only.
+        static StringPool& pool()
+        {
+            static StringPool strings;
+            return strings;
+        }
+};
+
+inline
+std::ostream& operator<<(std::ostream& stream, const SharedString& value)
+{
+    return stream << value.str();
+}
+
+}
+
+#endif
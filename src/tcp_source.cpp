@@ -0,0 +1,238 @@
+#include "tcp_source.h"
+
+#include "error.h"
+#include "logger.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <functional> // std::bind
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::TcpSource;
+
+namespace pls = std::placeholders;
+namespace bs = boost::system;
+namespace ba = boost::asio;
+
+TcpSource::TcpSource(ba::io_service& ioService,
+                     const std::string& server, uint16_t port)
+    : m_server(server),
+      m_port(port),
+      m_listen(false),
+      m_timeout(0),
+      m_running(false),
+      m_generation(0),
+      m_resolver(ioService),
+      m_acceptor(ioService),
+      m_socket(ioService),
+      m_peer(ioService),
+      m_timer(ioService),
+      m_buffer(),
+      m_outstanding(0)
+{
+}
+
+TcpSource::TcpSource(ba::io_service& ioService, uint16_t port)
+    : m_port(port),
+      m_listen(true),
+      m_timeout(0),
+      m_running(false),
+      m_generation(0),
+      m_resolver(ioService),
+      m_acceptor(ioService),
+      m_socket(ioService),
+      m_peer(ioService),
+      m_timer(ioService),
+      m_buffer(),
+      m_outstanding(0)
+{
+}
+
+void TcpSource::start(unsigned timeout)
+{
+    m_timeout = timeout;
+    m_running = true;
+    if (!m_listen) {
+        m_resolver.async_resolve(tcp::resolver::query(m_server, boost::lexical_cast<std::string>(m_port)),
+                                 track(std::bind(&TcpSource::handleResolve, this, pls::_1, pls::_2)));
+        restartTimer();
+        return;
+    }
+
+    bs::error_code ec;
+    const tcp::endpoint endpoint(tcp::v6(), m_port);
+    m_acceptor.open(endpoint.protocol(), ec);
+    if (!ec) {
+        m_acceptor.set_option(tcp::acceptor::reuse_address(true), ec);
+        m_acceptor.set_option(ba::ip::v6_only(false), ec);
+        m_acceptor.bind(endpoint, ec);
+    }
+    if (!ec)
+        m_acceptor.listen(ba::socket_base::max_listen_connections, ec);
+    if (ec) {
+        // Not from within start(), the relay is not done starting yet.
+        ba::post(m_acceptor.get_executor(), track([this, ec]()
+                                                  {
+                                                      if (m_running)
+                                                          fail(ec);
+                                                  }));
+        return;
+    }
+    ERRLOG(logInfo) << "Waiting for a raw RTCM stream on port " << m_port;
+    accept();
+}
+
+void TcpSource::stop()
+{
+    m_running = false;
+    m_resolver.cancel();
+    bs::error_code ec;
+    m_acceptor.close(ec);
+    m_timer.cancel(ec);
+    disconnect();
+}
+
+void TcpSource::handleResolve(const bs::error_code& ec,
+                              tcp::resolver::iterator it)
+{
+    if (!m_running)
+        return;
+    if (ec) {
+        fail(ec);
+        return;
+    }
+    if (it == tcp::resolver::iterator()) {
+        fail(bs::error_code(resolveError, CasterCategory::getInstance()));
+        return;
+    }
+    ERRLOG(logDebug) << "Trying to connect to " << it->endpoint();
+    m_socket.async_connect(*it, track(std::bind(&TcpSource::handleConnect, this, pls::_1, it)));
+}
+
+void TcpSource::handleConnect(const bs::error_code& ec,
+                              tcp::resolver::iterator it)
+{
+    if (!m_running)
+        return;
+    if (ec) {
+        ERRLOG(logDebug) << "Error connecting to " << it->endpoint() << ": " << ec.message();
+        bs::error_code error;
+        m_socket.close(error);
+        if (++it == tcp::resolver::iterator()) {
+            fail(ec);
+            return;
+        }
+        m_socket.async_connect(*it, track(std::bind(&TcpSource::handleConnect, this, pls::_1, it)));
+        return;
+    }
+    ERRLOG(logInfo) << "Connected to raw RTCM stream at " << it->endpoint();
+    restartTimer();
+    read();
+}
+
+void TcpSource::accept()
+{
+    m_acceptor.async_accept(m_peer, track(std::bind(&TcpSource::handleAccept, this, pls::_1)));
+}
+
+void TcpSource::handleAccept(const bs::error_code& ec)
+{
+    if (!m_running)
+        return;
+    if (ec) {
+        fail(ec);
+        return;
+    }
+    bs::error_code error;
+    ERRLOG(logInfo) << "Raw RTCM stream from " << m_peer.remote_endpoint(error);
+    // Handlers of the previous connection see a different generation.
+    disconnect();
+    m_socket = std::move(m_peer);
+    // A moved-from socket has no executor left.
+    m_peer = tcp::socket(m_acceptor.get_executor());
+    restartTimer();
+    read();
+    accept();
+}
+
+void TcpSource::read()
+{
+    m_socket.async_read_some(ba::buffer(m_buffer),
+                             track(std::bind(&TcpSource::handleRead, this, m_generation, pls::_1, pls::_2)));
+}
+
+void TcpSource::handleRead(unsigned generation, const bs::error_code& ec, size_t size)
+{
+    if (!m_running || generation != m_generation)
+        return;
+    if (size > 0) {
+        restartTimer();
+        if (m_dataCallback)
+            m_dataCallback(ba::const_buffers_1(m_buffer.data(), size));
+        // The relay may stop the source from the callback.
+        if (!m_running)
+            return;
+    }
+    if (!ec) {
+        read();
+        return;
+    }
+
+    if (m_listen) {
+        ERRLOG(logWarning) << "Raw RTCM stream closed: " << ec.message();
+        disconnect();
+        return;
+    }
+    if (ec == ba::error::eof) {
+        m_running = false;
+        bs::error_code error;
+        m_timer.cancel(error);
+        disconnect();
+        if (m_eofCallback)
+            m_eofCallback();
+        return;
+    }
+    fail(ec);
+}
+
+void TcpSource::restartTimer()
+{
+    if (m_timeout == 0)
+        return;
+    m_timer.expires_from_now(std::chrono::seconds(m_timeout));
+    m_timer.async_wait(track(std::bind(&TcpSource::handleTimeout, this, pls::_1)));
+}
+
+void TcpSource::handleTimeout(const bs::error_code& ec)
+{
+    if (ec || !m_running)
+        return;
+    // Moved by a later read.
+    if (m_timer.expires_at() > std::chrono::steady_clock::now())
+        return;
+    if (m_listen) {
+        if (m_socket.is_open()) {
+            ERRLOG(logWarning) << "Raw RTCM stream is silent, waiting for another connection";
+            disconnect();
+        }
+        return;
+    }
+    fail(bs::error_code(connectionTimeout, CasterCategory::getInstance()));
+}
+
+void TcpSource::disconnect()
+{
+    ++m_generation;
+    bs::error_code ec;
+    m_socket.shutdown(tcp::socket::shutdown_both, ec);
+    m_socket.close(ec);
+}
+
+void TcpSource::fail(const bs::error_code& ec)
+{
+    stop();
+    if (m_errorCallback)
+        m_errorCallback(ec);
+}
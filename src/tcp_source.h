@@ -0,0 +1,86 @@
+#ifndef __CASTER_TCP_SOURCE_H__
+#define __CASTER_TCP_SOURCE_H__
+
+#include "source.h"
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <string>
+#include <utility>
+#include <cstdint>
+
+namespace Caster {
+
+// Raw RTCM 3 over TCP, without NTRIP: connects to a receiver or a
+// serial-to-TCP converter, or listens for one that connects by itself.
+class TcpSource : public Source
+{
+    public:
+        // Connects to server:port, the stream ends when the peer closes it.
+        TcpSource(boost::asio::io_service& ioService,
+                  const std::string& server, uint16_t port);
+        // Listens on port. A new connection replaces the current one and a
+        // closed or silent one is waited for again, the stream never ends.
+        TcpSource(boost::asio::io_service& ioService, uint16_t port);
+
+        void start(unsigned timeout) override;
+        void stop() override;
+        bool isIdle() const override { return m_outstanding == 0; }
+
+        void setErrorCallback(const ErrorCallback& cb) override { m_errorCallback = cb; }
+        void setDataCallback(const DataCallback& cb) override { m_dataCallback = cb; }
+        void setEOFCallback(const EOFCallback& cb) override { m_eofCallback = cb; }
+
+    private:
+        using tcp = boost::asio::ip::tcp;
+
+        std::string m_server;
+        uint16_t m_port;
+        bool m_listen;
+        unsigned m_timeout;
+        bool m_running;
+        unsigned m_generation; // of the current connection
+        tcp::resolver m_resolver;
+        tcp::acceptor m_acceptor;
+        tcp::socket m_socket;
+        tcp::socket m_peer;
+        boost::asio::steady_timer m_timer;
+        std::array<uint8_t, 4096> m_buffer;
+        size_t m_outstanding;
+        ErrorCallback m_errorCallback;
+        DataCallback m_dataCallback;
+        EOFCallback m_eofCallback;
+
+        template <typename Handler>
+        auto track(Handler handler);
+
+        void handleResolve(const boost::system::error_code& ec,
+                           tcp::resolver::iterator it);
+        void handleConnect(const boost::system::error_code& ec,
+                           tcp::resolver::iterator it);
+        void accept();
+        void handleAccept(const boost::system::error_code& ec);
+        void read();
+        void handleRead(unsigned generation, const boost::system::error_code& ec, size_t size);
+        void restartTimer();
+        void handleTimeout(const boost::system::error_code& ec);
+        void disconnect();
+        void fail(const boost::system::error_code& ec);
+};
+
+template <typename Handler>
+inline
+auto TcpSource::track(Handler handler)
+{
+    ++m_outstanding;
+    return [this, handler](auto&&... args) mutable
+           {
+               --m_outstanding;
+               handler(std::forward<decltype(args)>(args)...);
+           };
+}
+
+}
+
+#endif
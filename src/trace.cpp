@@ -0,0 +1,164 @@
+#include "trace.h"
+
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::Tracer;
+using Caster::TraceEvent;
+
+namespace
+{
+
+struct Phase {
+    const char* name;
+    char phase; // B - begins a span, E - ends it, i - instant
+    const char* arg; // name of the argument, if any
+};
+
+Phase phaseOf(TraceEvent event) noexcept
+{
+    switch (event) {
+        case TraceEvent::Resolve: return {"resolve", 'B', nullptr};
+        case TraceEvent::Resolved: return {"resolve", 'E', "error"};
+        case TraceEvent::Connect: return {"connect", 'B', nullptr};
+        case TraceEvent::ConnectFailed: return {"connect", 'E', "error"};
+        case TraceEvent::Connected: return {"connect", 'E', nullptr};
+        case TraceEvent::RequestWritten: return {"request written", 'i', nullptr};
+        case TraceEvent::Status: return {"status", 'i', "code"};
+        case TraceEvent::Headers: return {"headers", 'i', nullptr};
+        case TraceEvent::Data: return {"data", 'i', "bytes"};
+        case TraceEvent::Timeout: return {"timeout", 'i', nullptr};
+        case TraceEvent::Error: return {"error", 'i', "error"};
+        case TraceEvent::Closed: return {"closed", 'i', nullptr};
+    }
+    return {"unknown", 'i', nullptr};
+}
+
+void writeString(std::ostream& stream, const std::string& value)
+{
+    stream << '"';
+    for (const char c : value) {
+        if (c == '"' || c == '\\')
+            stream << '\\';
+        if (static_cast<unsigned char>(c) >= 0x20)
+            stream << c;
+    }
+    stream << '"';
+}
+
+}
+
+thread_local Tracer::Ring* Tracer::m_threadRing = nullptr;
+
+Tracer& Tracer::instance()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+void Tracer::enable(const std::string& path, size_t capacity)
+{
+    m_path = path;
+    m_capacity = 1;
+    while (m_capacity < capacity)
+        m_capacity *= 2;
+    m_enabled = true;
+}
+
+uint32_t Tracer::open(const std::string& name)
+{
+    if (!m_enabled)
+        return 0;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_names.push_back(name);
+    return static_cast<uint32_t>(m_names.size());
+}
+
+Tracer::Ring& Tracer::attach()
+{
+    std::unique_ptr<Ring> ring(new Ring());
+    ring->records.resize(m_capacity);
+    ring->mask = m_capacity - 1;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ring->thread = static_cast<uint32_t>(m_rings.size() + 1);
+    m_rings.push_back(std::move(ring));
+    m_threadRing = m_rings.back().get();
+    return *m_threadRing;
+}
+
+void Tracer::dump() const
+{
+    if (!m_enabled)
+        return;
+
+    std::vector<Record> records;
+    std::vector<std::string> names;
+    {
+        // Other threads go on recording, their latest events may be torn.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& ring : m_rings) {
+            const uint64_t count = std::min<uint64_t>(ring->next, ring->records.size());
+            for (uint64_t i = ring->next - count; i < ring->next; ++i)
+                records.push_back(ring->records[i & ring->mask]);
+        }
+        names = m_names;
+    }
+    std::stable_sort(records.begin(), records.end(),
+                     [](const Record& a, const Record& b) { return a.time < b.time; });
+
+    const std::string temporary = m_path + ".tmp";
+    std::ofstream stream(temporary, std::ios::trunc);
+    if (!stream) {
+        ERRLOG(logError) << "Failed to create " << temporary << ": " << strerror(errno);
+        return;
+    }
+    // Each connection is a thread of its own in the viewer, timestamps are
+    // in microseconds.
+    stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (size_t i = 0; i < names.size(); ++i) {
+        stream << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << i + 1
+               << ",\"args\":{\"name\":";
+        writeString(stream, names[i]);
+        stream << "}}";
+        first = false;
+    }
+    const int64_t origin = records.empty() ? 0 : records.front().time;
+    // Unknown for connections whose start has been overwritten.
+    std::vector<bool> streaming(names.size() + 1, true);
+    for (const Record& record : records) {
+        Phase phase = phaseOf(record.event);
+        // Time to first data is what a slow reconnect is about.
+        if (record.id < streaming.size()) {
+            if (record.event == TraceEvent::Resolve) {
+                streaming[record.id] = false;
+            } else if (record.event == TraceEvent::Data && !streaming[record.id]) {
+                streaming[record.id] = true;
+                phase.name = "first data";
+            }
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::duration(record.time - origin)).count();
+        stream << (first ? "" : ",\n") << "{\"ph\":\"" << phase.phase << "\",\"name\":\"" << phase.name
+               << "\",\"pid\":1,\"tid\":" << record.id << ",\"ts\":" << ns / 1000 << "." << ns / 100 % 10;
+        if (phase.phase == 'i')
+            stream << ",\"s\":\"t\"";
+        if (phase.arg)
+            stream << ",\"args\":{\"" << phase.arg << "\":" << record.arg << "}";
+        stream << "}";
+        first = false;
+    }
+    stream << "\n]}\n";
+    stream.close();
+    if (!stream || std::rename(temporary.c_str(), m_path.c_str()) != 0) {
+        ERRLOG(logError) << "Failed to write " << m_path << ": " << strerror(errno);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef __CASTER_TRACE_H__
+#define __CASTER_TRACE_H__
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace Caster {
+
+// Steps in the life of a connection, see Connection.
+enum class TraceEvent : uint8_t {
+    Resolve,
+    Resolved, // argument: error value
+    Connect,
+    ConnectFailed, // argument: error value
+    Connected,
+    RequestWritten,
+    Status, // argument: status code
+    Headers,
+    Data, // argument: bytes
+    Timeout,
+    Error, // argument: error value
+    Closed
+};
+
+// Connection lifecycle events in memory, written out in Chrome trace JSON
+// for Perfetto or chrome://tracing. Each thread records into a ring of its
+// own that keeps the latest events, recording is a clock read and a store.
+class Tracer {
+    public:
+        static Tracer& instance();
+
+        // Nothing is recorded unless enabled before the connections are
+        // created. Capacity is in events per thread, rounded up to a power of
+        // two.
+        void enable(const std::string& path, size_t capacity);
+        bool isEnabled() const noexcept { return m_enabled; }
+
+        // A timeline for the named connection, zero while tracing is off.
+        uint32_t open(const std::string& name);
+
+        void record(uint32_t id, TraceEvent event, uint64_t arg = 0)
+        {
+            Ring& ring = m_threadRing ? *m_threadRing : attach();
+            Record& record = ring.records[ring.next++ & ring.mask];
+            record.time = std::chrono::steady_clock::now().time_since_epoch().count();
+            record.arg = arg;
+            record.id = id;
+            record.event = event;
+        }
+
+        // Replaces the trace file with the events recorded so far.
+        void dump() const;
+
+    private:
+        struct Record {
+            int64_t time; // steady clock ticks
+            uint64_t arg;
+            uint32_t id;
+            TraceEvent event;
+        };
+
+        struct Ring {
+            std::vector<Record> records;
+            uint64_t next = 0;
+            uint64_t mask = 0;
+            uint32_t thread = 0;
+        };
+
+        bool m_enabled = false;
+        std::string m_path;
+        size_t m_capacity = 0;
+        mutable std::mutex m_mutex; // rings and names
+        std::vector<std::unique_ptr<Ring>> m_rings;
+        std::vector<std::string> m_names; // by id - 1
+
+        static thread_local Ring* m_threadRing;
+
+        Ring& attach();
+};
+
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include <boost/phoenix.hpp>
 
 #include <algorithm>
+#include <vector>
 
 namespace Caster {
 
@@ -25,6 +26,16 @@ size_t parseChunkLength(const boost::asio::const_buffers_1& buffers,
     return std::distance(begin, iter);
 }
 
+// Destroys stopped connections that have no completion handlers left.
+template <typename Ptr>
+inline
+void purgeIdle(std::vector<Ptr>& connections)
+{
+    connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                     [](const Ptr& c) { return c->isIdle(); }),
+                      connections.end());
+}
+
 }
 
 #endif
@@ -0,0 +1,257 @@
+#include "vrs_pool.h"
+
+#include "logger.h"
+#include "nmea.h"
+#include "utils.h"
+
+#include <functional> // std::bind
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+
+#define ERRLOG(level) LOG(CerrWriter, level)
+
+using namespace MADF;
+using Caster::VrsPool;
+
+namespace pls = std::placeholders;
+namespace ba = boost::asio;
+
+namespace
+{
+
+const double metersPerDegree = 111320;
+const double degToRad = M_PI / 180;
+// An empty cell keeps its upstream connection for a while, in case a rover
+// comes back.
+const auto cellLinger = std::chrono::seconds(60);
+
+}
+
+VrsPool::VrsPool(ba::io_service& ioService,
+                 const std::string& server, uint16_t port,
+                 const std::string& mountpoint, double cellSize)
+    : m_ioService(ioService),
+      m_server(server),
+      m_port(port),
+      m_mountpoint(mountpoint),
+      m_cellSize(cellSize),
+      m_ggaInterval(10),
+      m_timeout(0),
+      m_timer(ioService)
+{
+}
+
+void VrsPool::start(unsigned timeout)
+{
+    m_timeout = timeout;
+    scheduleTick();
+}
+
+void VrsPool::stop()
+{
+    boost::system::error_code ec;
+    m_timer.cancel(ec);
+    for (auto& kv : m_cells)
+        if (kv.second.client)
+            retire(kv.second);
+    m_cells.clear();
+    auto rovers = std::move(m_rovers);
+    m_rovers.clear();
+    for (const auto& kv : rovers)
+        kv.first->close();
+}
+
+void VrsPool::addRover(const RoverSessionPtr& rover, const LocalCaster::Headers& headers)
+{
+    const std::weak_ptr<RoverSession> weak(rover);
+    rover->setGGACallback([self = shared_from_this(), weak](const std::string& gga)
+                          {
+                              if (const auto session = weak.lock())
+                                  self->handleGGA(session, gga);
+                          });
+    rover->setCloseCallback([self = shared_from_this(), weak]()
+                            {
+                                if (const auto session = weak.lock())
+                                    self->handleClose(session);
+                            });
+    // NTRIP 2.0 rovers may send the position with the request.
+    const auto it = headers.find("Ntrip-GGA");
+    if (it != headers.end())
+        handleGGA(rover, it->second);
+}
+
+VrsPool::CellKey VrsPool::cellOf(double lat, double lon) const
+{
+    const int32_t row = static_cast<int32_t>(std::floor(lat * metersPerDegree / m_cellSize));
+    const double centerLat = (row + 0.5) * m_cellSize / metersPerDegree;
+    const double lonScale = metersPerDegree * std::cos(centerLat * degToRad);
+    return CellKey(row, static_cast<int32_t>(std::floor(lon * lonScale / m_cellSize)));
+}
+
+std::string VrsPool::cellGGA(const CellKey& key) const
+{
+    const double lat = (key.first + 0.5) * m_cellSize / metersPerDegree;
+    const double lonScale = metersPerDegree * std::cos(lat * degToRad);
+    const double lon = (key.second + 0.5) * m_cellSize / lonScale;
+    return makeGGA(lat, lon, time(nullptr));
+}
+
+void VrsPool::connect(const CellKey& key, Cell& cell)
+{
+    ERRLOG(logDebug) << "Connecting VRS cell " << key.first << ":" << key.second;
+    cell.client.reset(new Client(m_ioService, m_server, m_port, m_mountpoint));
+    Client* client = cell.client.get();
+    if (!m_login.empty() || !m_password.empty())
+        client->setCredentials(m_login, m_password);
+    client->setGGA(cellGGA(key));
+    // Lambdas rather than binds keep the callbacks small enough to be
+    // stored in place. The pool owns its clients, so their callbacks hold
+    // it weakly.
+    const std::weak_ptr<VrsPool> weak = shared_from_this();
+    client->setDataCallback([weak, key, client](const ba::const_buffers_1& buffers)
+                            {
+                                if (const auto self = weak.lock())
+                                    self->handleData(key, client, buffers);
+                            });
+    client->setErrorCallback([weak, key, client](const boost::system::error_code& ec)
+                             {
+                                 if (const auto self = weak.lock())
+                                     self->handleError(key, client, ec);
+                             });
+    client->setEOFCallback([weak, key, client]()
+                           {
+                               if (const auto self = weak.lock())
+                                   self->handleError(key, client, boost::system::error_code(ba::error::eof));
+                           });
+    cell.framer.reset();
+    client->start(m_timeout);
+}
+
+void VrsPool::retire(Cell& cell)
+{
+    // Completion handlers of a stopped client may still run, it is
+    // destroyed when it becomes idle. Its callbacks are dropped right away,
+    // retire may be called from one of them, which therefore takes the key
+    // by value.
+    cell.client->stop();
+    cell.client->resetCallbacks();
+    m_retired.push_back(std::move(cell.client));
+}
+
+void VrsPool::scheduleTick()
+{
+    m_timer.expires_from_now(std::chrono::seconds(std::max(m_ggaInterval, 1u)));
+    m_timer.async_wait(std::bind(&VrsPool::handleTick, shared_from_this(), pls::_1));
+}
+
+void VrsPool::handleTick(const boost::system::error_code& ec)
+{
+    if (ec)
+        return;
+
+    purgeIdle(m_retired);
+    const auto now = Clock::now();
+    for (auto it = m_cells.begin(); it != m_cells.end();) {
+        Cell& cell = it->second;
+        if (cell.rovers.empty() && now - cell.emptySince > cellLinger) {
+            ERRLOG(logDebug) << "Closing VRS cell " << it->first.first << ":" << it->first.second;
+            if (cell.client)
+                retire(cell);
+            it = m_cells.erase(it);
+            continue;
+        }
+        if (!cell.client) {
+            if (!cell.rovers.empty())
+                connect(it->first, cell);
+        } else {
+            cell.client->setGGA(cellGGA(it->first));
+            cell.client->sendGGA();
+        }
+        ++it;
+    }
+    scheduleTick();
+}
+
+void VrsPool::handleGGA(const RoverSessionPtr& rover, const std::string& gga)
+{
+    double lat = 0;
+    double lon = 0;
+    if (!parseGGA(gga, lat, lon))
+        return;
+
+    const CellKey key = cellOf(lat, lon);
+    const auto it = m_rovers.find(rover);
+    if (it != m_rovers.end()) {
+        if (it->second == key)
+            return;
+        handleClose(rover);
+    }
+
+    m_rovers[rover] = key;
+    Cell& cell = m_cells[key];
+    cell.rovers.insert(rover);
+    if (!cell.client)
+        connect(key, cell);
+    // The cell stream is already running, the rover gets its station and
+    // ephemeris messages right away instead of waiting for their repetition.
+    if (!cell.cache.empty())
+        rover->send(std::make_shared<const std::vector<uint8_t>>(cell.cache.snapshot()));
+    ERRLOG(logDebug) << "Rover joined VRS cell " << key.first << ":" << key.second
+                     << ", " << cell.rovers.size() << " rovers, " << m_cells.size() << " cells";
+}
+
+void VrsPool::handleClose(const RoverSessionPtr& rover)
+{
+    const auto it = m_rovers.find(rover);
+    if (it == m_rovers.end())
+        return;
+    const auto cell = m_cells.find(it->second);
+    if (cell != m_cells.end()) {
+        cell->second.rovers.erase(rover);
+        if (cell->second.rovers.empty())
+            cell->second.emptySince = Clock::now();
+    }
+    m_rovers.erase(it);
+}
+
+void VrsPool::handleData(const CellKey& key, const Client* client,
+                         const ba::const_buffers_1& buffers)
+{
+    const auto it = m_cells.find(key);
+    if (it == m_cells.end() || it->second.client.get() != client)
+        return;
+
+    // Rovers get whole frames only, so one that moves to another cell does
+    // not see a frame cut in the middle.
+    auto data = std::make_shared<std::vector<uint8_t>>();
+    const auto& buffer = *buffers.begin();
+    Cell& cell = it->second;
+    cell.framer.feed(ba::buffer_cast<const uint8_t*>(buffer),
+                     ba::buffer_size(buffer),
+                     [&data, &cell](const RTCM::Frame& frame)
+                     {
+                         cell.cache.update(frame);
+                         data->insert(data->end(), frame.data, frame.data + frame.size);
+                     });
+    if (data->empty())
+        return;
+
+    const SharedBuffer shared(std::move(data));
+    // A slow rover is closed inside send, which changes the set.
+    const std::vector<RoverSessionPtr> rovers(cell.rovers.begin(), cell.rovers.end());
+    for (const auto& rover : rovers)
+        rover->send(shared);
+}
+
+void VrsPool::handleError(CellKey key, const Client* client,
+                          const boost::system::error_code& ec)
+{
+    const auto it = m_cells.find(key);
+    if (it == m_cells.end() || it->second.client.get() != client)
+        return;
+    ERRLOG(logWarning) << "VRS cell " << key.first << ":" << key.second
+                       << " upstream error: " << ec.message();
+    // Reconnected on the next tick if the cell still has rovers.
+    retire(it->second);
+}
@@ -0,0 +1,91 @@
+#ifndef __CASTER_VRS_POOL_H__
+#define __CASTER_VRS_POOL_H__
+
+#include "client.h"
+#include "local_caster.h"
+#include "rtcm.h"
+#include "message_cache.h"
+
+#include <boost/asio.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <utility>
+#include <chrono>
+#include <cstdint>
+
+namespace Caster {
+
+// Shares upstream VRS streams between nearby rovers.
+//
+// Rovers are grouped into square grid cells by their GGA positions. Each
+// occupied cell has one upstream Client that reports the cell center as its
+// position, its stream is sent to every rover of the cell. Cells appear with
+// their first rover and go away some time after their last one has left.
+class VrsPool : public std::enable_shared_from_this<VrsPool>
+{
+    public:
+        VrsPool(boost::asio::io_service& ioService,
+                const std::string& server, uint16_t port,
+                const std::string& mountpoint, double cellSize);
+
+        void setCredentials(const std::string& login,
+                            const std::string& password)
+        { m_login = login; m_password = password; }
+        // Upstream GGA is repeated with this period, cells are checked too.
+        void setGGAInterval(unsigned seconds) { m_ggaInterval = seconds; }
+
+        void start(unsigned timeout);
+        void stop();
+
+        // LocalCaster::RoverHandler
+        void addRover(const RoverSessionPtr& rover, const LocalCaster::Headers& headers);
+
+    private:
+        using CellKey = std::pair<int32_t, int32_t>; // row, column
+        using Clock = std::chrono::steady_clock;
+
+        struct Cell {
+            std::unique_ptr<Client> client;
+            std::set<RoverSessionPtr> rovers;
+            RTCM::Framer framer;
+            MessageCache cache; // sent to rovers joining the cell
+            Clock::time_point emptySince;
+        };
+
+        boost::asio::io_service& m_ioService;
+        std::string m_server;
+        uint16_t m_port;
+        std::string m_mountpoint;
+        std::string m_login;
+        std::string m_password;
+        double m_cellSize;
+        unsigned m_ggaInterval;
+        unsigned m_timeout;
+        boost::asio::steady_timer m_timer;
+        std::map<CellKey, Cell> m_cells;
+        std::map<RoverSessionPtr, CellKey> m_rovers;
+        std::vector<std::unique_ptr<Client>> m_retired;
+
+        CellKey cellOf(double lat, double lon) const;
+        std::string cellGGA(const CellKey& key) const;
+        void connect(const CellKey& key, Cell& cell);
+        void retire(Cell& cell);
+        void scheduleTick();
+        void handleTick(const boost::system::error_code& ec);
+        void handleGGA(const RoverSessionPtr& rover, const std::string& gga);
+        void handleClose(const RoverSessionPtr& rover);
+        void handleData(const CellKey& key, const Client* client,
+                        const boost::asio::const_buffers_1& buffers);
+        void handleError(CellKey key, const Client* client,
+                         const boost::system::error_code& ec);
+};
+
+using VrsPoolPtr = std::shared_ptr<VrsPool>;
+
+}
+
+#endif
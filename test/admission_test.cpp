@@ -0,0 +1,132 @@
+// Connection admission: the rate limit and priorities of
+// Connection::setAdmissionLimits, and relays that fail while their source
+// caster is down being restarted by RelayManager through the same limits.
+
+#include "fake_caster.h"
+
+#include "client.h"
+#include "connection.h"
+#include "relay_manager.h"
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+const double rate = 20; // connections per second
+
+// The most requests in any window of a second.
+size_t busiestSecond(std::vector<Test::FakeCaster::Request> requests)
+{
+    std::sort(requests.begin(), requests.end(),
+              [](const auto& lhs, const auto& rhs) { return lhs.time < rhs.time; });
+    size_t res = 0;
+    size_t first = 0;
+    for (size_t i = 0; i < requests.size(); ++i) {
+        while (requests[i].time - requests[first].time >= std::chrono::seconds(1))
+            ++first;
+        res = std::max(res, i - first + 1);
+    }
+    return res;
+}
+
+int testRateAndPriority()
+{
+    boost::asio::io_service ioService;
+    Test::FakeCaster caster(Test::sourceResponse);
+    caster.listen();
+
+    // The first one is admitted right away, the ones of higher priority
+    // overtake the others waiting.
+    std::vector<std::unique_ptr<Caster::Client>> clients;
+    for (int i = 0; i < 30; ++i) {
+        clients.emplace_back(new Caster::Client(ioService, "127.0.0.1", caster.port(), "M" + std::to_string(i)));
+        clients.back()->setPriority(i >= 25 ? 1 : 0);
+        clients.back()->start(0);
+    }
+    ioService.run_for(std::chrono::milliseconds(1050));
+    const auto requests = caster.requests();
+    CHECK(requests.size() >= rate - 2);
+    CHECK(requests.size() <= rate + 1);
+    CHECK(requests[0].line.find("/M0 ") != std::string::npos);
+    for (size_t i = 1; i <= 5; ++i)
+        CHECK(requests[i].line.find("/M" + std::to_string(24 + i) + " ") != std::string::npos);
+
+    ioService.run_for(std::chrono::milliseconds(1000));
+    CHECK(caster.requests().size() == clients.size());
+    CHECK(busiestSecond(caster.requests()) <= rate + 1);
+    for (auto& client : clients)
+        client->stop();
+    return 0;
+}
+
+int testRestartAfterOutage()
+{
+    boost::asio::io_service ioService;
+    // The source caster refuses connections until it comes back.
+    Test::FakeCaster source(Test::sourceResponse);
+    Test::FakeCaster destination(Test::destinationResponse);
+    destination.listen();
+
+    const size_t count = 20;
+    Caster::RelayManager manager(ioService);
+    for (size_t i = 0; i < count; ++i) {
+        Caster::RelayConfig config;
+        config.srcServer = "127.0.0.1";
+        config.srcPort = source.port();
+        config.srcMountpoint = "S" + std::to_string(i);
+        config.dstServer = "127.0.0.1";
+        config.dstPort = destination.port();
+        config.dstMountpoint = "D" + std::to_string(i);
+        manager.add("R" + std::to_string(i), config);
+    }
+    // All the relays fail by then and wait for the first restart.
+    ioService.run_for(std::chrono::milliseconds(1500));
+    CHECK(source.requests().empty());
+    source.listen();
+
+    // Every relay reconnects on its own, as fast as the limits allow.
+    ioService.run_for(std::chrono::seconds(6));
+    const auto requests = source.requests();
+    CHECK(requests.size() == count);
+    for (size_t i = 0; i < count; ++i) {
+        const std::string uri = "/S" + std::to_string(i) + " ";
+        CHECK(std::any_of(requests.begin(), requests.end(),
+                          [&uri](const auto& request) { return request.line.find(uri) != std::string::npos; }));
+    }
+    // Both casters are on the same address, the limits are not per host.
+    auto all = requests;
+    const auto uploads = destination.requests();
+    all.insert(all.end(), uploads.begin(), uploads.end());
+    CHECK(busiestSecond(all) <= rate + 1);
+
+    std::ostringstream list;
+    manager.list(list);
+    CHECK(list.str().find("failed") == std::string::npos);
+    manager.stop();
+    ioService.run_for(std::chrono::milliseconds(100));
+    return 0;
+}
+
+}
+
+int main()
+{
+    Caster::Connection::AdmissionLimits limits;
+    limits.rate = rate;
+    Caster::Connection::setAdmissionLimits(limits);
+
+    if (testRateAndPriority() != 0)
+        return 1;
+    if (testRestartAfterOutage() != 0)
+        return 1;
+    return 0;
+}
@@ -0,0 +1,252 @@
+// Relays a stream from a source caster to a destination caster over
+// loopback and checks that, once the connections are up and the buffers
+// have grown, relaying allocates nothing, see allocation_counter.h. Part of
+// the stream is sent while the destination stalls, so frames queue, are
+// superseded by newer epochs, expire and are dropped.
+
+#include "fake_caster.h"
+
+#include "allocation_counter.h"
+#include "client.h"
+#include "relay.h"
+#include "rtcm.h"
+#include "server.h"
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+namespace
+{
+
+const size_t frameSize = 106; // MSM7 sized, with header and CRC
+const size_t framesPerBuffer = 4;
+const uint64_t warmUpBuffers = 5000;
+const uint64_t buffers = 100000;
+const uint64_t stallBuffers = 5000; // of the above, sent during a stall
+const auto maxAge = std::chrono::milliseconds(100);
+const auto deadline = std::chrono::seconds(60);
+
+std::atomic<uint64_t> received(0); // payload bytes at the destination
+std::atomic<bool> stalled(false); // the destination does not read
+std::atomic<uint64_t> dropped(0); // bytes lost during stalls
+std::atomic<bool> failed(false);
+uint64_t before = 0;
+uint64_t after = 0;
+
+using Buffer = std::array<uint8_t, frameSize * framesPerBuffer>;
+
+// One epoch of GPS MSM7 frames with an empty body, the multiple message bit
+// set on all but the last one.
+Buffer makeBuffer()
+{
+    Buffer res{};
+    for (size_t i = 0; i < framesPerBuffer; ++i) {
+        uint8_t* frame = res.data() + i * frameSize;
+        const size_t length = frameSize - 6;
+        frame[0] = 0xD3;
+        frame[1] = static_cast<uint8_t>(length >> 8);
+        frame[2] = static_cast<uint8_t>(length);
+        frame[3] = 1077 >> 4;
+        frame[4] = (1077 & 0xF) << 4;
+        if (i + 1 < framesPerBuffer)
+            frame[9] |= 0x02; // bit 54 of the payload
+    }
+    return res;
+}
+
+// Sets the epoch of the frames to the current GPS time of week, so that the
+// relay finds them fresh and they expire maxAge after they were sent.
+void stamp(Buffer& buffer)
+{
+    const int64_t utc = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    const int64_t msPerWeek = 7 * 24 * 3600 * 1000LL;
+    const auto epoch = static_cast<uint32_t>((utc - 315964800000LL + 18000) % msPerWeek);
+    for (size_t i = 0; i < framesPerBuffer; ++i) {
+        uint8_t* frame = buffer.data() + i * frameSize;
+        uint8_t* payload = frame + 3;
+        // 30 bits from bit 24 of the payload, after type and station id.
+        payload[3] = static_cast<uint8_t>(epoch >> 22);
+        payload[4] = static_cast<uint8_t>(epoch >> 14);
+        payload[5] = static_cast<uint8_t>(epoch >> 6);
+        payload[6] = static_cast<uint8_t>((payload[6] & 0x03) | ((epoch & 0x3F) << 2));
+        const size_t length = frameSize - 6;
+        const uint32_t crc = Caster::RTCM::crc24q(frame, length + 3);
+        frame[length + 3] = static_cast<uint8_t>(crc >> 16);
+        frame[length + 4] = static_cast<uint8_t>(crc >> 8);
+        frame[length + 5] = static_cast<uint8_t>(crc);
+    }
+}
+
+bool waitForReceived(uint64_t bytes)
+{
+    const auto until = std::chrono::steady_clock::now() + deadline;
+    while (received.load() < bytes) {
+        if (std::chrono::steady_clock::now() > until)
+            return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+// Waits until the destination has had nothing new for a while.
+uint64_t waitForQuiet()
+{
+    uint64_t last = received.load();
+    for (;;) {
+        std::this_thread::sleep_for(maxAge * 3);
+        const uint64_t now = received.load();
+        if (now == last)
+            return now;
+        last = now;
+    }
+}
+
+// Source caster side: warms up, then sends the measured buffers, each time
+// steadily and during a stall. A congested destination queues frames in
+// buffers that grow to the largest backlog seen. Outside the stalls the
+// source keeps at most one buffer ahead, so the backlog there stays small.
+// Within them it is bounded by the capacity of the queue and the maximum
+// age of the frames, and the warm-up stall reaches it already.
+void feed(int fd)
+{
+    auto buffer = makeBuffer();
+    uint64_t expected = 0; // payload bytes the destination is to get
+    const auto send = [fd, &buffer, &expected](uint64_t count)
+                      {
+                          for (uint64_t i = 0; i < count; ++i) {
+                              if (!waitForReceived(expected > buffer.size() ? expected - buffer.size() : 0))
+                                  return false;
+                              stamp(buffer);
+                              Test::writeAll(fd, buffer.data(), buffer.size());
+                              expected += buffer.size();
+                          }
+                          return waitForReceived(expected);
+                      };
+    const auto stall = [fd, &buffer, &expected](uint64_t count)
+                       {
+                           stalled = true;
+                           std::this_thread::sleep_for(maxAge);
+                           for (uint64_t i = 0; i < count; ++i) {
+                               stamp(buffer);
+                               Test::writeAll(fd, buffer.data(), buffer.size());
+                               expected += buffer.size();
+                           }
+                           // What is still queued expires before the
+                           // destination reads again.
+                           std::this_thread::sleep_for(maxAge * 2);
+                           stalled = false;
+                           const uint64_t now = waitForQuiet();
+                           dropped += expected - now;
+                           expected = now;
+                           return true;
+                       };
+    const auto run = [&send, &stall](uint64_t count)
+                     {
+                         const uint64_t steady = (count - stallBuffers) / 2;
+                         return send(steady) && stall(stallBuffers) &&
+                                send(count - stallBuffers - steady);
+                     };
+    if (!run(warmUpBuffers + stallBuffers)) {
+        failed = true;
+        ::close(fd);
+        return;
+    }
+    before = Caster::allocationCount();
+    if (!run(buffers))
+        failed = true;
+    after = Caster::allocationCount();
+    ::close(fd);
+}
+
+// Destination caster side: takes the chunked upload apart and counts the
+// payload, up to the last chunk.
+void drain(int fd)
+{
+    enum class State { Size, Data, DataEnd } state = State::Size;
+    uint64_t size = 0;
+    uint64_t left = 0;
+    std::array<char, 16384> buffer;
+    for (;;) {
+        if (stalled) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        const ssize_t res = ::read(fd, buffer.data(), buffer.size());
+        if (res <= 0)
+            break;
+        for (const char* pos = buffer.data(); pos != buffer.data() + res; ++pos) {
+            switch (state) {
+                case State::Size:
+                    if (*pos == '\n') {
+                        if (size == 0) {
+                            ::close(fd);
+                            return;
+                        }
+                        left = size;
+                        size = 0;
+                        state = State::Data;
+                    } else if (*pos != '\r') {
+                        size = size * 16 + static_cast<uint64_t>(*pos <= '9' ? *pos - '0' : (*pos | 0x20) - 'a' + 10);
+                    }
+                    break;
+                case State::Data:
+                    ++received;
+                    if (--left == 0)
+                        state = State::DataEnd;
+                    break;
+                case State::DataEnd:
+                    if (*pos == '\n')
+                        state = State::Size;
+                    break;
+            }
+        }
+    }
+    ::close(fd);
+}
+
+}
+
+int main()
+{
+    boost::asio::io_service ioService;
+    Test::FakeCaster source(Test::sourceResponse);
+    Test::FakeCaster destination(Test::destinationResponse);
+    source.listen(feed);
+    destination.listen(drain);
+
+    // The source starts once the destination is ready, no frame is lost.
+    auto relay = std::make_shared<Caster::Relay>(ioService,
+                                                 Caster::SourcePtr(new Caster::Client(ioService, "127.0.0.1", source.port(), "SRC")),
+                                                 "SRC",
+                                                 Caster::SinkPtr(new Caster::Server(ioService, "127.0.0.1", destination.port(), "DST")));
+    bool done = false;
+    relay->setEOFCallback([&done]() { done = true; });
+    relay->setErrorCallback([&done](const boost::system::error_code& ec)
+                            {
+                                std::cerr << "Relay failed: " << ec.message() << "\n";
+                                failed = true;
+                                done = true;
+                            });
+    relay->setMaxAge(maxAge);
+    relay->start(10);
+    const auto until = std::chrono::steady_clock::now() + deadline;
+    while (!done && std::chrono::steady_clock::now() < until)
+        ioService.run_for(std::chrono::milliseconds(100));
+
+    CHECK(done);
+    CHECK(!failed);
+    // The stalls did lose frames, the paths that drop them ran.
+    CHECK(dropped > 0);
+    std::cout << "Allocations while relaying " << buffers << " buffers: " << after - before
+              << ", bytes dropped during stalls: " << dropped << "\n";
+    CHECK(after == before);
+    return 0;
+}
@@ -0,0 +1,153 @@
+#ifndef __CASTER_TEST_FAKE_CASTER_H__
+#define __CASTER_TEST_FAKE_CASTER_H__
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Test {
+
+inline bool writeAll(int fd, const void* data, size_t size)
+{
+    const char* pos = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t res = ::write(fd, pos, size);
+        if (res <= 0)
+            return false;
+        pos += res;
+        size -= static_cast<size_t>(res);
+    }
+    return true;
+}
+
+// Caster on a loopback port served by a thread of its own with blocking
+// sockets, so that it does not disturb what the test measures on the
+// io_service. Each connection is accepted, its request read and answered
+// with the given response, then it is kept open until the caster is
+// destroyed. Connections are refused until listen() is called.
+class FakeCaster {
+    public:
+        struct Request {
+            std::chrono::steady_clock::time_point time;
+            std::string line; // "GET /mountpoint HTTP/1.1"
+        };
+
+        explicit FakeCaster(const std::string& response)
+            : m_response(response),
+              m_fd(::socket(AF_INET, SOCK_STREAM, 0)),
+              m_port(0)
+        {
+            if (m_fd < 0)
+                throw std::runtime_error("socket() failed");
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t size = sizeof(address);
+            if (::bind(m_fd, reinterpret_cast<sockaddr*>(&address), size) != 0 ||
+                ::getsockname(m_fd, reinterpret_cast<sockaddr*>(&address), &size) != 0)
+                throw std::runtime_error("bind() failed");
+            m_port = ntohs(address.sin_port);
+            // Allocates nothing per connection but the request line, for
+            // tests measuring the heap.
+            m_connections.reserve(1024);
+            m_requests.reserve(1024);
+        }
+
+        ~FakeCaster()
+        {
+            ::shutdown(m_fd, SHUT_RDWR);
+            if (m_thread.joinable())
+                m_thread.join();
+            for (int fd : m_connections)
+                ::close(fd);
+            ::close(m_fd);
+        }
+
+        FakeCaster(const FakeCaster&) = delete;
+        FakeCaster& operator=(const FakeCaster&) = delete;
+
+        uint16_t port() const { return m_port; }
+
+        // With a handler the connection is passed to it, from the caster
+        // thread, once the response is sent, it then belongs to the handler.
+        void listen(std::function<void (int fd)> handler = nullptr)
+        {
+            if (::listen(m_fd, SOMAXCONN) != 0)
+                throw std::runtime_error("listen() failed");
+            m_handler = std::move(handler);
+            m_thread = std::thread([this]() { run(); });
+        }
+
+        std::vector<Request> requests() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_requests;
+        }
+
+    private:
+        std::string m_response;
+        int m_fd;
+        uint16_t m_port;
+        std::function<void (int fd)> m_handler;
+        std::thread m_thread;
+        std::vector<int> m_connections;
+        mutable std::mutex m_mutex;
+        std::vector<Request> m_requests;
+
+        void run()
+        {
+            for (;;) {
+                const int fd = ::accept(m_fd, nullptr, nullptr);
+                if (fd < 0)
+                    return;
+                const auto time = std::chrono::steady_clock::now();
+                std::string request;
+                char c;
+                while (request.size() < 4 || request.compare(request.size() - 4, 4, "\r\n\r\n") != 0) {
+                    if (::read(fd, &c, 1) != 1)
+                        break;
+                    request += c;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_requests.push_back(Request{time, request.substr(0, request.find("\r\n"))});
+                }
+                writeAll(fd, m_response.data(), m_response.size());
+                if (m_handler)
+                    m_handler(fd);
+                else
+                    m_connections.push_back(fd);
+            }
+        }
+};
+
+// What a source caster answers an NTRIP 1.0 request with.
+const char* const sourceResponse = "ICY 200 OK\r\n";
+// What a destination caster answers an upload with.
+const char* const destinationResponse = "HTTP/1.1 200 OK\r\nServer: test\r\n\r\n";
+
+// Reports a failed check, the test then exits with 1.
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition "\n"; \
+            return 1; \
+        } \
+    } while (false)
+
+}
+
+#endif
@@ -0,0 +1,80 @@
+// Heap bytes per idle connection: source connections that wait for data and
+// destination connections with nothing to send, once their handshakes are
+// over. Guards the footprint of Client and Server, see allocatedBytes().
+
+#include "fake_caster.h"
+
+#include "allocation_counter.h"
+#include "client.h"
+#include "server.h"
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+const size_t warmUp = 10; // connections that set up what all of them share
+const size_t count = 250;
+// Everything a connection keeps: the object, its strings, the socket state
+// of Asio and the handler memory of its pending read. The fake caster adds
+// about 32 bytes per request line. Both take about 1.8 KB now.
+const uint64_t clientBudget = 2304;
+const uint64_t serverBudget = 2304;
+
+template <typename Connection>
+int measure(const char* response, const char* name, uint64_t budget)
+{
+    boost::asio::io_service ioService;
+    Test::FakeCaster caster(response);
+    caster.listen();
+    std::vector<std::unique_ptr<Connection>> connections;
+    connections.reserve(warmUp + count);
+    const auto open = [&](size_t number)
+                      {
+                          const size_t total = connections.size() + number;
+                          while (connections.size() < total) {
+                              connections.emplace_back(new Connection(ioService, "127.0.0.1", caster.port(),
+                                                                      "M" + std::to_string(connections.size())));
+                              connections.back()->start(0);
+                          }
+                          const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+                          while (caster.requests().size() < total && std::chrono::steady_clock::now() < until)
+                              ioService.run_for(std::chrono::milliseconds(10));
+                          // The responses are read by then.
+                          ioService.run_for(std::chrono::milliseconds(200));
+                          return caster.requests().size() == total;
+                      };
+
+    CHECK(open(warmUp));
+    const uint64_t before = Caster::allocatedBytes();
+    CHECK(open(count));
+    const uint64_t after = Caster::allocatedBytes();
+    for (const auto& connection : connections)
+        CHECK(connection->isActive());
+
+    const uint64_t perConnection = (after - before) / count;
+    std::cout << name << ": " << perConnection << " bytes per idle connection, budget " << budget << "\n";
+    CHECK(perConnection <= budget);
+
+    for (const auto& connection : connections)
+        connection->stop();
+    ioService.run_for(std::chrono::milliseconds(100));
+    return 0;
+}
+
+}
+
+int main()
+{
+    if (measure<Caster::Client>(Test::sourceResponse, "Client", clientBudget) != 0)
+        return 1;
+    if (measure<Caster::Server>(Test::destinationResponse, "Server", serverBudget) != 0)
+        return 1;
+    return 0;
+}